@@ -0,0 +1,61 @@
+/* Copyright 2016 SKA South Africa
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Packing and unpacking of arrays of bit-fields, for item formats that do not
+ * correspond to native types.
+ */
+
+#ifndef SPEAD2_COMMON_BITS_H
+#define SPEAD2_COMMON_BITS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace spead2
+{
+
+/**
+ * Unpack a sequence of records of big-endian bit-fields. Each record consists
+ * of fields whose widths (in bits, from 1 to 64) are given by @a bits, and
+ * records are packed with no padding between them. Field @a j of record
+ * @a i is zero-extended and stored in @a out[j][i].
+ *
+ * The input must contain at least
+ * <code>ceil(records * sum(bits) / 8)</code> bytes.
+ *
+ * @throw std::invalid_argument if any field width is out of range
+ */
+void unpack_bits(const std::uint8_t *in, std::size_t records,
+                 const std::vector<int> &bits, std::uint64_t * const *out);
+
+/**
+ * Inverse of @ref unpack_bits. Values must already fit into their fields;
+ * any excess high bits are discarded. The final byte is padded with zero
+ * bits. The output must have space for
+ * <code>ceil(records * sum(bits) / 8)</code> bytes.
+ *
+ * @throw std::invalid_argument if any field width is out of range
+ */
+void pack_bits(const std::uint64_t * const *in, std::size_t records,
+               const std::vector<int> &bits, std::uint8_t *out);
+
+} // namespace spead2
+
+#endif // SPEAD2_COMMON_BITS_H
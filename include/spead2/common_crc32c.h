@@ -0,0 +1,44 @@
+/* Copyright 2016 SKA South Africa
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ */
+
+#ifndef SPEAD2_COMMON_CRC32C_H
+#define SPEAD2_COMMON_CRC32C_H
+
+#include <cstddef>
+#include <cstdint>
+
+namespace spead2
+{
+
+/**
+ * Compute the CRC-32C (Castagnoli) checksum of a buffer. A checksum of
+ * several buffers can be computed by passing the result for the earlier
+ * buffers as @a crc, so that
+ * <code>crc32c(b, nb, crc32c(a, na)) == crc32c(ab, na + nb)</code>.
+ *
+ * The SSE4.2 CRC32 instruction is used if the compiler supports it and the
+ * CPU running the code has it; otherwise a table-driven implementation is
+ * used.
+ */
+std::uint32_t crc32c(const void *data, std::size_t length, std::uint32_t crc = 0) noexcept;
+
+} // namespace spead2
+
+#endif // SPEAD2_COMMON_CRC32C_H
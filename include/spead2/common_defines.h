@@ -90,6 +90,19 @@ enum memcpy_function_id : unsigned int
 
 typedef void *(*memcpy_function)(void * __restrict__, const void * __restrict__, std::size_t);
 
+/// Outcome of checking the payload checksum of a received heap
+enum checksum_status : unsigned int
+{
+    /// The stream does not check checksums, or the heap has no checksum item
+    CHECKSUM_NONE,
+    /// The checksum matches the payload
+    CHECKSUM_VALID,
+    /// The checksum does not match the payload
+    CHECKSUM_INVALID,
+    /// The heap has a checksum item, but is incomplete or was filtered
+    CHECKSUM_UNVERIFIED
+};
+
 /**
  * An unpacked descriptor.
  *
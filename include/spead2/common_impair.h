@@ -0,0 +1,101 @@
+/* Copyright 2016 SKA South Africa
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Deterministic impairment of packet sequences (loss, duplication,
+ * reordering and interleaving of heaps), for testing and benchmarking
+ * reassembly without a real network.
+ */
+
+#ifndef SPEAD2_COMMON_IMPAIR_H
+#define SPEAD2_COMMON_IMPAIR_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <spead2/common_defines.h>
+#include <spead2/send_heap.h>
+
+namespace spead2
+{
+
+/// Parameters for @ref packet_impairer
+struct impairment_config
+{
+    /// Probability that each packet is dropped
+    double drop = 0.0;
+    /// Probability that each (non-dropped) packet is sent twice
+    double duplicate = 0.0;
+    /**
+     * Maximum number of positions by which a packet may be delayed relative
+     * to its neighbours. Zero preserves the order.
+     */
+    std::size_t reorder_window = 0;
+    /**
+     * Number of consecutive heaps whose packets are interleaved round-robin,
+     * as if sent by several senders at once. One sends heaps one at a time.
+     */
+    std::size_t interleave = 1;
+    /// Seed for the pseudo-random generator
+    std::uint64_t seed = 0;
+};
+
+/**
+ * Collects the packets of a sequence of heaps and produces an impaired
+ * version of the sequence. The output depends only on the packets and the
+ * configuration (including the seed), and not on the platform, so that
+ * results can be reproduced.
+ *
+ * The impairments are applied in the following order: interleaving, then
+ * drops and duplicates, and finally reordering.
+ */
+class packet_impairer
+{
+public:
+    typedef std::vector<std::uint8_t> packet_data;
+
+private:
+    impairment_config config;
+    /// Packets for each heap, in the order they were added
+    std::vector<std::vector<packet_data>> heaps;
+
+public:
+    /**
+     * Constructor.
+     *
+     * @throw std::invalid_argument if a probability is outside [0, 1] or
+     * @a interleave is zero
+     */
+    explicit packet_impairer(const impairment_config &config);
+
+    /// Add the packets of one heap
+    void add_heap(std::vector<packet_data> &&packets);
+
+    /// Generate the packets for @a h with @ref send::packet_generator and add them
+    void add_heap(const send::heap &h, item_pointer_t cnt, std::size_t max_packet_size);
+
+    /// Number of packets added, before impairment
+    std::size_t get_num_packets() const;
+
+    /// Produce the impaired packet sequence
+    std::vector<packet_data> get_packets() const;
+};
+
+} // namespace spead2
+
+#endif // SPEAD2_COMMON_IMPAIR_H
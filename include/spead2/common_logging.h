@@ -24,6 +24,14 @@
 #define SPEAD2_COMMON_LOGGING_H
 
 #include <functional>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <string>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
 #include <boost/format.hpp>
 #include <boost/preprocessor/cat.hpp>
 #include <spead2/common_defines.h>
@@ -43,6 +51,16 @@ namespace detail
 
 void log_msg_impl(log_level level, const std::string &msg);
 
+/**
+ * Apply the rate limit for the message site identified by @a site (the
+ * format string, whose address is used as the key, so it should be a string
+ * literal). Returns false if the
+ * message should be suppressed, in which case it is counted for a later
+ * summary. This is checked before formatting, so that suppressed messages
+ * cost very little.
+ */
+bool log_rate_check(log_level level, const char *site);
+
 static inline void apply_format(boost::format &format)
 {
 }
@@ -56,7 +74,119 @@ static inline void apply_format(boost::format &format, T0&& arg0, Ts&&... args)
 
 } // namespace detail
 
-void set_log_function(std::function<void(log_level, const std::string &)>);
+/**
+ * Replace the function that receives log messages.
+ *
+ * @return The previous log function
+ */
+std::function<void(log_level, const std::string &)> set_log_function(
+    std::function<void(log_level, const std::string &)>);
+
+/**
+ * Bounded multi-producer, multi-consumer queue of log messages. Pushing never
+ * blocks or takes a lock (except to wake a consumer that is asleep): if the
+ * queue is full, the message is discarded and counted. Consumers can poll
+ * or block with a timeout.
+ */
+class log_queue
+{
+private:
+    struct cell
+    {
+        std::atomic<std::size_t> sequence;
+        log_level level;
+        std::string msg;
+    };
+
+    std::unique_ptr<cell[]> cells;
+    const std::size_t mask;
+    /* Padding keeps producers and consumers on separate cache lines. This
+     * is used rather than alignas, which plain new does not honour in C++11.
+     */
+    char pad0[64];
+    std::atomic<std::size_t> enqueue_pos{0};
+    char pad1[64];
+    std::atomic<std::size_t> dequeue_pos{0};
+    char pad2[64];
+    std::atomic<std::uint64_t> dropped{0};
+
+    std::mutex wait_mutex;
+    std::condition_variable wait_cond;
+    std::atomic<bool> waiting{false};      ///< A consumer is (about to be) asleep
+    std::atomic<bool> stopped{false};
+
+public:
+    /// Create a queue holding at least @a capacity messages
+    explicit log_queue(std::size_t capacity);
+
+    /**
+     * Append a message, taking ownership of @a msg.
+     *
+     * @retval false if the queue was full and the message was dropped
+     */
+    bool try_push(log_level level, std::string &&msg);
+
+    /// Remove the oldest message if there is one, without blocking
+    bool try_pop(log_level &level, std::string &msg);
+
+    /**
+     * Remove the oldest message, waiting up to @a timeout for one to arrive.
+     *
+     * @retval false if the wait timed out or the queue was stopped while empty
+     */
+    bool pop(log_level &level, std::string &msg, std::chrono::steady_clock::duration timeout);
+
+    /// Wake up consumers and make future calls to @ref pop return immediately when empty
+    void stop();
+
+    /// Whether @ref stop has been called
+    bool is_stopped() const { return stopped.load(); }
+
+    /// Number of messages discarded because the queue was full
+    std::uint64_t get_dropped() const { return dropped.load(std::memory_order_relaxed); }
+};
+
+/// Default value for @ref set_log_rate_limit
+static constexpr unsigned int default_log_rate_messages = 10;
+/// Default value for @ref set_log_rate_limit
+static constexpr std::chrono::seconds default_log_rate_interval{1};
+
+/**
+ * Limit each message site (identified by its format string) to at most @a
+ * max_messages messages every @a interval. Further messages from the site
+ * are not formatted, and the number suppressed is logged once the interval
+ * expires. A limit of zero disables rate limiting. Messages without format
+ * arguments are not rate-limited, since they may be built at runtime (and
+ * so cannot identify their site).
+ */
+void set_log_rate_limit(unsigned int max_messages,
+                        std::chrono::steady_clock::duration interval = default_log_rate_interval);
+
+/// Total number of messages suppressed by the rate limit
+std::uint64_t get_log_suppressed();
+
+/// Default capacity for @ref start_log_thread
+static constexpr std::size_t default_log_queue_capacity = 4096;
+
+/**
+ * Deliver log messages from a background thread. After this is called,
+ * logging only formats the message and appends it to a bounded @ref
+ * log_queue, so that the log function never runs on (or blocks) the
+ * threads handling packets. Messages that arrive while the queue is full are
+ * dropped (see @ref get_log_dropped). This has no effect if the thread is
+ * already running.
+ */
+void start_log_thread(std::size_t capacity = default_log_queue_capacity);
+
+/**
+ * Stop the thread started by @ref start_log_thread, after delivering the
+ * messages already queued. Messages are then delivered synchronously again.
+ * This is called automatically at program exit.
+ */
+void stop_log_thread();
+
+/// Number of messages dropped because the queue of the log thread was full
+std::uint64_t get_log_dropped();
 
 /**
  * Log a plain string at a given log level. Do not append a final newline to @a msg.
@@ -79,7 +209,7 @@ static inline void log_msg(log_level level, const char *msg)
 template<typename T0, typename... Ts>
 static inline void log_msg(log_level level, const char *format, T0&& arg0, Ts&&... args)
 {
-    if (level <= SPEAD2_MAX_LOG_LEVEL)
+    if (level <= SPEAD2_MAX_LOG_LEVEL && detail::log_rate_check(level, format))
     {
         boost::format formatter(format);
         detail::apply_format(formatter, std::forward<T0>(arg0), std::forward<Ts>(args)...);
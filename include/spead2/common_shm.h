@@ -0,0 +1,149 @@
+/* Copyright 2016 SKA South Africa
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Ring of fixed-size packet slots in POSIX shared memory, shared between a
+ * producing and a consuming process.
+ */
+
+#ifndef SPEAD2_COMMON_SHM_H
+#define SPEAD2_COMMON_SHM_H
+
+#include <spead2/common_features.h>
+#if SPEAD2_USE_SHM
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <boost/noncopyable.hpp>
+
+namespace spead2
+{
+
+namespace detail
+{
+
+struct shm_ring_header;
+struct shm_slot_info;
+
+} // namespace detail
+
+/**
+ * Ring of fixed-size slots in a POSIX shared memory object, used to pass
+ * packets from one process to another without going through the network
+ * stack. There must be a single producer and a single consumer (which may be
+ * in the same process).
+ *
+ * The producer claims any free slot, writes a packet into it and commits it,
+ * which appends it to a queue of ready slots and posts a process-shared
+ * semaphore. The consumer takes slots from the queue in order, but may
+ * release them in any order (for example, when the heap that refers to the
+ * slot is destroyed). The producer never blocks: if no slot is free, it is
+ * up to the caller to try again later.
+ */
+class shm_ring : public boost::noncopyable
+{
+private:
+    std::string name;       ///< Shared memory object to unlink when destroyed (empty if not the creator)
+    std::uint8_t *base = nullptr;
+    std::size_t mapped_size = 0;
+    detail::shm_ring_header *header = nullptr;
+    detail::shm_slot_info *info = nullptr;
+    std::uint64_t *ready = nullptr;         ///< Queue of committed slot indices
+    std::uint8_t *slots = nullptr;
+    std::size_t n_slots = 0;
+    std::size_t slot_size = 0;
+    std::size_t next_free = 0;              ///< Where the producer starts looking for a free slot
+
+    /// Map @a size bytes of @a fd and set up the pointers into the mapping
+    void map(int fd, std::size_t size);
+
+public:
+    /**
+     * Create a new ring. The shared memory object is removed when this
+     * object is destroyed, although processes that have already opened it
+     * can continue to use it.
+     *
+     * @param name         Name of the POSIX shared memory object (must start with a slash)
+     * @param n_slots      Number of slots
+     * @param slot_size    Maximum size of a packet
+     *
+     * @throw std::invalid_argument if @a n_slots or @a slot_size is zero
+     * @throw std::system_error if the object already exists or cannot be created
+     */
+    shm_ring(const std::string &name, std::size_t n_slots, std::size_t slot_size);
+
+    /**
+     * Open a ring created by another process.
+     *
+     * @throw std::system_error if the object cannot be opened
+     * @throw std::invalid_argument if the object is not a ring
+     */
+    explicit shm_ring(const std::string &name);
+
+    ~shm_ring();
+
+    std::size_t get_n_slots() const { return n_slots; }
+    std::size_t get_slot_size() const { return slot_size; }
+    /// Whether @a ptr points into a slot of this ring
+    bool contains(const void *ptr) const;
+
+    /**
+     * @name Producer interface
+     * @{
+     */
+    /**
+     * Claim a free slot.
+     *
+     * @param[out] index   Index of the slot, to pass to @ref commit
+     * @returns Pointer to the slot, or null if all slots are in use
+     */
+    std::uint8_t *try_acquire(std::size_t &index);
+    /// Pass a slot claimed by @ref try_acquire, containing @a length bytes, to the consumer
+    void commit(std::size_t index, std::size_t length);
+    /// Indicate that no more slots will be committed, and wake the consumer
+    void close();
+    /** @} */
+
+    /**
+     * @name Consumer interface
+     * @{
+     */
+    /**
+     * Take the oldest committed slot, without blocking.
+     *
+     * @param[out] index   Index of the slot, to pass to @ref release
+     * @param[out] length  Number of bytes in the slot
+     * @returns Pointer to the slot, or null if no slot is ready
+     */
+    const std::uint8_t *try_next(std::size_t &index, std::size_t &length);
+    /// Block until a slot is committed, the ring is closed or @ref wake is called
+    void wait();
+    /// Make a concurrent or future call to @ref wait return
+    void wake();
+    /// Whether the producer has called @ref close
+    bool is_closed() const;
+    /// Return a slot taken with @ref try_next to the producer
+    void release(std::size_t index);
+    /** @} */
+};
+
+} // namespace spead2
+
+#endif // SPEAD2_USE_SHM
+#endif // SPEAD2_COMMON_SHM_H
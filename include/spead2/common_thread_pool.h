@@ -27,6 +27,7 @@
 #include <array>
 #include <cstdint>
 #include <memory>
+#include <atomic>
 #include <boost/asio.hpp>
 #include <spead2/recv_reader.h>
 
@@ -72,6 +73,57 @@ public:
     static void set_affinity(int core);
 };
 
+/**
+ * Set of threads, each with its own @c boost::asio::io_service and optionally
+ * pinned to a core. Each thread is a single-threaded @ref thread_pool, so
+ * anything that accepts a @ref thread_pool or an io_service (streams, and
+ * hence their strands and readers, and the refill tasks of a
+ * @ref memory_pool) can be placed on a specific thread.
+ *
+ * Compared to a single @ref thread_pool with several threads, handlers never
+ * migrate between threads and there is no shared handler queue, which helps
+ * when there are many independent streams. The cost is that a busy stream
+ * cannot borrow an idle thread.
+ */
+class pinned_thread_pool
+{
+private:
+    std::vector<std::unique_ptr<thread_pool>> threads;
+    /// Next thread to hand out from @ref next
+    std::atomic<std::size_t> next_index{0};
+
+public:
+    /**
+     * Constructor. Threads are assigned to cores from @a affinity in
+     * round-robin fashion. If @a affinity is empty, threads are not pinned.
+     *
+     * @throw std::invalid_argument if @a num_threads is less than 1
+     */
+    explicit pinned_thread_pool(int num_threads, const std::vector<int> &affinity = {});
+
+    /// Number of threads
+    std::size_t size() const { return threads.size(); }
+
+    /**
+     * Retrieve the pool for one thread.
+     *
+     * @throw std::out_of_range if @a idx is not less than @ref size()
+     */
+    thread_pool &get_thread(std::size_t idx) { return *threads.at(idx); }
+
+    /// Retrieve the io_service for one thread
+    boost::asio::io_service &get_io_service(std::size_t idx) { return get_thread(idx).get_io_service(); }
+
+    /**
+     * Retrieve the pool for the next thread in round-robin order. This is
+     * a convenience for spreading streams evenly across the threads.
+     */
+    thread_pool &next();
+
+    /// Shut down all the threads
+    void stop();
+};
+
 } // namespace spead2
 
 #endif // SPEAD2_COMMON_THREAD_POOL_H
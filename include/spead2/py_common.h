@@ -29,6 +29,11 @@
 #include <boost/system/system_error.hpp>
 #include <cassert>
 #include <mutex>
+#include <deque>
+#include <vector>
+#include <atomic>
+#include <functional>
+#include <string>
 #include <stdexcept>
 #include <spead2/common_memory_allocator.h>
 #include <spead2/common_memory_pool.h>
@@ -177,16 +182,17 @@ public:
 /**
  * Wraps access to a Python buffer-protocol object. On construction, it
  * fetches the buffer, and on destruction it releases it. At present, only
- * @c PyBUF_SIMPLE is supported, but it could easily be extended.
+ * contiguous buffers are supported (@c PyBUF_SIMPLE, optionally combined with
+ * @c PyBUF_WRITABLE).
  */
 class buffer_view : public boost::noncopyable
 {
 public:
     Py_buffer view;
 
-    explicit buffer_view(boost::python::object obj)
+    explicit buffer_view(boost::python::object obj, int flags = PyBUF_SIMPLE)
     {
-        if (PyObject_GetBuffer(obj.ptr(), &view, PyBUF_SIMPLE) != 0)
+        if (PyObject_GetBuffer(obj.ptr(), &view, flags) != 0)
             boost::python::throw_error_already_set();
     }
 
@@ -263,6 +269,56 @@ struct memory_allocator_handle_wrapper
     boost::python::handle<> memory_allocator_handle;
 };
 
+/**
+ * Allocator that hands out a fixed set of user-supplied writable Python
+ * buffers (typically numpy arrays), so that heaps are assembled directly
+ * into memory owned by the user. Each allocation takes the first free buffer
+ * that is large enough, and the buffer is returned to the free list when the
+ * payload is freed (i.e., when the heap is destroyed or discarded). If no
+ * buffer is available, it falls back to the default allocator.
+ *
+ * Allocation and freeing happen on network threads and do not touch Python
+ * objects, so they do not need the GIL.
+ *
+ * @internal
+ *
+ * The user data pointer holds one more than the index of the buffer, or zero
+ * for a fallback allocation.
+ */
+class buffer_allocator : public memory_allocator
+{
+private:
+    /// Views on the buffers, which also hold references to the objects
+    std::vector<buffer_view> buffers;
+    /// Indices of buffers that are not in use, in the order they were freed
+    std::deque<std::size_t> free_list;
+    /// Protects @ref free_list
+    mutable std::mutex free_mutex;
+    /// Number of allocations that could not be satisfied from the buffers
+    std::atomic<std::size_t> fallbacks{0};
+
+    virtual void free(std::uint8_t *ptr, void *user) override;
+
+public:
+    /// Construct from a sequence of writable buffer-protocol objects
+    explicit buffer_allocator(boost::python::object buffers);
+
+    virtual pointer allocate(std::size_t size, void *hint) override;
+
+    /**
+     * Return the user buffer that holds the payload of @a heap, or @c None
+     * if the payload was not allocated from one of the buffers. The buffer
+     * remains reserved for as long as the heap is alive.
+     */
+    boost::python::object pop(boost::python::object heap) const;
+
+    /// Number of buffers not currently in use
+    std::size_t get_free() const;
+
+    /// Number of allocations that fell back to the default allocator
+    std::size_t get_fallbacks() const { return fallbacks.load(); }
+};
+
 /**
  * Semaphore variant that releases the GIL during waits, and throws an
  * exception if interrupted by SIGINT in the Python process.
@@ -349,29 +405,36 @@ struct store_handle_postcall : BasePolicy_
     }
 };
 
+/**
+ * Log function that hands messages to Python without taking the GIL, so that
+ * a network thread never waits for Python. Messages are appended to a
+ * bounded queue, which a Python thread drains into the @c logging module.
+ * If the queue is full the message is dropped and counted.
+ *
+ * Once the queue is stopped (at interpreter shutdown), messages are passed
+ * to a fallback function instead. This object stays installed as the log
+ * function, since replacing it could race with other threads that are
+ * logging.
+ */
 class log_function_python
 {
 private:
-    boost::python::object logger;
+    std::shared_ptr<log_queue> queue;
+    std::function<void(log_level, const std::string &)> fallback;
 public:
     typedef void result_type;
 
-    log_function_python() = default;
-    explicit log_function_python(const boost::python::object &logger) : logger(logger) {}
+    log_function_python(
+        std::shared_ptr<log_queue> queue,
+        std::function<void(log_level, const std::string &)> fallback)
+        : queue(std::move(queue)), fallback(std::move(fallback)) {}
 
     void operator()(log_level level, const std::string &msg)
     {
-        acquire_gil gil;
-
-        static const char *const level_methods[] =
-        {
-            "warning",
-            "info",
-            "debug"
-        };
-        unsigned int level_idx = static_cast<unsigned int>(level);
-        assert(level_idx < sizeof(level_methods) / sizeof(level_methods[0]));
-        logger.attr(level_methods[level_idx])("%s", msg);
+        if (queue->is_stopped())
+            fallback(level, msg);
+        else
+            queue->try_push(level, std::string(msg));
     }
 };
 
@@ -0,0 +1,229 @@
+/* Copyright 2016 SKA South Africa
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Indexed on-disk archive of received heaps.
+ */
+
+#ifndef SPEAD2_RECV_ARCHIVE_H
+#define SPEAD2_RECV_ARCHIVE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <utility>
+#include <boost/noncopyable.hpp>
+#include <spead2/common_defines.h>
+#include <spead2/common_thread_pool.h>
+#include <spead2/recv_heap.h>
+#include <spead2/recv_live_heap.h>
+#include <spead2/recv_stream.h>
+
+namespace spead2
+{
+namespace recv
+{
+
+namespace detail
+{
+
+class archive_mapping;
+
+/// Position of a heap in an archive
+struct archive_index_entry
+{
+    s_item_pointer_t cnt;
+    std::uint64_t offset;       ///< Offset of the record from the start of the file
+};
+
+} // namespace detail
+
+/**
+ * Writes frozen heaps to a file that can be read back with
+ * @ref heap_archive_reader. Each heap is stored as a record holding its item
+ * pointers followed by its payload (aligned to 64 bytes), and an index of
+ * all the records is appended when the archive is closed. Records are
+ * accumulated in a page-aligned buffer so that the file is written in large
+ * aligned chunks.
+ *
+ * Items that were omitted from the heap by an item filter are not stored,
+ * and nor is the checksum item (although the checksum status is). This
+ * class is thread-safe.
+ */
+class heap_archive_writer : public boost::noncopyable
+{
+private:
+    std::mutex mutex;
+    int fd = -1;
+    std::uint8_t *buffer = nullptr;
+    std::size_t buffer_size;
+    std::size_t buffer_fill = 0;
+    std::uint64_t offset = 0;                   ///< File offset of the start of the buffer
+    std::vector<detail::archive_index_entry> index;
+
+    /// Write out the buffer
+    void flush_buffer();
+    /// Append bytes to the file via the buffer
+    void append(const void *data, std::size_t size);
+    /// Append zero bytes to make the file size a multiple of 64
+    void pad();
+
+public:
+    /// Default size of the write buffer
+    static constexpr std::size_t default_buffer_size = 4 * 1024 * 1024;
+
+    /**
+     * Create an archive, replacing any existing file.
+     *
+     * @param filename     File to write
+     * @param buffer_size  Size of the write buffer (rounded up to a whole page)
+     *
+     * @throw std::system_error if the file cannot be created
+     */
+    explicit heap_archive_writer(const std::string &filename,
+                                 std::size_t buffer_size = default_buffer_size);
+
+    /// Closes the archive if it has not already been closed (logging any errors)
+    ~heap_archive_writer();
+
+    /**
+     * Append a heap to the archive.
+     *
+     * @throw std::system_error on I/O error
+     * @throw std::logic_error if the archive has been closed
+     */
+    void write(const heap &h);
+
+    /**
+     * Write the index and close the file. An archive that is not closed
+     * (for example, because the process crashed) can still be read, but the
+     * reader has to scan all the records.
+     */
+    void close();
+
+    /// Number of heaps written
+    std::size_t size();
+};
+
+/**
+ * Stream that appends every complete heap to a @ref heap_archive_writer.
+ * Incomplete heaps are discarded.
+ */
+class archive_stream : public stream
+{
+private:
+    std::shared_ptr<heap_archive_writer> writer;
+
+    virtual void heap_ready(live_heap &&heap) override;
+
+public:
+    /**
+     * Constructor.
+     *
+     * @param io_service   I/O service for the stream
+     * @param writer       Archive to which heaps are written. It is not
+     *                     closed when the stream stops.
+     * @param bug_compat   Protocol bugs to be compatible with
+     * @param max_heaps    Maximum number of heaps that can be in flight at once
+     */
+    archive_stream(boost::asio::io_service &io_service,
+                   std::shared_ptr<heap_archive_writer> writer,
+                   bug_compat_mask bug_compat = 0,
+                   std::size_t max_heaps = default_max_heaps);
+
+    /// Constructor using the I/O service of a thread pool
+    archive_stream(thread_pool &pool,
+                   std::shared_ptr<heap_archive_writer> writer,
+                   bug_compat_mask bug_compat = 0,
+                   std::size_t max_heaps = default_max_heaps)
+        : archive_stream(pool.get_io_service(), std::move(writer), bug_compat, max_heaps) {}
+
+    /// Stops the stream, so that heaps still under construction are archived
+    virtual ~archive_stream() override;
+};
+
+/**
+ * Memory-mapped reader for files written by @ref heap_archive_writer. Heaps
+ * can be retrieved in constant time by position or by heap ID, and refer
+ * directly to the mapped file rather than copying the payload. The mapping
+ * is private, so modifying the payload of a heap does not modify the file.
+ * Heaps remain valid after the reader is destroyed.
+ *
+ * This class is thread-safe.
+ */
+class heap_archive_reader : public boost::noncopyable
+{
+private:
+    std::shared_ptr<detail::archive_mapping> mapping;
+    /// Index from the trailer of the file, or @ref scanned_index if there is none
+    const detail::archive_index_entry *index = nullptr;
+    std::size_t n_heaps = 0;
+    std::vector<detail::archive_index_entry> scanned_index;
+    std::unordered_map<s_item_pointer_t, std::size_t> by_cnt;
+    std::vector<std::size_t> descriptor_indices;
+
+    /// Build @ref scanned_index by walking the records
+    void scan();
+
+public:
+    /**
+     * Open an archive.
+     *
+     * @throw std::system_error if the file cannot be opened or mapped
+     * @throw std::invalid_argument if the file is not a heap archive
+     */
+    explicit heap_archive_reader(const std::string &filename);
+
+    /// Number of heaps in the archive
+    std::size_t size() const { return n_heaps; }
+
+    /**
+     * Get the heap at position @a index (in the order written).
+     *
+     * @throw std::out_of_range if @a index is not less than @ref size
+     */
+    heap get(std::size_t index) const;
+
+    /**
+     * Get the position of the first heap with ID @a cnt.
+     *
+     * @throw std::out_of_range if there is no such heap
+     */
+    std::size_t find(s_item_pointer_t cnt) const;
+
+    /// Whether there is a heap with ID @a cnt
+    bool contains(s_item_pointer_t cnt) const { return by_cnt.count(cnt) > 0; }
+
+    /// Get the ID of the heap at position @a index, without decoding it
+    s_item_pointer_t get_cnt(std::size_t index) const;
+
+    /**
+     * Positions of the heaps that contain descriptors, in order. Applying
+     * these first allows other heaps to be interpreted out of order.
+     */
+    const std::vector<std::size_t> &get_descriptor_indices() const { return descriptor_indices; }
+};
+
+} // namespace recv
+} // namespace spead2
+
+#endif // SPEAD2_RECV_ARCHIVE_H
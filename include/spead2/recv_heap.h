@@ -25,6 +25,11 @@
 #include <cstdint>
 #include <memory>
 #include <vector>
+#include <map>
+#include <string>
+#include <mutex>
+#include <atomic>
+#include <unordered_map>
 #include <spead2/common_defines.h>
 #include <spead2/common_flavour.h>
 #include <spead2/common_memory_allocator.h>
@@ -35,6 +40,7 @@ namespace recv
 {
 
 class live_heap;
+class item_filter;
 
 /**
  * An item extracted from a heap.
@@ -53,39 +59,183 @@ struct item
     bool is_immediate;
 };
 
+/**
+ * Cache of parsed descriptors, keyed by the raw bytes of descriptor items.
+ * Senders typically re-send the same descriptors periodically, and the
+ * cache avoids parsing them again. Each distinct descriptor is given a key
+ * that is unique across all caches in the process, so that consumers can
+ * cheaply recognise a descriptor they have already applied.
+ *
+ * When the cache reaches its capacity it is emptied. This class is
+ * thread-safe.
+ */
+class descriptor_cache
+{
+public:
+    /// Result of a lookup
+    struct entry
+    {
+        /// Parsed descriptor, or null if the item was not a valid descriptor
+        std::shared_ptr<const descriptor> desc;
+        /// Unique identifier for the raw descriptor (0 if not cached)
+        std::uint64_t key;
+    };
+
+    static constexpr std::size_t default_max_entries = 1024;
+
+private:
+    std::mutex mutex;
+    std::unordered_map<std::string, entry> entries;
+    std::size_t max_entries;
+    std::uint64_t hits = 0;
+    std::uint64_t misses = 0;
+
+public:
+    explicit descriptor_cache(std::size_t max_entries = default_max_entries);
+
+    /**
+     * Find the descriptor for a descriptor item, parsing it if it has not
+     * been seen before.
+     */
+    entry lookup(const item &raw, bug_compat_mask bug_compat);
+
+    /// Number of lookups that were satisfied from the cache
+    std::uint64_t get_hits();
+    /// Number of lookups that required parsing
+    std::uint64_t get_misses();
+};
+
 /**
  * Received heap that has been finalised.
  */
 class heap
 {
 private:
+    /**
+     * Ensures that @ref decode runs exactly once, even if several threads
+     * call const accessors on the same heap. Moving transfers the state,
+     * and (like moving the heap) must not race with other accesses.
+     */
+    class decode_once
+    {
+    private:
+        std::atomic<bool> done{false};
+        std::mutex mutex;
+
+    public:
+        decode_once() = default;
+        decode_once(decode_once &&other) noexcept
+            : done(other.done.load(std::memory_order_relaxed)) {}
+        decode_once &operator=(decode_once &&other) noexcept
+        {
+            done.store(other.done.load(std::memory_order_relaxed), std::memory_order_relaxed);
+            return *this;
+        }
+
+        template<typename F>
+        void call(F &&func)
+        {
+            if (!done.load(std::memory_order_acquire))
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (!done.load(std::memory_order_relaxed))
+                {
+                    func();
+                    done.store(true, std::memory_order_release);
+                }
+            }
+        }
+    };
+
     s_item_pointer_t cnt;       ///< Heap ID
     flavour flavour_;           ///< Flavour
     /**
-     * Extracted items. The pointers in the items point into either @ref
-     * payload or @ref immediate_payload.
+     * Item pointers taken over from the live heap, sorted by address. Once
+     * the items have been decoded, each pointer is stored big-endian so that
+     * immediate items can point directly at their value.
      */
-    std::vector<item> items;
+    mutable std::vector<item_pointer_t> pointers;
+    /// Length of the payload
+    s_item_pointer_t payload_length;
+    /// Item filter from the live heap (may be null)
+    std::shared_ptr<const item_filter> filter;
+    /// Payload ranges skipped by @ref filter
+    std::map<s_item_pointer_t, s_item_pointer_t> skipped_ranges;
+    /// Guards the population of @ref items from @ref pointers
+    mutable decode_once decoded;
+    /**
+     * Extracted items, populated on first use. The pointers in the items
+     * point into either @ref payload or @ref pointers.
+     */
+    mutable std::vector<item> items;
     /// Heap payload
     memory_allocator::pointer payload;
-    /// Storage for immediate values
-    std::unique_ptr<std::uint8_t[]> immediate_payload;
+    /// Cache used by @ref get_descriptors (may be null)
+    std::shared_ptr<descriptor_cache> descriptors_cache;
+    /// Result of checking the payload checksum
+    checksum_status checksum;
+    /// ID of the checksum item, which is omitted from @ref items (0 if none)
+    s_item_pointer_t checksum_id;
+
+    /// Populate @ref items (only called through @ref decoded)
+    void decode() const;
 
 public:
     /**
      * Freeze a heap, which must satisfy live_heap::is_contiguous. The original
-     * heap is destroyed.
+     * heap is left in a state where it may only be destroyed or assigned to.
+     *
+     * Items are only decoded on the first call to @ref get_items (or any
+     * function that uses it). This is synchronised internally, so const
+     * member functions may still be called concurrently.
      */
     explicit heap(live_heap &&h);
+
+    /**
+     * Construct a heap from its parts, for heaps that were not assembled
+     * from packets (such as those read by @ref heap_archive_reader). The
+     * heap takes ownership of @a payload, which must hold at least
+     * @a payload_length bytes (it may be null if there are no addressed
+     * items).
+     *
+     * @param cnt              Heap ID
+     * @param flavour_         Flavour, which determines the item pointer encoding
+     * @param pointers         Item pointers in host byte order, sorted as for a live heap
+     * @param payload          Heap payload
+     * @param payload_length   Length of the payload, which ends the last addressed item
+     * @param checksum         Result of a previous checksum of the payload
+     */
+    heap(s_item_pointer_t cnt, const flavour &flavour_,
+         std::vector<item_pointer_t> &&pointers,
+         memory_allocator::pointer &&payload, s_item_pointer_t payload_length,
+         checksum_status checksum = CHECKSUM_NONE);
+
     /// Get heap ID
     s_item_pointer_t get_cnt() const { return cnt; }
     /// Get protocol flavour used
     const flavour &get_flavour() const { return flavour_; }
+    /**
+     * Get the result of checking the payload checksum. This is
+     * @ref CHECKSUM_NONE unless the stream was configured with
+     * @ref stream_base::set_checksum_id.
+     */
+    checksum_status get_checksum_status() const { return checksum; }
+
     /**
      * Get the items from the heap. This includes descriptors, but
-     * excludes any items with ID <= 4.
+     * excludes any items with ID <= 4 and the checksum item.
+     */
+    const std::vector<item> &get_items() const
+    {
+        decoded.call([this] { decode(); });
+        return items;
+    }
+
+    /**
+     * Get the start of the payload memory, as returned by the memory
+     * allocator. This is null if the heap has no payload.
      */
-    const std::vector<item> &get_items() const { return items; }
+    const std::uint8_t *get_payload() const { return payload.get(); }
 
     /**
      * Extract descriptor fields from the heap. Any missing fields are
@@ -103,9 +253,20 @@ public:
      */
     descriptor to_descriptor() const;
 
-    /// Extract and decode descriptors from this heap
+    /**
+     * Extract and decode descriptors from this heap. If the heap was
+     * received by a stream with a @ref descriptor_cache, descriptors seen
+     * before are not parsed again.
+     */
     std::vector<descriptor> get_descriptors() const;
 
+    /**
+     * Like @ref get_descriptors, but return the cache entries. This allows
+     * a consumer to skip descriptors whose key it has already applied. If
+     * there is no cache, every entry has a key of 0.
+     */
+    std::vector<descriptor_cache::entry> get_descriptor_entries() const;
+
     /**
      * Convenience function to check whether any of the items is
      * a @c CTRL_STREAM_START.
@@ -42,6 +42,45 @@ namespace recv
 {
 
 class heap;
+class descriptor_cache;
+
+/**
+ * Selects which items are retained when heaps are received. Payload that
+ * belongs only to items that are not retained is not copied out of the
+ * packets, and those items are omitted from the frozen @ref heap.
+ *
+ * Descriptors and stream control items are always retained, regardless of
+ * the filter.
+ */
+class item_filter
+{
+public:
+    enum class mode
+    {
+        /// Retain only the listed items
+        INCLUDE,
+        /// Retain all items except the listed ones
+        EXCLUDE
+    };
+
+private:
+    mode mode_;
+    std::unordered_set<s_item_pointer_t> ids;
+
+public:
+    item_filter(mode mode_, const std::vector<s_item_pointer_t> &ids)
+        : mode_(mode_), ids(ids.begin(), ids.end()) {}
+
+    /// Whether an item with ID @a id should be retained
+    bool is_wanted(s_item_pointer_t id) const
+    {
+        if (id == 0)
+            return false;    // padding
+        if (id <= STREAM_CTRL_ID)
+            return true;
+        return (ids.count(id) != 0) == (mode_ == mode::INCLUDE);
+    }
+};
 
 /**
  * A SPEAD heap that is in the process of being received. Once it is fully
@@ -119,6 +158,28 @@ private:
     /// Backing memory allocator
     std::shared_ptr<memory_allocator> allocator;
 
+    /// Item filter (null to retain all items)
+    std::shared_ptr<const item_filter> filter;
+    /**
+     * Start addresses of addressed items seen so far, mapped to whether the
+     * payload from that address up to the next start is wanted. Only
+     * maintained when there is a @ref filter.
+     */
+    std::map<s_item_pointer_t, bool> item_starts;
+    /**
+     * Ranges of payload that were not copied because of the @ref filter,
+     * in the same format as @ref payload_ranges.
+     */
+    std::map<s_item_pointer_t, s_item_pointer_t> skipped_ranges;
+
+    /// Descriptor cache passed on to the frozen heap (may be null)
+    std::shared_ptr<descriptor_cache> descriptors_cache;
+
+    /// Result of @ref verify_checksum
+    checksum_status checksum = CHECKSUM_NONE;
+    /// ID of the checksum item found by @ref verify_checksum (0 if none)
+    s_item_pointer_t checksum_id = 0;
+
     /**
      * Make sure at least @a size bytes are allocated for payload. If
      * @a exact is false, then a doubling heuristic will be used.
@@ -131,6 +192,12 @@ private:
      */
     bool add_payload_range(s_item_pointer_t first, s_item_pointer_t last);
 
+    /**
+     * Copy the payload from a packet into @ref payload, skipping any parts
+     * that the @ref filter excludes.
+     */
+    void copy_payload(const packet_header &packet);
+
 public:
     /**
      * Constructor.
@@ -145,6 +212,15 @@ public:
     /// Set memcpy function to use for copying payload
     void set_memcpy(memcpy_function memcpy);
 
+    /**
+     * Set the filter selecting which items to retain. It must be set before
+     * the first packet is added.
+     */
+    void set_item_filter(std::shared_ptr<const item_filter> filter);
+
+    /// Set the descriptor cache that the frozen heap will use
+    void set_descriptor_cache(std::shared_ptr<descriptor_cache> cache);
+
     /**
      * Attempt to add a packet to the heap. The packet must have been
      * successfully prepared by @ref decode_packet. It returns @c true if
@@ -171,6 +247,16 @@ public:
     s_item_pointer_t get_received_length() const;
     /// Get amount of payload expected, or -1 if not known
     s_item_pointer_t get_heap_length() const;
+
+    /**
+     * Compare the CRC-32C of the payload to the immediate item with ID @a id
+     * (see @ref send::heap::set_checksum_id). The result is also recorded
+     * so that it is available from the frozen heap. This should only be
+     * called once no more packets will be added.
+     */
+    checksum_status verify_checksum(s_item_pointer_t id);
+    /// Get the result of @ref verify_checksum
+    checksum_status get_checksum_status() const { return checksum; }
 };
 
 } // namespace recv
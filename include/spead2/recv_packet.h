@@ -24,6 +24,7 @@
 #include <cstddef>
 #include <cstdint>
 #include <spead2/common_defines.h>
+#include <spead2/common_memory_allocator.h>
 
 namespace spead2
 {
@@ -54,6 +55,17 @@ struct packet_header
     const std::uint8_t *pointers;
     /// Start of the packet payload
     const std::uint8_t *payload;
+    /// Start of the whole packet, as it was received
+    const std::uint8_t *raw;
+    /// Size of the whole packet, in bytes
+    std::size_t raw_size;
+    /**
+     * Optional ownership of the memory starting at @ref payload, set by
+     * readers whose buffers can outlive the packet. If the packet holds an
+     * entire heap, the heap takes this (leaving it null) instead of copying
+     * the payload.
+     */
+    memory_allocator::pointer *payload_owner = nullptr;
 };
 
 /**
@@ -22,7 +22,9 @@
 #define SPEAD2_RECV_READER_H
 
 #include <boost/asio.hpp>
+#include <cstdint>
 #include <future>
+#include <functional>
 #include <utility>
 
 namespace spead2
@@ -42,24 +44,57 @@ class stream_base;
  * - stop (strand held)
  * - join (strand not held)
  * - destruction (strand held)
+ *
+ * A reader is stopped either because the stream is stopped, or because it
+ * is removed from the stream with @ref stream::remove_reader. Completion
+ * handlers should use @ref is_stopping to determine whether to wind up.
  */
 class reader
 {
 private:
+    friend class stream;
+
     stream &owner;  ///< Owning stream
     std::promise<void> stopped_promise; ///< Promise filled when last completion handler done
+    bool removed = false;   ///< Set (with the strand held) by @ref stream::remove_reader
+    const std::uint64_t id; ///< Unique identifier (see @ref get_id)
+
+    /// Allocate a new value for @ref id
+    static std::uint64_t next_id();
 
 protected:
     /// Called by last completion handler
     void stopped();
 
+    /**
+     * Whether the reader should wind up rather than start another
+     * asynchronous operation, because the stream has stopped or the reader
+     * has been removed from it. This must be called with the strand held.
+     */
+    bool is_stopping() const;
+
+    /**
+     * Run @a func with the owner's strand held, and block until it
+     * completes. Exceptions are rethrown in the caller. This must not be
+     * called from a thread running the io_service, unless it already holds
+     * the strand.
+     */
+    void run_in_strand(std::function<void()> func);
+
 public:
-    explicit reader(stream &owner) : owner(owner) {}
+    explicit reader(stream &owner) : owner(owner), id(next_id()) {}
     virtual ~reader() = default;
 
     /// Retrieve the wrapped stream
     stream &get_stream() const { return owner; }
 
+    /**
+     * Identifier for the reader, which is never zero and is never reused
+     * for another reader (of any stream) in the process. Unlike the reader's
+     * address, it remains unambiguous after the reader is destroyed.
+     */
+    std::uint64_t get_id() const { return id; }
+
     /**
      * Retrieve the wrapped stream's base class. This must only be used when
      * the stream's strand is held.
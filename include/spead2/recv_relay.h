@@ -0,0 +1,242 @@
+/* Copyright 2016 SKA South Africa
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Forwarding of received packets to a send stream without heap assembly.
+ */
+
+#ifndef SPEAD2_RECV_RELAY_H
+#define SPEAD2_RECV_RELAY_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+#include <boost/asio.hpp>
+#include <spead2/common_defines.h>
+#include <spead2/common_thread_pool.h>
+#include <spead2/recv_packet.h>
+#include <spead2/recv_stream.h>
+#include <spead2/recv_udp_base.h>
+#include <spead2/send_stream.h>
+
+namespace spead2
+{
+namespace recv
+{
+
+/// Counters reported by @ref relay_stream::get_stats
+struct relay_stats
+{
+    std::uint64_t packets = 0;            ///< Packets received
+    std::uint64_t forwarded_packets = 0;  ///< Packets successfully sent
+    std::uint64_t forwarded_bytes = 0;    ///< Bytes successfully sent
+    std::uint64_t batches = 0;            ///< Batches passed to the send stream
+    std::uint64_t filtered = 0;           ///< Packets rejected by the heap filters
+    std::uint64_t rate_limited = 0;       ///< Packets dropped by the rate limit
+    /// Packets dropped because no batch was free, or they were too large
+    std::uint64_t overflow = 0;
+    std::uint64_t send_errors = 0;        ///< Packets whose transmission failed
+};
+
+/**
+ * Stream that forwards every received packet to a send stream, without
+ * assembling heaps. Packets are sent exactly as they were received, so
+ * heap cnts and item pointers are preserved; the destination is that of the
+ * send stream (typically a @ref send::udp_stream or @ref
+ * send::udp_ibv_stream on another network).
+ *
+ * Each packet is copied once, from the reader's buffer into one of a fixed
+ * number of preallocated batches, since the reader reuses its buffer as soon
+ * as the packet has been processed. A batch is passed to
+ * @ref send::stream::async_send_packets when it is full or when the reader
+ * has finished its current burst of packets, so that one receive burst
+ * becomes one send. If no batch is free (because the send stream is slower
+ * than the input) the packet is dropped and counted.
+ *
+ * Heaps can be selected by heap cnt (see @ref set_cnt_filter) or by the items
+ * they contain (see @ref set_item_ids), and the forwarded traffic can be
+ * limited to a maximum rate independently of the send stream (see
+ * @ref set_rate). Packets that exceed the rate are dropped rather than
+ * delayed, so that a slow output never holds up the reader. Stream control
+ * packets bypass the filters and the rate limit, and a stop packet is
+ * forwarded before the relay stops.
+ *
+ * The send stream must outlive the relay, and should not be used for
+ * anything else while the relay is running, since the relay occupies slots
+ * in its queue.
+ */
+class relay_stream : public stream
+{
+private:
+    struct batch
+    {
+        std::unique_ptr<std::uint8_t[]> storage;
+        std::vector<boost::asio::const_buffer> packets;
+    };
+
+    send::stream &output;
+    const std::size_t max_packet_size;
+    const std::size_t batch_size;
+    std::vector<batch> batches;
+
+    /// Protects @ref free_batches
+    std::mutex batch_mutex;
+    /// Signalled when a batch is returned to @ref free_batches
+    std::condition_variable batch_returned;
+    std::vector<batch *> free_batches;
+    /// Batch being filled (only accessed from the strand)
+    batch *current = nullptr;
+    /// Whether a flush has been posted to the strand but not yet run
+    bool flush_pending = false;
+
+    /**
+     * @name Filters
+     * @{
+     * Only accessed from the strand.
+     */
+    item_pointer_t cnt_modulus = 1;
+    item_pointer_t cnt_remainder = 0;
+    std::vector<s_item_pointer_t> item_ids;  ///< Sorted; empty to accept all
+    /// Recent heaps and whether they were accepted by the item filter
+    std::vector<std::pair<s_item_pointer_t, bool>> recent;
+    std::size_t recent_head = 0;
+    /** @} */
+
+    /**
+     * @name Rate limit
+     * @{
+     * Token bucket, only accessed from the strand. A rate of 0 disables it.
+     */
+    double rate = 0.0;
+    std::size_t burst_size = 0;
+    double tokens = 0.0;
+    std::chrono::steady_clock::time_point last_refill;
+    /** @} */
+
+    std::atomic<std::uint64_t> n_packets{0};
+    std::atomic<std::uint64_t> n_forwarded_packets{0};
+    std::atomic<std::uint64_t> n_forwarded_bytes{0};
+    std::atomic<std::uint64_t> n_batches{0};
+    std::atomic<std::uint64_t> n_filtered{0};
+    std::atomic<std::uint64_t> n_rate_limited{0};
+    std::atomic<std::uint64_t> n_overflow{0};
+    std::atomic<std::uint64_t> n_send_errors{0};
+
+    /// Whether the heap containing @a packet passes the filters
+    bool is_wanted(const packet_header &packet);
+    /// Whether the rate limit allows another @a bytes to be sent
+    bool consume_tokens(std::size_t bytes);
+    /// Pass @ref current (if not empty) to the send stream
+    void send_current();
+    /// Completion handler for @ref send_current
+    void batch_sent(batch *b, const boost::system::error_code &ec, item_pointer_t bytes);
+
+    virtual bool packet_ready(const packet_header &packet) override;
+
+protected:
+    virtual void stop_received() override;
+
+public:
+    static constexpr std::size_t default_max_packet_size = udp_reader_base::default_max_size;
+    static constexpr std::size_t default_batch_size = 64;
+    static constexpr std::size_t default_max_batches = 4;
+
+    /**
+     * Constructor.
+     *
+     * @param io_service      I/O service for the stream
+     * @param output          Stream to which packets are forwarded
+     * @param max_packet_size Largest packet that can be forwarded
+     * @param batch_size      Maximum number of packets in a batch
+     * @param max_batches     Number of batches that can be in flight at once.
+     *                        This should not exceed the maximum number of
+     *                        heaps of @a output.
+     * @param max_heaps       Number of recent heaps whose item filter
+     *                        decision is remembered
+     *
+     * @throw std::invalid_argument if any of the sizes is zero
+     */
+    relay_stream(boost::asio::io_service &io_service,
+                 send::stream &output,
+                 std::size_t max_packet_size = default_max_packet_size,
+                 std::size_t batch_size = default_batch_size,
+                 std::size_t max_batches = default_max_batches,
+                 std::size_t max_heaps = default_max_heaps);
+
+    /// Constructor using the I/O service of a thread pool
+    relay_stream(thread_pool &pool,
+                 send::stream &output,
+                 std::size_t max_packet_size = default_max_packet_size,
+                 std::size_t batch_size = default_batch_size,
+                 std::size_t max_batches = default_max_batches,
+                 std::size_t max_heaps = default_max_heaps)
+        : relay_stream(pool.get_io_service(), output, max_packet_size,
+                       batch_size, max_batches, max_heaps) {}
+
+    /**
+     * Only forward heaps whose cnt is congruent to @a remainder modulo @a
+     * modulus. This can be used to split a stream between several
+     * destinations. The default (modulus 1) forwards all heaps.
+     *
+     * @throw std::invalid_argument if @a modulus is zero or @a remainder is
+     * not less than @a modulus
+     */
+    void set_cnt_filter(item_pointer_t modulus, item_pointer_t remainder);
+
+    /**
+     * Only forward heaps containing at least one of the items in @a ids.
+     * Heaps carrying item descriptors are always forwarded, so that the
+     * selected items can be decoded. Passing an empty list forwards all
+     * heaps. The decision is made on the first packet received for each
+     * heap, which is normally the one carrying the item pointers.
+     */
+    void set_item_ids(std::vector<s_item_pointer_t> ids);
+
+    /**
+     * Limit the forwarded traffic to @a rate bytes per second, with bursts
+     * of up to @a burst_size bytes. Packets beyond the limit are dropped.
+     * A rate of 0 removes the limit.
+     *
+     * @throw std::invalid_argument if @a rate is negative, or if it is
+     * positive and @a burst_size is smaller than the maximum packet size
+     */
+    void set_rate(double rate, std::size_t burst_size = send::stream_config::default_burst_size);
+
+    /// Return a snapshot of the counters
+    relay_stats get_stats() const;
+
+    /**
+     * Stop the stream and block until all batches have been sent (or
+     * failed), so that the counters are final. The send stream is not
+     * flushed.
+     */
+    virtual void stop() override;
+
+    virtual ~relay_stream() override;
+};
+
+} // namespace recv
+} // namespace spead2
+
+#endif // SPEAD2_RECV_RELAY_H
@@ -21,6 +21,8 @@
 #ifndef SPEAD2_RECV_RING_STREAM
 #define SPEAD2_RECV_RING_STREAM
 
+#include <atomic>
+#include <cstdint>
 #include <spead2/common_ringbuffer.h>
 #include <spead2/common_logging.h>
 #include <spead2/common_thread_pool.h>
@@ -33,23 +35,55 @@ namespace spead2
 namespace recv
 {
 
+/// What to do with a heap when the ringbuffer of a @ref ring_stream is full
+enum class ring_overflow_policy
+{
+    /// Wait for space, which blocks all the readers of the stream
+    BLOCK,
+    /// Discard the heap that does not fit
+    DROP_NEWEST,
+    /// Discard the oldest heap in the ringbuffer to make space
+    DROP_OLDEST
+};
+
 /**
  * Base class for ring_stream containing only the parts that are independent of
  * the ringbuffer class.
  */
 class ring_stream_base : public stream
 {
+private:
+    std::atomic<ring_overflow_policy> overflow_policy{ring_overflow_policy::BLOCK};
+    std::atomic<std::uint64_t> overflow_drops{0};
+
+protected:
+    /// Record that a heap was discarded because the ringbuffer was full
+    void add_overflow_drop() { overflow_drops++; }
+
 public:
     static constexpr std::size_t default_ring_heaps = 4;
 
     using stream::stream;
+
+    /**
+     * Set the policy for heaps that do not fit in the ringbuffer. With
+     * @ref ring_overflow_policy::BLOCK (the default), a slow consumer stalls
+     * the readers, which typically causes packets to be lost from many
+     * heaps. The other policies instead discard whole heaps, releasing their
+     * memory immediately.
+     */
+    void set_overflow_policy(ring_overflow_policy policy) { overflow_policy = policy; }
+    ring_overflow_policy get_overflow_policy() const { return overflow_policy; }
+    /// Number of heaps discarded because the ringbuffer was full
+    std::uint64_t get_overflow_drops() const { return overflow_drops; }
 };
 
 /**
  * Specialisation of @ref stream that pushes its results into a ringbuffer.
  * The ringbuffer class may be replaced, but must provide the same interface as
- * @ref ringbuffer. If the ring buffer fills up, @ref add_packet will block the
- * reader.
+ * @ref ringbuffer. If the ring buffer fills up, the behaviour depends on
+ * the overflow policy (see @ref set_overflow_policy): by default,
+ * @ref add_packet will block the reader.
  *
  * On the consumer side, heaps are automatically frozen as they are
  * extracted.
@@ -156,7 +190,51 @@ void ring_stream<Ringbuffer>::heap_ready(live_heap &&h)
     {
         try
         {
-            ready_heaps.push(std::move(h));
+            switch (get_overflow_policy())
+            {
+            case ring_overflow_policy::BLOCK:
+                ready_heaps.push(std::move(h));
+                break;
+            case ring_overflow_policy::DROP_NEWEST:
+                try
+                {
+                    ready_heaps.try_push(std::move(h));
+                }
+                catch (ringbuffer_full &e)
+                {
+                    add_overflow_drop();
+                    log_info("dropped heap %d because the ringbuffer is full", h.get_cnt());
+                    // Return the memory to the allocator now
+                    live_heap dropped(std::move(h));
+                }
+                break;
+            case ring_overflow_policy::DROP_OLDEST:
+                while (true)
+                {
+                    try
+                    {
+                        ready_heaps.try_push(std::move(h));
+                        break;
+                    }
+                    catch (ringbuffer_full &e)
+                    {
+                        /* The consumer may take the oldest heap before we
+                         * do, in which case there is space and we try again.
+                         */
+                        try
+                        {
+                            live_heap dropped = ready_heaps.try_pop();
+                            add_overflow_drop();
+                            log_info("dropped heap %d because the ringbuffer is full",
+                                     dropped.get_cnt());
+                        }
+                        catch (ringbuffer_empty &e)
+                        {
+                        }
+                    }
+                }
+                break;
+            }
         }
         catch (ringbuffer_stopped &e)
         {
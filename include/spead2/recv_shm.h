@@ -0,0 +1,95 @@
+/* Copyright 2016 SKA South Africa
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ */
+
+#ifndef SPEAD2_RECV_SHM_H
+#define SPEAD2_RECV_SHM_H
+
+#include <spead2/common_features.h>
+#if SPEAD2_USE_SHM
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <spead2/common_shm.h>
+#include <spead2/common_memory_allocator.h>
+#include <spead2/recv_reader.h>
+#include <spead2/recv_stream.h>
+
+namespace spead2
+{
+namespace recv
+{
+
+/**
+ * Reader for packets written to a @ref shm_ring by another process (usually
+ * with @ref send::shm_stream). A heap that fits in a single packet refers
+ * directly to the slot in shared memory, which is returned to the producer
+ * when the heap is destroyed. Other heaps are assembled as usual, and their
+ * slots are released immediately.
+ *
+ * A dedicated thread waits for slots to be committed. The stream is stopped
+ * when the producer closes the ring.
+ */
+class shm_reader : public reader
+{
+private:
+    std::shared_ptr<shm_ring> ring;
+    /// Releases slots adopted by heaps
+    std::shared_ptr<memory_allocator> slot_allocator;
+    /// Set when a drain has been posted to the strand
+    std::atomic<bool> drain_pending{false};
+    std::atomic<bool> stopping{false};
+    std::thread wait_thread;
+
+    /// Body of the waiting thread
+    void run_wait();
+    /// Process all committed slots (run in the strand)
+    void drain();
+    /// Final completion handler (run in the strand)
+    void finish();
+
+public:
+    /**
+     * Constructor.
+     *
+     * @param owner    Owning stream
+     * @param ring     Ring to consume. There must be no other consumer.
+     */
+    shm_reader(stream &owner, std::shared_ptr<shm_ring> ring);
+
+    /**
+     * Constructor that opens the ring by name.
+     *
+     * @param owner    Owning stream
+     * @param name     Name of a POSIX shared memory object created by @ref shm_ring
+     */
+    shm_reader(stream &owner, const std::string &name);
+
+    virtual ~shm_reader() override;
+
+    virtual void stop() override;
+};
+
+} // namespace recv
+} // namespace spead2
+
+#endif // SPEAD2_USE_SHM
+#endif // SPEAD2_RECV_SHM_H
@@ -22,6 +22,7 @@
 #define SPEAD2_RECV_STREAM_H
 
 #include <cstddef>
+#include <cstdint>
 #include <deque>
 #include <memory>
 #include <utility>
@@ -45,6 +46,7 @@ namespace recv
 {
 
 struct packet_header;
+class descriptor_cache;
 
 /**
  * Encapsulation of a SPEAD stream. Packets are fed in through @ref add_packet.
@@ -103,7 +105,7 @@ private:
     /// Function used to copy heap payloads
     std::atomic<memcpy_function> memcpy{std::memcpy};
 
-    /// Mutex protecting @ref allocator
+    /// Mutex protecting @ref allocator and @ref filter
     std::mutex allocator_mutex;
     /**
      * Memory allocator used by heaps.
@@ -115,12 +117,35 @@ private:
      */
     std::shared_ptr<memory_allocator> allocator;
 
+    /// Item filter applied to new heaps (protected by allocator_mutex)
+    std::shared_ptr<const item_filter> filter;
+    /// Descriptor cache given to new heaps (protected by allocator_mutex)
+    std::shared_ptr<descriptor_cache> descriptors_cache;
+
+    /// ID of the payload checksum item (0 to not check)
+    std::atomic<s_item_pointer_t> checksum_id{0};
+    /// Number of heaps whose checksum matched
+    std::atomic<std::uint64_t> checksum_valid{0};
+    /// Number of heaps whose checksum did not match
+    std::atomic<std::uint64_t> checksum_invalid{0};
+
     /**
      * Callback called when a heap is being ejected from the live list.
      * The heap might or might not be complete.
      */
     virtual void heap_ready(live_heap &&) {}
 
+    /**
+     * Callback called by @ref add_packet for every packet, before it is
+     * matched to a heap. A subclass that handles raw packets itself returns
+     * @c true to consume the packet, in which case no heap is assembled from
+     * it. The default returns @c false.
+     */
+    virtual bool packet_ready(const packet_header &) { return false; }
+
+    /// Verify the checksum of @a h (if enabled) and pass it to @ref heap_ready
+    void eject_heap(live_heap &h);
+
 public:
     static constexpr std::size_t default_max_heaps = 4;
 
@@ -151,6 +176,40 @@ public:
     /// Set builtin memcpy function to use for copying payload
     void set_memcpy(memcpy_function_id id);
 
+    /**
+     * Set a filter selecting which items to retain in received heaps. The
+     * payload of other items is not copied. It takes effect for heaps that
+     * start after the call. Pass a null pointer to retain all items.
+     */
+    void set_item_filter(std::shared_ptr<const item_filter> filter);
+
+    /**
+     * Set the cache used to avoid re-parsing descriptors that have been
+     * seen before. It is attached to heaps that start after the call. Pass
+     * a null pointer to disable caching. Several streams may share a cache.
+     */
+    void set_descriptor_cache(std::shared_ptr<descriptor_cache> cache);
+
+    /// Get the current descriptor cache (may be null)
+    std::shared_ptr<descriptor_cache> get_descriptor_cache();
+
+    /**
+     * Verify a CRC-32C of the payload carried in the immediate item with ID
+     * @a id (see @ref send::heap::set_checksum_id). The outcome is
+     * available from @ref heap::get_checksum_status, and is counted by the
+     * stream. Pass 0 (the default) to disable checking.
+     */
+    void set_checksum_id(s_item_pointer_t id);
+
+    /// Get the ID of the checksum item (0 if checking is disabled)
+    s_item_pointer_t get_checksum_id() const;
+
+    /// Number of complete heaps whose checksum matched the payload
+    std::uint64_t get_checksum_valid() const;
+
+    /// Number of complete heaps whose checksum did not match the payload
+    std::uint64_t get_checksum_invalid() const;
+
     /**
      * Add a packet that was received, and which has been examined by @a
      * decode_packet, and returns @c true if it is consumed. Even though @a
@@ -207,15 +266,24 @@ private:
     /// Ensure that @ref stop is only run once
     std::once_flag stop_once;
 
+    /**
+     * Remove the first reader matching @a pred (see @ref remove_reader),
+     * throwing @c std::invalid_argument if there is none.
+     */
+    void remove_reader_if(std::function<bool(const reader &)> pred);
+
     template<typename T, typename... Args>
-    void emplace_reader_callback(Args&&... args)
+    reader *emplace_reader_callback(Args&&... args)
     {
         if (!is_stopped())
         {
             readers.reserve(readers.size() + 1);
             std::unique_ptr<reader> ptr(reader_factory<T>::make_reader(*this, std::forward<Args>(args)...));
             readers.push_back(std::move(ptr));
+            return readers.back().get();
         }
+        else
+            return nullptr;
     }
 
     /* Prevent moving (copying is already impossible). Moving is not safe
@@ -257,12 +325,25 @@ protected:
     /// Actual implementation of @ref stop
     void stop_impl();
 
+    /**
+     * Find the reader of this stream with the given @ref reader::get_id, or
+     * return null if there is none. This must be called with the strand held.
+     */
+    reader *find_reader(std::uint64_t id) const;
+
 public:
     using stream_base::get_bug_compat;
     using stream_base::default_max_heaps;
     using stream_base::set_memory_pool;
     using stream_base::set_memory_allocator;
     using stream_base::set_memcpy;
+    using stream_base::set_item_filter;
+    using stream_base::set_descriptor_cache;
+    using stream_base::get_descriptor_cache;
+    using stream_base::set_checksum_id;
+    using stream_base::get_checksum_id;
+    using stream_base::get_checksum_valid;
+    using stream_base::get_checksum_invalid;
 
     boost::asio::io_service::strand &get_strand() { return strand; }
 
@@ -273,18 +354,42 @@ public:
     /**
      * Add a new reader by passing its constructor arguments, excluding
      * the initial @a stream argument.
+     *
+     * @return The new reader, which remains valid until it is passed to
+     * @ref remove_reader or the stream is stopped, or null if the stream
+     * has already been stopped.
      */
     template<typename T, typename... Args>
-    void emplace_reader(Args&&... args)
+    reader *emplace_reader(Args&&... args)
     {
         // This would probably work better with a lambda (better forwarding),
         // but GCC 4.8 has a bug with accessing parameter packs inside a
         // lambda.
-        run_in_strand(detail::reference_bind(
+        return run_in_strand(detail::reference_bind(
                 std::mem_fn(&stream::emplace_reader_callback<T, Args&&...>),
                 this, std::forward<Args>(args)...));
     }
 
+    /**
+     * Stop a reader returned by @ref emplace_reader and remove it from the
+     * stream, blocking until its completion handlers have finished. The
+     * other readers and the partially-received heaps are unaffected. If the
+     * stream has been stopped, this does nothing (the readers have already
+     * been removed).
+     *
+     * @throw std::invalid_argument if @a r is not a reader of this stream
+     */
+    void remove_reader(reader *r);
+
+    /**
+     * Remove the reader whose @ref reader::get_id is @a id, as for
+     * @ref remove_reader. This is safe to use even if the reader may have
+     * been removed already, since IDs are not reused.
+     *
+     * @throw std::invalid_argument if there is no such reader
+     */
+    void remove_reader_by_id(std::uint64_t id);
+
     /**
      * Stop the stream and block until all the readers have wound up. After
      * calling this there should be no more outstanding completion handlers
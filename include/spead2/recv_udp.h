@@ -30,7 +30,10 @@
 # include <sys/types.h>
 #endif
 #include <cstdint>
+#include <memory>
+#include <vector>
 #include <boost/asio.hpp>
+#include <spead2/common_memory_allocator.h>
 #include <spead2/recv_reader.h>
 #include <spead2/recv_stream.h>
 #include <spead2/recv_udp_base.h>
@@ -61,20 +64,29 @@ private:
      * read from a closed file descriptor.
      */
     boost::asio::ip::udp::socket socket2;
-    /// Buffer for asynchronous receive, of size @a max_size + 1.
-    std::vector<std::unique_ptr<std::uint8_t[]>> buffer;
-    /// Scatter-gather array for each buffer
+    /// Scatter-gather array for each slot of @ref buffer
     std::vector<iovec> iov;
     /// recvmmsg control structures
     std::vector<mmsghdr> msgvec;
-#else
-    /// Buffer for asynchronous receive, of size @a max_size + 1.
-    std::unique_ptr<std::uint8_t[]> buffer;
 #endif
+    /// Distance in bytes between consecutive receive slots in @ref buffer
+    std::size_t slot_stride;
+    /**
+     * Contiguous arena holding all the receive slots. Each slot holds
+     * @a max_size + 1 bytes and starts on a cache-line boundary.
+     */
+    memory_allocator::pointer buffer;
+
+    /// Pointer to the start of slot @a idx of @ref buffer
+    std::uint8_t *slot(std::size_t idx) { return buffer.get() + idx * slot_stride; }
 
     /// Start an asynchronous receive
     void enqueue_receive();
 
+    /// Apply a multicast join or leave option to the socket (strand held)
+    template<typename Option>
+    void set_multicast_option(const Option &option);
+
     /// Callback on completion of asynchronous receive
     void packet_handler(
         const boost::system::error_code &error,
@@ -83,8 +95,8 @@ private:
 public:
     /// Socket receive buffer size, if none is explicitly passed to the constructor
     static constexpr std::size_t default_buffer_size = 8 * 1024 * 1024;
-    /// Number of packets to receive in one go, if recvmmsg support is present
-    static constexpr std::size_t mmsg_count = 64;
+    /// Number of packets to receive in one go, if none is explicitly passed to the constructor
+    static constexpr std::size_t default_mmsg_count = 64;
 
     /**
      * Constructor.
@@ -106,6 +118,31 @@ public:
         std::size_t max_size = default_max_size,
         std::size_t buffer_size = default_buffer_size);
 
+    /**
+     * Constructor with explicit control over the receive slots. This is
+     * otherwise identical to the standard constructor.
+     *
+     * @param owner        Owning stream
+     * @param endpoint     Address on which to listen
+     * @param max_size     Maximum packet size that will be accepted.
+     * @param buffer_size  Requested socket buffer size.
+     * @param mmsg_count   Maximum number of packets to receive per system
+     *                     call (ignored if recvmmsg is not supported).
+     * @param allocator    Allocator for the arena holding the receive slots.
+     *                     If null, a @ref mmap_allocator is used. Pass a
+     *                     @ref mmap_allocator with @a prefer_huge set to
+     *                     back the arena with huge pages.
+     *
+     * @throws std::invalid_argument If @a mmsg_count is zero
+     */
+    udp_reader(
+        stream &owner,
+        const boost::asio::ip::udp::endpoint &endpoint,
+        std::size_t max_size,
+        std::size_t buffer_size,
+        std::size_t mmsg_count,
+        std::shared_ptr<memory_allocator> allocator);
+
     /**
      * Constructor with explicit multicast interface address (IPv4 only).
      *
@@ -119,16 +156,21 @@ public:
      * @param max_size     Maximum packet size that will be accepted.
      * @param buffer_size  Requested socket buffer size.
      * @param interface_address  Address of the interface which should join the group
+     * @param mmsg_count   Maximum number of packets to receive per system call
+     * @param allocator    Allocator for the receive slots (null for default)
      *
      * @throws std::invalid_argument If @a endpoint is not an IPv4 multicast address
      * @throws std::invalid_argument If @a interface_address is not an IPv4 address
+     * @throws std::invalid_argument If @a mmsg_count is zero
      */
     udp_reader(
         stream &owner,
         const boost::asio::ip::udp::endpoint &endpoint,
         std::size_t max_size,
         std::size_t buffer_size,
-        const boost::asio::ip::address &interface_address);
+        const boost::asio::ip::address &interface_address,
+        std::size_t mmsg_count = default_mmsg_count,
+        std::shared_ptr<memory_allocator> allocator = nullptr);
 
     /**
      * Constructor with explicit multicast interface index (IPv6 only).
@@ -143,6 +185,8 @@ public:
      * @param max_size     Maximum packet size that will be accepted.
      * @param buffer_size  Requested socket buffer size.
      * @param interface_index  Address of the interface which should join the group
+     * @param mmsg_count   Maximum number of packets to receive per system call
+     * @param allocator    Allocator for the receive slots (null for default)
      *
      * @see if_nametoindex(3)
      */
@@ -151,7 +195,9 @@ public:
         const boost::asio::ip::udp::endpoint &endpoint,
         std::size_t max_size,
         std::size_t buffer_size,
-        unsigned int interface_index);
+        unsigned int interface_index,
+        std::size_t mmsg_count = default_mmsg_count,
+        std::shared_ptr<memory_allocator> allocator = nullptr);
 
     /**
      * Constructor using an existing socket. This allows socket options (e.g.,
@@ -167,13 +213,59 @@ public:
      * @param buffer_size  Requested socket buffer size. Note that the
      *                     operating system might not allow a buffer size
      *                     as big as the default.
+     * @param mmsg_count   Maximum number of packets to receive per system call
+     * @param allocator    Allocator for the receive slots (null for default)
+     *
+     * @throws std::invalid_argument If @a mmsg_count is zero
      */
     udp_reader(
         stream &owner,
         boost::asio::ip::udp::socket &&socket,
         const boost::asio::ip::udp::endpoint &endpoint,
         std::size_t max_size = default_max_size,
-        std::size_t buffer_size = default_buffer_size);
+        std::size_t buffer_size = default_buffer_size,
+        std::size_t mmsg_count = default_mmsg_count,
+        std::shared_ptr<memory_allocator> allocator = nullptr);
+
+    /**
+     * Subscribe the socket to an additional IPv4 multicast group while the
+     * reader is running. To receive several groups, the reader should be
+     * bound to the wildcard address rather than to a group address. If the
+     * reader is already stopping, this does nothing.
+     *
+     * @param group        Multicast group to join
+     * @param interface_address  Address of the interface which should join
+     *                     the group, or @c address_v4::any() to let the
+     *                     system choose.
+     *
+     * @throws std::invalid_argument If @a group is not an IPv4 multicast address
+     * @throws std::invalid_argument If @a interface_address is not an IPv4 address
+     * @throws boost::system::system_error If the subscription fails
+     */
+    void join_multicast(
+        const boost::asio::ip::address &group,
+        const boost::asio::ip::address &interface_address = boost::asio::ip::address_v4::any());
+
+    /**
+     * Subscribe the socket to an additional IPv6 multicast group while the
+     * reader is running.
+     *
+     * @param group        Multicast group to join
+     * @param interface_index  Index of the interface which should join the
+     *                     group, or 0 to let the system choose.
+     *
+     * @throws std::invalid_argument If @a group is not an IPv6 multicast address
+     * @throws boost::system::system_error If the subscription fails
+     */
+    void join_multicast(const boost::asio::ip::address &group, unsigned int interface_index);
+
+    /// Undo @ref join_multicast for an IPv4 group
+    void leave_multicast(
+        const boost::asio::ip::address &group,
+        const boost::asio::ip::address &interface_address = boost::asio::ip::address_v4::any());
+
+    /// Undo @ref join_multicast for an IPv6 group
+    void leave_multicast(const boost::asio::ip::address &group, unsigned int interface_index);
 
     virtual void stop() override;
 };
@@ -196,21 +288,35 @@ struct reader_factory<udp_reader>
         const boost::asio::ip::udp::endpoint &endpoint,
         std::size_t max_size,
         std::size_t buffer_size,
-        const boost::asio::ip::address &interface_address);
+        std::size_t mmsg_count,
+        std::shared_ptr<memory_allocator> allocator);
+
+    static std::unique_ptr<reader> make_reader(
+        stream &owner,
+        const boost::asio::ip::udp::endpoint &endpoint,
+        std::size_t max_size,
+        std::size_t buffer_size,
+        const boost::asio::ip::address &interface_address,
+        std::size_t mmsg_count = udp_reader::default_mmsg_count,
+        std::shared_ptr<memory_allocator> allocator = nullptr);
 
     static std::unique_ptr<reader> make_reader(
         stream &owner,
         const boost::asio::ip::udp::endpoint &endpoint,
         std::size_t max_size,
         std::size_t buffer_size,
-        unsigned int interface_index);
+        unsigned int interface_index,
+        std::size_t mmsg_count = udp_reader::default_mmsg_count,
+        std::shared_ptr<memory_allocator> allocator = nullptr);
 
     static std::unique_ptr<reader> make_reader(
         stream &owner,
         boost::asio::ip::udp::socket &&socket,
         const boost::asio::ip::udp::endpoint &endpoint,
         std::size_t max_size = udp_reader::default_max_size,
-        std::size_t buffer_size = udp_reader::default_buffer_size);
+        std::size_t buffer_size = udp_reader::default_buffer_size,
+        std::size_t mmsg_count = udp_reader::default_mmsg_count,
+        std::shared_ptr<memory_allocator> allocator = nullptr);
 };
 
 } // namespace recv
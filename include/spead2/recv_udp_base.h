@@ -23,6 +23,7 @@
 
 #include <cstddef>
 #include <cstdint>
+#include <boost/asio.hpp>
 #include <spead2/recv_reader.h>
 
 namespace spead2
@@ -48,6 +49,46 @@ protected:
      */
     bool process_one_packet(const std::uint8_t *data, std::size_t length, std::size_t max_size);
 
+    /**
+     * Create an unbound socket for listening on @a endpoint. If it is a
+     * multicast address, the socket subscribes to the group (on an interface
+     * chosen by the system) and has @c SO_REUSEADDR set.
+     */
+    static boost::asio::ip::udp::socket make_socket(
+        boost::asio::io_service &io_service,
+        const boost::asio::ip::udp::endpoint &endpoint);
+
+    /**
+     * Create an unbound socket subscribed to an IPv4 multicast group on a
+     * specific interface, with @c SO_REUSEADDR set.
+     *
+     * @throws std::invalid_argument If @a endpoint is not an IPv4 multicast address
+     * @throws std::invalid_argument If @a interface_address is not an IPv4 address
+     */
+    static boost::asio::ip::udp::socket make_multicast_v4_socket(
+        boost::asio::io_service &io_service,
+        const boost::asio::ip::udp::endpoint &endpoint,
+        const boost::asio::ip::address &interface_address);
+
+    /**
+     * Create an unbound socket subscribed to an IPv6 multicast group on a
+     * specific interface, with @c SO_REUSEADDR set.
+     *
+     * @throws std::invalid_argument If @a endpoint is not an IPv6 multicast address
+     */
+    static boost::asio::ip::udp::socket make_multicast_v6_socket(
+        boost::asio::io_service &io_service,
+        const boost::asio::ip::udp::endpoint &endpoint,
+        unsigned int interface_index);
+
+    /**
+     * Request a receive buffer size for @a socket. If the request fails, or
+     * the operating system grants less than requested, a warning is logged.
+     * If @a buffer_size is zero, the operating system default is kept.
+     */
+    static void set_socket_buffer_size(
+        boost::asio::ip::udp::socket &socket, std::size_t buffer_size);
+
 public:
     /// Maximum packet size, if none is explicitly passed to the constructor
     static constexpr std::size_t default_max_size = 9200;
@@ -33,6 +33,7 @@
 #include <cstddef>
 #include <memory>
 #include <vector>
+#include <map>
 #include <boost/asio.hpp>
 #include <boost/noncopyable.hpp>
 #include <spead2/common_ibv.h>
@@ -71,6 +72,8 @@ private:
      * bound to a port.
      */
     boost::asio::ip::udp::socket join_socket;
+    /// Interface on which multicast groups are joined
+    boost::asio::ip::address_v4 interface_address;
     /// Data buffer for all the packets
     memory_allocator::pointer buffer;
 
@@ -83,7 +86,8 @@ private:
     ibv_cq_t send_cq;
     ibv_cq_t recv_cq;
     ibv_qp_t qp;
-    std::vector<ibv_flow_t> flows;
+    /// Flow rules steering each subscribed endpoint to @ref qp
+    std::map<boost::asio::ip::udp::endpoint, ibv_flow_t> flows;
     ibv_mr_t mr;
 
     /// array of @ref n_slots slots for work requests
@@ -104,6 +108,11 @@ private:
 
     static void req_notify_cq(ibv_cq *cq);
 
+    /// Install a flow rule for @a endpoint and join its group (strand held)
+    void add_endpoint(const boost::asio::ip::udp::endpoint &endpoint);
+    /// Remove the flow rule for @a endpoint and leave its group if unused (strand held)
+    void remove_endpoint(const boost::asio::ip::udp::endpoint &endpoint);
+
     /**
      * Do one pass over the completion queue.
      *
@@ -208,6 +217,25 @@ public:
         int comp_vector = 0,
         int max_poll = default_max_poll);
 
+    /**
+     * Start receiving packets addressed to @a endpoint while the reader is
+     * running, by adding a flow rule and joining the multicast group on the
+     * reader's interface. If the reader is already stopping, this does
+     * nothing.
+     *
+     * @throws std::invalid_argument If @a endpoint is not an IPv4 multicast address
+     * @throws std::invalid_argument If @a endpoint is already being received
+     */
+    void join_multicast(const boost::asio::ip::udp::endpoint &endpoint);
+
+    /**
+     * Stop receiving packets addressed to @a endpoint. The multicast group is
+     * left once no other endpoint of the reader uses it.
+     *
+     * @throws std::invalid_argument If @a endpoint is not being received
+     */
+    void leave_multicast(const boost::asio::ip::udp::endpoint &endpoint);
+
     virtual void stop() override;
 };
 
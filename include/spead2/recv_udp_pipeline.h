@@ -0,0 +1,222 @@
+/* Copyright 2016 SKA South Africa
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/**
+ * @file
+ */
+
+#ifndef SPEAD2_RECV_UDP_PIPELINE_H
+#define SPEAD2_RECV_UDP_PIPELINE_H
+
+#ifndef _GNU_SOURCE
+# define _GNU_SOURCE
+#endif
+#include <spead2/common_features.h>
+#if SPEAD2_USE_RECVMMSG
+# include <sys/socket.h>
+# include <sys/types.h>
+#endif
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <memory>
+#include <vector>
+#include <boost/asio.hpp>
+#include <spead2/common_ringbuffer.h>
+#include <spead2/common_semaphore.h>
+#include <spead2/recv_reader.h>
+#include <spead2/recv_stream.h>
+#include <spead2/recv_udp_base.h>
+
+namespace spead2
+{
+namespace recv
+{
+
+/**
+ * UDP reader that decouples draining the socket from heap assembly.
+ *
+ * A dedicated network thread does nothing but receive packets into a fixed
+ * pool of batches, and hands full batches over a queue to the stream's
+ * strand, which decodes them, runs @ref stream_base::add_packet and then
+ * returns the batches to the pool. If assembly briefly falls behind, the
+ * network thread keeps receiving into the free batches, so the socket
+ * buffer does not overflow. Only when every batch is waiting for assembly
+ * does the network thread wait (and the socket buffer absorbs the rest).
+ *
+ * The stream's strand runs on its thread pool as usual, so the thread pool
+ * should be dedicated to this stream for the full benefit.
+ *
+ * Optionally, the network thread can busy-poll: when the socket is empty, it
+ * keeps trying to receive for a configurable time before sleeping in
+ * poll(2). This costs a core, but avoids the wakeup latency of the kernel
+ * scheduler. The kernel can additionally be asked to busy-poll the device
+ * queue (SO_BUSY_POLL), where supported.
+ */
+class udp_pipeline_reader : public udp_reader_base
+{
+private:
+    /// A group of packets received together
+    struct batch
+    {
+        std::unique_ptr<std::uint8_t[]> storage;    ///< Space for @a capacity packets
+        std::vector<std::size_t> lengths;           ///< Length of each received packet
+        std::size_t size = 0;                       ///< Number of packets received
+#if SPEAD2_USE_RECVMMSG
+        std::vector<iovec> iov;
+        std::vector<mmsghdr> msgvec;
+#endif
+    };
+
+    /// UDP socket we are listening on
+    boost::asio::ip::udp::socket socket;
+    /// Maximum packet size we will accept
+    std::size_t max_size;
+    /// Number of packets per batch
+    std::size_t batch_size;
+    /// Time to spin on an empty socket before sleeping
+    std::chrono::microseconds busy_poll;
+    std::vector<batch> batches;
+    /// Batches that are ready to be filled by the network thread
+    ringbuffer<batch *> free_batches;
+    /// Batches that have been filled and are waiting for assembly
+    ringbuffer<batch *> full_batches;
+    /// Set when a drain of @ref full_batches has been posted to the strand
+    std::atomic<bool> drain_pending{false};
+    /// Signalled by @ref stop to wake the network thread
+    semaphore_fd stop_sem;
+    std::atomic<bool> stopping{false};
+    std::thread network_thread;
+
+    /// Body of the network thread
+    void run_network();
+    /// Wait for the socket to be readable; returns false if stopping
+    bool wait_readable();
+    /// Receive at least one packet into @a b; returns false if stopping
+    bool fill(batch &b);
+    /// Receive as many packets as are available (at least one) into @a b
+    void receive(batch &b);
+    /// Assemble all full batches (run in the strand)
+    void drain();
+    /// Final completion handler (run in the strand)
+    void finish();
+
+public:
+    /// Socket receive buffer size, if none is explicitly passed to the constructor
+    static constexpr std::size_t default_buffer_size = 8 * 1024 * 1024;
+    /// Number of batches, if none is explicitly passed to the constructor
+    static constexpr std::size_t default_batches = 64;
+    /// Packets per batch, if none is explicitly passed to the constructor
+    static constexpr std::size_t default_batch_size = 64;
+
+    /**
+     * Constructor.
+     *
+     * If @a endpoint is a multicast address, then this constructor will
+     * subscribe to the multicast group, and also set @c SO_REUSEADDR so that
+     * multiple sockets can be subscribed to the multicast group.
+     *
+     * @param owner        Owning stream
+     * @param endpoint     Address on which to listen
+     * @param max_size     Maximum packet size that will be accepted
+     * @param buffer_size  Requested socket buffer size
+     * @param batches      Number of batches in the pool
+     * @param batch_size   Maximum number of packets in a batch
+     * @param busy_poll    Time in microseconds to keep polling an empty
+     *                     socket before sleeping (0 to always sleep)
+     * @param kernel_busy_poll If true (and @a busy_poll is non-zero), also set
+     *                     SO_BUSY_POLL (and SO_PREFER_BUSY_POLL where
+     *                     available) on the socket. Failure to do so is
+     *                     logged but is not an error.
+     *
+     * @throw std::invalid_argument if @a batches or @a batch_size is zero,
+     * or @a busy_poll is negative
+     */
+    udp_pipeline_reader(
+        stream &owner,
+        const boost::asio::ip::udp::endpoint &endpoint,
+        std::size_t max_size = default_max_size,
+        std::size_t buffer_size = default_buffer_size,
+        std::size_t batches = default_batches,
+        std::size_t batch_size = default_batch_size,
+        int busy_poll = 0,
+        bool kernel_busy_poll = false);
+
+    /**
+     * Constructor with explicit multicast interface address (IPv4 only).
+     * The parameters are otherwise as for the standard constructor.
+     *
+     * @throw std::invalid_argument If @a endpoint is not an IPv4 multicast address
+     * @throw std::invalid_argument If @a interface_address is not an IPv4 address
+     */
+    udp_pipeline_reader(
+        stream &owner,
+        const boost::asio::ip::udp::endpoint &endpoint,
+        std::size_t max_size,
+        std::size_t buffer_size,
+        const boost::asio::ip::address &interface_address,
+        std::size_t batches = default_batches,
+        std::size_t batch_size = default_batch_size,
+        int busy_poll = 0,
+        bool kernel_busy_poll = false);
+
+    /**
+     * Constructor with explicit multicast interface index (IPv6 only).
+     * The parameters are otherwise as for the standard constructor.
+     *
+     * @throw std::invalid_argument If @a endpoint is not an IPv6 multicast address
+     * @see if_nametoindex(3)
+     */
+    udp_pipeline_reader(
+        stream &owner,
+        const boost::asio::ip::udp::endpoint &endpoint,
+        std::size_t max_size,
+        std::size_t buffer_size,
+        unsigned int interface_index,
+        std::size_t batches = default_batches,
+        std::size_t batch_size = default_batch_size,
+        int busy_poll = 0,
+        bool kernel_busy_poll = false);
+
+    /**
+     * Constructor using an existing socket, which should not be bound. Note
+     * that there is no special handling for multicast addresses here. The
+     * socket must use the same I/O service as @a owner. The other parameters
+     * are as for the standard constructor.
+     */
+    udp_pipeline_reader(
+        stream &owner,
+        boost::asio::ip::udp::socket &&socket,
+        const boost::asio::ip::udp::endpoint &endpoint,
+        std::size_t max_size = default_max_size,
+        std::size_t buffer_size = default_buffer_size,
+        std::size_t batches = default_batches,
+        std::size_t batch_size = default_batch_size,
+        int busy_poll = 0,
+        bool kernel_busy_poll = false);
+
+    virtual ~udp_pipeline_reader() override;
+
+    virtual void stop() override;
+};
+
+} // namespace recv
+} // namespace spead2
+
+#endif // SPEAD2_RECV_UDP_PIPELINE_H
@@ -134,6 +134,8 @@ private:
      * needed. Items may point to either this storage or external storage.
      */
     std::vector<std::unique_ptr<std::uint8_t[]> > storage;
+    /// ID of the payload checksum item, or 0 if there is none
+    s_item_pointer_t checksum_id = 0;
 
 public:
     /**
@@ -173,6 +175,24 @@ public:
      */
     void add_descriptor(const descriptor &descriptor);
 
+    /**
+     * Request that a CRC-32C checksum of the heap payload be sent as an
+     * immediate item with ID @a id, so that a receiver configured with the
+     * same ID can detect corruption (see @ref recv::stream_base::set_checksum_id).
+     * Computing the checksum requires a pass over the payload. Set it to 0
+     * (the default) to disable the checksum.
+     *
+     * @throw std::invalid_argument if the flavour has fewer than 32 heap
+     * address bits, so that the checksum cannot be an immediate item.
+     */
+    void set_checksum_id(s_item_pointer_t id);
+
+    /// Get the ID of the checksum item (0 if disabled)
+    s_item_pointer_t get_checksum_id() const
+    {
+        return checksum_id;
+    }
+
     /**
      * Add a start-of-stream control item.
      */
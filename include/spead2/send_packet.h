@@ -76,6 +76,10 @@ private:
     s_item_pointer_t payload_size = 0;
     /// There is payload padding, so we need to add a NULL item pointer
     bool need_null_item = false;
+    /// Number of item pointers to send, excluding the NULL item pointer
+    std::size_t n_items;
+    /// CRC-32C of the payload, sent after the heap's items if requested
+    std::uint32_t checksum = 0;
 
 public:
     packet_generator(const heap &h, item_pointer_t cnt, std::size_t max_packet_size);
@@ -0,0 +1,114 @@
+/* Copyright 2016 SKA South Africa
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ */
+
+#ifndef SPEAD2_SEND_SHM_H
+#define SPEAD2_SEND_SHM_H
+
+#include <spead2/common_features.h>
+#if SPEAD2_USE_SHM
+
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+#include <boost/asio.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <spead2/common_shm.h>
+#include <spead2/send_packet.h>
+#include <spead2/send_stream.h>
+
+namespace spead2
+{
+namespace send
+{
+
+/**
+ * Stream that writes packets into a @ref shm_ring, to be received by
+ * @ref recv::shm_reader in another process. Each packet occupies one slot,
+ * so the slot size must be at least the maximum packet size. If the consumer
+ * falls behind and all slots are in use, the stream polls until one is
+ * freed rather than dropping packets.
+ *
+ * The ring is closed when the stream is destroyed, which stops the
+ * receiving stream.
+ */
+class shm_stream : public stream_impl<shm_stream>
+{
+private:
+    friend class stream_impl<shm_stream>;
+    typedef std::function<void(const boost::system::error_code &, std::size_t)> handler_type;
+
+    std::shared_ptr<shm_ring> ring;
+    boost::asio::steady_timer timer;
+    /// Packet waiting for a free slot
+    const packet *pending_packet = nullptr;
+    handler_type pending_handler;
+
+    /// Copy @ref pending_packet into a slot, or schedule a retry if none is free
+    void try_send();
+
+    template<typename Handler>
+    void async_send_packet(const packet &pkt, Handler &&handler)
+    {
+        pending_packet = &pkt;
+        pending_handler = std::forward<Handler>(handler);
+        try_send();
+    }
+
+public:
+    /// Interval between attempts to claim a slot when the ring is full
+    static constexpr std::chrono::microseconds retry_interval{50};
+
+    /**
+     * Constructor using an existing ring.
+     *
+     * @throw std::invalid_argument if the slot size of @a ring is less than
+     * the maximum packet size in @a config
+     */
+    shm_stream(
+        boost::asio::io_service &io_service,
+        std::shared_ptr<shm_ring> ring,
+        const stream_config &config = stream_config());
+
+    /**
+     * Constructor that creates a new ring, with slots that are big enough
+     * for the maximum packet size in @a config.
+     *
+     * @param io_service   I/O service for sending data
+     * @param name         Name of the POSIX shared memory object (must start with a slash)
+     * @param n_slots      Number of packets that can be in flight at once
+     * @param config       Stream configuration
+     */
+    shm_stream(
+        boost::asio::io_service &io_service,
+        const std::string &name,
+        std::size_t n_slots,
+        const stream_config &config = stream_config());
+
+    virtual ~shm_stream();
+};
+
+} // namespace send
+} // namespace spead2
+
+#endif // SPEAD2_USE_SHM
+#endif // SPEAD2_SEND_SHM_H
@@ -128,6 +128,25 @@ public:
      */
     virtual bool async_send_heap(const heap &h, completion_handler handler, s_item_pointer_t cnt = -1) = 0;
 
+    /**
+     * Send pre-encoded packets asynchronously, with @a handler called on
+     * completion. Each element of @a packets is one complete SPEAD packet,
+     * which is sent as is (in particular, its heap cnt is not rewritten).
+     * This allows packets to be forwarded without reassembling heaps.
+     *
+     * The batch occupies one slot in the heap queue and is subject to the
+     * same rate limit as heaps, and the return value and error handling
+     * are the same as for @ref async_send_heap. The caller must ensure that
+     * @a packets and the memory it refers to remain valid until @a handler
+     * is called. The number of bytes passed to @a handler is the total for
+     * all packets sent.
+     *
+     * @retval  false  If the packets were immediately discarded
+     * @retval  true   If the packets were enqueued
+     */
+    virtual bool async_send_packets(const std::vector<boost::asio::const_buffer> &packets,
+                                    completion_handler handler) = 0;
+
     /**
      * Block until all enqueued heaps have been sent. This function is
      * thread-safe, but can be live-locked if more heaps are added while it is
@@ -151,13 +170,21 @@ private:
 
     struct queue_item
     {
-        const heap &h;
+        /// Heap to send, or @c nullptr to send @ref packets
+        const heap *h;
+        /// Pre-encoded packets to send (if @ref h is null)
+        const std::vector<boost::asio::const_buffer> *packets;
         item_pointer_t cnt;
         completion_handler handler;
 
-        queue_item() = default;
         queue_item(const heap &h, item_pointer_t cnt, completion_handler &&handler)
-            : h(std::move(h)), cnt(cnt), handler(std::move(handler))
+            : h(&h), packets(nullptr), cnt(cnt), handler(std::move(handler))
+        {
+        }
+
+        queue_item(const std::vector<boost::asio::const_buffer> &packets,
+                   completion_handler &&handler)
+            : h(nullptr), packets(&packets), cnt(0), handler(std::move(handler))
         {
         }
     };
@@ -183,11 +210,73 @@ private:
     /// Increment to next_cnt after each heap
     item_pointer_t step_cnt = 1;
     std::unique_ptr<packet_generator> gen; // TODO: make this inlinable
+    /// Pre-encoded packets being sent, if the current item is not a heap
+    const std::vector<boost::asio::const_buffer> *raw_packets = nullptr;
+    /// Index of the next packet to send from @ref raw_packets
+    std::size_t raw_next = 0;
     /// Packet undergoing transmission by send_next_packet
     packet current_packet;
     /// Signalled whenever the last heap is popped from the queue
     std::condition_variable heap_empty;
 
+    /**
+     * Set up @ref gen or @ref raw_packets for the item at the front of the
+     * queue. This must be called with @ref queue_mutex held.
+     */
+    void start_item()
+    {
+        const queue_item &item = queue.front();
+        if (item.h)
+            gen.reset(new packet_generator(*item.h, item.cnt, config.get_max_packet_size()));
+        else
+            gen.reset();
+        raw_packets = item.packets;
+        raw_next = 0;
+    }
+
+    /// Load the next packet of the current item into @ref current_packet
+    void next_packet()
+    {
+        if (gen)
+            current_packet = gen->next_packet();
+        else
+        {
+            assert(raw_packets);
+            current_packet.data.reset();
+            if (raw_next < raw_packets->size())
+                current_packet.buffers.assign(1, (*raw_packets)[raw_next++]);
+            else
+                current_packet.buffers.clear();
+        }
+    }
+
+    /**
+     * Add @a item to the queue, and start transmission if the queue was
+     * empty. This must be called with @a lock held on @ref queue_mutex, and
+     * releases it.
+     */
+    void enqueue(std::unique_lock<std::mutex> &lock, queue_item &&item)
+    {
+        bool empty = queue.empty();
+        queue.push(std::move(item));
+        if (empty)
+        {
+            assert(!gen && !raw_packets);
+            start_item();
+        }
+        lock.unlock();
+
+        /* If it is not empty, the new item will be started as a continuation
+         * of the previous one.
+         */
+        if (empty)
+        {
+            send_time = timer_type::clock_type::now();
+            rate_bytes = 0;
+            get_io_service().dispatch([this] { send_next_packet(); });
+        }
+    }
+
     /**
      * Asynchronously send the next packet from the current heap
      * (or the next heap, if the current one is finished).
@@ -200,9 +289,8 @@ private:
         bool again;
         do
         {
-            assert(gen);
             again = false;
-            current_packet = gen->next_packet();
+            next_packet();
             if (ec || current_packet.buffers.empty())
             {
                 // Reached the end of a heap. Pop the current one, and start the
@@ -216,10 +304,12 @@ private:
                 queue.pop();
                 empty = queue.empty();
                 if (!empty)
-                    gen.reset(new packet_generator(
-                        queue.front().h, queue.front().cnt, config.get_max_packet_size()));
+                    start_item();
                 else
+                {
                     gen.reset();
+                    raw_packets = nullptr;
+                }
 
                 std::size_t old_heap_bytes = heap_bytes;
                 heap_bytes = 0;
@@ -288,6 +378,9 @@ public:
     {
     }
 
+    /// Retrieve the configuration passed to the constructor
+    const stream_config &get_config() const { return config; }
+
     virtual void set_cnt_sequence(item_pointer_t next, item_pointer_t step) override
     {
         if (step == 0)
@@ -306,7 +399,6 @@ public:
             get_io_service().dispatch(std::bind(handler, boost::asio::error::would_block, 0));
             return false;
         }
-        bool empty = queue.empty();
         item_pointer_t ucnt; // unsigned, so that copying next_cnt cannot overflow
         if (cnt < 0)
         {
@@ -315,26 +407,34 @@ public:
         }
         else
             ucnt = cnt;
-        queue.emplace(h, ucnt, std::move(handler));
-        if (empty)
-        {
-            assert(!gen);
-            gen.reset(new packet_generator(queue.front().h, queue.front().cnt, config.get_max_packet_size()));
-        }
-        lock.unlock();
+        enqueue(lock, queue_item(h, ucnt, std::move(handler)));
+        return true;
+    }
 
-        /* If it is not empty, the new heap will be started as a continuation
-         * of the previous one.
-         */
-        if (empty)
+    virtual bool async_send_packets(const std::vector<boost::asio::const_buffer> &packets,
+                                    completion_handler handler) override
+    {
+        std::unique_lock<std::mutex> lock(queue_mutex);
+        if (queue.size() >= config.get_max_heaps())
         {
-            send_time = timer_type::clock_type::now();
-            rate_bytes = 0;
-            get_io_service().dispatch([this] { send_next_packet(); });
+            log_warning("async_send_packets: dropping packets because queue is full");
+            get_io_service().dispatch(std::bind(handler, boost::asio::error::would_block, 0));
+            return false;
         }
+        enqueue(lock, queue_item(packets, std::move(handler)));
         return true;
     }
 
+    /**
+     * Number of heaps that can currently be enqueued without being rejected.
+     * This is only a snapshot, since other threads may be adding heaps.
+     */
+    std::size_t get_queue_space()
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        return config.get_max_heaps() - queue.size();
+    }
+
     /**
      * Block until all enqueued heaps have been sent. This function is
      * thread-safe, but can be live-locked if more heaps are added while it is
@@ -50,13 +50,18 @@ class BuildExt(build_ext):
         subprocess.check_call(os.path.abspath('configure'), cwd=self.build_temp)
         # Ugly hack to add libraries conditional on configure result
         have_ibv = False
+        have_shm = False
         with open(os.path.join(self.build_temp, 'include', 'spead2', 'common_features.h')) as f:
             for line in f:
                 if line.strip() == '#define SPEAD2_USE_IBV 1':
                     have_ibv = True
+                elif line.strip() == '#define SPEAD2_USE_SHM 1':
+                    have_shm = True
         for extension in self.extensions:
             if have_ibv:
                 extension.libraries.extend(['rdmacm', 'ibverbs'])
+            if have_shm:
+                extension.libraries.append('rt')
             extension.include_dirs.insert(0, os.path.join(self.build_temp, 'include'))
         # distutils uses old-style classes, so no super
         build_ext.run(self)
@@ -16,7 +16,7 @@
 import spead2._spead2
 from spead2._spead2 import (
     Flavour, ThreadPool, Stopped, Empty, Stopped,
-    MemoryAllocator, MmapAllocator, MemoryPool,
+    MemoryAllocator, MmapAllocator, MemoryPool, BufferAllocator,
     BUG_COMPAT_DESCRIPTOR_WIDTHS,
     BUG_COMPAT_SHAPE_BIT_1,
     BUG_COMPAT_SWAP_ENDIAN,
@@ -39,10 +39,18 @@ from spead2._spead2 import (
     CTRL_STREAM_STOP,
     CTRL_DESCRIPTOR_UPDATE,
     MEMCPY_STD,
-    MEMCPY_NONTEMPORAL)
+    MEMCPY_NONTEMPORAL,
+    CHECKSUM_NONE,
+    CHECKSUM_VALID,
+    CHECKSUM_INVALID,
+    CHECKSUM_UNVERIFIED,
+    get_log_dropped)
 import numbers as _numbers
 import numpy as _np
 import logging
+import os as _os
+import threading as _threading
+import atexit as _atexit
 import six
 from spead2._version import __version__
 
@@ -53,6 +61,44 @@ _UNRESERVED_ID = 0x1000      #: First ID that can be auto-allocated
 _FASTPATH_NONE = 0
 _FASTPATH_IMMEDIATE = 1
 _FASTPATH_NUMPY = 2
+_LOG_LEVELS = [logging.WARNING, logging.INFO, logging.DEBUG]
+
+
+def _log_thread_main():
+    """Pass log messages from the C++ code to :py:mod:`logging`. The C++ code
+    only queues them, so that network threads never wait for the GIL.
+    """
+    while True:
+        entry = spead2._spead2._pop_log()
+        if entry is None:
+            break
+        _logger.log(_LOG_LEVELS[entry[0]], '%s', entry[1])
+
+
+def _start_log_thread():
+    global _log_thread
+    _log_thread = _threading.Thread(target=_log_thread_main, name='spead2-log')
+    _log_thread.daemon = True
+    _log_thread.start()
+
+
+def _stop_log_thread():
+    spead2._spead2._stop_log()
+    _log_thread.join()
+
+
+def _restart_log_thread_after_fork():
+    """The log thread does not survive :func:`os.fork`, so the child gets a
+    new one (with a new queue, since the old one may have been in use).
+    """
+    spead2._spead2._reset_log_after_fork()
+    _start_log_thread()
+
+
+_start_log_thread()
+_atexit.register(_stop_log_thread)
+if hasattr(_os, 'register_at_fork'):
+    _os.register_at_fork(after_in_child=_restart_log_thread_after_fork)
 
 
 if six.PY2:
@@ -161,6 +207,22 @@ class Descriptor(object):
             self._fastpath = _FASTPATH_IMMEDIATE
         else:
             self._fastpath = _FASTPATH_NONE
+        # Non-numpy formats are (un)packed in C++ if every field fits in 64 bits
+        self._native_bits = (format is not None and
+                             all(length <= 64 for code, length in format))
+        # Precomputed information used by the C++ implementation of
+        # ItemGroup.update to decode the value without calling set_from_raw.
+        if (self._fastpath == _FASTPATH_NUMPY and
+                self._internal_dtype.itemsize > 0 and
+                not (len(shape) == 1 and format == [('c', 8)])):
+            native_dtype = self._internal_dtype.newbyteorder('=')
+            if native_dtype == self._internal_dtype:
+                native_dtype = self._internal_dtype    # Avoids a conversion
+            self._numpy_spec = (
+                self._internal_dtype, native_dtype,
+                self._internal_dtype.itemsize, shape, order == 'F')
+        else:
+            self._numpy_spec = None
 
     @classmethod
     def _parse_numpy_header(cls, header):
@@ -523,9 +585,19 @@ class Item(Descriptor):
                 size_bytes = (bits + 7) // 8
                 raw_value = raw_value[-size_bytes:]
 
-            gen = self._read_bits(raw_value)
-            gen.send(None)    # Initialisation of the generator
-            value = _np.array(self._load_recursive(shape, gen), self._internal_dtype)
+            if self._native_bits:
+                fields = spead2._spead2.unpack_bits(raw_value, self.format, elements)
+                if len(fields) == 1:
+                    value = fields[0].astype(self._internal_dtype)
+                else:
+                    value = _np.empty(elements, self._internal_dtype)
+                    for name, field in zip(value.dtype.names, fields):
+                        value[name] = field
+                value = value.reshape(shape)
+            else:
+                gen = self._read_bits(raw_value)
+                gen.send(None)    # Initialisation of the generator
+                value = _np.array(self._load_recursive(shape, gen), self._internal_dtype)
 
         if len(self.shape) == 0 and isinstance(value, _np.ndarray):
             # Convert zero-dimensional array to scalar
@@ -590,7 +662,13 @@ class Item(Descriptor):
         temporary object.
         """
         value = self._transform_value()
-        if self._fastpath != _FASTPATH_NUMPY:
+        if self._fastpath != _FASTPATH_NUMPY and self._native_bits:
+            if len(self.format) == 1:
+                fields = [value]
+            else:
+                fields = [value[name] for name in value.dtype.names]
+            return spead2._spead2.pack_bits(fields, self.format)
+        elif self._fastpath != _FASTPATH_NUMPY:
             bit_length = self.itemsize_bits * self._num_elements()
             out = bytearray((bit_length + 7) // 8)
             gen = self._write_bits(out)
@@ -632,10 +710,13 @@ class ItemGroup(object):
     def __init__(self):
         self._by_id = {}
         self._by_name = {}
+        # Descriptor cache keys of the descriptors applied by update, by ID
+        self._descriptor_keys = {}
 
     def _remove_item(self, item):
         del self._by_id[item.id]
         del self._by_name[item.name]
+        self._descriptor_keys.pop(item.id, None)
 
     def _add_item(self, item):
         try:
@@ -681,6 +762,7 @@ class ItemGroup(object):
         # Install new item
         self._by_id[item.id] = item
         self._by_name[item.name] = item
+        self._descriptor_keys.pop(item.id, None)
 
     def add_item(self, *args, **kwargs):
         """Add a new item to the group. The parameters are used to construct an
@@ -747,19 +829,13 @@ class ItemGroup(object):
         dict
             Items that have been updated from this heap, indexed by name
         """
-        for descriptor in heap.get_descriptors():
+        # Descriptors that are byte-identical to ones already applied are
+        # recognised by their cache key and skipped without being parsed.
+        for key, descriptor in heap._get_changed_descriptors(self._descriptor_keys):
             item = Item.from_raw(descriptor, flavour=heap.flavour)
             self._add_item(item)
-        updated_items = {}
-        for raw_item in heap.get_items():
-            if raw_item.id <= STREAM_CTRL_ID:
-                continue     # Special fields, not real items
-            try:
-                item = self._by_id[raw_item.id]
-            except KeyError:
-                _logger.warning('Item with ID %#x received but there is no descriptor', raw_item.id)
-            else:
-                item.set_from_raw(raw_item)
-                item.version += 1
-                updated_items[item.name] = item
-        return updated_items
+            if key:
+                self._descriptor_keys[descriptor.id] = key
+        # Item lookup and decoding is done in C++. Items with a numpy type
+        # are decoded directly, and others are passed to Item.set_from_raw.
+        return heap._update_items(self._by_id)
@@ -39,11 +39,12 @@ Python. The following are accepted.
    element of the shape may indicate a variable-length field, whose length
    will be computed from the size of the item, or 0 if any other element of
    the shape is zero.
- - The `u`, `i`, `c` and `b` types may also be used with other sizes, but it
-   will invoke a slow conversion process and is not recommended for large
-   arrays. The valid range of the `c` conversion depends on the Python
-   version: for Python 2 it must be 0 to 255, for Python 3 it is interpreted
-   as a Unicode code point.
+ - The `u`, `i`, `c` and `b` types may also be used with other sizes. These
+   are unpacked by native code (if no field exceeds 64 bits), but the values
+   are stored as Python objects so it is less efficient than a numpy type.
+   The valid range of the `c` conversion depends on the Python version: for
+   Python 2 it must be 0 to 255, for Python 3 it is interpreted as a Unicode
+   code point.
 
 Two cases are treated specially:
 
@@ -56,4 +57,4 @@ Immediate values are treated as items with heap_address_bits/8
 bytes, in the order they appeared in the original packet.
 """
 
-from spead2._recv import Stream, Heap
+from spead2._recv import Stream, Heap, Reader, HeapArchiveWriter, HeapArchiveReader, Relay, RelayStats, OVERFLOW_BLOCK, OVERFLOW_DROP_NEWEST, OVERFLOW_DROP_OLDEST
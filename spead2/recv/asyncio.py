@@ -0,0 +1,111 @@
+# Copyright 2016 SKA South Africa
+#
+# This program is free software: you can redistribute it and/or modify it under
+# the terms of the GNU Lesser General Public License as published by the Free
+# Software Foundation, either version 3 of the License, or (at your option) any
+# later version.
+#
+# This program is distributed in the hope that it will be useful, but WITHOUT
+# ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+# FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+# details.
+#
+# You should have received a copy of the GNU Lesser General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+"""
+Integration between spead2.recv and asyncio (Python 3.5+)
+"""
+import asyncio
+import collections
+import spead2.recv
+
+
+class Stream(spead2.recv.Stream):
+    """Stream where `get` is a coroutine that yields the next heap, and which
+    can be iterated with ``async for``.
+
+    Internally, it maintains a queue of waiters, each represented by a future.
+    The file descriptor of the ringbuffer is registered with the event loop
+    while there is at least one waiter. Each time it becomes readable, heaps
+    are handed to waiters until either the waiters or the available heaps are
+    exhausted, so that a burst of heaps costs a single wakeup. Heaps are not
+    removed from the ringbuffer unless there is a waiter for them, so that
+    the ringbuffer still provides back-pressure.
+
+    Parameters
+    ----------
+    loop : event loop, optional
+        Default event loop
+    """
+
+    def __init__(self, *args, **kwargs):
+        self._loop = kwargs.pop('loop', None)
+        if self._loop is None:
+            self._loop = asyncio.get_event_loop()
+        super().__init__(*args, **kwargs)
+        self._waiters = collections.deque()
+        self._listening = False
+
+    def _start_listening(self):
+        if not self._listening:
+            self._loop.add_reader(self.fd, self._ready_callback)
+            self._listening = True
+
+    def _stop_listening(self):
+        if self._listening:
+            self._loop.remove_reader(self.fd)
+            self._listening = False
+
+    def _clear_done_waiters(self):
+        """Remove waiters at the head of the queue that are done (should only
+        happen if they are cancelled)"""
+        while self._waiters and self._waiters[0].done():
+            self._waiters.popleft()
+
+    def _ready_callback(self):
+        self._clear_done_waiters()
+        while self._waiters:
+            try:
+                heap = self.get_nowait()
+            except spead2.Empty:
+                # Either all available heaps have been handed out, or poll
+                # was woken spuriously
+                break
+            except spead2.Stopped as e:
+                for waiter in self._waiters:
+                    if not waiter.done():
+                        waiter.set_exception(e)
+                self._waiters.clear()
+            else:
+                self._waiters.popleft().set_result(heap)
+                self._clear_done_waiters()
+        if not self._waiters:
+            self._stop_listening()
+
+    async def get(self, loop=None):
+        """Coroutine that waits for a heap to become available and returns it."""
+        self._clear_done_waiters()
+        if not self._waiters:
+            # If something is available directly, we can avoid going back to
+            # the scheduler
+            try:
+                return self.get_nowait()
+            except spead2.Empty:
+                pass
+
+        if loop is None:
+            loop = self._loop
+        waiter = loop.create_future()
+        self._waiters.append(waiter)
+        self._start_listening()
+        return await waiter
+
+    def __aiter__(self):
+        return self
+
+    async def __anext__(self):
+        try:
+            return await self.get()
+        except spead2.Stopped:
+            raise StopAsyncIteration
@@ -23,6 +23,10 @@ try:
     from spead2._send import UdpIbvStream
 except ImportError:
     pass
+try:
+    from spead2._send import ShmStream
+except ImportError:
+    pass
 
 
 class _ItemInfo(object):
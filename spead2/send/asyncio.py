@@ -0,0 +1,155 @@
+# Copyright 2016 SKA South Africa
+#
+# This program is free software: you can redistribute it and/or modify it under
+# the terms of the GNU Lesser General Public License as published by the Free
+# Software Foundation, either version 3 of the License, or (at your option) any
+# later version.
+#
+# This program is distributed in the hope that it will be useful, but WITHOUT
+# ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+# FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+# details.
+#
+# You should have received a copy of the GNU Lesser General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+"""
+Integration between spead2.send and asyncio (Python 3.5+)
+"""
+import asyncio
+import functools
+import spead2.send
+from spead2._send import UdpStreamAsyncio as _UdpStreamAsyncio
+
+
+class _UdpStreamMixin(object):
+    """Mixin class used to define :class:`UdpStream` and :class:`UdpIbvStream`.
+
+    Completions are reported by the C++ layer through a single file
+    descriptor, and all completions that are pending when it becomes readable
+    are delivered in one call to `process_callbacks`, so a burst of heaps
+    costs a single event loop wakeup.
+    """
+    def __init__(self, *args, **kwargs):
+        self._loop = kwargs.pop('loop', None)
+        if self._loop is None:
+            self._loop = asyncio.get_event_loop()
+        self._active = 0
+        self._last_queued_future = None
+        super().__init__(*args, **kwargs)
+
+    def _send_done(self, future, exc, bytes_transferred):
+        if not future.done():
+            if exc is not None:
+                future.set_exception(exc)
+            else:
+                future.set_result(bytes_transferred)
+        self._active -= 1
+        if self._active == 0:
+            self._loop.remove_reader(self.fd)
+            self._last_queued_future = None  # Purely to free the memory
+
+    def async_send_heap(self, heap, cnt=-1, loop=None):
+        """Send a heap asynchronously. Note that this is *not* a coroutine:
+        it returns a future. Adding the heap to the queue is done
+        synchronously, to ensure proper ordering.
+
+        Parameters
+        ----------
+        heap : :py:class:`spead2.send.Heap`
+            Heap to send
+        cnt : int, optional
+            Heap cnt to send (defaults to auto-incrementing)
+        loop : :py:class:`asyncio.AbstractEventLoop`, optional
+            Event loop to use, overriding the constructor.
+        """
+
+        if loop is None:
+            loop = self._loop
+        future = loop.create_future()
+        callback = functools.partial(self._send_done, future)
+        queued = super().async_send_heap(heap, callback, cnt)
+        if self._active == 0:
+            self._loop.add_reader(self.fd, self.process_callbacks)
+        self._active += 1
+        if queued:
+            self._last_queued_future = future
+        return future
+
+    def async_send_heaps(self, heaps, cnts=None, loop=None):
+        """Send a sequence of heaps asynchronously. Note that this is *not*
+        a coroutine: it returns a future, whose result is the total number of
+        bytes transferred. Heaps fill whatever space is free in the stream's
+        queue and are queued in order without returning to the event loop
+        between them. If other heaps fill the queue, the remaining heaps wait
+        for space rather than being dropped.
+
+        If any heap fails to send, the future has the exception for the
+        first failure, but the remaining heaps are still sent.
+
+        Parameters
+        ----------
+        heaps : sequence of :py:class:`spead2.send.Heap`
+            Heaps to send
+        cnts : sequence of int, optional
+            Heap cnts to send, one per heap (defaults to auto-incrementing)
+        loop : :py:class:`asyncio.AbstractEventLoop`, optional
+            Event loop to use, overriding the constructor.
+        """
+        if loop is None:
+            loop = self._loop
+        future = loop.create_future()
+        callback = functools.partial(self._send_done, future)
+        super().async_send_heaps(heaps, callback, cnts)
+        if self._active == 0:
+            self._loop.add_reader(self.fd, self.process_callbacks)
+        self._active += 1
+        self._last_queued_future = future
+        return future
+
+    async def async_flush(self):
+        """Asynchronously wait for all enqueued heaps to be sent. Note that
+        this only waits for heaps passed to :meth:`async_send_heap` prior to
+        this call, not ones added while waiting."""
+        future = self._last_queued_future
+        if future is not None:
+            await asyncio.wait([future])
+
+
+class UdpStream(_UdpStreamMixin, _UdpStreamAsyncio):
+    """SPEAD over UDP with asynchronous sends. The other constructors
+    defined for :py:class:`spead2.send.UdpStream` are also applicable here.
+
+    Parameters
+    ----------
+    thread_pool : :py:class:`spead2.ThreadPool`
+        Thread pool handling the I/O
+    hostname : str
+        Peer hostname
+    port : int
+        Peer port
+    config : :py:class:`spead2.send.StreamConfig`
+        Stream configuration
+    buffer_size : int
+        Socket buffer size. A warning is logged if this size cannot be set due
+        to OS limits.
+    loop : :py:class:`asyncio.AbstractEventLoop`, optional
+        Event loop to use (defaults to ``asyncio.get_event_loop()``)
+    """
+    def __init__(self, *args, **kwargs):
+        super().__init__(*args, **kwargs)
+
+
+try:
+    from spead2._send import UdpIbvStreamAsyncio as _UdpIbvStreamAsyncio
+
+    class UdpIbvStream(_UdpStreamMixin, _UdpIbvStreamAsyncio):
+        """Like :class:`UdpStream`, but using the Infiniband Verbs API. See
+        :py:class:`spead2.send.trollius.UdpIbvStream` for the constructor
+        parameters, with `loop` being an asyncio event loop.
+        """
+        def __init__(self, *args, **kwargs):
+            super().__init__(*args, **kwargs)
+
+except ImportError:
+    pass
@@ -33,6 +33,18 @@ class _UdpStreamMixin(object):
         self._last_queued_future = None
         super(_UdpStreamMixin, self).__init__(*args, **kwargs)
 
+    def _make_callback(self, future):
+        def callback(exc, bytes_transferred):
+            if exc is not None:
+                future.set_exception(exc)
+            else:
+                future.set_result(bytes_transferred)
+            self._active -= 1
+            if self._active == 0:
+                self._loop.remove_reader(self.fd)
+                self._last_queued_future = None  # Purely to free the memory
+        return callback
+
     def async_send_heap(self, heap, cnt=-1, loop=None):
         """Send a heap asynchronously. Note that this is *not* a coroutine:
         it returns a future. Adding the heap to the queue is done
@@ -51,16 +63,7 @@ class _UdpStreamMixin(object):
         if loop is None:
             loop = self._loop
         future = trollius.Future(loop=self._loop)
-
-        def callback(exc, bytes_transferred):
-            if exc is not None:
-                future.set_exception(exc)
-            else:
-                future.set_result(bytes_transferred)
-            self._active -= 1
-            if self._active == 0:
-                self._loop.remove_reader(self.fd)
-                self._last_queued_future = None  # Purely to free the memory
+        callback = self._make_callback(future)
         queued = super(_UdpStreamMixin, self).async_send_heap(heap, callback, cnt)
         if self._active == 0:
             self._loop.add_reader(self.fd, self.process_callbacks)
@@ -69,6 +72,37 @@ class _UdpStreamMixin(object):
             self._last_queued_future = future
         return future
 
+    def async_send_heaps(self, heaps, cnts=None, loop=None):
+        """Send a sequence of heaps asynchronously. Note that this is *not*
+        a coroutine: it returns a future, whose result is the total number of
+        bytes transferred. Heaps fill whatever space is free in the stream's
+        queue and are queued in order without returning to the event loop
+        between them. If other heaps fill the queue, the remaining heaps wait
+        for space rather than being dropped.
+
+        If any heap fails to send, the future has the exception for the
+        first failure, but the remaining heaps are still sent.
+
+        Parameters
+        ----------
+        heaps : sequence of :py:class:`spead2.send.Heap`
+            Heaps to send
+        cnts : sequence of int, optional
+            Heap cnts to send, one per heap (defaults to auto-incrementing)
+        loop : :py:class:`trollius.BaseEventLoop`, optional
+            Event loop to use, overriding the constructor.
+        """
+        if loop is None:
+            loop = self._loop
+        future = trollius.Future(loop=self._loop)
+        callback = self._make_callback(future)
+        super(_UdpStreamMixin, self).async_send_heaps(heaps, callback, cnts)
+        if self._active == 0:
+            self._loop.add_reader(self.fd, self.process_callbacks)
+        self._active += 1
+        self._last_queued_future = future
+        return future
+
     @trollius.coroutine
     def async_flush(self):
         """Asynchronously wait for all enqueued heaps to be sent. Note that
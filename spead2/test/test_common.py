@@ -16,10 +16,15 @@
 """Tests for parts of spead2 that are shared between send and receive"""
 
 from __future__ import division, print_function
+import logging
+import os
+import threading
 import spead2
+import spead2.recv
 import numpy as np
 import six
 from nose.tools import *
+from nose.plugins.skip import SkipTest
 
 
 def assert_equal_typed(expected, actual, msg=None):
@@ -32,6 +37,13 @@ def assert_equal_typed(expected, actual, msg=None):
     assert_equal(type(expected), type(actual), msg)
 
 
+class RawItem(object):
+    """Minimal stand-in for :py:class:`spead2.recv.RawItem`"""
+    def __init__(self, value):
+        self.value = value
+        self.is_immediate = False
+
+
 class TestParseRangeList(object):
     def test_empty(self):
         assert_equal([], spead2.parse_range_list(''))
@@ -56,6 +68,55 @@ class TestThreadPool(object):
         spead2.ThreadPool(1, [1, 0, 2])
 
 
+class TestLogging(object):
+    class _Handler(logging.Handler):
+        def __init__(self):
+            super(TestLogging._Handler, self).__init__()
+            self.records = []
+            self.event = threading.Event()
+
+        def emit(self, record):
+            if 'magic' in record.getMessage():
+                self.records.append(record)
+                self.event.set()
+
+    def test_forwarded(self):
+        """Log messages from C++ reach the logging module on the log thread"""
+        handler = self._Handler()
+        logger = logging.getLogger('spead2')
+        logger.addHandler(handler)
+        old_level = logger.level
+        logger.setLevel(logging.INFO)
+        try:
+            stream = spead2.recv.Stream(spead2.ThreadPool())
+            # Not a SPEAD packet, so it is rejected with an info message
+            stream.add_buffer_reader(b'\xff' * 64)
+            list(stream)
+            # The message might have been rate-limited, in which case a
+            # summary arrives later
+            assert_true(handler.event.wait(5))
+            assert_equal('spead2-log', handler.records[0].threadName)
+            assert_equal(0, spead2.get_log_dropped())
+        finally:
+            logger.removeHandler(handler)
+            logger.setLevel(old_level)
+
+    def test_forwarded_after_fork(self):
+        """Log messages are still forwarded in a forked child process"""
+        if not hasattr(os, 'register_at_fork'):
+            raise SkipTest('os.register_at_fork is not available')
+        pid = os.fork()
+        if pid == 0:
+            status = 1
+            try:
+                self.test_forwarded()
+                status = 0
+            finally:
+                os._exit(status)
+        _, status = os.waitpid(pid, 0)
+        assert_equal(0, status)
+
+
 class TestFlavour(object):
     def test_bad_version(self):
         with assert_raises(ValueError):
@@ -150,6 +211,34 @@ class TestItem(object):
         assert_raises(ValueError, spead2.Item, 0x1000, 'name', 'description',
             (5, None), np.int32)
 
+    def test_fallback_roundtrip(self):
+        """Non-numpy formats must survive a round trip through a buffer"""
+        format = [('u', 10), ('i', 3), ('b', 1), ('c', 8), ('f', 64)]
+        value = [(1023, -4, True, b'x', 2.5), (7, 3, False, b'y', -1.0), (0, -1, True, b'z', 0.0)]
+        item = spead2.Item(0x1000, 'name', 'description', (3,), format=format, value=value)
+        buf = item.to_buffer()
+        assert_equal(8 * len(buf), 3 * 86 + 6)
+        raw = RawItem(memoryview(bytes(buf)))
+        item2 = spead2.Item(0x1000, 'name', 'description', (3,), format=format)
+        item2.set_from_raw(raw)
+        assert_equal([tuple(x) for x in value], [tuple(x) for x in item2.value])
+
+    def test_fallback_out_of_range(self):
+        """Values that do not fit in the field raise :py:exc:`ValueError`"""
+        for format, value in [([('u', 12)], 4096), ([('u', 12)], -1),
+                              ([('i', 12)], 2048), ([('i', 12)], -2049),
+                              ([('u', 12)], 1 << 70)]:
+            item = spead2.Item(0x1000, 'name', 'description', (), format=format, value=value)
+            assert_raises(ValueError, item.to_buffer)
+
+    def test_pack_bits_u64_out_of_range(self):
+        """Negative values must not wrap silently in a u64 field"""
+        format = [('u', 64), ('u', 4)]
+        for value in [[-1, 5], np.array([5, -1], np.int64), [1 << 64, 5], [-1.0, 5.0]]:
+            assert_raises(ValueError, spead2._spead2.pack_bits, [value, [1, 2]], format)
+        buf = spead2._spead2.pack_bits([[(1 << 64) - 1], [3]], format)
+        assert_equal(b'\xff' * 8 + b'\x30', bytes(buf))
+
     def test_nonascii_name(self):
         """Name with non-ASCII characters must fail"""
         with assert_raises(UnicodeEncodeError):
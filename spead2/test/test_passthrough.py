@@ -20,6 +20,7 @@ transports, and mixing with the old PySPEAD implementation.
 from __future__ import division, print_function
 import numpy as np
 import io
+import os
 import spead2
 import spead2.send
 import spead2.recv
@@ -252,6 +253,64 @@ class TestPassthroughUdp(BaseTestPassthrough):
         return received_item_group
 
 
+class TestPassthroughRelay(BaseTestPassthrough):
+    def transmit_item_group(self, item_group, memcpy, allocator):
+        thread_pool = spead2.ThreadPool(2)
+        sender = spead2.send.UdpStream(
+                thread_pool, "localhost", 8889,
+                spead2.send.StreamConfig(rate=1e8),
+                buffer_size=0)
+        # Enough batches for every packet, so that none are dropped even if
+        # the output falls behind
+        output = spead2.send.UdpStream(
+                thread_pool, "localhost", 8888,
+                spead2.send.StreamConfig(max_heaps=128),
+                buffer_size=0)
+        relay = spead2.recv.Relay(thread_pool, output, max_batches=128)
+        relay.add_udp_reader(8889, bind_hostname="localhost")
+        receiver = spead2.recv.Stream(thread_pool)
+        receiver.set_memcpy(memcpy)
+        if allocator is not None:
+            receiver.set_memory_allocator(allocator)
+        receiver.add_udp_reader(8888, bind_hostname="localhost")
+        gen = spead2.send.HeapGenerator(item_group)
+        sender.send_heap(gen.get_heap())
+        sender.send_heap(gen.get_end())
+        received_item_group = spead2.ItemGroup()
+        for heap in receiver:
+            received_item_group.update(heap)
+        relay.stop()
+        assert_equal(relay.stats.packets, relay.stats.forwarded_packets)
+        return received_item_group
+
+
+class TestPassthroughUdpPipeline(BaseTestPassthrough):
+    reader_kwargs = dict(batches=2, batch_size=4)
+
+    def transmit_item_group(self, item_group, memcpy, allocator):
+        thread_pool = spead2.ThreadPool(2)
+        sender = spead2.send.UdpStream(
+                thread_pool, "localhost", 8888,
+                spead2.send.StreamConfig(rate=1e8),
+                buffer_size=0)
+        receiver = spead2.recv.Stream(thread_pool)
+        receiver.set_memcpy(memcpy)
+        if allocator is not None:
+            receiver.set_memory_allocator(allocator)
+        receiver.add_udp_pipeline_reader(8888, bind_hostname="localhost", **self.reader_kwargs)
+        gen = spead2.send.HeapGenerator(item_group)
+        sender.send_heap(gen.get_heap())
+        sender.send_heap(gen.get_end())
+        received_item_group = spead2.ItemGroup()
+        for heap in receiver:
+            received_item_group.update(heap)
+        return received_item_group
+
+
+class TestPassthroughUdpPipelineBusyPoll(TestPassthroughUdpPipeline):
+    reader_kwargs = dict(batches=2, batch_size=4, busy_poll=100)
+
+
 class TestPassthroughUdp6(BaseTestPassthrough):
     @classmethod
     def check_ipv6(cls):
@@ -313,6 +372,9 @@ class TestPassthroughUdpCustomSocket(BaseTestPassthrough):
 
 
 class TestPassthroughUdpMulticast(BaseTestPassthrough):
+    def add_reader(self, receiver, mcast_group, interface_address):
+        receiver.add_udp_reader(mcast_group, 8887, interface_address=interface_address)
+
     def transmit_item_group(self, item_group, memcpy, allocator):
         thread_pool = spead2.ThreadPool(2)
         mcast_group = '239.255.88.88'
@@ -325,7 +387,7 @@ class TestPassthroughUdpMulticast(BaseTestPassthrough):
         receiver.set_memcpy(memcpy)
         if allocator is not None:
             receiver.set_memory_allocator(allocator)
-        receiver.add_udp_reader(mcast_group, 8887, interface_address=interface_address)
+        self.add_reader(receiver, mcast_group, interface_address)
         gen = spead2.send.HeapGenerator(item_group)
         sender.send_heap(gen.get_heap())
         sender.send_heap(gen.get_end())
@@ -334,6 +396,12 @@ class TestPassthroughUdpMulticast(BaseTestPassthrough):
             received_item_group.update(heap)
         return received_item_group
 
+
+class TestPassthroughUdpPipelineMulticast(TestPassthroughUdpMulticast):
+    def add_reader(self, receiver, mcast_group, interface_address):
+        receiver.add_udp_pipeline_reader(mcast_group, 8887, interface_address=interface_address,
+                                         batches=2, batch_size=4)
+
 class TestPassthroughUdp6Multicast(TestPassthroughUdp6):
     @classmethod
     def get_interface_index(cls):
@@ -385,6 +453,27 @@ class TestPassthroughMem(BaseTestPassthrough):
         return received_item_group
 
 
+
+class TestPassthroughShm(BaseTestPassthrough):
+    def transmit_item_group(self, item_group, memcpy, allocator):
+        if not hasattr(spead2.send, 'ShmStream'):
+            raise SkipTest('shared memory support not compiled in')
+        thread_pool = spead2.ThreadPool(2)
+        name = '/spead2-test-{}'.format(os.getpid())
+        sender = spead2.send.ShmStream(thread_pool, name, 4)
+        receiver = spead2.recv.Stream(thread_pool)
+        receiver.set_memcpy(memcpy)
+        if allocator is not None:
+            receiver.set_memory_allocator(allocator)
+        receiver.add_shm_reader(name)
+        gen = spead2.send.HeapGenerator(item_group)
+        sender.send_heap(gen.get_heap())
+        sender.send_heap(gen.get_end())
+        received_item_group = spead2.ItemGroup()
+        for heap in receiver:
+            received_item_group.update(heap)
+        return received_item_group
+
 class TestAllocators(BaseTestPassthrough):
     """Like TestPassthroughMem, but uses some custom allocators"""
     def transmit_item_group(self, item_group, memcpy, allocator):
@@ -18,6 +18,9 @@ import spead2
 import spead2.recv as recv
 import spead2.send as send
 import struct
+import os
+import shutil
+import tempfile
 import numpy as np
 import six
 from nose.tools import *
@@ -253,6 +256,29 @@ class TestDecode(object):
         assert_equal(0x1234567890AB, ig[0x1235].value)
         assert_equal(-0x6DCBA9876F55, ig[0x1236].value)
 
+    def test_update_result(self):
+        """ItemGroup.update returns only the items with descriptors, and
+        increments their versions"""
+        packet = self.flavour.make_packet_heap(
+            1,
+            [
+                self.flavour.make_plain_descriptor(
+                    0x1234, 'test_variable', 'a variable-length array', [('u', 16)], [None]),
+                Item(0x1234, struct.pack('>3H', 1, 2, 3)),
+                Item(0x1235, struct.pack('>I', 4))
+            ])
+        heaps = self.data_to_heaps(packet)
+        ig = spead2.ItemGroup()
+        updated = ig.update(heaps[0])
+        assert_equal(['test_variable'], list(updated.keys()))
+        item = updated['test_variable']
+        assert_is(ig[0x1234], item)
+        assert_equal(np.dtype(np.uint16), item.value.dtype)
+        np.testing.assert_equal([1, 2, 3], item.value)
+        version = item.version
+        ig.update(heaps[0])
+        assert_greater(item.version, version)
+
     def test_string(self):
         packet = self.flavour.make_packet_heap(
             1,
@@ -351,6 +377,32 @@ class TestDecode(object):
         item = self.data_to_item(packet, 0x1234)
         np.testing.assert_equal(expected, item.value)
 
+    def test_fallback_uint4(self):
+        expected = np.array([0xA, 0xB, 0xC, 0xD, 0xE])
+        packet = self.flavour.make_packet_heap(
+            1,
+            [
+                self.flavour.make_plain_descriptor(
+                    0x1234, 'test_fallback_uint4', 'an array of 4-bit uints', [('u', 4)], (5,)),
+                Item(0x1234, b'\xAB\xCD\xE0')
+            ])
+        item = self.data_to_item(packet, 0x1234)
+        np.testing.assert_equal(expected, item.value)
+
+    def test_fallback_wide(self):
+        """Fields wider than 64 bits are decoded in Python"""
+        expected = [0x0123456789ABCDEF01, 0x1]
+        packet = self.flavour.make_packet_heap(
+            1,
+            [
+                self.flavour.make_plain_descriptor(
+                    0x1234, 'test_fallback_wide', 'an array of 72-bit uints', [('u', 72)], (2,)),
+                Item(0x1234, b'\x01\x23\x45\x67\x89\xAB\xCD\xEF\x01'
+                             b'\x00\x00\x00\x00\x00\x00\x00\x00\x01')
+            ])
+        item = self.data_to_item(packet, 0x1234)
+        assert_equal(expected, list(item.value))
+
     def test_fallback_types(self):
         expected = np.array([(True, 17, 'y', 1.0), (False, -23, 'n', -1.0)], dtype='O,O,S1,>f4')
         packet = self.flavour.make_packet_heap(
@@ -601,6 +653,204 @@ class TestStream(object):
         heaps = list(receiver)
         assert_equal(1, len(heaps))
 
+    def test_buffer_allocator(self):
+        """Heaps are received into user buffers, which are recycled when the
+        heaps are freed"""
+        thread_pool = spead2.ThreadPool(1)
+        sender = send.BytesStream(thread_pool)
+        ig = send.ItemGroup()
+        item = ig.add_item(id=0x2345, name='name', description='description',
+                           shape=(1000,), dtype=np.uint32)
+        for i in range(3):
+            item.value = np.arange(1000, dtype=np.uint32) + i
+            sender.send_heap(ig.get_heap(descriptors='none', data='all'))
+        buffers = [np.zeros(1000, np.uint32) for i in range(2)]
+        allocator = spead2.BufferAllocator(buffers)
+        receiver = spead2.recv.Stream(thread_pool)
+        receiver.set_memory_allocator(allocator)
+        receiver.add_buffer_reader(sender.getvalue())
+        heaps = list(receiver)
+        assert_equal(3, len(heaps))
+        assert_is(buffers[0], allocator.pop(heaps[0]))
+        assert_is(buffers[1], allocator.pop(heaps[1]))
+        assert_is_none(allocator.pop(heaps[2]))
+        np.testing.assert_equal(np.arange(1000) + 1, buffers[1])
+        assert_equal(0, allocator.free)
+        assert_equal(1, allocator.fallbacks)
+        del heaps
+        assert_equal(2, allocator.free)
+
+    def _overflow_heaps(self, policy):
+        """Send 10 heaps into a stream with space for 2 and no consumer"""
+        thread_pool = spead2.ThreadPool(1)
+        sender = send.BytesStream(thread_pool)
+        ig = send.ItemGroup()
+        item = ig.add_item(id=0x2345, name='name', description='description',
+                           shape=(), format=[('u', 32)])
+        for i in range(10):
+            item.value = i
+            sender.send_heap(ig.get_heap(descriptors='none', data='all'))
+        receiver = spead2.recv.Stream(thread_pool, ring_heaps=2)
+        receiver.set_overflow_policy(policy)
+        receiver.add_buffer_reader(sender.getvalue())
+        # Adding a reader runs on the stream's strand, after the handler of
+        # the first reader has pushed all its heaps and stopped the stream
+        # (so this one is ignored). The consumer thus cannot make space early.
+        receiver.add_buffer_reader(b'')
+        return receiver, [heap.cnt for heap in receiver]
+
+    def test_overflow_drop_newest(self):
+        receiver, cnts = self._overflow_heaps(spead2.recv.OVERFLOW_DROP_NEWEST)
+        assert_equal([1, 2], cnts)
+        assert_equal(8, receiver.overflow_drops)
+
+    def test_overflow_drop_oldest(self):
+        receiver, cnts = self._overflow_heaps(spead2.recv.OVERFLOW_DROP_OLDEST)
+        assert_equal([9, 10], cnts)
+        assert_equal(8, receiver.overflow_drops)
+
+    def test_overflow_bad_policy(self):
+        receiver = spead2.recv.Stream(spead2.ThreadPool())
+        with assert_raises(ValueError):
+            receiver.set_overflow_policy(7)
+
+    def _filtered_heap(self, ids, exclude):
+        """Send a heap with a small and a large item through a filtered stream"""
+        thread_pool = spead2.ThreadPool(1)
+        sender = send.BytesStream(thread_pool, send.StreamConfig(max_packet_size=1024))
+        ig = send.ItemGroup()
+        ig.add_item(id=0x1000, name='timestamp', description='timestamp',
+                    shape=(), format=[('u', 64)], value=12345)
+        ig.add_item(id=0x1001, name='data', description='data',
+                    shape=(10000,), dtype=np.uint8, value=np.arange(10000) % 256)
+        sender.send_heap(ig.get_heap(descriptors='all', data='all'))
+        receiver = spead2.recv.Stream(thread_pool)
+        receiver.set_item_filter(ids, exclude)
+        receiver.add_buffer_reader(sender.getvalue())
+        heaps = list(receiver)
+        assert_equal(1, len(heaps))
+        raw_ids = [item.id for item in heaps[0].get_items()]
+        assert_equal(2, len(heaps[0].get_descriptors()))
+        rig = spead2.ItemGroup()
+        rig.update(heaps[0])
+        return raw_ids, rig
+
+    def test_item_filter_include(self):
+        raw_ids, rig = self._filtered_heap([0x1000], False)
+        assert_in(0x1000, raw_ids)
+        assert_not_in(0x1001, raw_ids)
+        assert_equal(12345, rig['timestamp'].value)
+        assert_is_none(rig['data'].value)
+
+    def test_item_filter_exclude(self):
+        raw_ids, rig = self._filtered_heap([0x1000], True)
+        assert_not_in(0x1000, raw_ids)
+        assert_in(0x1001, raw_ids)
+        np.testing.assert_equal(np.arange(10000) % 256, rig['data'].value)
+
+    def test_item_filter_late_pointer(self):
+        """A wanted item whose start is only revealed after some of its payload
+        was skipped must be dropped rather than returned with garbage"""
+        flavour = FLAVOUR
+        packet1 = flavour.make_packet(
+            [
+                Item(spead2.HEAP_CNT_ID, 1, True),
+                Item(spead2.HEAP_LENGTH_ID, 16, True),
+                Item(spead2.PAYLOAD_OFFSET_ID, 0, True),
+                Item(spead2.PAYLOAD_LENGTH_ID, 8, True),
+                Item(0x1000, None, False, offset=0)
+            ], b'\1' * 8)
+        packet2 = flavour.make_packet(
+            [
+                Item(spead2.HEAP_CNT_ID, 1, True),
+                Item(spead2.HEAP_LENGTH_ID, 16, True),
+                Item(spead2.PAYLOAD_OFFSET_ID, 8, True),
+                Item(spead2.PAYLOAD_LENGTH_ID, 8, True),
+                Item(0x1001, None, False, offset=4)
+            ], b'\2' * 8)
+        receiver = spead2.recv.Stream(spead2.ThreadPool())
+        receiver.set_item_filter([0x1001])
+        receiver.add_buffer_reader(packet1 + packet2)
+        heaps = list(receiver)
+        assert_equal(1, len(heaps))
+        assert_equal([], heaps[0].get_items())
+
+    def test_descriptor_cache(self):
+        """Repeated descriptors are recognised without being reapplied, and
+        changed descriptors still take effect"""
+        thread_pool = spead2.ThreadPool(1)
+        sender = send.BytesStream(thread_pool)
+        for name in ['first', 'first', 'second', 'first']:
+            ig = send.ItemGroup()
+            ig.add_item(id=0x1000, name=name, description='', shape=(), format=[('u', 32)], value=5)
+            sender.send_heap(ig.get_heap(descriptors='all', data='all'))
+        receiver = spead2.recv.Stream(thread_pool)
+        receiver.add_buffer_reader(sender.getvalue())
+        heaps = list(receiver)
+        assert_equal(4, len(heaps))
+        ig = spead2.ItemGroup()
+        names = []
+        for heap in heaps:
+            changed = heap._get_changed_descriptors(ig._descriptor_keys)
+            ig.update(heap)
+            names.append((len(changed), list(ig.keys())))
+        assert_equal([(1, ['first']), (0, ['first']), (1, ['second']), (1, ['first'])], names)
+        assert_equal(5, ig['first'].value)
+
+    def _checksum_heaps(self, corrupt):
+        thread_pool = spead2.ThreadPool(1)
+        sender = send.BytesStream(thread_pool)
+        ig = send.ItemGroup()
+        ig.add_item(id=0x1000, name='data', description='', shape=(1000,), dtype=np.uint8,
+                    value=np.arange(1000) % 256)
+        for i in range(2):
+            heap = ig.get_heap(descriptors='all', data='all')
+            heap.checksum_id = 0x0f00
+            sender.send_heap(heap)
+        data = bytearray(sender.getvalue())
+        if corrupt:
+            # Alter the last byte of payload in the second heap
+            data[-1] ^= 1
+        receiver = spead2.recv.Stream(thread_pool)
+        receiver.checksum_id = 0x0f00
+        receiver.add_buffer_reader(bytes(data))
+        heaps = list(receiver)
+        assert_equal(2, len(heaps))
+        return receiver, heaps
+
+    def test_checksum_valid(self):
+        receiver, heaps = self._checksum_heaps(False)
+        assert_equal([spead2.CHECKSUM_VALID] * 2, [heap.checksum_status for heap in heaps])
+        assert_equal(2, receiver.checksum_valid)
+        assert_equal(0, receiver.checksum_invalid)
+        assert_not_in(0x0f00, [item.id for item in heaps[0].get_items()])
+
+    def test_checksum_invalid(self):
+        receiver, heaps = self._checksum_heaps(True)
+        assert_equal([spead2.CHECKSUM_VALID, spead2.CHECKSUM_INVALID],
+                     [heap.checksum_status for heap in heaps])
+        assert_equal(1, receiver.checksum_valid)
+        assert_equal(1, receiver.checksum_invalid)
+
+    def test_checksum_disabled(self):
+        """Heaps without a checksum, or streams not checking, report no status"""
+        thread_pool = spead2.ThreadPool(1)
+        sender = send.BytesStream(thread_pool)
+        ig = send.ItemGroup()
+        ig.add_item(id=0x1000, name='x', description='', shape=(), format=[('u', 32)], value=1)
+        sender.send_heap(ig.get_heap())
+        receiver = spead2.recv.Stream(thread_pool)
+        receiver.checksum_id = 0x0f00
+        receiver.add_buffer_reader(sender.getvalue())
+        heaps = list(receiver)
+        assert_equal(spead2.CHECKSUM_NONE, heaps[0].checksum_status)
+        assert_equal(0, receiver.checksum_valid)
+
+    def test_buffer_allocator_readonly(self):
+        """Read-only buffers are rejected"""
+        with assert_raises(BufferError):
+            spead2.BufferAllocator([b'read-only'])
+
 class TestUdpStream(object):
     def test_out_of_range_udp_port(self):
         receiver = spead2.recv.Stream(spead2.ThreadPool())
@@ -609,3 +859,192 @@ class TestUdpStream(object):
     def test_illegal_udp_port(self):
         receiver = spead2.recv.Stream(spead2.ThreadPool())
         assert_raises(RuntimeError, receiver.add_udp_reader, 22)
+
+    def test_pipeline_bad_batches(self):
+        receiver = spead2.recv.Stream(spead2.ThreadPool())
+        assert_raises(ValueError, receiver.add_udp_pipeline_reader, 8885,
+                      bind_hostname='127.0.0.1', batches=0)
+        assert_raises(ValueError, receiver.add_udp_pipeline_reader, 8885,
+                      bind_hostname='127.0.0.1', batch_size=0)
+
+    def _send_heap(self, thread_pool, host, port, **kwargs):
+        sender = spead2.send.UdpStream(
+                thread_pool, host, port, spead2.send.StreamConfig(rate=1e8),
+                buffer_size=0, **kwargs)
+        ig = send.ItemGroup()
+        ig.add_item(id=0x1000, name='name', description='description',
+                    shape=(), format=[('u', 32)], value=port)
+        gen = send.HeapGenerator(ig)
+        sender.send_heap(gen.get_heap())
+        sender.send_heap(gen.get_end())
+
+    def test_remove_reader(self):
+        """Removing a reader leaves the other readers running"""
+        thread_pool = spead2.ThreadPool(2)
+        receiver = spead2.recv.Stream(thread_pool)
+        reader1 = receiver.add_udp_reader(8885, bind_hostname='127.0.0.1')
+        receiver.add_udp_reader(8886, bind_hostname='127.0.0.1')
+        receiver.remove_reader(reader1)
+        assert_raises(ValueError, receiver.remove_reader, reader1)
+        self._send_heap(thread_pool, '127.0.0.1', 8885)
+        self._send_heap(thread_pool, '127.0.0.1', 8886)
+        heaps = list(receiver)
+        assert_equal(1, len(heaps))
+        ig = spead2.ItemGroup()
+        ig.update(heaps[0])
+        assert_equal(8886, ig['name'].value)
+
+    def test_remove_reader_stale(self):
+        """A handle to a removed reader does not refer to a later reader"""
+        receiver = spead2.recv.Stream(spead2.ThreadPool())
+        for i in range(10):
+            reader = receiver.add_udp_reader(8885, bind_hostname='127.0.0.1')
+            receiver.remove_reader(reader)
+            # Likely to be allocated where the removed reader was
+            new_reader = receiver.add_udp_reader(8885, bind_hostname='127.0.0.1')
+            assert_raises(ValueError, receiver.remove_reader, reader)
+            receiver.remove_reader(new_reader)
+
+    def test_join_leave_multicast(self):
+        """Multicast groups can be joined and left on a running reader"""
+        thread_pool = spead2.ThreadPool(2)
+        receiver = spead2.recv.Stream(thread_pool)
+        reader = receiver.add_udp_reader(8884)
+        receiver.join_multicast(reader, '239.255.88.89', '127.0.0.1')
+        self._send_heap(thread_pool, '239.255.88.89', 8884,
+                        ttl=1, interface_address='127.0.0.1')
+        heaps = list(receiver)
+        assert_equal(1, len(heaps))
+        receiver.leave_multicast(reader, '239.255.88.89', '127.0.0.1')
+
+    def test_join_multicast_bad(self):
+        receiver = spead2.recv.Stream(spead2.ThreadPool())
+        reader = receiver.add_udp_reader(8883, bind_hostname='127.0.0.1')
+        other = spead2.recv.Stream(spead2.ThreadPool())
+        other_reader = other.add_udp_reader(8882, bind_hostname='127.0.0.1')
+        assert_raises(ValueError, receiver.join_multicast, reader, '127.0.0.1')
+        assert_raises(ValueError, receiver.join_multicast, other_reader, '239.255.88.89')
+        assert_raises(ValueError, receiver.remove_reader, other_reader)
+        receiver.remove_reader(reader)
+        assert_raises(ValueError, receiver.join_multicast, reader, '239.255.88.89')
+
+
+class TestHeapArchive(object):
+    def setup(self):
+        self.tmpdir = tempfile.mkdtemp()
+        self.filename = os.path.join(self.tmpdir, 'heaps.spead2')
+
+    def teardown(self):
+        shutil.rmtree(self.tmpdir)
+
+    def _write(self, n_heaps):
+        thread_pool = spead2.ThreadPool()
+        sender = spead2.send.BytesStream(thread_pool)
+        ig = spead2.send.ItemGroup()
+        ig.add_item(0x1000, 'values', 'an array', (100,), np.uint32)
+        ig.add_item(0x1001, 'index', 'a scalar', (), format=[('u', 32)])
+        gen = spead2.send.HeapGenerator(ig)
+        for i in range(n_heaps):
+            ig['values'].value = np.arange(100, dtype=np.uint32) * i
+            ig['index'].value = i
+            sender.send_heap(gen.get_heap(), cnt=100 + 2 * i)
+        receiver = spead2.recv.Stream(thread_pool)
+        receiver.add_buffer_reader(sender.getvalue())
+        writer = recv.HeapArchiveWriter(self.filename)
+        for heap in receiver:
+            writer.write(heap)
+        assert_equal(n_heaps, len(writer))
+        writer.close()
+
+    def test_random_access(self):
+        self._write(5)
+        reader = recv.HeapArchiveReader(self.filename)
+        assert_equal(5, len(reader))
+        assert_equal([0], reader.descriptor_indices)
+        assert_in(104, reader)
+        assert_not_in(103, reader)
+        assert_equal(2, reader.find(104))
+        assert_equal(108, reader.get_cnt(4))
+        assert_raises(IndexError, reader.find, 103)
+        assert_raises(IndexError, lambda: reader[5])
+
+        ig = spead2.ItemGroup()
+        for index in reader.descriptor_indices:
+            ig.update(reader[index])
+        for i in [3, 1, -1]:
+            heap = reader[i]
+            ig.update(heap)
+            j = i % 5
+            assert_equal(100 + 2 * j, heap.cnt)
+            assert_equal(j, ig['index'].value)
+            np.testing.assert_equal(np.arange(100, dtype=np.uint32) * j, ig['values'].value)
+
+    def test_not_archive(self):
+        with open(self.filename, 'wb') as f:
+            f.write(b'\0' * 128)
+        assert_raises(ValueError, recv.HeapArchiveReader, self.filename)
+
+
+class TestRelay(object):
+    def _relay(self, **kwargs):
+        """Send heaps with cnts 1 to 6 through a relay configured by `kwargs`,
+        and return the heaps that arrive at the other end, and the relay
+        statistics.
+        """
+        thread_pool = spead2.ThreadPool(2)
+        receiver = recv.Stream(thread_pool)
+        receiver.add_udp_reader(8888, bind_hostname='127.0.0.1')
+        output = send.UdpStream(thread_pool, '127.0.0.1', 8888)
+        relay = recv.Relay(thread_pool, output)
+        if 'cnt_filter' in kwargs:
+            relay.set_cnt_filter(*kwargs['cnt_filter'])
+        if 'item_ids' in kwargs:
+            relay.set_item_ids(kwargs['item_ids'])
+        relay.add_udp_reader(8889, bind_hostname='127.0.0.1')
+        sender = send.UdpStream(thread_pool, '127.0.0.1', 8889, send.StreamConfig(rate=1e7))
+        ig = send.ItemGroup()
+        ig.add_item(0x1000, 'even', 'even heaps', (), format=[('u', 32)])
+        ig.add_item(0x1001, 'odd', 'odd heaps', (), format=[('u', 32)])
+        gen = send.HeapGenerator(ig)
+        for i in range(1, 7):
+            ig['odd' if i % 2 else 'even'].value = i
+            sender.send_heap(gen.get_heap(), cnt=i)
+        sender.send_heap(gen.get_end(), cnt=7)
+        heaps = list(receiver)
+        relay.stop()
+        return heaps, relay.stats
+
+    def test_forward(self):
+        heaps, stats = self._relay()
+        assert_equal([1, 2, 3, 4, 5, 6], [heap.cnt for heap in heaps])
+        assert_equal(7, stats.packets)
+        assert_equal(7, stats.forwarded_packets)
+        assert_equal(0, stats.filtered)
+
+    def test_cnt_filter(self):
+        heaps, stats = self._relay(cnt_filter=(2, 1))
+        assert_equal([1, 3, 5], [heap.cnt for heap in heaps])
+        assert_equal(3, stats.filtered)
+
+    def test_item_ids(self):
+        heaps, stats = self._relay(item_ids=[0x1000])
+        # Heap 1 carries the descriptors, so it is forwarded too
+        assert_equal([1, 2, 4, 6], [heap.cnt for heap in heaps])
+        ig = spead2.ItemGroup()
+        values = []
+        for heap in heaps:
+            updated = ig.update(heap)
+            if 'even' in updated:
+                values.append(updated['even'].value)
+        assert_equal([2, 4, 6], values)
+
+    def test_bad_args(self):
+        thread_pool = spead2.ThreadPool()
+        output = send.BytesStream(thread_pool)
+        assert_raises(ValueError, recv.Relay, thread_pool, output, batch_size=0)
+        relay = recv.Relay(thread_pool, output)
+        assert_raises(ValueError, relay.set_cnt_filter, 2, 2)
+        assert_raises(ValueError, relay.set_rate, -1.0)
+        assert_raises(ValueError, relay.set_rate, 1e6, 0)
+        assert_raises(ValueError, relay.set_rate, 1e6, 1000)
+        relay.set_rate(0.0, 0)
@@ -0,0 +1,95 @@
+# Copyright 2016 SKA South Africa
+#
+# This program is free software: you can redistribute it and/or modify it under
+# the terms of the GNU Lesser General Public License as published by the Free
+# Software Foundation, either version 3 of the License, or (at your option) any
+# later version.
+#
+# This program is distributed in the hope that it will be useful, but WITHOUT
+# ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+# FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+# details.
+#
+# You should have received a copy of the GNU Lesser General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+"""Tests for :py:mod:`spead2.recv.asyncio`"""
+
+from __future__ import division, print_function
+import sys
+from nose.plugins.skip import SkipTest
+if sys.version_info < (3, 5):
+    raise SkipTest('asyncio integration requires Python 3.5+')
+
+import asyncio
+import numpy as np
+import spead2
+import spead2.send
+import spead2.recv.asyncio
+from nose.tools import *
+
+
+class TestStream(object):
+    def setup(self):
+        self.loop = asyncio.new_event_loop()
+        self.stream = spead2.recv.asyncio.Stream(spead2.ThreadPool(), loop=self.loop)
+
+    def teardown(self):
+        self.stream.stop()
+        self.loop.close()
+
+    def _make_data(self, n_heaps):
+        """Encode `n_heaps` heaps (each with a single item whose value is the
+        heap index) followed by a stop heap"""
+        sender = spead2.send.BytesStream(spead2.ThreadPool())
+        ig = spead2.send.ItemGroup()
+        item = ig.add_item(0x1000, 'value', 'heap index', (), np.int32)
+        for i in range(n_heaps):
+            item.value = i
+            sender.send_heap(ig.get_heap())
+        sender.send_heap(ig.get_end())
+        return sender.getvalue()
+
+    async def _collect(self):
+        ig = spead2.ItemGroup()
+        values = []
+        async for heap in self.stream:
+            ig.update(heap)
+            values.append(int(ig['value'].value))
+        return values
+
+    def test_async_for(self):
+        """Iterating with ``async for`` must yield every heap, then stop"""
+        self.stream.add_buffer_reader(self._make_data(10))
+        values = self.loop.run_until_complete(self._collect())
+        assert_equal(list(range(10)), values)
+
+    def test_concurrent_get(self):
+        """Multiple in-flight calls to get are satisfied in order"""
+        async def run():
+            waiters = [self.loop.create_task(self.stream.get()) for i in range(4)]
+            await asyncio.sleep(0)
+            self.stream.add_buffer_reader(self._make_data(3))
+            results = await asyncio.gather(*waiters, return_exceptions=True)
+            return results
+        results = self.loop.run_until_complete(run())
+        ig = spead2.ItemGroup()
+        for i in range(3):
+            ig.update(results[i])
+            assert_equal(i, ig['value'].value)
+        assert_is_instance(results[3], spead2.Stopped)
+        assert_false(self.stream._listening)
+
+    def test_cancelled_waiter(self):
+        """A cancelled waiter must not consume a heap"""
+        async def run():
+            cancelled = self.loop.create_task(self.stream.get())
+            waiter = self.loop.create_task(self.stream.get())
+            await asyncio.sleep(0)
+            cancelled.cancel()
+            self.stream.add_buffer_reader(self._make_data(1))
+            return await waiter
+        heap = self.loop.run_until_complete(run())
+        ig = spead2.ItemGroup()
+        ig.update(heap)
+        assert_equal(0, ig['value'].value)
@@ -386,6 +386,33 @@ class TestEncode(object):
         packet = list(send.PacketGenerator(heap, 0x123456, 1500))
         assert_equal(hexlify(expected), hexlify(packet))
 
+    def test_checksum(self):
+        """Tests sending a CRC-32C of the (padding) payload."""
+        expected = [
+            b''.join([
+                self.flavour.make_header(7),
+                self.flavour.make_immediate(spead2.HEAP_CNT_ID, 0x123456),
+                self.flavour.make_immediate(spead2.HEAP_LENGTH_ID, 1),
+                self.flavour.make_immediate(spead2.PAYLOAD_OFFSET_ID, 0),
+                self.flavour.make_immediate(spead2.PAYLOAD_LENGTH_ID, 1),
+                self.flavour.make_immediate(spead2.STREAM_CTRL_ID, spead2.CTRL_STREAM_START),
+                self.flavour.make_immediate(0x0f00, 0x527d5351),   # CRC-32C of b'\0'
+                self.flavour.make_address(spead2.NULL_ID, 0),
+                struct.pack('B', 0)
+            ])
+        ]
+        heap = send.Heap(self.flavour)
+        heap.add_start()
+        heap.checksum_id = 0x0f00
+        packet = list(send.PacketGenerator(heap, 0x123456, 1500))
+        assert_equal(hexlify(expected), hexlify(packet))
+
+    def test_checksum_small_address(self):
+        """A checksum needs at least 32 heap address bits."""
+        heap = send.Heap(Flavour(4, 64, 24, 0))
+        with assert_raises(ValueError):
+            heap.checksum_id = 0x0f00
+
 
 class TestStream(object):
     def setup(self):
@@ -453,3 +480,39 @@ class TestStream(object):
                     struct.pack('B', 0)
                 ])
         assert_equal(hexlify(expected), hexlify(self.stream.getvalue()))
+
+    def test_send_heaps(self):
+        """Sending a batch must produce the same output as sending the heaps
+        one at a time, with more heaps than fit in the queue."""
+        ig = send.ItemGroup(flavour=self.flavour)
+        heaps = [ig.get_start() for i in range(5)]
+        expected_stream = send.BytesStream(spead2.ThreadPool())
+        expected_stream.set_cnt_sequence(3, 1)
+        for heap in heaps:
+            expected_stream.send_heap(heap)
+        self.stream.set_cnt_sequence(3, 1)
+        size = self.stream.send_heaps(heaps)
+        assert_equal(hexlify(expected_stream.getvalue()), hexlify(self.stream.getvalue()))
+        assert_equal(len(self.stream.getvalue()), size)
+
+    def test_send_heaps_explicit_cnts(self):
+        ig = send.ItemGroup(flavour=self.flavour)
+        heaps = [ig.get_start() for i in range(3)]
+        expected_stream = send.BytesStream(spead2.ThreadPool())
+        for heap, cnt in zip(heaps, [10, 20, 30]):
+            expected_stream.send_heap(heap, cnt)
+        self.stream.send_heaps(heaps, [10, 20, 30])
+        assert_equal(hexlify(expected_stream.getvalue()), hexlify(self.stream.getvalue()))
+
+    def test_send_heaps_bad_cnts(self):
+        ig = send.ItemGroup(flavour=self.flavour)
+        heaps = [ig.get_start() for i in range(3)]
+        assert_raises(ValueError, self.stream.send_heaps, heaps, [1, 2])
+        assert_equal(0, self.stream.send_heaps([]))
+
+    def test_send_heaps_error(self):
+        """An error in sending one heap of a batch must be reported."""
+        stream = send.UdpStream(
+            spead2.ThreadPool(), "localhost", 8888,
+            send.StreamConfig(max_packet_size=100000), buffer_size=0)
+        assert_raises(IOError, stream.send_heaps, [self.heap, self.heap])
@@ -0,0 +1,122 @@
+# Copyright 2016 SKA South Africa
+#
+# This program is free software: you can redistribute it and/or modify it under
+# the terms of the GNU Lesser General Public License as published by the Free
+# Software Foundation, either version 3 of the License, or (at your option) any
+# later version.
+#
+# This program is distributed in the hope that it will be useful, but WITHOUT
+# ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+# FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+# details.
+#
+# You should have received a copy of the GNU Lesser General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+"""Tests for :py:mod:`spead2.send.asyncio`"""
+
+from __future__ import division, print_function
+import sys
+from nose.plugins.skip import SkipTest
+if sys.version_info < (3, 5):
+    raise SkipTest('asyncio integration requires Python 3.5+')
+
+import asyncio
+import numpy as np
+import spead2
+import spead2.recv
+import spead2.send
+from spead2.send.asyncio import UdpStream
+from nose.tools import *
+
+
+class TestUdpStream(object):
+    def setup(self):
+        self.loop = asyncio.new_event_loop()
+        # Make a stream slow enough that we can test async interactions
+        config = spead2.send.StreamConfig(rate=5e6)
+        self.stream = UdpStream(spead2.ThreadPool(), 'localhost', 8888, config, loop=self.loop)
+        self.ig = spead2.send.ItemGroup()
+        self.ig.add_item(0x1000, 'test', 'Test item', shape=(256 * 1024,), dtype=np.uint8)
+        self.ig['test'].value = np.zeros((256 * 1024,), np.uint8)
+        self.heap = self.ig.get_heap()
+
+    def teardown(self):
+        self.loop.close()
+
+    async def _test_async_flush(self):
+        assert_greater(self.stream._active, 0)
+        await self.stream.async_flush()
+        assert_equal(self.stream._active, 0)
+
+    def test_async_flush(self):
+        for i in range(3):
+            self.stream.async_send_heap(self.heap)
+        self.loop.run_until_complete(self._test_async_flush())
+
+    def test_async_flush_fail(self):
+        """Test async_flush in the case that the last heap sent failed.
+        This is arranged by filling up the queue slots first.
+        """
+        futures = [self.stream.async_send_heap(self.heap) for i in range(5)]
+        self.loop.run_until_complete(self._test_async_flush())
+        for future in futures[:-1]:
+            assert_greater(future.result(), 0)
+        assert_is_instance(futures[-1].exception(), IOError)
+
+    def test_send_error(self):
+        """An error in sending must be reported through the future."""
+        # Create a stream with a packet size that is bigger than the likely
+        # MTU. It should cause an error.
+        stream = UdpStream(
+            spead2.ThreadPool(), "localhost", 8888,
+            spead2.send.StreamConfig(max_packet_size=100000), buffer_size=0,
+            loop=self.loop)
+        future = stream.async_send_heap(self.heap)
+        with assert_raises(IOError):
+            self.loop.run_until_complete(future)
+
+    def test_async_send_heaps(self):
+        """A batch larger than max_heaps must be sent in full"""
+        config = spead2.send.StreamConfig(max_heaps=2)
+        stream = UdpStream(spead2.ThreadPool(), 'localhost', 8888, config, loop=self.loop)
+        heaps = [self.ig.get_start() for i in range(5)]
+        future = stream.async_send_heaps(heaps)
+        size = self.loop.run_until_complete(future)
+        assert_greater(size, 0)
+        assert_equal(0, stream._active)
+
+    def test_async_send_heaps_queue_busy(self):
+        """A batch must wait for queue space taken by earlier heaps rather
+        than dropping heaps.
+        """
+        config = spead2.send.StreamConfig(rate=5e6, max_heaps=2)
+        stream = UdpStream(spead2.ThreadPool(), 'localhost', 8888, config, loop=self.loop)
+        # Fill the queue, so that the batch cannot start immediately
+        first = [stream.async_send_heap(self.heap) for i in range(2)]
+        future = stream.async_send_heaps([self.ig.get_start() for i in range(5)])
+        size = self.loop.run_until_complete(future)
+        assert_greater(size, 0)
+        for f in first:
+            assert_greater(f.result(), 0)
+
+    def test_async_send_heaps_order(self):
+        """Heaps that wait for queue space must still be sent in order, with
+        the end of stream last.
+        """
+        receiver = spead2.recv.Stream(spead2.ThreadPool())
+        receiver.add_udp_reader(8887, bind_hostname='localhost')
+        config = spead2.send.StreamConfig(rate=5e6, max_heaps=2)
+        stream = UdpStream(spead2.ThreadPool(), 'localhost', 8887, config, loop=self.loop)
+        ig = spead2.send.ItemGroup()
+        ig.add_item(0x1001, 'small', 'Small item', shape=(), format=[('u', 32)], value=1)
+        heap = ig.get_heap(descriptors='all', data='all')
+        # Fill the queue, so that heaps of the batch are rejected
+        first = [stream.async_send_heap(self.heap, cnt) for cnt in [1, 2]]
+        heaps = [heap] * 5 + [ig.get_end()]
+        future = stream.async_send_heaps(heaps, list(range(3, 9)))
+        self.loop.run_until_complete(future)
+        for f in first:
+            assert_greater(f.result(), 0)
+        cnts = [h.cnt for h in receiver]
+        assert_equal(list(range(1, 8)), cnts)
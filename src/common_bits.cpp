@@ -0,0 +1,325 @@
+/* Copyright 2016 SKA South Africa
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <stdexcept>
+#include <spead2/common_bits.h>
+
+namespace spead2
+{
+
+namespace
+{
+
+/// Extracts big-endian bit-fields from a byte stream
+class bit_reader
+{
+private:
+    const std::uint8_t *ptr;
+    std::uint64_t buffer = 0;   ///< Bits read from the stream but not yet consumed
+    int buffer_bits = 0;        ///< Number of valid bits in @ref buffer
+
+    // Only valid for bits <= 32, so that buffer cannot overflow
+    std::uint64_t get_small(int bits)
+    {
+        while (buffer_bits < bits)
+        {
+            buffer = (buffer << 8) | *ptr++;
+            buffer_bits += 8;
+        }
+        buffer_bits -= bits;
+        std::uint64_t value = buffer >> buffer_bits;
+        buffer &= (std::uint64_t(1) << buffer_bits) - 1;
+        return value;
+    }
+
+public:
+    explicit bit_reader(const std::uint8_t *ptr) : ptr(ptr) {}
+
+    std::uint64_t get(int bits)
+    {
+        if (bits > 32)
+        {
+            std::uint64_t high = get_small(bits - 32);
+            return (high << 32) | get_small(32);
+        }
+        else
+            return get_small(bits);
+    }
+};
+
+/// Inserts big-endian bit-fields into a byte stream
+class bit_writer
+{
+private:
+    std::uint8_t *ptr;
+    std::uint64_t buffer = 0;   ///< Bits not yet written to the stream
+    int buffer_bits = 0;        ///< Number of valid bits in @ref buffer
+
+    // Only valid for bits <= 32 and value < 2^bits
+    void put_small(std::uint64_t value, int bits)
+    {
+        buffer = (buffer << bits) | value;
+        buffer_bits += bits;
+        while (buffer_bits >= 8)
+        {
+            buffer_bits -= 8;
+            *ptr++ = std::uint8_t(buffer >> buffer_bits);
+        }
+        buffer &= (std::uint64_t(1) << buffer_bits) - 1;
+    }
+
+public:
+    explicit bit_writer(std::uint8_t *ptr) : ptr(ptr) {}
+
+    void put(std::uint64_t value, int bits)
+    {
+        if (bits < 64)
+            value &= (std::uint64_t(1) << bits) - 1;
+        if (bits > 32)
+        {
+            put_small(value >> 32, bits - 32);
+            put_small(value & 0xffffffff, 32);
+        }
+        else
+            put_small(value, bits);
+    }
+
+    /// Write out any partial byte, padding with zeros
+    void flush()
+    {
+        if (buffer_bits > 0)
+            *ptr++ = std::uint8_t(buffer << (8 - buffer_bits));
+        buffer = 0;
+        buffer_bits = 0;
+    }
+};
+
+} // anonymous namespace
+
+static void check_bits(const std::vector<int> &bits)
+{
+    for (int b : bits)
+        if (b < 1 || b > 64)
+            throw std::invalid_argument("bit-field width must be between 1 and 64");
+}
+
+/* Special cases for single-field records of common widths. Each handles a
+ * whole number of groups (where a group ends on a byte boundary) and returns
+ * the number of records handled, leaving any tail to the generic code.
+ * They are written without loop-carried state so that the compiler can
+ * unroll and vectorise them.
+ */
+
+template<int Bytes>
+static std::size_t unpack_bytes(const std::uint8_t * __restrict__ in, std::size_t records,
+                                std::uint64_t * __restrict__ out)
+{
+    for (std::size_t i = 0; i < records; i++)
+    {
+        std::uint64_t value = 0;
+        for (int j = 0; j < Bytes; j++)
+            value = (value << 8) | in[i * Bytes + j];
+        out[i] = value;
+    }
+    return records;
+}
+
+template<int Bytes>
+static std::size_t pack_bytes(const std::uint64_t * __restrict__ in, std::size_t records,
+                              std::uint8_t * __restrict__ out)
+{
+    for (std::size_t i = 0; i < records; i++)
+    {
+        std::uint64_t value = in[i];
+        for (int j = Bytes - 1; j >= 0; j--)
+        {
+            out[i * Bytes + j] = std::uint8_t(value);
+            value >>= 8;
+        }
+    }
+    return records;
+}
+
+static std::size_t unpack_4(const std::uint8_t * __restrict__ in, std::size_t records,
+                            std::uint64_t * __restrict__ out)
+{
+    std::size_t groups = records / 2;
+    for (std::size_t i = 0; i < groups; i++)
+    {
+        out[2 * i] = in[i] >> 4;
+        out[2 * i + 1] = in[i] & 0xf;
+    }
+    return groups * 2;
+}
+
+static std::size_t pack_4(const std::uint64_t * __restrict__ in, std::size_t records,
+                          std::uint8_t * __restrict__ out)
+{
+    std::size_t groups = records / 2;
+    for (std::size_t i = 0; i < groups; i++)
+        out[i] = std::uint8_t(((in[2 * i] & 0xf) << 4) | (in[2 * i + 1] & 0xf));
+    return groups * 2;
+}
+
+static std::size_t unpack_10(const std::uint8_t * __restrict__ in, std::size_t records,
+                             std::uint64_t * __restrict__ out)
+{
+    std::size_t groups = records / 4;
+    for (std::size_t i = 0; i < groups; i++)
+    {
+        const std::uint8_t *p = in + 5 * i;
+        std::uint64_t v = (std::uint64_t(p[0]) << 32) | (std::uint64_t(p[1]) << 24)
+            | (std::uint64_t(p[2]) << 16) | (std::uint64_t(p[3]) << 8) | p[4];
+        out[4 * i] = (v >> 30) & 0x3ff;
+        out[4 * i + 1] = (v >> 20) & 0x3ff;
+        out[4 * i + 2] = (v >> 10) & 0x3ff;
+        out[4 * i + 3] = v & 0x3ff;
+    }
+    return groups * 4;
+}
+
+static std::size_t pack_10(const std::uint64_t * __restrict__ in, std::size_t records,
+                           std::uint8_t * __restrict__ out)
+{
+    std::size_t groups = records / 4;
+    for (std::size_t i = 0; i < groups; i++)
+    {
+        const std::uint64_t *q = in + 4 * i;
+        std::uint64_t v = ((q[0] & 0x3ff) << 30) | ((q[1] & 0x3ff) << 20)
+            | ((q[2] & 0x3ff) << 10) | (q[3] & 0x3ff);
+        std::uint8_t *p = out + 5 * i;
+        p[0] = std::uint8_t(v >> 32);
+        p[1] = std::uint8_t(v >> 24);
+        p[2] = std::uint8_t(v >> 16);
+        p[3] = std::uint8_t(v >> 8);
+        p[4] = std::uint8_t(v);
+    }
+    return groups * 4;
+}
+
+static std::size_t unpack_12(const std::uint8_t * __restrict__ in, std::size_t records,
+                             std::uint64_t * __restrict__ out)
+{
+    std::size_t groups = records / 2;
+    for (std::size_t i = 0; i < groups; i++)
+    {
+        const std::uint8_t *p = in + 3 * i;
+        out[2 * i] = (std::uint64_t(p[0]) << 4) | (p[1] >> 4);
+        out[2 * i + 1] = (std::uint64_t(p[1] & 0xf) << 8) | p[2];
+    }
+    return groups * 2;
+}
+
+static std::size_t pack_12(const std::uint64_t * __restrict__ in, std::size_t records,
+                           std::uint8_t * __restrict__ out)
+{
+    std::size_t groups = records / 2;
+    for (std::size_t i = 0; i < groups; i++)
+    {
+        std::uint64_t a = in[2 * i] & 0xfff;
+        std::uint64_t b = in[2 * i + 1] & 0xfff;
+        std::uint8_t *p = out + 3 * i;
+        p[0] = std::uint8_t(a >> 4);
+        p[1] = std::uint8_t(((a & 0xf) << 4) | (b >> 8));
+        p[2] = std::uint8_t(b);
+    }
+    return groups * 2;
+}
+
+/// Dispatch to a special-case unpacker, returning the number of records handled
+static std::size_t unpack_special(const std::uint8_t *in, std::size_t records,
+                                  int bits, std::uint64_t *out)
+{
+    switch (bits)
+    {
+    case 4: return unpack_4(in, records, out);
+    case 10: return unpack_10(in, records, out);
+    case 12: return unpack_12(in, records, out);
+    case 8: return unpack_bytes<1>(in, records, out);
+    case 16: return unpack_bytes<2>(in, records, out);
+    case 24: return unpack_bytes<3>(in, records, out);
+    case 32: return unpack_bytes<4>(in, records, out);
+    case 40: return unpack_bytes<5>(in, records, out);
+    case 48: return unpack_bytes<6>(in, records, out);
+    case 56: return unpack_bytes<7>(in, records, out);
+    case 64: return unpack_bytes<8>(in, records, out);
+    default: return 0;
+    }
+}
+
+/// Dispatch to a special-case packer, returning the number of records handled
+static std::size_t pack_special(const std::uint64_t *in, std::size_t records,
+                                int bits, std::uint8_t *out)
+{
+    switch (bits)
+    {
+    case 4: return pack_4(in, records, out);
+    case 10: return pack_10(in, records, out);
+    case 12: return pack_12(in, records, out);
+    case 8: return pack_bytes<1>(in, records, out);
+    case 16: return pack_bytes<2>(in, records, out);
+    case 24: return pack_bytes<3>(in, records, out);
+    case 32: return pack_bytes<4>(in, records, out);
+    case 40: return pack_bytes<5>(in, records, out);
+    case 48: return pack_bytes<6>(in, records, out);
+    case 56: return pack_bytes<7>(in, records, out);
+    case 64: return pack_bytes<8>(in, records, out);
+    default: return 0;
+    }
+}
+
+void unpack_bits(const std::uint8_t *in, std::size_t records,
+                 const std::vector<int> &bits, std::uint64_t * const *out)
+{
+    check_bits(bits);
+    std::size_t start = 0;
+    if (bits.size() == 1)
+    {
+        start = unpack_special(in, records, bits[0], out[0]);
+        // Special cases always stop on a byte boundary
+        in += start * bits[0] / 8;
+    }
+    bit_reader reader(in);
+    for (std::size_t i = start; i < records; i++)
+        for (std::size_t j = 0; j < bits.size(); j++)
+            out[j][i] = reader.get(bits[j]);
+}
+
+void pack_bits(const std::uint64_t * const *in, std::size_t records,
+               const std::vector<int> &bits, std::uint8_t *out)
+{
+    check_bits(bits);
+    std::size_t start = 0;
+    if (bits.size() == 1)
+    {
+        start = pack_special(in[0], records, bits[0], out);
+        out += start * bits[0] / 8;
+    }
+    bit_writer writer(out);
+    for (std::size_t i = start; i < records; i++)
+        for (std::size_t j = 0; j < bits.size(); j++)
+            writer.put(in[j][i], bits[j]);
+    writer.flush();
+}
+
+} // namespace spead2
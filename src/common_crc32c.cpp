@@ -0,0 +1,270 @@
+/* Copyright 2016 SKA South Africa
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * The hardware implementation follows the approach of Mark Adler's crc32c.c:
+ * three independent CRCs are computed over adjacent blocks so that the
+ * latency of the CRC32 instruction is hidden, and the results are combined
+ * using precomputed tables that append a block of zeros to a CRC.
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <spead2/common_features.h>
+#include <spead2/common_crc32c.h>
+#if SPEAD2_USE_SSE42_CRC32
+# include <nmmintrin.h>
+#endif
+
+namespace spead2
+{
+
+namespace
+{
+
+/// CRC-32C polynomial, bit-reversed
+static constexpr std::uint32_t poly = 0x82f63b78;
+
+/// Tables for the slicing-by-8 software implementation
+class crc32c_software_tables
+{
+public:
+    std::uint32_t table[8][256];
+
+    crc32c_software_tables()
+    {
+        for (std::uint32_t n = 0; n < 256; n++)
+        {
+            std::uint32_t crc = n;
+            for (int k = 0; k < 8; k++)
+                crc = (crc & 1) ? (crc >> 1) ^ poly : crc >> 1;
+            table[0][n] = crc;
+        }
+        for (std::uint32_t n = 0; n < 256; n++)
+        {
+            std::uint32_t crc = table[0][n];
+            for (int k = 1; k < 8; k++)
+            {
+                crc = table[0][crc & 0xff] ^ (crc >> 8);
+                table[k][n] = crc;
+            }
+        }
+    }
+};
+
+static const crc32c_software_tables software_tables;
+
+static std::uint32_t crc32c_software(
+    std::uint32_t crc, const std::uint8_t *next, std::size_t length) noexcept
+{
+    const auto &table = software_tables.table;
+    while (length > 0 && (std::uintptr_t(next) & 7) != 0)
+    {
+        crc = table[0][(crc ^ *next++) & 0xff] ^ (crc >> 8);
+        length--;
+    }
+    while (length >= 8)
+    {
+        // Input is interpreted as little-endian
+        std::uint64_t word = 0;
+        for (int i = 7; i >= 0; i--)
+            word = (word << 8) | next[i];
+        word ^= crc;
+        crc = table[7][word & 0xff]
+            ^ table[6][(word >> 8) & 0xff]
+            ^ table[5][(word >> 16) & 0xff]
+            ^ table[4][(word >> 24) & 0xff]
+            ^ table[3][(word >> 32) & 0xff]
+            ^ table[2][(word >> 40) & 0xff]
+            ^ table[1][(word >> 48) & 0xff]
+            ^ table[0][word >> 56];
+        next += 8;
+        length -= 8;
+    }
+    while (length > 0)
+    {
+        crc = table[0][(crc ^ *next++) & 0xff] ^ (crc >> 8);
+        length--;
+    }
+    return crc;
+}
+
+#if SPEAD2_USE_SSE42_CRC32
+
+/* Block sizes for the three-way interleaved computation. They must be
+ * multiples of 8 and powers of 2.
+ */
+static constexpr std::size_t long_block = 8192;
+static constexpr std::size_t short_block = 256;
+
+/// Multiply a vector by a 32x32 matrix over GF(2)
+static std::uint32_t gf2_matrix_times(const std::uint32_t *mat, std::uint32_t vec)
+{
+    std::uint32_t sum = 0;
+    for (; vec; vec >>= 1, mat++)
+        if (vec & 1)
+            sum ^= *mat;
+    return sum;
+}
+
+static void gf2_matrix_square(std::uint32_t *square, const std::uint32_t *mat)
+{
+    for (int n = 0; n < 32; n++)
+        square[n] = gf2_matrix_times(mat, mat[n]);
+}
+
+/**
+ * Tables that map a CRC to the CRC obtained by appending @a length zero
+ * bytes, one table per byte of the CRC.
+ */
+class crc32c_shift_table
+{
+private:
+    std::uint32_t table[4][256];
+
+public:
+    explicit crc32c_shift_table(std::size_t length)
+    {
+        // Operator for a single zero bit
+        std::uint32_t odd[32], even[32];
+        odd[0] = poly;
+        for (int n = 1; n < 32; n++)
+            odd[n] = std::uint32_t(1) << (n - 1);
+        gf2_matrix_square(even, odd);   // 2 zero bits
+        gf2_matrix_square(odd, even);   // 4 zero bits
+        // Repeatedly square to get operators for 8, 16, ... zero bits
+        const std::uint32_t *op;
+        while (true)
+        {
+            gf2_matrix_square(even, odd);
+            length >>= 1;
+            if (length == 0)
+            {
+                op = even;
+                break;
+            }
+            gf2_matrix_square(odd, even);
+            length >>= 1;
+            if (length == 0)
+            {
+                op = odd;
+                break;
+            }
+        }
+        for (std::uint32_t n = 0; n < 256; n++)
+            for (int k = 0; k < 4; k++)
+                table[k][n] = gf2_matrix_times(op, n << (8 * k));
+    }
+
+    std::uint32_t operator()(std::uint32_t crc) const
+    {
+        return table[0][crc & 0xff] ^ table[1][(crc >> 8) & 0xff]
+            ^ table[2][(crc >> 16) & 0xff] ^ table[3][crc >> 24];
+    }
+};
+
+static const crc32c_shift_table shift_long(long_block);
+static const crc32c_shift_table shift_short(short_block);
+
+static inline std::uint64_t load64(const std::uint8_t *ptr)
+{
+    std::uint64_t value;
+    std::memcpy(&value, ptr, sizeof(value));
+    return value;
+}
+
+template<std::size_t Block>
+__attribute__((target("sse4.2")))
+static inline std::uint32_t crc32c_blocks(
+    std::uint32_t crc0, const std::uint8_t *&next, std::size_t &length,
+    const crc32c_shift_table &shift) noexcept
+{
+    while (length >= 3 * Block)
+    {
+        std::uint64_t c0 = crc0, c1 = 0, c2 = 0;
+        const std::uint8_t *end = next + Block;
+        do
+        {
+            c0 = _mm_crc32_u64(c0, load64(next));
+            c1 = _mm_crc32_u64(c1, load64(next + Block));
+            c2 = _mm_crc32_u64(c2, load64(next + 2 * Block));
+            next += 8;
+        } while (next < end);
+        crc0 = shift(std::uint32_t(c0)) ^ std::uint32_t(c1);
+        crc0 = shift(crc0) ^ std::uint32_t(c2);
+        next += 2 * Block;
+        length -= 3 * Block;
+    }
+    return crc0;
+}
+
+__attribute__((target("sse4.2")))
+static std::uint32_t crc32c_hardware(
+    std::uint32_t crc, const std::uint8_t *next, std::size_t length) noexcept
+{
+    while (length > 0 && (std::uintptr_t(next) & 7) != 0)
+    {
+        crc = _mm_crc32_u8(crc, *next++);
+        length--;
+    }
+    crc = crc32c_blocks<long_block>(crc, next, length, shift_long);
+    crc = crc32c_blocks<short_block>(crc, next, length, shift_short);
+    std::uint64_t crc64 = crc;
+    while (length >= 8)
+    {
+        crc64 = _mm_crc32_u64(crc64, load64(next));
+        next += 8;
+        length -= 8;
+    }
+    crc = std::uint32_t(crc64);
+    while (length > 0)
+    {
+        crc = _mm_crc32_u8(crc, *next++);
+        length--;
+    }
+    return crc;
+}
+
+static bool detect_sse42()
+{
+    // Needed because this runs from a static initialiser
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse4.2");
+}
+
+static const bool have_sse42 = detect_sse42();
+
+#endif // SPEAD2_USE_SSE42_CRC32
+
+} // anonymous namespace
+
+std::uint32_t crc32c(const void *data, std::size_t length, std::uint32_t crc) noexcept
+{
+    const std::uint8_t *next = reinterpret_cast<const std::uint8_t *>(data);
+    crc = ~crc;
+#if SPEAD2_USE_SSE42_CRC32
+    if (have_sse42)
+        crc = crc32c_hardware(crc, next, length);
+    else
+#endif
+        crc = crc32c_software(crc, next, length);
+    return ~crc;
+}
+
+} // namespace spead2
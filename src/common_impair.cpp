@@ -0,0 +1,174 @@
+/* Copyright 2016 SKA South Africa
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/**
+ * @file
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+#include <utility>
+#include <stdexcept>
+#include <boost/asio/buffer.hpp>
+#include <spead2/common_impair.h>
+#include <spead2/send_heap.h>
+#include <spead2/send_packet.h>
+
+namespace spead2
+{
+
+namespace
+{
+
+/**
+ * Small pseudo-random generator (splitmix64). It is used instead of the
+ * standard distributions because those are implementation-defined, and the
+ * impaired sequence must be reproducible everywhere for a given seed.
+ */
+class impair_random
+{
+private:
+    std::uint64_t state;
+
+public:
+    explicit impair_random(std::uint64_t seed) : state(seed) {}
+
+    std::uint64_t next()
+    {
+        std::uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        return z ^ (z >> 31);
+    }
+
+    /// Uniform value in [0, 1)
+    double uniform()
+    {
+        return (next() >> 11) * (1.0 / 9007199254740992.0);
+    }
+
+    /// Uniform integer in [0, n]
+    std::uint64_t below_or_equal(std::uint64_t n)
+    {
+        return next() % (n + 1);
+    }
+};
+
+} // anonymous namespace
+
+packet_impairer::packet_impairer(const impairment_config &config)
+    : config(config)
+{
+    if (!(config.drop >= 0.0 && config.drop <= 1.0))
+        throw std::invalid_argument("drop probability must be in [0, 1]");
+    if (!(config.duplicate >= 0.0 && config.duplicate <= 1.0))
+        throw std::invalid_argument("duplicate probability must be in [0, 1]");
+    if (config.interleave == 0)
+        throw std::invalid_argument("interleave must be at least 1");
+}
+
+void packet_impairer::add_heap(std::vector<packet_data> &&packets)
+{
+    heaps.push_back(std::move(packets));
+}
+
+void packet_impairer::add_heap(const send::heap &h, item_pointer_t cnt, std::size_t max_packet_size)
+{
+    std::vector<packet_data> packets;
+    send::packet_generator gen(h, cnt, max_packet_size);
+    while (true)
+    {
+        send::packet pkt = gen.next_packet();
+        if (pkt.buffers.empty())
+            break;
+        packet_data data(boost::asio::buffer_size(pkt.buffers));
+        boost::asio::buffer_copy(boost::asio::buffer(data), pkt.buffers);
+        packets.push_back(std::move(data));
+    }
+    add_heap(std::move(packets));
+}
+
+std::size_t packet_impairer::get_num_packets() const
+{
+    std::size_t total = 0;
+    for (const auto &h : heaps)
+        total += h.size();
+    return total;
+}
+
+std::vector<packet_impairer::packet_data> packet_impairer::get_packets() const
+{
+    impair_random rng(config.seed);
+
+    // Interleave: take groups of heaps and emit their packets round-robin
+    std::vector<const packet_data *> order;
+    order.reserve(get_num_packets());
+    for (std::size_t first = 0; first < heaps.size(); first += config.interleave)
+    {
+        std::size_t last = std::min(heaps.size(), first + config.interleave);
+        for (std::size_t i = 0; ; i++)
+        {
+            bool any = false;
+            for (std::size_t j = first; j < last; j++)
+                if (i < heaps[j].size())
+                {
+                    order.push_back(&heaps[j][i]);
+                    any = true;
+                }
+            if (!any)
+                break;
+        }
+    }
+
+    // Drop and duplicate
+    std::vector<const packet_data *> kept;
+    kept.reserve(order.size());
+    for (const packet_data *pkt : order)
+    {
+        if (config.drop > 0.0 && rng.uniform() < config.drop)
+            continue;
+        kept.push_back(pkt);
+        if (config.duplicate > 0.0 && rng.uniform() < config.duplicate)
+            kept.push_back(pkt);
+    }
+
+    /* Reorder: delay each packet by a random amount up to the window, and
+     * sort by the delayed position. Stable sorting keeps ties in their
+     * original order, so a window of zero is the identity.
+     */
+    std::vector<std::pair<std::uint64_t, const packet_data *>> keyed;
+    keyed.reserve(kept.size());
+    for (std::size_t i = 0; i < kept.size(); i++)
+    {
+        std::uint64_t delay = config.reorder_window ? rng.below_or_equal(config.reorder_window) : 0;
+        keyed.emplace_back(i + delay, kept[i]);
+    }
+    std::stable_sort(keyed.begin(), keyed.end(),
+                     [](const std::pair<std::uint64_t, const packet_data *> &a,
+                        const std::pair<std::uint64_t, const packet_data *> &b)
+                     { return a.first < b.first; });
+
+    std::vector<packet_data> out;
+    out.reserve(keyed.size());
+    for (const auto &k : keyed)
+        out.push_back(*k.second);
+    return out;
+}
+
+} // namespace spead2
@@ -25,6 +25,10 @@
 #include <cassert>
 #include <system_error>
 #include <cerrno>
+#include <cstring>
+#include <thread>
+#include <utility>
+#include <boost/format.hpp>
 
 namespace spead2
 {
@@ -45,17 +49,372 @@ static void default_log_function(log_level level, const std::string &msg)
 
 static std::function<void(log_level, const std::string &)> log_function = default_log_function;
 
-void set_log_function(std::function<void(log_level, const std::string &)> f)
+std::function<void(log_level, const std::string &)> set_log_function(
+    std::function<void(log_level, const std::string &)> f)
 {
-    log_function = f;
+    std::swap(log_function, f);
+    return f;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+/* This is Dmitry Vyukov's bounded MPMC queue. Each cell has a sequence
+ * number that tells a producer (sequence == pos) or consumer
+ * (sequence == pos + 1) that the cell is ready for it.
+ */
+
+static std::size_t round_up_pow2(std::size_t n)
+{
+    std::size_t out = 2;
+    while (out < n)
+        out *= 2;
+    return out;
+}
+
+log_queue::log_queue(std::size_t capacity)
+    : cells(new cell[round_up_pow2(capacity)]), mask(round_up_pow2(capacity) - 1)
+{
+    for (std::size_t i = 0; i <= mask; i++)
+        cells[i].sequence.store(i, std::memory_order_relaxed);
+}
+
+bool log_queue::try_push(log_level level, std::string &&msg)
+{
+    cell *c;
+    std::size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+    while (true)
+    {
+        c = &cells[pos & mask];
+        std::size_t seq = c->sequence.load(std::memory_order_acquire);
+        std::intptr_t diff = std::intptr_t(seq) - std::intptr_t(pos);
+        if (diff == 0)
+        {
+            if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                break;
+        }
+        else if (diff < 0)
+        {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        else
+            pos = enqueue_pos.load(std::memory_order_relaxed);
+    }
+    c->level = level;
+    c->msg = std::move(msg);
+    c->sequence.store(pos + 1, std::memory_order_release);
+
+    // Pairs with the fence in pop, so that either we see the consumer
+    // waiting or it sees the new message.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (waiting.load(std::memory_order_relaxed) && waiting.exchange(false))
+    {
+        std::lock_guard<std::mutex> lock(wait_mutex);
+        wait_cond.notify_one();
+    }
+    return true;
+}
+
+bool log_queue::try_pop(log_level &level, std::string &msg)
+{
+    cell *c;
+    std::size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+    while (true)
+    {
+        c = &cells[pos & mask];
+        std::size_t seq = c->sequence.load(std::memory_order_acquire);
+        std::intptr_t diff = std::intptr_t(seq) - std::intptr_t(pos + 1);
+        if (diff == 0)
+        {
+            if (dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                break;
+        }
+        else if (diff < 0)
+            return false;       // empty
+        else
+            pos = dequeue_pos.load(std::memory_order_relaxed);
+    }
+    level = c->level;
+    msg = std::move(c->msg);
+    c->msg.clear();
+    c->sequence.store(pos + mask + 1, std::memory_order_release);
+    return true;
+}
+
+bool log_queue::pop(log_level &level, std::string &msg, std::chrono::steady_clock::duration timeout)
+{
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    std::unique_lock<std::mutex> lock(wait_mutex);
+    while (true)
+    {
+        if (try_pop(level, msg))
+            return true;
+        if (stopped.load())
+            return false;
+        waiting.store(true);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (try_pop(level, msg))
+        {
+            waiting.store(false);
+            return true;
+        }
+        if (wait_cond.wait_until(lock, deadline) == std::cv_status::timeout)
+        {
+            waiting.store(false);
+            return try_pop(level, msg);
+        }
+    }
+}
+
+void log_queue::stop()
+{
+    std::lock_guard<std::mutex> lock(wait_mutex);
+    stopped.store(true);
+    wait_cond.notify_all();
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+namespace
+{
+
+/**
+ * Rate-limiting state for one message site. The fields are updated without
+ * a lock, so the limit is approximate when several threads log from the
+ * same site at once.
+ */
+struct log_site
+{
+    std::atomic<const char *> key{nullptr};
+    std::atomic<unsigned int> level{0};
+    std::atomic<std::int64_t> window_start{0};   ///< steady_clock ticks
+    std::atomic<unsigned int> count{0};           ///< Messages in current window
+    std::atomic<std::uint64_t> suppressed{0};     ///< Not yet reported
+    /**
+     * Copy of the (possibly truncated) text of @ref key, for the summary of
+     * suppressed messages. The key itself is never dereferenced, in case
+     * the caller did not pass a string literal.
+     */
+    char text[128];
+    std::atomic<bool> has_text{false};            ///< Set once @ref text is written
+};
+
+/* Open-addressed table of sites. Entries are never removed, since sites are
+ * expected to be format strings with static storage. If it fills up,
+ * further sites are not rate-limited.
+ */
+static constexpr std::size_t max_log_sites = 512;
+static log_site log_sites[max_log_sites];
+
+static std::atomic<unsigned int> rate_messages{default_log_rate_messages};
+static std::atomic<std::int64_t> rate_interval{
+    std::chrono::duration_cast<std::chrono::steady_clock::duration>(default_log_rate_interval).count()};
+static std::atomic<std::uint64_t> total_suppressed{0};
+
+static log_site *find_site(const char *key)
+{
+    std::size_t h = std::hash<const char *>()(key);
+    for (std::size_t i = 0; i < max_log_sites; i++)
+    {
+        log_site &site = log_sites[(h + i) % max_log_sites];
+        const char *cur = site.key.load(std::memory_order_acquire);
+        if (cur == key)
+            return &site;
+        if (cur == nullptr)
+        {
+            if (site.key.compare_exchange_strong(cur, key))
+            {
+                std::strncpy(site.text, key, sizeof(site.text) - 1);
+                site.text[sizeof(site.text) - 1] = '\0';
+                site.has_text.store(true, std::memory_order_release);
+                return &site;
+            }
+            if (cur == key)
+                return &site;
+        }
+    }
+    return nullptr;
+}
+
+/// Deliver a message without rate limiting, via the log thread if running
+static void deliver(log_level level, std::string &&msg);
+
+static void report_suppressed(log_site &site)
+{
+    std::uint64_t n = site.suppressed.exchange(0);
+    if (n > 0)
+    {
+        boost::format formatter("suppressed %1% similar messages: %2%");
+        formatter % n % (site.has_text.load(std::memory_order_acquire) ? site.text : "");
+        deliver(log_level(site.level.load()), formatter.str());
+    }
+}
+
+/// Report suppressed messages for sites whose window has expired
+static void flush_suppressed(bool all)
+{
+    std::int64_t now = std::chrono::steady_clock::now().time_since_epoch().count();
+    std::int64_t interval = rate_interval.load(std::memory_order_relaxed);
+    for (log_site &site : log_sites)
+        if (site.key.load(std::memory_order_acquire) != nullptr
+            && site.suppressed.load(std::memory_order_relaxed) > 0
+            && (all || now - site.window_start.load() >= interval))
+            report_suppressed(site);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+/// Background thread that delivers messages from a @ref log_queue
+class log_thread
+{
+private:
+    std::mutex mutex;                    ///< Serialises start and stop
+    std::unique_ptr<log_queue> queue;
+    std::thread thread;
+
+    void run(log_queue &q)
+    {
+        log_level level;
+        std::string msg;
+        while (true)
+        {
+            if (q.pop(level, msg, std::chrono::milliseconds(100)))
+                log_function(level, msg);
+            else
+            {
+                flush_suppressed(false);
+                if (!active.load())
+                    break;
+            }
+        }
+    }
+
+public:
+    /// Queue that messages should be sent to, or null to deliver them directly
+    std::atomic<log_queue *> active{nullptr};
+
+    void start(std::size_t capacity)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (thread.joinable())
+            return;
+        /* A producer that loaded the previous queue could still be pushing
+         * to it, so it is kept alive until replaced by the next start.
+         */
+        queue.reset(new log_queue(capacity));
+        active.store(queue.get());
+        log_queue &q = *queue;
+        thread = std::thread([this, &q] { run(q); });
+    }
+
+    void stop()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!thread.joinable())
+            return;
+        active.store(nullptr);
+        queue->stop();
+        thread.join();
+        // Deliver anything that raced with the shutdown
+        log_level level;
+        std::string msg;
+        while (queue->try_pop(level, msg))
+            log_function(level, msg);
+    }
+
+    std::uint64_t get_dropped()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return queue ? queue->get_dropped() : 0;
+    }
+
+    ~log_thread()
+    {
+        stop();
+    }
+};
+
+static log_thread &get_log_thread()
+{
+    static log_thread instance;
+    return instance;
+}
+
+static void deliver(log_level level, std::string &&msg)
+{
+    log_queue *q = get_log_thread().active.load();
+    if (q)
+        q->try_push(level, std::move(msg));
+    else
+        log_function(level, msg);
+}
+
+} // anonymous namespace
+
+void set_log_rate_limit(unsigned int max_messages, std::chrono::steady_clock::duration interval)
+{
+    rate_messages.store(max_messages);
+    rate_interval.store(interval.count());
+}
+
+std::uint64_t get_log_suppressed()
+{
+    return total_suppressed.load();
+}
+
+void start_log_thread(std::size_t capacity)
+{
+    get_log_thread().start(capacity);
+}
+
+void stop_log_thread()
+{
+    get_log_thread().stop();
+    flush_suppressed(true);
+}
+
+std::uint64_t get_log_dropped()
+{
+    return get_log_thread().get_dropped();
 }
 
 namespace detail
 {
 
+bool log_rate_check(log_level level, const char *site_key)
+{
+    unsigned int max_messages = rate_messages.load(std::memory_order_relaxed);
+    if (max_messages == 0)
+        return true;
+    log_site *site = find_site(site_key);
+    if (!site)
+        return true;
+    std::int64_t now = std::chrono::steady_clock::now().time_since_epoch().count();
+    std::int64_t start = site->window_start.load(std::memory_order_relaxed);
+    if (now - start >= rate_interval.load(std::memory_order_relaxed))
+    {
+        // Only one thread wins the race to start the new window
+        if (site->window_start.compare_exchange_strong(start, now))
+        {
+            site->level.store(static_cast<unsigned int>(level), std::memory_order_relaxed);
+            site->count.store(0, std::memory_order_relaxed);
+            report_suppressed(*site);
+        }
+    }
+    if (site->count.fetch_add(1, std::memory_order_relaxed) < max_messages)
+        return true;
+    site->suppressed.fetch_add(1, std::memory_order_relaxed);
+    total_suppressed.fetch_add(1, std::memory_order_relaxed);
+    return false;
+}
+
 void log_msg_impl(log_level level, const std::string &msg)
 {
-    log_function(level, msg);
+    log_queue *q = get_log_thread().active.load();
+    if (q)
+        q->try_push(level, std::string(msg));
+    else
+        log_function(level, msg);
 }
 
 } // namespace detail
@@ -0,0 +1,280 @@
+/* Copyright 2016 SKA South Africa
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ */
+
+#include <spead2/common_features.h>
+#if SPEAD2_USE_SHM
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <cassert>
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <stdexcept>
+#include <system_error>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <semaphore.h>
+#include <spead2/common_shm.h>
+#include <spead2/common_logging.h>
+
+namespace spead2
+{
+
+namespace detail
+{
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2 && ATOMIC_INT_LOCK_FREE == 2,
+              "shared memory rings need address-free atomics");
+
+static constexpr std::uint64_t shm_ring_magic = 0x7370656164327368ULL;   // "spead2sh"
+
+/**
+ * Start of the shared memory object. It is followed by @c n_slots instances
+ * of @ref shm_slot_info, then the queue of ready slots (@c n_slots 64-bit
+ * indices), then the slots themselves starting at @c slots_offset.
+ */
+struct shm_ring_header
+{
+    std::atomic<std::uint64_t> magic;   ///< Written last by the creator
+    std::uint64_t n_slots;
+    std::uint64_t slot_size;
+    std::uint64_t slots_offset;
+    sem_t ready_sem;                    ///< Posted for each commit, and to wake the consumer
+    std::atomic<std::uint32_t> closed;
+    /// Number of slots committed by the producer
+    alignas(64) std::atomic<std::uint64_t> head;
+    /// Number of slots taken by the consumer
+    alignas(64) std::atomic<std::uint64_t> tail;
+};
+
+struct shm_slot_info
+{
+    std::atomic<std::uint32_t> busy;    ///< Set by the producer, cleared by the consumer
+    std::uint32_t padding;
+    std::uint64_t length;
+};
+
+} // namespace detail
+
+static std::size_t round_up(std::size_t value, std::size_t align)
+{
+    return (value + align - 1) / align * align;
+}
+
+static std::size_t slots_offset(std::size_t n_slots)
+{
+    std::size_t page = sysconf(_SC_PAGESIZE);
+    return round_up(sizeof(detail::shm_ring_header)
+                    + n_slots * (sizeof(detail::shm_slot_info) + sizeof(std::uint64_t)), page);
+}
+
+void shm_ring::map(int fd, std::size_t size)
+{
+    void *ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (ptr == MAP_FAILED)
+        throw_errno("mmap failed");
+    base = static_cast<std::uint8_t *>(ptr);
+    mapped_size = size;
+    header = reinterpret_cast<detail::shm_ring_header *>(base);
+}
+
+shm_ring::shm_ring(const std::string &name, std::size_t n_slots, std::size_t slot_size)
+    : name(name), n_slots(n_slots), slot_size(round_up(slot_size, 64))
+{
+    if (n_slots == 0 || slot_size == 0)
+        throw std::invalid_argument("n_slots and slot_size must be positive");
+    int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0)
+        throw_errno("shm_open failed");
+    std::size_t offset = slots_offset(n_slots);
+    std::size_t size = offset + n_slots * this->slot_size;
+    try
+    {
+        if (ftruncate(fd, size) != 0)
+            throw_errno("ftruncate failed");
+        map(fd, size);
+    }
+    catch (...)
+    {
+        ::close(fd);
+        shm_unlink(name.c_str());
+        throw;
+    }
+    ::close(fd);
+
+    // The object is zero-filled, which is the initial state of the atomics
+    header->n_slots = n_slots;
+    header->slot_size = this->slot_size;
+    header->slots_offset = offset;
+    if (sem_init(&header->ready_sem, 1, 0) != 0)
+    {
+        int err = errno;
+        munmap(base, mapped_size);
+        shm_unlink(name.c_str());
+        throw_errno("sem_init failed", err);
+    }
+    info = reinterpret_cast<detail::shm_slot_info *>(header + 1);
+    ready = reinterpret_cast<std::uint64_t *>(info + n_slots);
+    slots = base + offset;
+    header->magic.store(detail::shm_ring_magic, std::memory_order_release);
+}
+
+shm_ring::shm_ring(const std::string &name)
+{
+    int fd = shm_open(name.c_str(), O_RDWR, 0);
+    if (fd < 0)
+        throw_errno("shm_open failed");
+    try
+    {
+        struct stat st;
+        if (fstat(fd, &st) != 0)
+            throw_errno("fstat failed");
+        if (std::size_t(st.st_size) < sizeof(detail::shm_ring_header))
+            throw std::invalid_argument("shared memory object is too small to be a ring");
+        map(fd, st.st_size);
+    }
+    catch (...)
+    {
+        ::close(fd);
+        throw;
+    }
+    ::close(fd);
+
+    if (header->magic.load(std::memory_order_acquire) != detail::shm_ring_magic)
+    {
+        munmap(base, mapped_size);
+        throw std::invalid_argument("shared memory object is not a ring");
+    }
+    n_slots = header->n_slots;
+    slot_size = header->slot_size;
+    if (header->slots_offset + n_slots * slot_size > mapped_size)
+    {
+        munmap(base, mapped_size);
+        throw std::invalid_argument("shared memory object is truncated");
+    }
+    info = reinterpret_cast<detail::shm_slot_info *>(header + 1);
+    ready = reinterpret_cast<std::uint64_t *>(info + n_slots);
+    slots = base + header->slots_offset;
+}
+
+shm_ring::~shm_ring()
+{
+    if (!name.empty())
+    {
+        /* The semaphore is not destroyed, since another process may still
+         * be using it. On Linux sem_destroy does nothing anyway.
+         */
+        shm_unlink(name.c_str());
+    }
+    munmap(base, mapped_size);
+}
+
+bool shm_ring::contains(const void *ptr) const
+{
+    const std::uint8_t *p = static_cast<const std::uint8_t *>(ptr);
+    return p >= slots && p < slots + n_slots * slot_size;
+}
+
+std::uint8_t *shm_ring::try_acquire(std::size_t &index)
+{
+    for (std::size_t i = 0; i < n_slots; i++)
+    {
+        std::size_t idx = next_free + i;
+        if (idx >= n_slots)
+            idx -= n_slots;
+        if (!info[idx].busy.load(std::memory_order_acquire))
+        {
+            info[idx].busy.store(1, std::memory_order_relaxed);
+            next_free = idx + 1 == n_slots ? 0 : idx + 1;
+            index = idx;
+            return slots + idx * slot_size;
+        }
+    }
+    return nullptr;
+}
+
+void shm_ring::commit(std::size_t index, std::size_t length)
+{
+    assert(index < n_slots && length <= slot_size);
+    info[index].length = length;
+    /* There are at most n_slots busy slots, so the queue cannot overflow,
+     * and only the producer writes head.
+     */
+    std::uint64_t head = header->head.load(std::memory_order_relaxed);
+    ready[head % n_slots] = index;
+    header->head.store(head + 1, std::memory_order_release);
+    sem_post(&header->ready_sem);
+}
+
+void shm_ring::close()
+{
+    header->closed.store(1, std::memory_order_release);
+    sem_post(&header->ready_sem);
+}
+
+const std::uint8_t *shm_ring::try_next(std::size_t &index, std::size_t &length)
+{
+    std::uint64_t tail = header->tail.load(std::memory_order_relaxed);
+    if (tail == header->head.load(std::memory_order_acquire))
+        return nullptr;
+    index = ready[tail % n_slots];
+    header->tail.store(tail + 1, std::memory_order_relaxed);
+    if (index >= n_slots)
+    {
+        // Only possible if the other process is misbehaving
+        log_warning("ignoring invalid slot index %1% in shared memory ring", index);
+        return nullptr;
+    }
+    length = std::min(std::size_t(info[index].length), slot_size);
+    return slots + index * slot_size;
+}
+
+void shm_ring::wait()
+{
+    while (sem_wait(&header->ready_sem) != 0)
+    {
+        if (errno != EINTR)
+            throw_errno("sem_wait failed");
+    }
+}
+
+void shm_ring::wake()
+{
+    sem_post(&header->ready_sem);
+}
+
+bool shm_ring::is_closed() const
+{
+    return header->closed.load(std::memory_order_acquire);
+}
+
+void shm_ring::release(std::size_t index)
+{
+    info[index].busy.store(0, std::memory_order_release);
+}
+
+} // namespace spead2
+
+#endif // SPEAD2_USE_SHM
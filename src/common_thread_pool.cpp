@@ -108,4 +108,29 @@ thread_pool::~thread_pool()
     stop();
 }
 
+pinned_thread_pool::pinned_thread_pool(int num_threads, const std::vector<int> &affinity)
+{
+    if (num_threads < 1)
+        throw std::invalid_argument("at least one thread is required");
+    threads.reserve(num_threads);
+    for (int i = 0; i < num_threads; i++)
+    {
+        std::vector<int> core;
+        if (!affinity.empty())
+            core.push_back(affinity[i % affinity.size()]);
+        threads.emplace_back(new thread_pool(1, core));
+    }
+}
+
+thread_pool &pinned_thread_pool::next()
+{
+    return *threads[next_index.fetch_add(1, std::memory_order_relaxed) % threads.size()];
+}
+
+void pinned_thread_pool::stop()
+{
+    for (auto &thread : threads)
+        thread->stop();
+}
+
 } // namespace spead2
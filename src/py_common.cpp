@@ -19,14 +19,22 @@
 #define NO_IMPORT_ARRAY
 #include <boost/python.hpp>
 #include <boost/system/system_error.hpp>
+#include <numpy/arrayobject.h>
 #include <memory>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <chrono>
+#include <functional>
 #include <spead2/py_common.h>
+#include <spead2/common_bits.h>
 #include <spead2/common_ringbuffer.h>
 #include <spead2/common_defines.h>
 #include <spead2/common_flavour.h>
 #include <spead2/common_logging.h>
 #include <spead2/common_memory_pool.h>
 #include <spead2/common_thread_pool.h>
+#include <spead2/recv_heap.h>
 
 namespace py = boost::python;
 
@@ -155,6 +163,421 @@ void thread_pool_wrapper::stop()
     thread_pool::stop();
 }
 
+buffer_allocator::buffer_allocator(py::object buffers)
+{
+    for (py::stl_input_iterator<py::object> it(buffers), end; it != end; ++it)
+    {
+        this->buffers.emplace_back(*it, PyBUF_WRITABLE);
+        free_list.push_back(this->buffers.size() - 1);
+    }
+}
+
+memory_allocator::pointer buffer_allocator::allocate(std::size_t size, void *hint)
+{
+    {
+        std::lock_guard<std::mutex> lock(free_mutex);
+        for (auto it = free_list.begin(); it != free_list.end(); ++it)
+        {
+            const Py_buffer &view = buffers[*it].view;
+            if (std::size_t(view.len) >= size)
+            {
+                std::size_t idx = *it;
+                free_list.erase(it);
+                return pointer(static_cast<std::uint8_t *>(view.buf),
+                               deleter(shared_from_this(), (void *) std::uintptr_t(idx + 1)));
+            }
+        }
+    }
+    fallbacks++;
+    return memory_allocator::allocate(size, hint);
+}
+
+void buffer_allocator::free(std::uint8_t *ptr, void *user)
+{
+    std::uintptr_t idx = std::uintptr_t(user);
+    if (idx == 0)
+        delete[] ptr;   // fallback allocation from memory_allocator::allocate
+    else
+    {
+        std::lock_guard<std::mutex> lock(free_mutex);
+        free_list.push_back(idx - 1);
+    }
+}
+
+py::object buffer_allocator::pop(py::object heap) const
+{
+    const recv::heap &h = py::extract<const recv::heap &>(heap);
+    const std::uint8_t *payload = h.get_payload();
+    if (payload != nullptr)
+    {
+        for (const buffer_view &b : buffers)
+            if (b.view.buf == payload)
+                return py::object(py::handle<>(py::borrowed(b.view.obj)));
+    }
+    return py::object();
+}
+
+std::size_t buffer_allocator::get_free() const
+{
+    std::lock_guard<std::mutex> lock(free_mutex);
+    return free_list.size();
+}
+
+/// A field in a format, as used by @ref py_unpack_bits and @ref py_pack_bits
+struct bits_field
+{
+    char code;
+    int bits;
+    int npy_type;     ///< numpy type used to hold values of the field
+};
+
+static std::vector<bits_field> parse_bits_format(py::object format)
+{
+    std::vector<bits_field> out;
+    out.reserve(len(format));
+    for (long i = 0; i < len(format); i++)
+    {
+        py::object item = format[i];
+        if (len(item) != 2)
+            throw std::length_error("expected 2 arguments in format");
+        char code = py::extract<char>(item[0]);
+        std::int64_t bits = py::extract<std::int64_t>(item[1]);
+        std::string name = std::string(1, code) + std::to_string(bits);
+        if (bits < 1 || bits > 64)
+            throw std::invalid_argument("unhandled format " + name);
+        int npy_type;
+        switch (code)
+        {
+        case 'u': npy_type = NPY_UINT64; break;
+        case 'i': npy_type = NPY_INT64; break;
+        case 'b': npy_type = NPY_BOOL; break;
+        case 'c':
+            if (bits != 8)
+                throw std::invalid_argument("unhandled format " + name);
+            npy_type = NPY_STRING;
+            break;
+        case 'f':
+            if (bits == 32)
+                npy_type = NPY_FLOAT32;
+            else if (bits == 64)
+                npy_type = NPY_FLOAT64;
+            else
+                throw std::invalid_argument("unhandled format " + name);
+            break;
+        default:
+            throw std::invalid_argument("unhandled format " + name);
+        }
+        out.push_back(bits_field{code, int(bits), npy_type});
+    }
+    return out;
+}
+
+/**
+ * Unpacks @a records records described by @a format from the buffer
+ * @a data. The result is a list of 1D numpy arrays, one per field, with
+ * types chosen according to the field code.
+ */
+static py::object py_unpack_bits(py::object data, py::object format, std::size_t records)
+{
+    std::vector<bits_field> fields = parse_bits_format(format);
+    std::vector<int> bits;
+    std::size_t record_bits = 0;
+    for (const auto &field : fields)
+    {
+        bits.push_back(field.bits);
+        record_bits += field.bits;
+    }
+    buffer_view view(data);
+    if (std::size_t(view.view.len) * 8 < records * record_bits)
+        throw std::invalid_argument("buffer is too small for the number of records");
+
+    /* Fields whose numpy type is 64-bit are unpacked directly into the
+     * output; others are unpacked to a temporary and then converted.
+     */
+    npy_intp dims[1] = {npy_intp(records)};
+    std::vector<py::object> arrays;
+    std::vector<std::vector<std::uint64_t>> scratch(fields.size());
+    std::vector<std::uint64_t *> raw;
+    for (std::size_t i = 0; i < fields.size(); i++)
+    {
+        int itemsize = fields[i].npy_type == NPY_STRING ? 1 : 0;
+        PyObject *array = PyArray_New(&PyArray_Type, 1, dims, fields[i].npy_type,
+                                      NULL, NULL, itemsize, 0, NULL);
+        if (!array)
+            py::throw_error_already_set();
+        arrays.emplace_back(py::handle<>(array));
+        if (PyArray_ITEMSIZE((PyArrayObject *) array) == 8)
+            raw.push_back(reinterpret_cast<std::uint64_t *>(PyArray_DATA((PyArrayObject *) array)));
+        else
+        {
+            scratch[i].resize(records);
+            raw.push_back(scratch[i].data());
+        }
+    }
+
+    {
+        release_gil gil;
+        unpack_bits(reinterpret_cast<const std::uint8_t *>(view.view.buf), records, bits, raw.data());
+        for (std::size_t i = 0; i < fields.size(); i++)
+        {
+            const std::uint64_t *in = raw[i];
+            void *out = PyArray_DATA((PyArrayObject *) arrays[i].ptr());
+            switch (fields[i].code)
+            {
+            case 'i':
+                if (fields[i].bits < 64)
+                {
+                    std::uint64_t sign = std::uint64_t(1) << (fields[i].bits - 1);
+                    std::int64_t *out_i = reinterpret_cast<std::int64_t *>(out);
+                    for (std::size_t j = 0; j < records; j++)
+                        out_i[j] = std::int64_t(in[j] ^ sign) - std::int64_t(sign);
+                }
+                break;
+            case 'b':
+                for (std::size_t j = 0; j < records; j++)
+                    reinterpret_cast<npy_bool *>(out)[j] = in[j] != 0;
+                break;
+            case 'c':
+                for (std::size_t j = 0; j < records; j++)
+                    reinterpret_cast<char *>(out)[j] = char(in[j]);
+                break;
+            case 'f':
+                if (fields[i].bits == 32)
+                    for (std::size_t j = 0; j < records; j++)
+                    {
+                        std::uint32_t v = in[j];
+                        std::memcpy(reinterpret_cast<float *>(out) + j, &v, sizeof(v));
+                    }
+                break;
+            }
+        }
+    }
+
+    py::list out;
+    for (const auto &array : arrays)
+        out.append(array);
+    return out;
+}
+
+/**
+ * Convert @a value to an array and check that it contains no negative
+ * values. This is needed for 64-bit unsigned fields, where there is no wider
+ * signed type to convert through and a forced cast would wrap silently.
+ */
+static py::object check_non_negative(py::object value, const bits_field &field)
+{
+    PyObject *array = PyArray_FROM_O(value.ptr());
+    if (!array)
+        py::throw_error_already_set();
+    py::object out{py::handle<>(array)};
+    char kind = PyArray_DESCR((PyArrayObject *) array)->kind;
+    if (PyArray_SIZE((PyArrayObject *) array) > 0
+        && (kind == 'i' || kind == 'f' || kind == 'O'))
+    {
+        PyObject *min = PyArray_Min((PyArrayObject *) array, NPY_MAXDIMS, NULL);
+        if (!min)
+            py::throw_error_already_set();
+        py::object min_obj{py::handle<>(min)};
+        if (min_obj < 0)
+            throw std::invalid_argument(
+                py::extract<std::string>(py::str(min_obj))() + " is out of range for "
+                + std::string(1, field.code) + std::to_string(field.bits));
+    }
+    return out;
+}
+
+/**
+ * Inverse of @ref py_unpack_bits. The elements of @a values are converted
+ * to arrays (of any shape, which is flattened in C order) and the result is
+ * returned as a new bytearray.
+ */
+static py::object py_pack_bits(py::object values, py::object format)
+{
+    std::vector<bits_field> fields = parse_bits_format(format);
+    if (std::size_t(len(values)) != fields.size())
+        throw std::invalid_argument("number of value arrays does not match format");
+    std::vector<int> bits;
+    std::size_t record_bits = 0;
+    std::vector<py::object> arrays;
+    for (std::size_t i = 0; i < fields.size(); i++)
+    {
+        const bits_field &field = fields[i];
+        bits.push_back(field.bits);
+        record_bits += field.bits;
+        /* Unsigned fields narrower than 64 bits are converted via a signed
+         * type so that negative values can be detected. 64-bit unsigned
+         * fields are checked separately by @ref check_non_negative.
+         */
+        PyArray_Descr *descr;
+        if (field.npy_type == NPY_STRING)
+        {
+            py::object s1("S1");
+            if (!PyArray_DescrConverter(s1.ptr(), &descr))
+                py::throw_error_already_set();
+        }
+        else if (field.code == 'u' && field.bits < 64)
+            descr = PyArray_DescrFromType(NPY_INT64);
+        else
+            descr = PyArray_DescrFromType(field.npy_type);
+        py::object value = values[i];
+        if (field.code == 'u' && field.bits == 64)
+            value = check_non_negative(value, field);
+        PyObject *array = PyArray_FromAny(
+            value.ptr(), descr, 0, 0,
+            NPY_ARRAY_C_CONTIGUOUS | NPY_ARRAY_ALIGNED | NPY_ARRAY_FORCECAST, NULL);
+        if (!array)
+        {
+            if (PyErr_ExceptionMatches(PyExc_OverflowError))
+            {
+                PyErr_Clear();
+                throw std::invalid_argument("value is out of range for " + std::string(1, field.code)
+                                            + std::to_string(field.bits));
+            }
+            py::throw_error_already_set();
+        }
+        arrays.emplace_back(py::handle<>(array));
+    }
+    std::size_t records = arrays.empty() ? 0 : PyArray_SIZE((PyArrayObject *) arrays[0].ptr());
+    for (const auto &array : arrays)
+        if (std::size_t(PyArray_SIZE((PyArrayObject *) array.ptr())) != records)
+            throw std::invalid_argument("value arrays have different sizes");
+
+    // Range-check and convert the values to raw bits
+    std::vector<std::vector<std::uint64_t>> scratch(fields.size());
+    std::vector<const std::uint64_t *> raw;
+    for (std::size_t i = 0; i < fields.size(); i++)
+    {
+        const bits_field &field = fields[i];
+        const void *in = PyArray_DATA((PyArrayObject *) arrays[i].ptr());
+        if (field.code == 'u' || field.code == 'i')
+        {
+            const std::int64_t *in_i = reinterpret_cast<const std::int64_t *>(in);
+            if (field.bits < 64)
+            {
+                std::int64_t lo, hi;
+                if (field.code == 'u')
+                {
+                    lo = 0;
+                    hi = (std::int64_t(1) << field.bits) - 1;
+                }
+                else
+                {
+                    lo = -(std::int64_t(1) << (field.bits - 1));
+                    hi = (std::int64_t(1) << (field.bits - 1)) - 1;
+                }
+                for (std::size_t j = 0; j < records; j++)
+                    if (in_i[j] < lo || in_i[j] > hi)
+                        throw std::invalid_argument(
+                            std::to_string(in_i[j]) + " is out of range for "
+                            + std::string(1, field.code) + std::to_string(field.bits));
+            }
+            // Excess high bits (from sign extension) are discarded by pack_bits
+            raw.push_back(reinterpret_cast<const std::uint64_t *>(in));
+        }
+        else if (field.code == 'f' && field.bits == 64)
+            raw.push_back(reinterpret_cast<const std::uint64_t *>(in));
+        else
+        {
+            scratch[i].resize(records);
+            std::uint64_t *out = scratch[i].data();
+            for (std::size_t j = 0; j < records; j++)
+            {
+                switch (field.code)
+                {
+                case 'b':
+                    out[j] = reinterpret_cast<const npy_bool *>(in)[j] ? 1 : 0;
+                    break;
+                case 'c':
+                    out[j] = reinterpret_cast<const std::uint8_t *>(in)[j];
+                    break;
+                case 'f':
+                    {
+                        std::uint32_t v;
+                        std::memcpy(&v, reinterpret_cast<const float *>(in) + j, sizeof(v));
+                        out[j] = v;
+                    }
+                    break;
+                }
+            }
+            raw.push_back(out);
+        }
+    }
+
+    std::size_t out_bytes = (records * record_bits + 7) / 8;
+    PyObject *out = PyByteArray_FromStringAndSize(NULL, out_bytes);
+    if (!out)
+        py::throw_error_already_set();
+    py::object out_obj{py::handle<>(out)};
+    {
+        release_gil gil;
+        pack_bits(raw.data(), records, bits,
+                  reinterpret_cast<std::uint8_t *>(PyByteArray_AS_STRING(out)));
+    }
+    return out_obj;
+}
+
+/// Queue feeding the Python log thread
+static std::shared_ptr<log_queue> python_log_queue;
+/// Log function used once @ref python_log_queue is stopped
+static std::function<void(log_level, const std::string &)> python_log_fallback;
+
+/// Create @ref python_log_queue and install a log function that feeds it
+static void start_python_log()
+{
+    python_log_queue = std::make_shared<log_queue>(default_log_queue_capacity);
+    set_log_function(log_function_python(python_log_queue, python_log_fallback));
+}
+
+/**
+ * Wait for the next log message for Python, returning a (level, message)
+ * tuple, or @c None once the queue is stopped and empty.
+ */
+static py::object py_pop_log()
+{
+    log_level level;
+    std::string msg;
+    bool found;
+    {
+        release_gil gil;
+        do
+        {
+            found = python_log_queue->pop(level, msg, std::chrono::seconds(1));
+        } while (!found && !python_log_queue->is_stopped());
+    }
+    if (found)
+        return py::make_tuple(static_cast<unsigned int>(level), msg);
+    else
+        return py::object();
+}
+
+/**
+ * Stop queueing log messages for Python (they go to standard error
+ * instead), and let the Python log thread finish once it has drained the
+ * queue.
+ */
+static void py_stop_log()
+{
+    python_log_queue->stop();
+}
+
+/**
+ * Give a forked child a new queue, for a new Python log thread to drain.
+ * The parent's log thread does not exist in the child, and it may have
+ * been using the old queue's mutex and condition variable at the time of
+ * the fork. Those cannot safely be used or destroyed, so the old queue is
+ * deliberately leaked.
+ */
+static void py_reset_log_after_fork()
+{
+    new std::shared_ptr<log_queue>(std::move(python_log_queue));
+    start_python_log();
+}
+
+static std::uint64_t py_get_log_dropped()
+{
+    return python_log_queue->get_dropped();
+}
+
 template<typename T>
 static void create_exception(PyObject *&type, const char *name, const char *basename)
 {
@@ -259,6 +682,11 @@ void register_module()
 
     EXPORT_ENUM(MEMCPY_STD);
     EXPORT_ENUM(MEMCPY_NONTEMPORAL);
+
+    EXPORT_ENUM(CHECKSUM_NONE);
+    EXPORT_ENUM(CHECKSUM_VALID);
+    EXPORT_ENUM(CHECKSUM_INVALID);
+    EXPORT_ENUM(CHECKSUM_UNVERIFIED);
 #undef EXPORT_ENUM
 
     class_<flavour>("Flavour",
@@ -298,6 +726,13 @@ void register_module()
                 store_handle_postcall<memory_pool_wrapper, thread_pool_handle_wrapper, &thread_pool_handle_wrapper::thread_pool_handle, 1, 2>()]);
     implicitly_convertible<std::shared_ptr<memory_pool_wrapper>, std::shared_ptr<memory_allocator>>();
 
+    class_<buffer_allocator, bases<memory_allocator>, std::shared_ptr<buffer_allocator>, boost::noncopyable>(
+        "BufferAllocator", init<py::object>(arg("buffers")))
+        .def("pop", &buffer_allocator::pop, arg("heap"))
+        .add_property("free", &buffer_allocator::get_free)
+        .add_property("fallbacks", &buffer_allocator::get_fallbacks);
+    implicitly_convertible<std::shared_ptr<buffer_allocator>, std::shared_ptr<memory_allocator>>();
+
     class_<thread_pool_wrapper, boost::noncopyable>("ThreadPool", init<int>(
             (arg("threads") = 1)))
         .def(init<int, py::list>((arg("threads"), arg("affinity"))))
@@ -314,9 +749,22 @@ void register_module()
         .add_property("numpy_header", make_bytestring_getter(&descriptor::numpy_header), make_bytestring_setter(&descriptor::numpy_header))
     ;
 
-    object logging_module = import("logging");
-    object logger = logging_module.attr("getLogger")("spead2");
-    set_log_function(log_function_python(logger));
+    def("unpack_bits", &py_unpack_bits, (arg("data"), arg("format"), arg("records")));
+    def("pack_bits", &py_pack_bits, (arg("values"), arg("format")));
+
+    /* Messages are only queued here. The spead2 package starts a Python
+     * thread that calls _pop_log to pass them to the logging module.
+     */
+    /* The default log function (writing to stderr) is the fallback once the
+     * queue is stopped. Briefly clearing it is safe, since no other threads
+     * can be logging while the module is being imported.
+     */
+    python_log_fallback = set_log_function(nullptr);
+    start_python_log();
+    def("_pop_log", &py_pop_log);
+    def("_stop_log", &py_stop_log);
+    def("_reset_log_after_fork", &py_reset_log_after_fork);
+    def("get_log_dropped", &py_get_log_dropped);
 }
 
 } // namespace spead2
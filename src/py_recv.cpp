@@ -22,15 +22,21 @@
 #include <numpy/arrayobject.h>
 #include <stdexcept>
 #include <cstdint>
+#include <vector>
 #include <unistd.h>
 #include <spead2/recv_udp.h>
+#include <spead2/recv_udp_pipeline.h>
 #include <spead2/recv_udp_ibv.h>
 #include <spead2/recv_mem.h>
+#include <spead2/recv_shm.h>
 #include <spead2/recv_stream.h>
 #include <spead2/recv_ring_stream.h>
 #include <spead2/recv_live_heap.h>
 #include <spead2/recv_heap.h>
+#include <spead2/recv_archive.h>
+#include <spead2/recv_relay.h>
 #include <spead2/common_ringbuffer.h>
+#include <spead2/common_logging.h>
 #include <spead2/py_common.h>
 
 namespace py = boost::python;
@@ -130,6 +136,12 @@ public:
         return out;
     }
 
+    /// Wrap @ref heap::get_checksum_status, converting the enum to an integer
+    int get_checksum_status() const
+    {
+        return heap::get_checksum_status();
+    }
+
     /// Wrap @ref heap::get_descriptors, and convert vector to a Python list
     py::list get_descriptors() const
     {
@@ -139,8 +151,145 @@ public:
             out.append(d);
         return out;
     }
+
+    /**
+     * Return (key, descriptor) pairs for the descriptors whose cache key
+     * differs from the one recorded in @a known (a dict indexed by item ID).
+     * Descriptors that were not cached have a key of 0 and are always
+     * returned.
+     */
+    py::list get_changed_descriptors(py::dict known) const
+    {
+        py::list out;
+        for (const descriptor_cache::entry &e : heap::get_descriptor_entries())
+        {
+            if (e.key != 0)
+            {
+                py::object old = known.get(e.desc->id);
+                if (!old.is_none() && py::extract<std::uint64_t>(old)() == e.key)
+                    continue;
+            }
+            out.append(py::make_tuple(e.key, *e.desc));
+        }
+        return out;
+    }
+
+    py::object make_numpy_value(const item &it, py::object spec) const;
+    py::dict update_items(py::dict by_id) const;
 };
 
+/**
+ * Compute the value of an item whose descriptor maps directly to a numpy
+ * type, without going through the Python @c Item.set_from_raw. The @a spec
+ * is the item's @c _numpy_spec, a tuple of (wire dtype, native dtype,
+ * itemsize, shape, Fortran order). If the item is too small for the shape,
+ * returns @c None so that the caller can use the Python path to raise the
+ * appropriate error.
+ */
+py::object heap_wrapper::make_numpy_value(const item &it, py::object spec) const
+{
+    PyArray_Descr *dtype = (PyArray_Descr *) PyTuple_GET_ITEM(spec.ptr(), 0);
+    PyArray_Descr *native_dtype = (PyArray_Descr *) PyTuple_GET_ITEM(spec.ptr(), 1);
+    std::size_t itemsize = py::extract<std::size_t>(PyTuple_GET_ITEM(spec.ptr(), 2));
+    PyObject *shape = PyTuple_GET_ITEM(spec.ptr(), 3);
+    bool fortran = PyObject_IsTrue(PyTuple_GET_ITEM(spec.ptr(), 4));
+
+    // Equivalent of Descriptor.dynamic_shape
+    std::size_t max_elements = it.length / itemsize;
+    Py_ssize_t ndim = PyTuple_GET_SIZE(shape);
+    std::vector<npy_intp> dims(ndim);
+    std::size_t known = 1;
+    Py_ssize_t unknown_pos = -1;
+    for (Py_ssize_t i = 0; i < ndim; i++)
+    {
+        PyObject *dim = PyTuple_GET_ITEM(shape, i);
+        if (dim == Py_None)
+            unknown_pos = i;
+        else
+        {
+            dims[i] = py::extract<npy_intp>(dim);
+            known *= dims[i];
+        }
+    }
+    if (unknown_pos != -1)
+        dims[unknown_pos] = known == 0 ? 0 : max_elements / known;
+    std::size_t elements = known * (unknown_pos != -1 ? dims[unknown_pos] : 1);
+    if (elements > max_elements)
+        return py::object();
+
+    std::size_t size_bytes = elements * itemsize;
+    std::uint8_t *data = it.ptr;
+    if (it.is_immediate)
+        data += it.length - size_bytes;    // immediates have head padding
+    if (ndim == 0 && !PyDataType_HASFIELDS(dtype))
+    {
+        // Scalars are common and can be built directly (with byteswapping)
+        PyObject *scalar = PyArray_Scalar(data, dtype, NULL);
+        if (scalar == NULL)
+            py::throw_error_already_set();
+        return py::object(py::handle<>(scalar));
+    }
+
+    Py_INCREF(dtype);     // PyArray_NewFromDescr steals a reference
+    PyObject *array = PyArray_NewFromDescr(
+        &PyArray_Type, dtype, int(ndim), dims.data(), NULL, data,
+        NPY_ARRAY_WRITEABLE | (fortran ? NPY_ARRAY_F_CONTIGUOUS : 0), NULL);
+    if (array == NULL)
+        py::throw_error_already_set();
+    py::object array_obj{py::handle<>(array)};
+    if (PyArray_SetBaseObject((PyArrayObject *) array, py::incref(self)) == -1)
+    {
+        py::decref(self);
+        py::throw_error_already_set();
+    }
+    if (dtype != native_dtype)
+    {
+        // Force to native endian
+        Py_INCREF(native_dtype);
+        PyObject *converted = PyArray_FromArray((PyArrayObject *) array, native_dtype, 0);
+        if (converted == NULL)
+            py::throw_error_already_set();
+        array_obj = py::object(py::handle<>(converted));
+    }
+    // Converts zero-dimensional arrays to scalars
+    return py::object(py::handle<>(PyArray_Return((PyArrayObject *) py::incref(array_obj.ptr()))));
+}
+
+/**
+ * Implementation of @c ItemGroup.update for the items (but not the
+ * descriptors) of the heap. Items are looked up in @a by_id. Those that
+ * have a @c _numpy_spec are decoded here; the rest are passed to
+ * @c set_from_raw.
+ */
+py::dict heap_wrapper::update_items(py::dict by_id) const
+{
+    py::dict updated;
+    for (const item &it : heap::get_items())
+    {
+        if (it.id <= STREAM_CTRL_ID)
+            continue;     // Special fields, not real items
+        py::object key(it.id);
+        PyObject *found = PyDict_GetItem(by_id.ptr(), key.ptr());  // borrowed
+        if (found == NULL)
+        {
+            log_warning("Item with ID %#x received but there is no descriptor", it.id);
+            continue;
+        }
+        py::object obj{py::handle<>(py::borrowed(found))};
+        py::object spec = obj.attr("_numpy_spec");
+        py::object value;
+        if (!spec.is_none())
+            value = make_numpy_value(it, spec);
+        if (!value.is_none())
+            obj.attr("value") = value;
+        else
+            obj.attr("set_from_raw")(item_wrapper(it, self));
+        obj.attr("version") += 1;
+        updated[obj.attr("name")] = obj;
+    }
+    return updated;
+}
+
 /**
  * Extends mem_reader to obtain data using the Python buffer protocol.
  * It steals the provided buffer view; it is not passed by rvalue reference
@@ -158,6 +307,223 @@ public:
     }
 };
 
+/// Resolve @a hostname to an address, with an empty string meaning any address
+static boost::asio::ip::address make_address(
+    boost::asio::io_service &io_service, const std::string &hostname)
+{
+    if (hostname.empty())
+        return boost::asio::ip::address_v4::any();
+    else
+    {
+        using boost::asio::ip::udp;
+        udp::resolver resolver(io_service);
+        udp::resolver::query query(hostname, "", udp::resolver::query::passive);
+        return resolver.resolve(query)->endpoint().address();
+    }
+}
+
+/**
+ * Opaque handle to a reader, returned to Python by the add_*_reader
+ * functions. The reader may have been removed or the stream stopped, so it
+ * is identified by its @ref reader::get_id (which is never reused) and
+ * looked up with @ref stream::find_reader while holding the strand. An ID of
+ * 0 means that the stream was already stopped when the reader was added.
+ */
+struct reader_handle
+{
+    std::uint64_t id;
+
+    explicit reader_handle(std::uint64_t id = 0) : id(id) {}
+};
+
+/**
+ * Mixin that adds the reader functions shared by the Python stream classes
+ * to @a Base, which must be a subclass of @ref stream. New readers are
+ * returned to Python as a @ref reader_handle.
+ */
+template<typename Base>
+class reader_wrapper : public Base
+{
+protected:
+    boost::asio::ip::address make_address(const std::string &hostname)
+    {
+        return recv::make_address(this->get_strand().get_io_service(), hostname);
+    }
+
+    boost::asio::ip::udp::endpoint make_endpoint(const std::string &hostname, std::uint16_t port)
+    {
+        return boost::asio::ip::udp::endpoint(make_address(hostname), port);
+    }
+
+    /**
+     * Call @a add (which must call @c emplace_reader) with the strand held
+     * and return a handle to the new reader. Reading the ID inside the
+     * strand ensures the reader cannot have been removed in the meantime.
+     */
+    template<typename F>
+    reader_handle add_reader(F &&add)
+    {
+        return this->run_in_strand([&add]
+        {
+            // emplace_reader dispatches on the strand, so this runs inline
+            reader *r = add();
+            return reader_handle(r ? r->get_id() : 0);
+        });
+    }
+
+public:
+    using Base::Base;
+
+    reader_handle add_udp_reader(
+        std::uint16_t port,
+        std::size_t max_size = udp_reader::default_max_size,
+        std::size_t buffer_size = udp_reader::default_buffer_size,
+        const std::string &bind_hostname = "",
+        const py::object &socket = py::object())
+    {
+        int fd2 = -1;
+        if (!socket.is_none())
+        {
+            int fd = py::extract<int>(socket.attr("fileno")());
+            /* Python still owns this FD and will close it, so we have to duplicate
+             * it for ourselves.
+             */
+            fd2 = ::dup(fd);
+            if (fd2 == -1)
+            {
+                PyErr_SetFromErrno(PyExc_OSError);
+                throw py::error_already_set();
+            }
+        }
+
+        release_gil gil;
+        auto endpoint = make_endpoint(bind_hostname, port);
+        if (fd2 == -1)
+        {
+            return add_reader([&] { return this->template emplace_reader<udp_reader>(endpoint, max_size, buffer_size); });
+        }
+        else
+        {
+            boost::asio::ip::udp::socket asio_socket(
+                this->get_strand().get_io_service(), endpoint.protocol(), fd2);
+            return add_reader([&] { return this->template emplace_reader<udp_reader>(std::move(asio_socket), endpoint, max_size, buffer_size); });
+        }
+    }
+
+    reader_handle add_udp_reader_multicast_v4(
+        const std::string &multicast_group,
+        std::uint16_t port,
+        std::size_t max_size,
+        std::size_t buffer_size,
+        const std::string &interface_address)
+    {
+        release_gil gil;
+        auto endpoint = make_endpoint(multicast_group, port);
+        return add_reader([&] { return this->template emplace_reader<udp_reader>(endpoint, max_size, buffer_size, make_address(interface_address)); });
+    }
+
+    reader_handle add_udp_reader_multicast_v6(
+        const std::string &multicast_group,
+        std::uint16_t port,
+        std::size_t max_size,
+        std::size_t buffer_size,
+        unsigned int interface_index)
+    {
+        release_gil gil;
+        auto endpoint = make_endpoint(multicast_group, port);
+        return add_reader([&] { return this->template emplace_reader<udp_reader>(endpoint, max_size, buffer_size, interface_index); });
+    }
+
+#if SPEAD2_USE_IBV
+    reader_handle add_udp_ibv_reader_single(
+        const std::string &multicast_group,
+        std::uint16_t port,
+        const std::string &interface_address,
+        std::size_t max_size,
+        std::size_t buffer_size,
+        int comp_vector,
+        int max_poll)
+    {
+        release_gil gil;
+        auto endpoint = make_endpoint(multicast_group, port);
+        return add_reader([&] { return this->template emplace_reader<udp_ibv_reader>(endpoint, make_address(interface_address),
+                                                            max_size, buffer_size, comp_vector, max_poll); });
+    }
+
+    reader_handle add_udp_ibv_reader_multi(
+        const py::object &endpoints,
+        const std::string &interface_address,
+        std::size_t max_size,
+        std::size_t buffer_size,
+        int comp_vector,
+        int max_poll)
+    {
+        // The Python objects must be read before the GIL is released
+        std::vector<std::pair<std::string, std::uint16_t>> endpoints1;
+        for (long i = 0; i < len(endpoints); i++)
+        {
+            std::string multicast_group = py::extract<std::string>(endpoints[i][0]);
+            std::uint16_t port = py::extract<int>(endpoints[i][1]);
+            endpoints1.emplace_back(multicast_group, port);
+        }
+        release_gil gil;
+        std::vector<boost::asio::ip::udp::endpoint> endpoints2;
+        for (const auto &endpoint : endpoints1)
+            endpoints2.push_back(make_endpoint(endpoint.first, endpoint.second));
+        return add_reader([&] { return this->template emplace_reader<udp_ibv_reader>(endpoints2, make_address(interface_address),
+                                                            max_size, buffer_size, comp_vector, max_poll); });
+    }
+#endif
+};
+
+/// Register the functions of @ref reader_wrapper on a Python stream class
+template<typename T>
+static void udp_reader_register(boost::python::class_<T, boost::noncopyable> &stream_class)
+{
+    using namespace boost::python;
+    stream_class
+        .def("add_udp_reader", &T::add_udp_reader,
+             (arg("port"),
+              arg("max_size") = udp_reader::default_max_size,
+              arg("buffer_size") = udp_reader::default_buffer_size,
+              arg("bind_hostname") = std::string(),
+              arg("socket") = py::object()))
+        .def("add_udp_reader", &T::add_udp_reader_multicast_v4,
+             (
+              arg("multicast_group"),
+              arg("port"),
+              arg("max_size") = udp_reader::default_max_size,
+              arg("buffer_size") = udp_reader::default_buffer_size,
+              arg("interface_address") = "0.0.0.0"))
+        .def("add_udp_reader", &T::add_udp_reader_multicast_v6,
+             (
+              arg("multicast_group"),
+              arg("port"),
+              arg("max_size") = udp_reader::default_max_size,
+              arg("buffer_size") = udp_reader::default_buffer_size,
+              arg("interface_index") = (unsigned int) 0))
+#if SPEAD2_USE_IBV
+        .def("add_udp_ibv_reader", &T::add_udp_ibv_reader_single,
+             (
+              arg("multicast_group"),
+              arg("port"),
+              arg("interface_address"),
+              arg("max_size") = udp_ibv_reader::default_max_size,
+              arg("buffer_size") = udp_ibv_reader::default_buffer_size,
+              arg("comp_vector") = 0,
+              arg("max_poll") = udp_ibv_reader::default_max_poll))
+        .def("add_udp_ibv_reader", &T::add_udp_ibv_reader_multi,
+             (
+              arg("endpoints"),
+              arg("interface_address"),
+              arg("max_size") = udp_ibv_reader::default_max_size,
+              arg("buffer_size") = udp_ibv_reader::default_buffer_size,
+              arg("comp_vector") = 0,
+              arg("max_poll") = udp_ibv_reader::default_max_poll))
+#endif
+        ;
+}
+
 /**
  * Stream that handles the magic necessary to reflect heaps into
  * Python space and capture the reference to it.
@@ -169,29 +535,28 @@ public:
  */
 class ring_stream_wrapper : public thread_pool_handle_wrapper,
                             public memory_allocator_handle_wrapper,
-                            public ring_stream<ringbuffer<live_heap, semaphore_gil<semaphore_fd>, semaphore> >
+                            public reader_wrapper<ring_stream<ringbuffer<live_heap, semaphore_gil<semaphore_fd>, semaphore> > >
 {
 private:
-    boost::asio::ip::address make_address(const std::string &hostname)
+    /**
+     * Run @a func on the reader referenced by @a handle, with the strand
+     * held, after checking that the reader is still part of the stream and
+     * has type @a T.
+     */
+    template<typename T, typename F>
+    void with_reader(const reader_handle &handle, F &&func)
     {
-        if (hostname.empty())
-            return boost::asio::ip::address_v4::any();
-        else
+        run_in_strand([this, &handle, &func]
         {
-            using boost::asio::ip::udp;
-            udp::resolver resolver(get_strand().get_io_service());
-            udp::resolver::query query(hostname, "", udp::resolver::query::passive);
-            return resolver.resolve(query)->endpoint().address();
-        }
-    }
-
-    boost::asio::ip::udp::endpoint make_endpoint(const std::string &hostname, std::uint16_t port)
-    {
-        return boost::asio::ip::udp::endpoint(make_address(hostname), port);
+            T *r = dynamic_cast<T *>(find_reader(handle.id));
+            if (!r)
+                throw std::invalid_argument("reader is not a suitable reader of this stream");
+            func(*r);
+        });
     }
 
 public:
-    using ring_stream::ring_stream;
+    using reader_wrapper::reader_wrapper;
 
     heap next()
     {
@@ -237,107 +602,180 @@ public:
         ring_stream::set_memcpy(memcpy_function_id(id));
     }
 
-    void add_buffer_reader(py::object buffer)
+    s_item_pointer_t get_checksum_id() const
+    {
+        return ring_stream::get_checksum_id();
+    }
+
+    void set_checksum_id(s_item_pointer_t id)
+    {
+        ring_stream::set_checksum_id(id);
+    }
+
+    std::uint64_t get_checksum_valid() const
+    {
+        return ring_stream::get_checksum_valid();
+    }
+
+    std::uint64_t get_checksum_invalid() const
+    {
+        return ring_stream::get_checksum_invalid();
+    }
+
+    void set_overflow_policy(int policy)
+    {
+        switch (policy)
+        {
+        case int(ring_overflow_policy::BLOCK):
+        case int(ring_overflow_policy::DROP_NEWEST):
+        case int(ring_overflow_policy::DROP_OLDEST):
+            ring_stream::set_overflow_policy(ring_overflow_policy(policy));
+            break;
+        default:
+            throw std::invalid_argument("invalid overflow policy");
+        }
+    }
+
+    void set_item_filter(const py::object &ids, bool exclude)
+    {
+        std::shared_ptr<item_filter> filter;
+        if (!ids.is_none())
+        {
+            std::vector<s_item_pointer_t> id_list;
+            for (py::stl_input_iterator<s_item_pointer_t> it(ids), end; it != end; ++it)
+                id_list.push_back(*it);
+            filter = std::make_shared<item_filter>(
+                exclude ? item_filter::mode::EXCLUDE : item_filter::mode::INCLUDE, id_list);
+        }
+        ring_stream::set_item_filter(std::move(filter));
+    }
+
+    reader_handle add_buffer_reader(py::object buffer)
     {
         buffer_view view(buffer);
         release_gil gil;
-        emplace_reader<buffer_reader>(std::ref(view));
+        return add_reader([&] { return emplace_reader<buffer_reader>(std::ref(view)); });
     }
 
-    void add_udp_reader(
+    reader_handle add_udp_pipeline_reader(
         std::uint16_t port,
         std::size_t max_size = udp_reader::default_max_size,
-        std::size_t buffer_size = udp_reader::default_buffer_size,
+        std::size_t buffer_size = udp_pipeline_reader::default_buffer_size,
         const std::string &bind_hostname = "",
-        const py::object &socket = py::object())
+        std::size_t batches = udp_pipeline_reader::default_batches,
+        std::size_t batch_size = udp_pipeline_reader::default_batch_size,
+        int busy_poll = 0,
+        bool kernel_busy_poll = false)
     {
-        int fd2 = -1;
-        if (!socket.is_none())
-        {
-            int fd = py::extract<int>(socket.attr("fileno")());
-            /* Python still owns this FD and will close it, so we have to duplicate
-             * it for ourselves.
-             */
-            fd2 = ::dup(fd);
-            if (fd2 == -1)
-            {
-                PyErr_SetFromErrno(PyExc_OSError);
-                throw py::error_already_set();
-            }
-        }
-
         release_gil gil;
         auto endpoint = make_endpoint(bind_hostname, port);
-        if (fd2 == -1)
-        {
-            emplace_reader<udp_reader>(endpoint, max_size, buffer_size);
-        }
-        else
-        {
-            boost::asio::ip::udp::socket asio_socket(
-                get_strand().get_io_service(), endpoint.protocol(), fd2);
-            emplace_reader<udp_reader>(std::move(asio_socket), endpoint, max_size, buffer_size);
-        }
+        return add_reader([&] { return emplace_reader<udp_pipeline_reader>(
+            endpoint, max_size, buffer_size, batches, batch_size, busy_poll, kernel_busy_poll); });
     }
 
-    void add_udp_reader_multicast_v4(
+    reader_handle add_udp_pipeline_reader_multicast_v4(
         const std::string &multicast_group,
         std::uint16_t port,
+        const std::string &interface_address,
         std::size_t max_size,
         std::size_t buffer_size,
-        const std::string &interface_address)
+        std::size_t batches,
+        std::size_t batch_size,
+        int busy_poll,
+        bool kernel_busy_poll)
     {
         release_gil gil;
         auto endpoint = make_endpoint(multicast_group, port);
-        emplace_reader<udp_reader>(endpoint, max_size, buffer_size, make_address(interface_address));
+        return add_reader([&] { return emplace_reader<udp_pipeline_reader>(
+            endpoint, max_size, buffer_size, make_address(interface_address),
+            batches, batch_size, busy_poll, kernel_busy_poll); });
     }
 
-    void add_udp_reader_multicast_v6(
+    reader_handle add_udp_pipeline_reader_multicast_v6(
         const std::string &multicast_group,
         std::uint16_t port,
+        unsigned int interface_index,
         std::size_t max_size,
         std::size_t buffer_size,
-        unsigned int interface_index)
+        std::size_t batches,
+        std::size_t batch_size,
+        int busy_poll,
+        bool kernel_busy_poll)
     {
         release_gil gil;
         auto endpoint = make_endpoint(multicast_group, port);
-        emplace_reader<udp_reader>(endpoint, max_size, buffer_size, interface_index);
+        return add_reader([&] { return emplace_reader<udp_pipeline_reader>(
+            endpoint, max_size, buffer_size, interface_index,
+            batches, batch_size, busy_poll, kernel_busy_poll); });
+    }
+
+#if SPEAD2_USE_SHM
+    reader_handle add_shm_reader(const std::string &name)
+    {
+        release_gil gil;
+        return add_reader([&] { return emplace_reader<shm_reader>(name); });
+    }
+#endif
+
+    void remove_reader(const reader_handle &handle)
+    {
+        release_gil gil;
+        ring_stream::remove_reader_by_id(handle.id);
+    }
+
+    void join_multicast_v4(const reader_handle &handle,
+                           const std::string &multicast_group,
+                           const std::string &interface_address)
+    {
+        release_gil gil;
+        auto group = make_address(multicast_group);
+        auto iface = make_address(interface_address);
+        with_reader<udp_reader>(handle, [&](udp_reader &r) { r.join_multicast(group, iface); });
+    }
+
+    void join_multicast_v6(const reader_handle &handle,
+                           const std::string &multicast_group,
+                           unsigned int interface_index)
+    {
+        release_gil gil;
+        auto group = make_address(multicast_group);
+        with_reader<udp_reader>(handle, [&](udp_reader &r) { r.join_multicast(group, interface_index); });
+    }
+
+    void leave_multicast_v4(const reader_handle &handle,
+                            const std::string &multicast_group,
+                            const std::string &interface_address)
+    {
+        release_gil gil;
+        auto group = make_address(multicast_group);
+        auto iface = make_address(interface_address);
+        with_reader<udp_reader>(handle, [&](udp_reader &r) { r.leave_multicast(group, iface); });
+    }
+
+    void leave_multicast_v6(const reader_handle &handle,
+                            const std::string &multicast_group,
+                            unsigned int interface_index)
+    {
+        release_gil gil;
+        auto group = make_address(multicast_group);
+        with_reader<udp_reader>(handle, [&](udp_reader &r) { r.leave_multicast(group, interface_index); });
     }
 
 #if SPEAD2_USE_IBV
-    void add_udp_ibv_reader_single(
-        const std::string &multicast_group,
-        std::uint16_t port,
-        const std::string &interface_address,
-        std::size_t max_size,
-        std::size_t buffer_size,
-        int comp_vector,
-        int max_poll)
+    void join_udp_ibv_multicast(const reader_handle &handle,
+                                const std::string &multicast_group, std::uint16_t port)
     {
         release_gil gil;
         auto endpoint = make_endpoint(multicast_group, port);
-        emplace_reader<udp_ibv_reader>(endpoint, make_address(interface_address),
-                                       max_size, buffer_size, comp_vector, max_poll);
+        with_reader<udp_ibv_reader>(handle, [&](udp_ibv_reader &r) { r.join_multicast(endpoint); });
     }
 
-    void add_udp_ibv_reader_multi(
-        const py::object &endpoints,
-        const std::string &interface_address,
-        std::size_t max_size,
-        std::size_t buffer_size,
-        int comp_vector,
-        int max_poll)
+    void leave_udp_ibv_multicast(const reader_handle &handle,
+                                 const std::string &multicast_group, std::uint16_t port)
     {
         release_gil gil;
-        std::vector<boost::asio::ip::udp::endpoint> endpoints2;
-        for (long i = 0; i < len(endpoints); i++)
-        {
-            std::string multicast_group = py::extract<std::string>(endpoints[i][0]);
-            std::uint16_t port = py::extract<int>(endpoints[i][1]);
-            endpoints2.push_back(make_endpoint(multicast_group, port));
-        }
-        emplace_reader<udp_ibv_reader>(endpoints2, make_address(interface_address),
-                                       max_size, buffer_size, comp_vector, max_poll);
+        auto endpoint = make_endpoint(multicast_group, port);
+        with_reader<udp_ibv_reader>(handle, [&](udp_ibv_reader &r) { r.leave_multicast(endpoint); });
     }
 #endif
 
@@ -353,6 +791,104 @@ public:
     }
 };
 
+/// Like @ref thread_pool_handle_wrapper, but for the send stream of a relay
+struct output_stream_handle_wrapper
+{
+    py::handle<> output_stream_handle;
+};
+
+/**
+ * Wraps @ref relay_stream to release the GIL and to keep the send stream
+ * alive. Only the network readers of @ref reader_wrapper are provided, since
+ * those are what a relay is for.
+ */
+class relay_stream_wrapper : public thread_pool_handle_wrapper,
+                             public output_stream_handle_wrapper,
+                             public reader_wrapper<relay_stream>
+{
+public:
+    using reader_wrapper::reader_wrapper;
+
+    void set_cnt_filter(item_pointer_t modulus, item_pointer_t remainder)
+    {
+        release_gil gil;
+        relay_stream::set_cnt_filter(modulus, remainder);
+    }
+
+    void set_item_ids(const py::object &ids)
+    {
+        std::vector<s_item_pointer_t> id_list;
+        if (!ids.is_none())
+            for (py::stl_input_iterator<s_item_pointer_t> it(ids), end; it != end; ++it)
+                id_list.push_back(*it);
+        release_gil gil;
+        relay_stream::set_item_ids(std::move(id_list));
+    }
+
+    void set_rate(double rate, std::size_t burst_size)
+    {
+        release_gil gil;
+        relay_stream::set_rate(rate, burst_size);
+    }
+
+    virtual void stop() override
+    {
+        release_gil gil;
+        relay_stream::stop();
+    }
+
+    ~relay_stream_wrapper()
+    {
+        // Must complete before the send stream handle is released
+        stop();
+    }
+};
+
+/// Wraps @ref heap_archive_writer to release the GIL while writing
+class heap_archive_writer_wrapper : public heap_archive_writer
+{
+public:
+    using heap_archive_writer::heap_archive_writer;
+
+    void write(const heap &h)
+    {
+        // Decode the items while holding the GIL, since decoding is lazy
+        h.get_items();
+        release_gil gil;
+        heap_archive_writer::write(h);
+    }
+
+    void close()
+    {
+        release_gil gil;
+        heap_archive_writer::close();
+    }
+};
+
+/// Wraps @ref heap_archive_reader to provide Python sequence semantics
+class heap_archive_reader_wrapper : public heap_archive_reader
+{
+public:
+    using heap_archive_reader::heap_archive_reader;
+
+    heap getitem(long index) const
+    {
+        if (index < 0)
+            index += size();
+        if (index < 0)
+            throw std::out_of_range("heap index out of range");
+        return get(index);
+    }
+
+    py::list get_descriptor_indices() const
+    {
+        py::list out;
+        for (std::size_t index : heap_archive_reader::get_descriptor_indices())
+            out.append(index);
+        return out;
+    }
+};
+
 /// Register the receiver module with Boost.Python
 void register_module()
 {
@@ -364,95 +900,173 @@ void register_module()
     py::object module(py::handle<>(py::borrowed(PyImport_AddModule("spead2._recv"))));
     py::scope scope = module;
 
+    scope.attr("OVERFLOW_BLOCK") = int(ring_overflow_policy::BLOCK);
+    scope.attr("OVERFLOW_DROP_NEWEST") = int(ring_overflow_policy::DROP_NEWEST);
+    scope.attr("OVERFLOW_DROP_OLDEST") = int(ring_overflow_policy::DROP_OLDEST);
+
     class_<heap, heap_wrapper>("Heap", no_init)
         .add_property("cnt", &heap_wrapper::get_cnt)
         .add_property("flavour",
             make_function(&heap_wrapper::get_flavour, return_value_policy<copy_const_reference>()))
         .def("get_items", &heap_wrapper::get_items)
         .def("get_descriptors", &heap_wrapper::get_descriptors)
-        .def("is_start_of_stream", &heap_wrapper::is_start_of_stream);
+        .def("_get_changed_descriptors", &heap_wrapper::get_changed_descriptors)
+        .def("_update_items", &heap_wrapper::update_items, arg("by_id"))
+        .def("is_start_of_stream", &heap_wrapper::is_start_of_stream)
+        .add_property("checksum_status", &heap_wrapper::get_checksum_status);
     class_<item_wrapper>("RawItem", no_init)
         .def_readonly("id", &item_wrapper::id)
         .def_readonly("is_immediate", &item_wrapper::is_immediate)
         .def_readonly("immediate_value", &item_wrapper::immediate_value)
         .add_property("value", &item_wrapper::get_value);
-    class_<ring_stream_wrapper, boost::noncopyable>("Stream",
-            init<thread_pool_wrapper &, bug_compat_mask, std::size_t, std::size_t>(
-                (arg("thread_pool"), arg("bug_compat") = 0,
-                 arg("max_heaps") = ring_stream_wrapper::default_max_heaps,
-                 arg("ring_heaps") = ring_stream_wrapper::default_ring_heaps))[
-                store_handle_postcall<ring_stream_wrapper, thread_pool_handle_wrapper, &thread_pool_handle_wrapper::thread_pool_handle, 1, 2>()])
-        .def("__iter__", objects::identity_function())
-        .def(
+    class_<reader_handle>("Reader", no_init);
+    class_<heap_archive_writer_wrapper, boost::noncopyable>("HeapArchiveWriter",
+            init<std::string, std::size_t>(
+                (arg("filename"),
+                 arg("buffer_size") = heap_archive_writer::default_buffer_size)))
+        .def("write", &heap_archive_writer_wrapper::write, arg("heap"))
+        .def("close", &heap_archive_writer_wrapper::close)
+        .def("__len__", &heap_archive_writer_wrapper::size)
+        .def_readonly("DEFAULT_BUFFER_SIZE", heap_archive_writer::default_buffer_size);
+    class_<heap_archive_reader_wrapper, boost::noncopyable>("HeapArchiveReader",
+            init<std::string>(arg("filename")))
+        .def("__len__", &heap_archive_reader_wrapper::size)
+        .def("__getitem__", &heap_archive_reader_wrapper::getitem, arg("index"))
+        .def("__contains__", &heap_archive_reader_wrapper::contains, arg("cnt"))
+        .def("find", &heap_archive_reader_wrapper::find, arg("cnt"))
+        .def("get_cnt", &heap_archive_reader_wrapper::get_cnt, arg("index"))
+        .add_property("descriptor_indices", &heap_archive_reader_wrapper::get_descriptor_indices);
+    class_<relay_stats>("RelayStats", no_init)
+        .def_readonly("packets", &relay_stats::packets)
+        .def_readonly("forwarded_packets", &relay_stats::forwarded_packets)
+        .def_readonly("forwarded_bytes", &relay_stats::forwarded_bytes)
+        .def_readonly("batches", &relay_stats::batches)
+        .def_readonly("filtered", &relay_stats::filtered)
+        .def_readonly("rate_limited", &relay_stats::rate_limited)
+        .def_readonly("overflow", &relay_stats::overflow)
+        .def_readonly("send_errors", &relay_stats::send_errors);
+    {
+        auto relay_class = class_<relay_stream_wrapper, boost::noncopyable>("Relay",
+                init<thread_pool_wrapper &, spead2::send::stream &, std::size_t, std::size_t, std::size_t, std::size_t>(
+                    (arg("thread_pool"), arg("output"),
+                     arg("max_packet_size") = relay_stream::default_max_packet_size,
+                     arg("batch_size") = relay_stream::default_batch_size,
+                     arg("max_batches") = relay_stream::default_max_batches,
+                     arg("max_heaps") = relay_stream::default_max_heaps))[
+                    store_handle_postcall<relay_stream_wrapper, thread_pool_handle_wrapper, &thread_pool_handle_wrapper::thread_pool_handle, 1, 2,
+                    store_handle_postcall<relay_stream_wrapper, output_stream_handle_wrapper, &output_stream_handle_wrapper::output_stream_handle, 1, 3> >()])
+            .def("set_cnt_filter", &relay_stream_wrapper::set_cnt_filter,
+                 (arg("modulus"), arg("remainder")))
+            .def("set_item_ids", &relay_stream_wrapper::set_item_ids, arg("ids"))
+            .def("set_rate", &relay_stream_wrapper::set_rate,
+                 (arg("rate"), arg("burst_size") = spead2::send::stream_config::default_burst_size))
+            .add_property("stats", &relay_stream_wrapper::get_stats)
+            .def("stop", &relay_stream_wrapper::stop)
+            .def_readonly("DEFAULT_MAX_PACKET_SIZE", relay_stream::default_max_packet_size)
+            .def_readonly("DEFAULT_BATCH_SIZE", relay_stream::default_batch_size)
+            .def_readonly("DEFAULT_MAX_BATCHES", relay_stream::default_max_batches)
+            .def_readonly("DEFAULT_MAX_HEAPS", relay_stream::default_max_heaps);
+        udp_reader_register(relay_class);
+    }
+    {
+        auto stream_class = class_<ring_stream_wrapper, boost::noncopyable>("Stream",
+                init<thread_pool_wrapper &, bug_compat_mask, std::size_t, std::size_t>(
+                    (arg("thread_pool"), arg("bug_compat") = 0,
+                     arg("max_heaps") = ring_stream_wrapper::default_max_heaps,
+                     arg("ring_heaps") = ring_stream_wrapper::default_ring_heaps))[
+                    store_handle_postcall<ring_stream_wrapper, thread_pool_handle_wrapper, &thread_pool_handle_wrapper::thread_pool_handle, 1, 2>()])
+            .def("__iter__", objects::identity_function())
+            .def(
 #if PY_MAJOR_VERSION >= 3
-              // Python 3 uses __next__ for the iterator protocol
-              "__next__"
+                  // Python 3 uses __next__ for the iterator protocol
+                  "__next__"
 #else
-              "next"
+                  "next"
 #endif
-        , &ring_stream_wrapper::next)
-        .def("get", &ring_stream_wrapper::get)
-        .def("get_nowait", &ring_stream_wrapper::get_nowait)
-        .def("set_memory_allocator", &ring_stream_wrapper::set_memory_allocator,
-             (arg("allocator")),
-             store_handle_postcall<ring_stream_wrapper, memory_allocator_handle_wrapper, &memory_allocator_handle_wrapper::memory_allocator_handle, 1, 2>())
-        .def("set_memory_pool", &ring_stream_wrapper::set_memory_pool,
-             (arg("pool")),
-             store_handle_postcall<ring_stream_wrapper, memory_allocator_handle_wrapper, &memory_allocator_handle_wrapper::memory_allocator_handle, 1, 2>())
-        .def("set_memcpy", &ring_stream_wrapper::set_memcpy,
-             arg("id"))
-        .def("add_buffer_reader", &ring_stream_wrapper::add_buffer_reader,
-             arg("buffer"))
-        .def("add_udp_reader", &ring_stream_wrapper::add_udp_reader,
-             (arg("port"),
-              arg("max_size") = udp_reader::default_max_size,
-              arg("buffer_size") = udp_reader::default_buffer_size,
-              arg("bind_hostname") = std::string(),
-              arg("socket") = py::object()))
-        .def("add_udp_reader", &ring_stream_wrapper::add_udp_reader_multicast_v4,
-             (
-              arg("multicast_group"),
-              arg("port"),
-              arg("max_size") = udp_reader::default_max_size,
-              arg("buffer_size") = udp_reader::default_buffer_size,
-              arg("interface_address") = "0.0.0.0"))
-        .def("add_udp_reader", &ring_stream_wrapper::add_udp_reader_multicast_v6,
-             (
-              arg("multicast_group"),
-              arg("port"),
-              arg("max_size") = udp_reader::default_max_size,
-              arg("buffer_size") = udp_reader::default_buffer_size,
-              arg("interface_index") = (unsigned int) 0))
+            , &ring_stream_wrapper::next)
+            .def("get", &ring_stream_wrapper::get)
+            .def("get_nowait", &ring_stream_wrapper::get_nowait)
+            .def("set_memory_allocator", &ring_stream_wrapper::set_memory_allocator,
+                 (arg("allocator")),
+                 store_handle_postcall<ring_stream_wrapper, memory_allocator_handle_wrapper, &memory_allocator_handle_wrapper::memory_allocator_handle, 1, 2>())
+            .def("set_memory_pool", &ring_stream_wrapper::set_memory_pool,
+                 (arg("pool")),
+                 store_handle_postcall<ring_stream_wrapper, memory_allocator_handle_wrapper, &memory_allocator_handle_wrapper::memory_allocator_handle, 1, 2>())
+            .def("set_memcpy", &ring_stream_wrapper::set_memcpy,
+                 arg("id"))
+            .def("set_overflow_policy", &ring_stream_wrapper::set_overflow_policy,
+                 arg("policy"))
+            .add_property("overflow_drops", &ring_stream_wrapper::get_overflow_drops)
+            .add_property("checksum_id", &ring_stream_wrapper::get_checksum_id,
+                          &ring_stream_wrapper::set_checksum_id)
+            .add_property("checksum_valid", &ring_stream_wrapper::get_checksum_valid)
+            .add_property("checksum_invalid", &ring_stream_wrapper::get_checksum_invalid)
+            .def("set_item_filter", &ring_stream_wrapper::set_item_filter,
+                 (arg("ids"), arg("exclude") = false))
+            .def("add_buffer_reader", &ring_stream_wrapper::add_buffer_reader,
+                 arg("buffer"))
+            .def("add_udp_pipeline_reader", &ring_stream_wrapper::add_udp_pipeline_reader,
+                 (arg("port"),
+                  arg("max_size") = udp_reader::default_max_size,
+                  arg("buffer_size") = udp_pipeline_reader::default_buffer_size,
+                  arg("bind_hostname") = std::string(),
+                  arg("batches") = udp_pipeline_reader::default_batches,
+                  arg("batch_size") = udp_pipeline_reader::default_batch_size,
+                  arg("busy_poll") = 0,
+                  arg("kernel_busy_poll") = false))
+            .def("add_udp_pipeline_reader", &ring_stream_wrapper::add_udp_pipeline_reader_multicast_v4,
+                 (
+                  arg("multicast_group"),
+                  arg("port"),
+                  arg("interface_address"),
+                  arg("max_size") = udp_reader::default_max_size,
+                  arg("buffer_size") = udp_pipeline_reader::default_buffer_size,
+                  arg("batches") = udp_pipeline_reader::default_batches,
+                  arg("batch_size") = udp_pipeline_reader::default_batch_size,
+                  arg("busy_poll") = 0,
+                  arg("kernel_busy_poll") = false))
+            .def("add_udp_pipeline_reader", &ring_stream_wrapper::add_udp_pipeline_reader_multicast_v6,
+                 (
+                  arg("multicast_group"),
+                  arg("port"),
+                  arg("interface_index"),
+                  arg("max_size") = udp_reader::default_max_size,
+                  arg("buffer_size") = udp_pipeline_reader::default_buffer_size,
+                  arg("batches") = udp_pipeline_reader::default_batches,
+                  arg("batch_size") = udp_pipeline_reader::default_batch_size,
+                  arg("busy_poll") = 0,
+                  arg("kernel_busy_poll") = false))
+#if SPEAD2_USE_SHM
+            .def("add_shm_reader", &ring_stream_wrapper::add_shm_reader, arg("name"))
+#endif
+            .def("remove_reader", &ring_stream_wrapper::remove_reader, arg("reader"))
+            .def("join_multicast", &ring_stream_wrapper::join_multicast_v4,
+                 (arg("reader"), arg("multicast_group"), arg("interface_address") = "0.0.0.0"))
+            .def("join_multicast", &ring_stream_wrapper::join_multicast_v6,
+                 (arg("reader"), arg("multicast_group"), arg("interface_index")))
+            .def("leave_multicast", &ring_stream_wrapper::leave_multicast_v4,
+                 (arg("reader"), arg("multicast_group"), arg("interface_address") = "0.0.0.0"))
+            .def("leave_multicast", &ring_stream_wrapper::leave_multicast_v6,
+                 (arg("reader"), arg("multicast_group"), arg("interface_index")))
 #if SPEAD2_USE_IBV
-        .def("add_udp_ibv_reader", &ring_stream_wrapper::add_udp_ibv_reader_single,
-             (
-              arg("multicast_group"),
-              arg("port"),
-              arg("interface_address"),
-              arg("max_size") = udp_ibv_reader::default_max_size,
-              arg("buffer_size") = udp_ibv_reader::default_buffer_size,
-              arg("comp_vector") = 0,
-              arg("max_poll") = udp_ibv_reader::default_max_poll))
-        .def("add_udp_ibv_reader", &ring_stream_wrapper::add_udp_ibv_reader_multi,
-             (
-              arg("endpoints"),
-              arg("interface_address"),
-              arg("max_size") = udp_ibv_reader::default_max_size,
-              arg("buffer_size") = udp_ibv_reader::default_buffer_size,
-              arg("comp_vector") = 0,
-              arg("max_poll") = udp_ibv_reader::default_max_poll))
+            .def("join_udp_ibv_multicast", &ring_stream_wrapper::join_udp_ibv_multicast,
+                 (arg("reader"), arg("multicast_group"), arg("port")))
+            .def("leave_udp_ibv_multicast", &ring_stream_wrapper::leave_udp_ibv_multicast,
+                 (arg("reader"), arg("multicast_group"), arg("port")))
 #endif
-        .def("stop", &ring_stream_wrapper::stop)
-        .add_property("fd", &ring_stream_wrapper::get_fd)
+            .def("stop", &ring_stream_wrapper::stop)
+            .add_property("fd", &ring_stream_wrapper::get_fd)
 #if SPEAD2_USE_IBV
-        .def_readonly("DEFAULT_UDP_IBV_MAX_SIZE", udp_ibv_reader::default_max_size)
-        .def_readonly("DEFAULT_UDP_IBV_BUFFER_SIZE", udp_ibv_reader::default_buffer_size)
-        .def_readonly("DEFAULT_UDP_IBV_MAX_POLL", udp_ibv_reader::default_max_poll)
+            .def_readonly("DEFAULT_UDP_IBV_MAX_SIZE", udp_ibv_reader::default_max_size)
+            .def_readonly("DEFAULT_UDP_IBV_BUFFER_SIZE", udp_ibv_reader::default_buffer_size)
+            .def_readonly("DEFAULT_UDP_IBV_MAX_POLL", udp_ibv_reader::default_max_poll)
 #endif
-        .def_readonly("DEFAULT_MAX_HEAPS", ring_stream_wrapper::default_max_heaps)
-        .def_readonly("DEFAULT_RING_HEAPS", ring_stream_wrapper::default_ring_heaps)
-        .def_readonly("DEFAULT_UDP_MAX_SIZE", udp_reader::default_max_size)
-        .def_readonly("DEFAULT_UDP_BUFFER_SIZE", udp_reader::default_buffer_size);
+            .def_readonly("DEFAULT_MAX_HEAPS", ring_stream_wrapper::default_max_heaps)
+            .def_readonly("DEFAULT_RING_HEAPS", ring_stream_wrapper::default_ring_heaps)
+            .def_readonly("DEFAULT_UDP_MAX_SIZE", udp_reader::default_max_size)
+            .def_readonly("DEFAULT_UDP_BUFFER_SIZE", udp_reader::default_buffer_size);
+        udp_reader_register(stream_class);
+    }
 }
 
 } // namespace recv
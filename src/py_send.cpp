@@ -23,16 +23,24 @@
 #define NO_IMPORT_ARRAY
 #include <boost/python.hpp>
 #include <boost/system/system_error.hpp>
+#include <boost/asio/steady_timer.hpp>
 #include <stdexcept>
 #include <mutex>
+#include <condition_variable>
+#include <chrono>
 #include <utility>
 #include <memory>
+#include <vector>
+#include <deque>
+#include <functional>
+#include <algorithm>
 #include <unistd.h>
 #include <spead2/send_heap.h>
 #include <spead2/send_stream.h>
 #include <spead2/send_udp.h>
 #include <spead2/send_udp_ibv.h>
 #include <spead2/send_streambuf.h>
+#include <spead2/send_shm.h>
 #include <spead2/common_thread_pool.h>
 #include <spead2/common_semaphore.h>
 #include <spead2/py_common.h>
@@ -54,6 +62,8 @@ public:
     void add_item(py::object item);
     void add_descriptor(py::object descriptor);
     flavour get_flavour() const;
+    s_item_pointer_t get_checksum_id() const;
+    void set_checksum_id(s_item_pointer_t id);
 };
 
 void heap_wrapper::add_item(py::object item)
@@ -76,6 +86,16 @@ flavour heap_wrapper::get_flavour() const
     return heap::get_flavour();
 }
 
+s_item_pointer_t heap_wrapper::get_checksum_id() const
+{
+    return heap::get_checksum_id();
+}
+
+void heap_wrapper::set_checksum_id(s_item_pointer_t id)
+{
+    heap::set_checksum_id(id);
+}
+
 class packet_generator_wrapper : public packet_generator
 {
 private:
@@ -97,6 +117,301 @@ bytestring packet_generator_wrapper::next()
                       boost::asio::buffers_end(pkt.buffers));
 }
 
+/**
+ * Count of @ref heap_batch objects still using a stream. A batch touches the
+ * stream between the completion of one heap (which has already been popped
+ * from the queue) and the start of the next, which @ref stream_impl::flush
+ * does not see, so the stream wrappers wait for this count to reach zero
+ * before the stream is destroyed.
+ */
+class heap_batch_tracker
+{
+private:
+    std::mutex mutex;
+    std::condition_variable idle;
+    std::size_t active = 0;
+
+public:
+    void add()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        active++;
+    }
+
+    /// Mark a batch as finished. The tracker may be destroyed once this returns.
+    void remove()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        active--;
+        idle.notify_all();
+    }
+
+    /// Block until there are no active batches
+    void wait()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        idle.wait(lock, [this] { return active == 0; });
+    }
+};
+
+/**
+ * State for sending a sequence of heaps, filling whatever space is free in
+ * the stream's queue. Each completion handler starts the next heap, so once
+ * the initial window is queued the caller is not involved again until @ref
+ * done is called for the whole batch.
+ *
+ * If the queue is full (because other heaps were queued on the stream) the
+ * rejected heap is kept and retried when one of the batch's own heaps
+ * completes, or after @ref retry_interval if none is in flight. No later
+ * heap is started while a rejected heap is waiting, and only one thread at
+ * a time starts heaps, so heaps are always queued in order.
+ */
+struct heap_batch
+{
+    typedef std::function<void(const boost::system::error_code &ec, item_pointer_t bytes_transferred)> completion_handler;
+
+    /// Time to wait before retrying when the queue is full of other heaps
+    static constexpr std::chrono::microseconds retry_interval{50};
+
+    /**
+     * Python sequence holding references to the heaps. It is only touched
+     * with the GIL held.
+     */
+    PyObject *heaps_obj = nullptr;
+    std::vector<const heap_wrapper *> heaps;
+    std::vector<s_item_pointer_t> cnts;
+    /// Called once all heaps have been sent, with the first error (if any)
+    completion_handler done;
+    /// Tracker for the stream, which is notified after @ref done
+    heap_batch_tracker *tracker = nullptr;
+    /// Timer for retrying when nothing is in flight (created on demand)
+    std::unique_ptr<boost::asio::steady_timer> timer;
+
+    /// Protects the members below
+    std::mutex mutex;
+    std::size_t next = 0;              ///< Index of the next heap to start
+    std::deque<std::size_t> retry;     ///< Heaps rejected because the queue was full
+    std::size_t in_flight = 0;         ///< Heaps started but not completed
+    bool starting = false;             ///< Whether a thread is inside @ref start
+    bool restart = false;              ///< Whether @ref start must make another pass
+    boost::system::error_code ec;      ///< First error encountered
+    item_pointer_t bytes_transferred = 0;
+    bool cancelled = false;            ///< Whether @ref cancel has been called
+    bool complete = false;             ///< Whether @ref finish has been called
+
+    /**
+     * Extract heaps (and cnts, if not @c None) from Python sequences. This
+     * must be called with the GIL held.
+     */
+    void set_heaps(py::object heaps, py::object cnts)
+    {
+        py::object seq(py::handle<>(PySequence_Tuple(heaps.ptr())));
+        std::size_t n = py::len(seq);
+        for (std::size_t i = 0; i < n; i++)
+            this->heaps.push_back(&py::extract<const heap_wrapper &>(seq[i])());
+        if (cnts.is_none())
+            this->cnts.resize(n, -1);
+        else
+        {
+            for (py::stl_input_iterator<s_item_pointer_t> it(cnts), end; it != end; ++it)
+                this->cnts.push_back(*it);
+            if (this->cnts.size() != n)
+                throw std::invalid_argument("cnts must have the same length as heaps");
+        }
+        heaps_obj = py::incref(seq.ptr());
+    }
+
+    /// Prevent any further heaps from being started
+    void cancel()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        next = heaps.size();
+        retry.clear();
+        cancelled = true;
+    }
+
+    /**
+     * Check whether all heaps have been started and completed, and if so
+     * mark the batch as complete. Returns @c true only for the first caller
+     * to see it complete, which must then call @ref finish. The mutex must
+     * be held.
+     */
+    bool take_last()
+    {
+        if (complete || in_flight > 0 || !retry.empty() || next < heaps.size())
+            return false;
+        complete = true;
+        return true;
+    }
+
+    /// Call @ref done and release the stream
+    static void finish(std::shared_ptr<heap_batch> batch)
+    {
+        batch->done(batch->ec, batch->bytes_transferred);
+        // Once this returns, the stream may no longer exist
+        batch->tracker->remove();
+    }
+
+    /**
+     * Start sending the next heap, if any. Returns @c false if there was no
+     * heap to start or if it was rejected because the queue is full. Note
+     * that @a done may be called before this returns.
+     */
+    template<typename Stream>
+    static bool start_next(Stream &stream, std::shared_ptr<heap_batch> batch)
+    {
+        std::size_t idx;
+        {
+            std::lock_guard<std::mutex> lock(batch->mutex);
+            if (!batch->retry.empty())
+            {
+                idx = batch->retry.front();
+                batch->retry.pop_front();
+            }
+            else if (batch->next < batch->heaps.size())
+                idx = batch->next++;
+            else
+                return false;
+            batch->in_flight++;
+        }
+        /* The mutex must not be held here, because the stream may call the
+         * handler from inside async_send_heap.
+         */
+        bool queued = stream.async_send_heap(*batch->heaps[idx], [&stream, batch] (
+            const boost::system::error_code &ec, item_pointer_t bytes_transferred)
+        {
+            // Rejected heaps are handled below, from the return value
+            if (ec == boost::asio::error::would_block)
+                return;
+            bool last;
+            {
+                std::lock_guard<std::mutex> lock(batch->mutex);
+                batch->in_flight--;
+                if (ec && !batch->ec)
+                    batch->ec = ec;
+                batch->bytes_transferred += bytes_transferred;
+                last = batch->take_last();
+            }
+            if (last)
+                finish(batch);
+            else
+                start(stream, batch);
+        }, batch->cnts[idx]);
+        if (!queued)
+        {
+            /* The queue is full of other heaps. Put the heap back at the
+             * front, to be retried from the next completion or from a timer
+             * (see @ref start).
+             */
+            std::lock_guard<std::mutex> lock(batch->mutex);
+            batch->in_flight--;
+            if (!batch->cancelled)
+                batch->retry.push_front(idx);
+        }
+        return queued;
+    }
+
+    /// Restart the batch after @ref retry_interval
+    template<typename Stream>
+    static void retry_later(Stream &stream, std::shared_ptr<heap_batch> batch)
+    {
+        if (!batch->timer)
+            batch->timer.reset(new boost::asio::steady_timer(stream.get_io_service()));
+        batch->timer->expires_from_now(retry_interval);
+        batch->timer->async_wait([&stream, batch] (const boost::system::error_code &ec)
+        {
+            // If aborted, a newer wait has replaced this one
+            if (ec == boost::asio::error::operation_aborted)
+                return;
+            bool last;
+            {
+                std::lock_guard<std::mutex> lock(batch->mutex);
+                // The stream may be gone once the batch is complete
+                if (batch->complete)
+                    return;
+                last = batch->take_last();  // e.g. cancelled while waiting
+            }
+            if (last)
+                finish(batch);
+            else
+                start(stream, batch);
+        });
+    }
+
+    /**
+     * Start as many heaps as there is free space for in the stream's queue
+     * (but always at least one, so that a full queue is retried). If another
+     * thread is already starting heaps (including a caller further up the
+     * stack), it is asked to make another pass instead.
+     */
+    template<typename Stream>
+    static void start(Stream &stream, std::shared_ptr<heap_batch> batch)
+    {
+        bool last, blocked;
+        {
+            std::lock_guard<std::mutex> lock(batch->mutex);
+            if (batch->starting)
+            {
+                batch->restart = true;
+                return;
+            }
+            batch->starting = true;
+        }
+        while (true)
+        {
+            std::size_t remaining;
+            {
+                std::lock_guard<std::mutex> lock(batch->mutex);
+                // The stream may be gone once the batch is complete
+                if (batch->complete)
+                {
+                    batch->starting = false;
+                    return;
+                }
+                batch->restart = false;
+                remaining = batch->retry.size() + (batch->heaps.size() - batch->next);
+            }
+            std::size_t window = std::max(std::size_t(1), std::min(remaining, stream.get_queue_space()));
+            for (std::size_t i = 0; i < window; i++)
+                if (!start_next(stream, batch))
+                    break;
+            std::lock_guard<std::mutex> lock(batch->mutex);
+            if (!batch->restart)
+            {
+                batch->starting = false;
+                last = batch->take_last();
+                // If nothing is in flight, no completion will retry
+                blocked = !batch->retry.empty() && batch->in_flight == 0;
+                break;
+            }
+        }
+        if (last)
+            finish(batch);
+        else if (blocked)
+            retry_later(stream, batch);
+    }
+
+    /**
+     * Start the batch on @a stream. The stream must not be destroyed until
+     * @a tracker has been waited for. If there are no heaps, @a done is
+     * called immediately.
+     */
+    template<typename Stream>
+    static void start(Stream &stream, heap_batch_tracker &tracker, std::shared_ptr<heap_batch> batch)
+    {
+        if (batch->heaps.empty())
+        {
+            batch->done(boost::system::error_code(), 0);
+            return;
+        }
+        batch->tracker = &tracker;
+        tracker.add();
+        start(stream, std::move(batch));
+    }
+};
+
+constexpr std::chrono::microseconds heap_batch::retry_interval;
+
 template<typename Base>
 class stream_wrapper : public Base
 {
@@ -118,6 +433,9 @@ private:
         item_pointer_t bytes_transferred = 0;
     };
 
+    /// Batches started by @ref send_heaps
+    heap_batch_tracker batches;
+
 public:
     using Base::Base;
 
@@ -141,6 +459,64 @@ public:
         else
             return state->bytes_transferred;
     }
+
+    /**
+     * Sends a sequence of heaps synchronously, releasing the GIL once for
+     * the whole batch. Returns the total number of bytes transferred, or
+     * throws an exception for the first heap that failed.
+     */
+    item_pointer_t send_heaps(py::object heaps, py::object cnts = py::object())
+    {
+        struct batch_state
+        {
+            semaphore sem;
+            boost::system::error_code ec;
+            item_pointer_t bytes_transferred = 0;
+        };
+
+        /* As for send_heap, the state needs to be in a shared_ptr. Unlike
+         * send_heap, an interruption only stops new heaps being started, and
+         * we wait for those already in flight, since they reference the
+         * Python heap objects.
+         */
+        auto state = std::make_shared<batch_state>();
+        auto batch = std::make_shared<heap_batch>();
+        batch->set_heaps(heaps, cnts);
+        py::handle<> heaps_handle(batch->heaps_obj);
+        batch->done = [state] (const boost::system::error_code &ec, item_pointer_t bytes_transferred)
+        {
+            state->ec = ec;
+            state->bytes_transferred = bytes_transferred;
+            state->sem.put();
+        };
+
+        bool interrupted = false;
+        {
+            release_gil gil;
+            heap_batch::start(static_cast<Base &>(*this), batches, batch);
+            while (state->sem.get() == -1)
+            {
+                gil.acquire();
+                if (!interrupted && PyErr_CheckSignals() == -1)
+                {
+                    interrupted = true;
+                    batch->cancel();
+                }
+                gil.release();
+            }
+        }
+        if (interrupted)
+            py::throw_error_already_set();
+        if (state->ec)
+            throw boost_io_error(state->ec);
+        return state->bytes_transferred;
+    }
+
+    ~stream_wrapper()
+    {
+        release_gil gil;
+        batches.wait();
+    }
 };
 
 template<typename Base>
@@ -158,10 +534,26 @@ private:
     semaphore_gil<semaphore_fd> sem;
     std::vector<callback_item> callbacks;
     std::mutex callbacks_mutex;
+    /// Batches started by @ref async_send_heaps
+    heap_batch_tracker batches;
 
     // Prevent copying: the callbacks vector cannot sanely be copied
     asyncio_stream_wrapper(const asyncio_stream_wrapper &) = delete;
     asyncio_stream_wrapper &operator=(const asyncio_stream_wrapper &) = delete;
+
+    /// Queue a completed callback for @ref process_callbacks (from any thread)
+    void push_callback(callback_item &&item)
+    {
+        bool was_empty;
+        {
+            std::unique_lock<std::mutex> lock(callbacks_mutex);
+            was_empty = callbacks.empty();
+            callbacks.push_back(std::move(item));
+        }
+        if (was_empty)
+            sem.put();
+    }
+
 public:
     using Base::Base;
 
@@ -186,17 +578,31 @@ public:
         return Base::async_send_heap(h2(), [this, callback_ptr, h_ptr] (
             const boost::system::error_code &ec, item_pointer_t bytes_transferred)
         {
-            bool was_empty;
-            {
-                std::unique_lock<std::mutex> lock(callbacks_mutex);
-                was_empty = callbacks.empty();
-                callbacks.push_back(callback_item{callback_ptr, h_ptr, ec, bytes_transferred});
-            }
-            if (was_empty)
-                sem.put();
+            push_callback(callback_item{callback_ptr, h_ptr, ec, bytes_transferred});
         }, cnt);
     }
 
+    /**
+     * Sends a sequence of heaps, calling @a callback once all of them have
+     * been sent, with the first error (if any) and the total bytes
+     * transferred. Heaps fill the free space in the stream's queue, with
+     * each completion starting the next heap from the network thread.
+     */
+    void async_send_heaps(py::object heaps, py::object callback, py::object cnts = py::object())
+    {
+        auto batch = std::make_shared<heap_batch>();
+        batch->set_heaps(heaps, cnts);
+        PyObject *h_ptr = batch->heaps_obj;
+        PyObject *callback_ptr = callback.ptr();
+        Py_INCREF(callback_ptr);
+        batch->done = [this, callback_ptr, h_ptr] (
+            const boost::system::error_code &ec, item_pointer_t bytes_transferred)
+        {
+            push_callback(callback_item{callback_ptr, h_ptr, ec, bytes_transferred});
+        };
+        heap_batch::start(static_cast<Base &>(*this), batches, batch);
+    }
+
     void process_callbacks()
     {
         sem.get();
@@ -240,6 +646,10 @@ public:
 
     ~asyncio_stream_wrapper()
     {
+        {
+            release_gil gil;
+            batches.wait();
+        }
         for (const callback_item &item : callbacks)
         {
             Py_DECREF(item.h);
@@ -416,6 +826,21 @@ public:
 };
 #endif
 
+#if SPEAD2_USE_SHM
+class shm_stream_wrapper : public thread_pool_handle_wrapper, public stream_wrapper<shm_stream>
+{
+public:
+    shm_stream_wrapper(
+        thread_pool &pool,
+        const std::string &name,
+        std::size_t n_slots,
+        const stream_config &config)
+        : stream_wrapper<shm_stream>(pool.get_io_service(), name, n_slots, config)
+    {
+    }
+};
+#endif
+
 class bytes_stream : private std::stringbuf, public thread_pool_handle_wrapper, public stream_wrapper<streambuf_stream>
 {
 public:
@@ -491,6 +916,10 @@ void stream_register(boost::python::class_<T, boost::noncopyable> &stream_class)
     using namespace boost::python;
     stream_class.def("set_cnt_sequence", &T::set_cnt_sequence,
                      (arg("next"), arg("step")));
+    // Allow the stream to be passed where a spead2::send::stream is needed (e.g. recv.Relay)
+    objects::register_dynamic_id<T>();
+    objects::register_dynamic_id<spead2::send::stream>();
+    objects::register_conversion<T, spead2::send::stream>(false);
 }
 
 template<typename T>
@@ -499,6 +928,7 @@ void sync_stream_register(boost::python::class_<T, boost::noncopyable> &stream_c
     using namespace boost::python;
     stream_register(stream_class);
     stream_class.def("send_heap", &T::send_heap, (arg("heap"), arg("cnt") = s_item_pointer_t(-1)));
+    stream_class.def("send_heaps", &T::send_heaps, (arg("heaps"), arg("cnts") = py::object()));
 }
 
 template<typename T>
@@ -510,6 +940,8 @@ void async_stream_register(boost::python::class_<T, boost::noncopyable> &stream_
         .add_property("fd", &T::get_fd)
         .def("async_send_heap", &T::async_send_heap,
              (arg("heap"), arg("callback"), arg("cnt") = s_item_pointer_t(-1)))
+        .def("async_send_heaps", &T::async_send_heaps,
+             (arg("heaps"), arg("callback"), arg("cnts") = py::object()))
         .def("flush", &T::flush)
         .def("process_callbacks", &T::process_callbacks);
 }
@@ -528,6 +960,7 @@ void register_module()
     class_<heap_wrapper, boost::noncopyable>("Heap", init<flavour>(
             (arg("flavour") = flavour())))
         .add_property("flavour", &heap_wrapper::get_flavour)
+        .add_property("checksum_id", &heap_wrapper::get_checksum_id, &heap_wrapper::set_checksum_id)
         .def("add_item", &heap_wrapper::add_item, arg("item"))
         .def("add_descriptor", &heap_wrapper::add_descriptor,
              (arg("descriptor")))
@@ -581,6 +1014,16 @@ void register_module()
     }
 #endif
 
+#if SPEAD2_USE_SHM
+    {
+        auto stream_class = class_<shm_stream_wrapper, boost::noncopyable>(
+            "ShmStream", init<thread_pool_wrapper &, std::string, std::size_t, const stream_config &>(
+                (arg("thread_pool"), arg("name"), arg("n_slots"), arg("config") = stream_config()))[
+            store_handle_postcall<shm_stream_wrapper, thread_pool_handle_wrapper, &thread_pool_handle_wrapper::thread_pool_handle, 1, 2>()]);
+        sync_stream_register(stream_class);
+    }
+#endif
+
     {
         auto stream_class = class_<bytes_stream, boost::noncopyable>(
             "BytesStream", init<thread_pool_wrapper &, const stream_config &>(
@@ -0,0 +1,476 @@
+/* Copyright 2016 SKA South Africa
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ */
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <spead2/common_defines.h>
+#include <spead2/common_flavour.h>
+#include <spead2/common_logging.h>
+#include <spead2/common_memory_allocator.h>
+#include <spead2/recv_archive.h>
+#include <spead2/recv_heap.h>
+#include <spead2/recv_utils.h>
+
+namespace spead2
+{
+namespace recv
+{
+
+namespace detail
+{
+
+/* File layout (all integers in host byte order, all sections aligned to 64
+ * bytes):
+ *
+ * - archive_file_header
+ * - for each heap: archive_record_header, item pointers, payload
+ * - index: one archive_index_entry per heap
+ * - archive_trailer
+ */
+static constexpr std::size_t archive_alignment = 64;
+static const char archive_magic[8] = {'S', 'P', 'E', 'A', 'D', '2', 'A', 'R'};
+static const char archive_index_magic[8] = {'S', 'P', 'E', 'A', 'D', '2', 'I', 'X'};
+static constexpr std::uint32_t archive_version = 1;
+static constexpr std::uint32_t archive_byte_order = 0x01020304;
+static constexpr std::uint64_t archive_record_magic = 0x7061656832616573ULL;
+
+/// Record flag: the heap contains descriptors
+static constexpr std::uint32_t archive_flag_descriptors = 1;
+
+struct archive_file_header
+{
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t byte_order;
+    std::uint8_t reserved[48];
+};
+
+struct archive_record_header
+{
+    std::uint64_t magic;
+    std::int64_t cnt;
+    std::uint64_t n_pointers;
+    std::uint64_t payload_length;
+    std::uint64_t record_size;          ///< Including this header and padding
+    std::uint32_t heap_address_bits;
+    std::uint32_t bug_compat;
+    std::uint32_t checksum;
+    std::uint32_t flags;
+    std::uint64_t reserved;
+};
+
+struct archive_trailer
+{
+    std::uint64_t index_offset;
+    std::uint64_t n_heaps;
+    std::uint8_t reserved[40];
+    char magic[8];
+};
+
+static_assert(sizeof(archive_file_header) == archive_alignment, "header layout is wrong");
+static_assert(sizeof(archive_record_header) == archive_alignment, "record header layout is wrong");
+static_assert(sizeof(archive_trailer) == archive_alignment, "trailer layout is wrong");
+static_assert(sizeof(archive_index_entry) == 16, "index entry layout is wrong");
+
+static std::size_t round_up(std::size_t value, std::size_t align)
+{
+    return (value + align - 1) / align * align;
+}
+
+/// Offset of the payload from the start of a record
+static std::size_t payload_offset(std::size_t n_pointers)
+{
+    return round_up(sizeof(archive_record_header) + n_pointers * sizeof(item_pointer_t),
+                    archive_alignment);
+}
+
+/**
+ * Read-only view of an archive file. It is a memory allocator so that heaps
+ * can hold a reference to it through their payload deleter; it never
+ * allocates.
+ */
+class archive_mapping : public memory_allocator
+{
+private:
+    virtual void free(std::uint8_t *, void *) override {}
+
+public:
+    std::uint8_t *base = nullptr;
+    std::size_t size = 0;
+
+    explicit archive_mapping(const std::string &filename)
+    {
+        int fd = open(filename.c_str(), O_RDONLY);
+        if (fd < 0)
+            throw_errno("open failed");
+        struct stat st;
+        if (fstat(fd, &st) != 0)
+        {
+            int err = errno;
+            ::close(fd);
+            throw_errno("fstat failed", err);
+        }
+        size = st.st_size;
+        if (size < sizeof(archive_file_header))
+        {
+            ::close(fd);
+            throw std::invalid_argument("file is too small to be a heap archive");
+        }
+        // Private and writable, so that consumers can modify heaps in place
+        void *ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        int err = errno;
+        ::close(fd);
+        if (ptr == MAP_FAILED)
+            throw_errno("mmap failed", err);
+        base = static_cast<std::uint8_t *>(ptr);
+    }
+
+    ~archive_mapping()
+    {
+        munmap(base, size);
+    }
+
+    /// Get the record at @a offset, or null if it is not a valid record
+    const archive_record_header *record(std::uint64_t offset) const
+    {
+        if (offset % archive_alignment != 0
+            || offset < sizeof(archive_file_header)
+            || offset > size - sizeof(archive_record_header))
+            return nullptr;
+        auto header = reinterpret_cast<const archive_record_header *>(base + offset);
+        if (header->magic != archive_record_magic
+            || header->record_size > size - offset
+            || header->n_pointers > (header->record_size - sizeof(archive_record_header)) / sizeof(item_pointer_t)
+            || payload_offset(header->n_pointers) + header->payload_length > header->record_size
+            || header->heap_address_bits == 0
+            || header->heap_address_bits >= 8 * sizeof(item_pointer_t)
+            || header->heap_address_bits % 8 != 0)
+            return nullptr;
+        return header;
+    }
+};
+
+} // namespace detail
+
+constexpr std::size_t heap_archive_writer::default_buffer_size;
+
+heap_archive_writer::heap_archive_writer(const std::string &filename, std::size_t buffer_size)
+{
+    std::size_t page = sysconf(_SC_PAGESIZE);
+    this->buffer_size = detail::round_up(std::max(buffer_size, std::size_t(1)), page);
+    void *ptr;
+    int err = posix_memalign(&ptr, page, this->buffer_size);
+    if (err != 0)
+        throw std::bad_alloc();
+    buffer = static_cast<std::uint8_t *>(ptr);
+    fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0)
+    {
+        err = errno;
+        std::free(buffer);
+        throw_errno("open failed", err);
+    }
+
+    detail::archive_file_header header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, detail::archive_magic, sizeof(header.magic));
+    header.version = detail::archive_version;
+    header.byte_order = detail::archive_byte_order;
+    append(&header, sizeof(header));
+}
+
+heap_archive_writer::~heap_archive_writer()
+{
+    try
+    {
+        close();
+    }
+    catch (std::exception &e)
+    {
+        log_warning("error closing heap archive: %1%", e.what());
+    }
+    std::free(buffer);
+}
+
+void heap_archive_writer::flush_buffer()
+{
+    std::size_t done = 0;
+    while (done < buffer_fill)
+    {
+        ssize_t ret = ::write(fd, buffer + done, buffer_fill - done);
+        if (ret < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            throw_errno("write failed");
+        }
+        done += ret;
+    }
+    offset += buffer_fill;
+    buffer_fill = 0;
+}
+
+void heap_archive_writer::append(const void *data, std::size_t size)
+{
+    const std::uint8_t *ptr = static_cast<const std::uint8_t *>(data);
+    while (size > 0)
+    {
+        std::size_t n = std::min(size, buffer_size - buffer_fill);
+        std::memcpy(buffer + buffer_fill, ptr, n);
+        buffer_fill += n;
+        ptr += n;
+        size -= n;
+        if (buffer_fill == buffer_size)
+            flush_buffer();
+    }
+}
+
+void heap_archive_writer::pad()
+{
+    static const std::uint8_t zeros[detail::archive_alignment] = {};
+    std::size_t misalign = (offset + buffer_fill) % detail::archive_alignment;
+    if (misalign != 0)
+        append(zeros, detail::archive_alignment - misalign);
+}
+
+void heap_archive_writer::write(const heap &h)
+{
+    const int heap_address_bits = h.get_flavour().get_heap_address_bits();
+    /* Re-encode the item pointers from the decoded items, so that items
+     * dropped by a filter (or the checksum item) are not stored. The payload
+     * is compacted to hold only the stored items, since the ranges of the
+     * dropped items were never filled in (and may hold stale data from
+     * recycled memory). Addressed items come before immediate items.
+     */
+    std::vector<item_pointer_t> pointers;
+    std::vector<std::pair<const std::uint8_t *, std::size_t>> segments;
+    s_item_pointer_t payload_length = 0;
+    std::uint32_t flags = 0;
+    for (const item &it : h.get_items())
+    {
+        if (it.id == DESCRIPTOR_ID)
+            flags |= detail::archive_flag_descriptors;
+        if (it.is_immediate)
+        {
+            pointers.push_back(immediate_mask | (item_pointer_t(it.id) << heap_address_bits)
+                               | it.immediate_value);
+        }
+        else
+        {
+            pointers.push_back((item_pointer_t(it.id) << heap_address_bits) | payload_length);
+            segments.emplace_back(it.ptr, it.length);
+            payload_length += it.length;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (fd < 0)
+        throw std::logic_error("heap archive has been closed");
+    detail::archive_record_header header;
+    std::memset(&header, 0, sizeof(header));
+    header.magic = detail::archive_record_magic;
+    header.cnt = h.get_cnt();
+    header.n_pointers = pointers.size();
+    header.payload_length = payload_length;
+    header.record_size = detail::round_up(
+        detail::payload_offset(pointers.size()) + payload_length, detail::archive_alignment);
+    header.heap_address_bits = heap_address_bits;
+    header.bug_compat = h.get_flavour().get_bug_compat();
+    header.checksum = h.get_checksum_status();
+    header.flags = flags;
+
+    index.push_back(detail::archive_index_entry{h.get_cnt(), offset + buffer_fill});
+    append(&header, sizeof(header));
+    append(pointers.data(), pointers.size() * sizeof(item_pointer_t));
+    pad();
+    for (const auto &segment : segments)
+        append(segment.first, segment.second);
+    pad();
+}
+
+void heap_archive_writer::close()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (fd < 0)
+        return;
+    detail::archive_trailer trailer;
+    std::memset(&trailer, 0, sizeof(trailer));
+    trailer.index_offset = offset + buffer_fill;
+    trailer.n_heaps = index.size();
+    std::memcpy(trailer.magic, detail::archive_index_magic, sizeof(trailer.magic));
+    append(index.data(), index.size() * sizeof(index[0]));
+    pad();
+    append(&trailer, sizeof(trailer));
+    try
+    {
+        flush_buffer();
+    }
+    catch (...)
+    {
+        ::close(fd);
+        fd = -1;
+        throw;
+    }
+    int ret = ::close(fd);
+    fd = -1;
+    if (ret != 0)
+        throw_errno("close failed");
+}
+
+std::size_t heap_archive_writer::size()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return index.size();
+}
+
+archive_stream::archive_stream(
+    boost::asio::io_service &io_service,
+    std::shared_ptr<heap_archive_writer> writer,
+    bug_compat_mask bug_compat,
+    std::size_t max_heaps)
+    : stream(io_service, bug_compat, max_heaps), writer(std::move(writer))
+{
+}
+
+archive_stream::~archive_stream()
+{
+    stop();
+}
+
+void archive_stream::heap_ready(live_heap &&h)
+{
+    if (h.is_contiguous())
+        writer->write(heap(std::move(h)));
+    else
+        log_info("discarding incomplete heap %d", h.get_cnt());
+}
+
+heap_archive_reader::heap_archive_reader(const std::string &filename)
+    : mapping(std::make_shared<detail::archive_mapping>(filename))
+{
+    auto header = reinterpret_cast<const detail::archive_file_header *>(mapping->base);
+    if (std::memcmp(header->magic, detail::archive_magic, sizeof(header->magic)) != 0)
+        throw std::invalid_argument("file is not a heap archive");
+    if (header->byte_order != detail::archive_byte_order)
+        throw std::invalid_argument("heap archive was written with a different byte order");
+    if (header->version != detail::archive_version)
+        throw std::invalid_argument("unsupported heap archive version");
+
+    bool have_index = false;
+    if (mapping->size >= sizeof(detail::archive_file_header) + sizeof(detail::archive_trailer))
+    {
+        auto trailer = reinterpret_cast<const detail::archive_trailer *>(
+            mapping->base + mapping->size - sizeof(detail::archive_trailer));
+        std::uint64_t index_end = mapping->size - sizeof(detail::archive_trailer);
+        if (std::memcmp(trailer->magic, detail::archive_index_magic, sizeof(trailer->magic)) == 0
+            && trailer->index_offset <= index_end
+            && trailer->n_heaps <= (index_end - trailer->index_offset) / sizeof(detail::archive_index_entry))
+        {
+            index = reinterpret_cast<const detail::archive_index_entry *>(
+                mapping->base + trailer->index_offset);
+            n_heaps = trailer->n_heaps;
+            have_index = true;
+        }
+    }
+    if (!have_index)
+    {
+        log_warning("heap archive %1% has no index, so scanning it", filename);
+        scan();
+    }
+
+    by_cnt.reserve(n_heaps);
+    for (std::size_t i = 0; i < n_heaps; i++)
+    {
+        by_cnt.emplace(index[i].cnt, i);
+        auto record = mapping->record(index[i].offset);
+        if (record && (record->flags & detail::archive_flag_descriptors))
+            descriptor_indices.push_back(i);
+    }
+}
+
+void heap_archive_reader::scan()
+{
+    std::uint64_t offset = sizeof(detail::archive_file_header);
+    while (offset < mapping->size)
+    {
+        auto record = mapping->record(offset);
+        if (!record)
+            break;    // Truncated record, or the start of the index
+        scanned_index.push_back(detail::archive_index_entry{record->cnt, offset});
+        offset += record->record_size;
+    }
+    index = scanned_index.data();
+    n_heaps = scanned_index.size();
+}
+
+heap heap_archive_reader::get(std::size_t index) const
+{
+    if (index >= n_heaps)
+        throw std::out_of_range("heap index out of range");
+    auto record = mapping->record(this->index[index].offset);
+    if (!record)
+        throw std::invalid_argument("heap archive is corrupt");
+    auto pointers_start = reinterpret_cast<const item_pointer_t *>(record + 1);
+    std::vector<item_pointer_t> pointers(pointers_start, pointers_start + record->n_pointers);
+    memory_allocator::pointer payload;
+    if (record->payload_length > 0)
+    {
+        std::uint8_t *ptr = reinterpret_cast<std::uint8_t *>(const_cast<detail::archive_record_header *>(record))
+            + detail::payload_offset(record->n_pointers);
+        payload = memory_allocator::pointer(ptr, memory_allocator::deleter(mapping));
+    }
+    flavour f(maximum_version, 8 * sizeof(item_pointer_t),
+              record->heap_address_bits, record->bug_compat);
+    return heap(record->cnt, f, std::move(pointers), std::move(payload),
+                record->payload_length, checksum_status(record->checksum));
+}
+
+std::size_t heap_archive_reader::find(s_item_pointer_t cnt) const
+{
+    auto pos = by_cnt.find(cnt);
+    if (pos == by_cnt.end())
+        throw std::out_of_range("heap ID not found in archive");
+    return pos->second;
+}
+
+s_item_pointer_t heap_archive_reader::get_cnt(std::size_t index) const
+{
+    if (index >= n_heaps)
+        throw std::out_of_range("heap index out of range");
+    return this->index[index].cnt;
+}
+
+} // namespace recv
+} // namespace spead2
@@ -19,6 +19,10 @@
  */
 
 #include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <iterator>
+#include <map>
 #include <cassert>
 #include <utility>
 #include <cstring>
@@ -50,10 +54,21 @@ static inline item_pointer_t load_bytes_be(const std::uint8_t *ptr, int len)
 }
 
 heap::heap(live_heap &&h)
+    : cnt(h.cnt),
+    flavour_(maximum_version, 8 * sizeof(item_pointer_t),
+             h.heap_address_bits, h.bug_compat),
+    pointers(std::move(h.pointers)),
+    payload_length(h.min_length),
+    filter(std::move(h.filter)),
+    skipped_ranges(std::move(h.skipped_ranges)),
+    payload(std::move(h.payload)),
+    descriptors_cache(std::move(h.descriptors_cache)),
+    checksum(h.checksum),
+    checksum_id(h.checksum_id)
 {
     assert(h.is_contiguous());
     log_debug("freezing heap with ID %d, %d item pointers, %d bytes payload",
-              h.get_cnt(), h.pointers.size(), h.min_length);
+              cnt, pointers.size(), payload_length);
     /* The length of addressed items is measured from the item to the
      * address of the next item, or the end of the heap. We may receive
      * packets (and hence pointers) out-of-order, so we have to sort.
@@ -62,81 +77,110 @@ heap::heap(live_heap &&h)
      *
      * The sort needs to be stable, because there can be zero-length fields.
      * TODO: these can still break if they cross packet boundaries.
+     *
+     * Packets from well-behaved senders (including spead2) usually
+     * arrive in order with pointers in address order, so check first to
+     * avoid the sort's temporary buffer.
      */
     item_pointer_t sort_mask =
         immediate_mask | ((item_pointer_t(1) << h.heap_address_bits) - 1);
     auto compare = [sort_mask](item_pointer_t a, item_pointer_t b) {
         return (a & sort_mask) < (b & sort_mask);
     };
-    std::stable_sort(h.pointers.begin(), h.pointers.end(), compare);
+    if (!std::is_sorted(pointers.begin(), pointers.end(), compare))
+        std::stable_sort(pointers.begin(), pointers.end(), compare);
 
-    pointer_decoder decoder(h.heap_address_bits);
-    // Determine how much memory is needed to store immediates
-    std::size_t n_immediates = 0;
-    for (std::size_t i = 0; i < h.pointers.size(); i++)
-    {
-        item_pointer_t pointer = h.pointers[i];
-        if (decoder.is_immediate(pointer))
-            n_immediates++;
-    }
-    // Allocate memory
-    const std::size_t immediate_size = h.heap_address_bits / 8;
+    /* Leave h cheaply in a consistent (empty) state, rather than
+     * constructing a new live_heap with fresh allocations. Callers only
+     * destroy it after this point.
+     */
+    h.payload_reserved = 0;
+    h.received_length = 0;
+    h.min_length = 0;
+    h.heap_length = -1;
+}
+
+heap::heap(s_item_pointer_t cnt, const flavour &flavour_,
+           std::vector<item_pointer_t> &&pointers,
+           memory_allocator::pointer &&payload, s_item_pointer_t payload_length,
+           checksum_status checksum)
+    : cnt(cnt), flavour_(flavour_), pointers(std::move(pointers)),
+    payload_length(payload_length), payload(std::move(payload)),
+    checksum(checksum), checksum_id(0)
+{
+}
+
+/// True if any of [first, last) overlaps one of the (disjoint) ranges
+static bool overlaps(const std::map<s_item_pointer_t, s_item_pointer_t> &ranges,
+                     s_item_pointer_t first, s_item_pointer_t last)
+{
+    // Only the last range to start before last can overlap
+    auto next = ranges.lower_bound(last);
+    return next != ranges.begin() && std::prev(next)->second > first;
+}
+
+void heap::decode() const
+{
+    const int heap_address_bits = flavour_.get_heap_address_bits();
+    pointer_decoder decoder(heap_address_bits);
+    const std::size_t immediate_size = heap_address_bits / 8;
     const std::size_t id_size = sizeof(item_pointer_t) - immediate_size;
-    if (n_immediates > 0)
-        immediate_payload.reset(new uint8_t[immediate_size * n_immediates]);
-    uint8_t *next_immediate = immediate_payload.get();
-    items.reserve(h.pointers.size());
+    items.reserve(pointers.size());
 
-    for (std::size_t i = 0; i < h.pointers.size(); i++)
+    for (std::size_t i = 0; i < pointers.size(); i++)
     {
         item new_item;
-        item_pointer_t pointer = h.pointers[i];
+        item_pointer_t pointer = pointers[i];
+        /* Convert to big endian in place, so that an immediate's value can
+         * be referenced directly. pointers[i + 1] is read below before it
+         * is converted.
+         */
+        pointers[i] = htobe<item_pointer_t>(pointer);
         new_item.id = decoder.get_id(pointer);
         if (new_item.id == 0)
             continue; // just padding
+        if (filter && !filter->is_wanted(new_item.id))
+            continue;
         new_item.is_immediate = decoder.is_immediate(pointer);
+        if (new_item.is_immediate && new_item.id == checksum_id)
+            continue;
         if (new_item.is_immediate)
         {
-            new_item.ptr = next_immediate;
+            new_item.ptr = reinterpret_cast<std::uint8_t *>(&pointers[i]) + id_size;
             new_item.length = immediate_size;
             new_item.immediate_value = decoder.get_immediate(pointer);
-            item_pointer_t pointer_be = htobe<item_pointer_t>(pointer);
-            std::memcpy(
-                next_immediate,
-                reinterpret_cast<const std::uint8_t *>(&pointer_be) + id_size,
-                immediate_size);
             log_debug("Found new immediate item ID %d, value %d",
                       new_item.id, new_item.immediate_value);
-            next_immediate += immediate_size;
         }
         else
         {
             s_item_pointer_t start = decoder.get_address(pointer);
             s_item_pointer_t end;
-            if (i + 1 < h.pointers.size()
-                && !decoder.is_immediate(h.pointers[i + 1]))
-                end = decoder.get_address(h.pointers[i + 1]);
+            if (i + 1 < pointers.size()
+                && !decoder.is_immediate(pointers[i + 1]))
+                end = decoder.get_address(pointers[i + 1]);
             else
-                end = h.min_length;
-            assert(start <= h.min_length);
+                end = payload_length;
+            assert(start <= payload_length);
             if (start == end)
             {
                 log_debug("skipping empty item %d", new_item.id);
                 continue;
             }
-            new_item.ptr = h.payload.get() + start;
+            if (filter && overlaps(skipped_ranges, start, end))
+            {
+                // Only possible if item pointers arrived after the payload
+                log_warning("dropping item %d from heap %d because some of its payload was filtered out",
+                            new_item.id, cnt);
+                continue;
+            }
+            new_item.ptr = payload.get() + start;
             new_item.length = end - start;
             log_debug("found new addressed item ID %d, offset %d, length %d",
                       new_item.id, start, end - start);
         }
         items.push_back(new_item);
     }
-    cnt = h.cnt;
-    flavour_ = flavour(maximum_version, 8 * sizeof(item_pointer_t),
-                       h.heap_address_bits, h.bug_compat);
-    payload = std::move(h.payload);
-    // Reset h so that it still satisfies its invariants
-    h = live_heap(0, h.bug_compat, h.allocator);
 }
 
 descriptor heap::to_descriptor() const
@@ -144,7 +188,7 @@ descriptor heap::to_descriptor() const
     const std::size_t immediate_size = flavour_.get_heap_address_bits() / 8;
     const std::size_t id_size = sizeof(item_pointer_t) - immediate_size;
     descriptor out;
-    for (const item &item : items)
+    for (const item &item : get_items())
     {
         switch (item.id)
         {
@@ -227,10 +271,101 @@ void descriptor_stream::heap_ready(live_heap &&h)
 
 } // anonymous namespace
 
+/// Parse a single descriptor item, returning null if it is not valid
+static std::shared_ptr<const descriptor> parse_descriptor(
+    const item &raw, bug_compat_mask bug_compat)
+{
+    descriptor_stream s(bug_compat, 1);
+    mem_to_stream(s, raw.ptr, raw.length);
+    s.stop_received();
+    if (s.descriptors.empty())
+        return nullptr;
+    return std::make_shared<const descriptor>(std::move(s.descriptors[0]));
+}
+
+/// Source of keys for @ref descriptor_cache, shared by all caches
+static std::atomic<std::uint64_t> next_descriptor_key{1};
+
+constexpr std::size_t descriptor_cache::default_max_entries;
+
+descriptor_cache::descriptor_cache(std::size_t max_entries)
+    : max_entries(max_entries)
+{
+}
+
+descriptor_cache::entry descriptor_cache::lookup(const item &raw, bug_compat_mask bug_compat)
+{
+    // The interpretation depends on the bug compatibility flags, so they form part of the key
+    std::string key(reinterpret_cast<const char *>(raw.ptr), raw.length);
+    key.append(reinterpret_cast<const char *>(&bug_compat), sizeof(bug_compat));
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto pos = entries.find(key);
+        if (pos != entries.end())
+        {
+            hits++;
+            return pos->second;
+        }
+        misses++;
+    }
+
+    // Parse without holding the lock
+    entry result{parse_descriptor(raw, bug_compat), 0};
+    if (result.desc)
+    {
+        result.key = next_descriptor_key.fetch_add(1, std::memory_order_relaxed);
+        std::lock_guard<std::mutex> lock(mutex);
+        if (entries.size() >= max_entries)
+            entries.clear();
+        // If another thread got there first, use its entry so that keys agree
+        result = entries.emplace(std::move(key), result).first->second;
+    }
+    return result;
+}
+
+std::uint64_t descriptor_cache::get_hits()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return hits;
+}
+
+std::uint64_t descriptor_cache::get_misses()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return misses;
+}
+
+std::vector<descriptor_cache::entry> heap::get_descriptor_entries() const
+{
+    std::vector<descriptor_cache::entry> out;
+    for (const item &item : get_items())
+    {
+        if (item.id == DESCRIPTOR_ID)
+        {
+            descriptor_cache::entry e;
+            if (descriptors_cache)
+                e = descriptors_cache->lookup(item, flavour_.get_bug_compat());
+            else
+                e = descriptor_cache::entry{parse_descriptor(item, flavour_.get_bug_compat()), 0};
+            if (e.desc)
+                out.push_back(std::move(e));
+        }
+    }
+    return out;
+}
+
 std::vector<descriptor> heap::get_descriptors() const
 {
+    if (descriptors_cache)
+    {
+        std::vector<descriptor> out;
+        for (const descriptor_cache::entry &e : get_descriptor_entries())
+            out.push_back(*e.desc);
+        return out;
+    }
+
     descriptor_stream s(flavour_.get_bug_compat(), 1);
-    for (const item &item : items)
+    for (const item &item : get_items())
     {
         if (item.id == DESCRIPTOR_ID)
         {
@@ -244,7 +379,7 @@ std::vector<descriptor> heap::get_descriptors() const
 
 bool heap::is_start_of_stream() const
 {
-    for (const item &item : items)
+    for (const item &item : get_items())
         if (item.id == STREAM_CTRL_ID)
         {
             item_pointer_t value = load_bytes_be(item.ptr, item.length);
@@ -28,6 +28,7 @@
 #include <spead2/common_defines.h>
 #include <spead2/common_endian.h>
 #include <spead2/common_logging.h>
+#include <spead2/common_crc32c.h>
 
 namespace spead2
 {
@@ -47,6 +48,17 @@ void live_heap::set_memcpy(memcpy_function memcpy)
     this->memcpy = memcpy;
 }
 
+void live_heap::set_item_filter(std::shared_ptr<const item_filter> filter)
+{
+    assert(payload_ranges.empty());
+    this->filter = std::move(filter);
+}
+
+void live_heap::set_descriptor_cache(std::shared_ptr<descriptor_cache> cache)
+{
+    descriptors_cache = std::move(cache);
+}
+
 void live_heap::payload_reserve(std::size_t size, bool exact, const packet_header &packet)
 {
     if (size > payload_reserved)
@@ -103,6 +115,50 @@ bool live_heap::add_payload_range(s_item_pointer_t first, s_item_pointer_t last)
     return true;
 }
 
+void live_heap::copy_payload(const packet_header &packet)
+{
+    s_item_pointer_t first = packet.payload_offset;
+    s_item_pointer_t last = first + packet.payload_length;
+    if (!filter)
+    {
+        this->memcpy(payload.get() + first, packet.payload, packet.payload_length);
+        return;
+    }
+
+    /* Split the packet at the item boundaries known so far. Bytes before the
+     * first known item are copied, since a pointer for them might still
+     * arrive. If a later pointer reveals a wanted item inside a skipped
+     * range, the heap constructor drops that item rather than exposing
+     * garbage.
+     */
+    auto next = item_starts.upper_bound(first);
+    bool wanted = next == item_starts.begin() || std::prev(next)->second;
+    s_item_pointer_t pos = first;
+    while (pos < last)
+    {
+        s_item_pointer_t end = last;
+        if (next != item_starts.end() && next->first < last)
+            end = next->first;
+        if (wanted)
+            this->memcpy(payload.get() + pos, packet.payload + (pos - first), end - pos);
+        else
+        {
+            // Extend the previous range if it is adjacent, to keep the map small
+            auto after = skipped_ranges.upper_bound(pos);
+            if (after != skipped_ranges.begin() && std::prev(after)->second == pos)
+                std::prev(after)->second = end;
+            else
+                skipped_ranges.emplace_hint(after, pos, end);
+        }
+        pos = end;
+        if (next != item_starts.end() && next->first <= pos)
+        {
+            wanted = next->second;
+            ++next;
+        }
+    }
+}
+
 bool live_heap::add_packet(const packet_header &packet)
 {
     assert(cnt == packet.heap_cnt);
@@ -136,12 +192,23 @@ bool live_heap::add_packet(const packet_header &packet)
     ///////////////////////////////////////////////
 
     heap_address_bits = packet.heap_address_bits;
+    bool adopted = false;
     // If this is the first time we know the length, record it
     if (heap_length < 0 && packet.heap_length >= 0)
     {
         heap_length = packet.heap_length;
         min_length = std::max(min_length, heap_length);
-        payload_reserve(min_length, true, packet);
+        if (packet.payload_owner && *packet.payload_owner && !payload && !filter
+            && packet.payload_offset == 0 && packet.payload_length == heap_length)
+        {
+            // The whole heap is in this packet, so use the reader's buffer as is
+            assert(packet.payload_owner->get() == packet.payload);
+            payload = std::move(*packet.payload_owner);
+            payload_reserved = heap_length;
+            adopted = true;
+        }
+        else
+            payload_reserve(min_length, true, packet);
     }
     else
     {
@@ -169,6 +236,15 @@ bool live_heap::add_packet(const packet_header &packet)
                  * pointer may determine the length of the previous direct-addressed item.
                  */
                 pointers.push_back(pointer);
+                if (filter && !decoder.is_immediate(pointer))
+                {
+                    /* Zero-length items can share an address with the
+                     * item that follows, so keep the range if any of them
+                     * is wanted.
+                     */
+                    bool &wanted = item_starts[decoder.get_address(pointer)];
+                    wanted = wanted || filter->is_wanted(item_id);
+                }
                 if (item_id == STREAM_CTRL_ID && decoder.is_immediate(pointer)
                     && decoder.get_immediate(pointer) == CTRL_STREAM_STOP)
                     end_of_stream = true;
@@ -178,9 +254,8 @@ bool live_heap::add_packet(const packet_header &packet)
 
     if (packet.payload_length > 0)
     {
-        this->memcpy(payload.get() + packet.payload_offset,
-                     packet.payload,
-                     packet.payload_length);
+        if (!adopted)
+            copy_payload(packet);
         received_length += packet.payload_length;
     }
     log_debug("packet with %d bytes of payload at offset %d added to heap %d",
@@ -217,5 +292,37 @@ s_item_pointer_t live_heap::get_heap_length() const
     return heap_length;
 }
 
+checksum_status live_heap::verify_checksum(s_item_pointer_t id)
+{
+    checksum = CHECKSUM_NONE;
+    if (pointers.empty())
+        return checksum;
+    pointer_decoder decoder(heap_address_bits);
+    for (item_pointer_t pointer : pointers)
+    {
+        if (decoder.is_immediate(pointer) && decoder.get_id(pointer) == id)
+        {
+            checksum_id = id;
+            if (!is_complete() || !skipped_ranges.empty())
+                checksum = CHECKSUM_UNVERIFIED;
+            else
+            {
+                std::uint32_t expected = decoder.get_immediate(pointer);
+                std::uint32_t actual = crc32c(payload.get(), heap_length);
+                if (expected == actual)
+                    checksum = CHECKSUM_VALID;
+                else
+                {
+                    log_debug("heap %d failed checksum (expected %#x, computed %#x)",
+                              cnt, expected, actual);
+                    checksum = CHECKSUM_INVALID;
+                }
+            }
+            break;
+        }
+    }
+    return checksum;
+}
+
 } // namespace recv
 } // namespace spead2
@@ -132,7 +132,7 @@ void netmap_udp_reader::packet_handler(const boost::system::error_code &error)
     else
         log_warning("error in netmap receive: %1% (%2%)", error.value(), error.message());
 
-    if (get_stream_base().is_stopped())
+    if (is_stopping())
         stopped();
     else
         enqueue_receive();
@@ -141,6 +141,8 @@ std::size_t decode_packet(packet_header &out, const uint8_t *data, std::size_t m
     out.n_items -= first_regular;
     out.payload = out.pointers + out.n_items * sizeof(item_pointer_t);
     out.heap_address_bits = heap_address_bits;
+    out.raw = data;
+    out.raw_size = size;
     return size;
 }
 
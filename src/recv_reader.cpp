@@ -18,6 +18,8 @@
  * @file
  */
 
+#include <atomic>
+#include <cstdint>
 #include <spead2/recv_reader.h>
 #include <spead2/recv_stream.h>
 
@@ -26,6 +28,12 @@ namespace spead2
 namespace recv
 {
 
+std::uint64_t reader::next_id()
+{
+    static std::atomic<std::uint64_t> counter{0};
+    return ++counter;
+}
+
 void reader::stopped()
 {
     stopped_promise.set_value();
@@ -41,6 +49,16 @@ stream_base &reader::get_stream_base() const
     return owner;
 }
 
+bool reader::is_stopping() const
+{
+    return removed || owner.is_stopped();
+}
+
+void reader::run_in_strand(std::function<void()> func)
+{
+    owner.run_in_strand(std::move(func));
+}
+
 void reader::join()
 {
     stopped_promise.get_future().get();
@@ -0,0 +1,293 @@
+/* Copyright 2016 SKA South Africa
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+#include <boost/asio.hpp>
+#include <spead2/common_defines.h>
+#include <spead2/common_endian.h>
+#include <spead2/common_logging.h>
+#include <spead2/recv_packet.h>
+#include <spead2/recv_relay.h>
+#include <spead2/recv_stream.h>
+#include <spead2/recv_utils.h>
+#include <spead2/send_stream.h>
+
+namespace spead2
+{
+namespace recv
+{
+
+constexpr std::size_t relay_stream::default_max_packet_size;
+constexpr std::size_t relay_stream::default_batch_size;
+constexpr std::size_t relay_stream::default_max_batches;
+
+relay_stream::relay_stream(
+    boost::asio::io_service &io_service,
+    send::stream &output,
+    std::size_t max_packet_size,
+    std::size_t batch_size,
+    std::size_t max_batches,
+    std::size_t max_heaps)
+    : stream(io_service, 0, max_heaps),
+    output(output),
+    max_packet_size(max_packet_size),
+    batch_size(batch_size),
+    batches(max_batches),
+    recent(max_heaps, std::make_pair(s_item_pointer_t(-1), false))
+{
+    if (max_packet_size == 0)
+        throw std::invalid_argument("max_packet_size must be positive");
+    if (batch_size == 0)
+        throw std::invalid_argument("batch_size must be positive");
+    if (max_batches == 0)
+        throw std::invalid_argument("max_batches must be positive");
+    free_batches.reserve(max_batches);
+    for (batch &b : batches)
+    {
+        b.storage.reset(new std::uint8_t[batch_size * max_packet_size]);
+        b.packets.reserve(batch_size);
+        free_batches.push_back(&b);
+    }
+}
+
+relay_stream::~relay_stream()
+{
+    stop();
+}
+
+void relay_stream::stop()
+{
+    stream::stop();
+    /* Any flush posted before the stop is ahead of this in the strand, and
+     * none can be posted after it.
+     */
+    run_in_strand([] {});
+    std::unique_lock<std::mutex> lock(batch_mutex);
+    batch_returned.wait(lock, [this] { return free_batches.size() == batches.size(); });
+}
+
+void relay_stream::set_cnt_filter(item_pointer_t modulus, item_pointer_t remainder)
+{
+    if (modulus == 0)
+        throw std::invalid_argument("modulus must be positive");
+    if (remainder >= modulus)
+        throw std::invalid_argument("remainder must be less than modulus");
+    run_in_strand([this, modulus, remainder]
+    {
+        cnt_modulus = modulus;
+        cnt_remainder = remainder;
+    });
+}
+
+void relay_stream::set_item_ids(std::vector<s_item_pointer_t> ids)
+{
+    std::sort(ids.begin(), ids.end());
+    ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+    run_in_strand([this, &ids]
+    {
+        item_ids = std::move(ids);
+        std::fill(recent.begin(), recent.end(), std::make_pair(s_item_pointer_t(-1), false));
+    });
+}
+
+void relay_stream::set_rate(double rate, std::size_t burst_size)
+{
+    if (rate < 0.0)
+        throw std::invalid_argument("rate must be non-negative");
+    // Otherwise a full-sized packet could never be forwarded
+    if (rate > 0.0 && burst_size < max_packet_size)
+        throw std::invalid_argument("burst_size must be at least max_packet_size");
+    run_in_strand([this, rate, burst_size]
+    {
+        this->rate = rate;
+        this->burst_size = burst_size;
+        tokens = burst_size;
+        last_refill = std::chrono::steady_clock::now();
+    });
+}
+
+relay_stats relay_stream::get_stats() const
+{
+    relay_stats stats;
+    stats.packets = n_packets.load();
+    stats.forwarded_packets = n_forwarded_packets.load();
+    stats.forwarded_bytes = n_forwarded_bytes.load();
+    stats.batches = n_batches.load();
+    stats.filtered = n_filtered.load();
+    stats.rate_limited = n_rate_limited.load();
+    stats.overflow = n_overflow.load();
+    stats.send_errors = n_send_errors.load();
+    return stats;
+}
+
+bool relay_stream::is_wanted(const packet_header &packet)
+{
+    if (item_pointer_t(packet.heap_cnt) % cnt_modulus != cnt_remainder)
+        return false;
+    if (item_ids.empty())
+        return true;
+    for (const auto &entry : recent)
+        if (entry.first == packet.heap_cnt)
+            return entry.second;
+
+    pointer_decoder decoder(packet.heap_address_bits);
+    bool wanted = false;
+    for (int i = 0; i < packet.n_items && !wanted; i++)
+    {
+        item_pointer_t pointer = load_be<item_pointer_t>(packet.pointers + i * sizeof(item_pointer_t));
+        s_item_pointer_t id = decoder.get_id(pointer);
+        // Descriptors are needed to decode the items that are wanted
+        wanted = id == DESCRIPTOR_ID || std::binary_search(item_ids.begin(), item_ids.end(), id);
+    }
+    recent[recent_head] = std::make_pair(packet.heap_cnt, wanted);
+    if (++recent_head == recent.size())
+        recent_head = 0;
+    return wanted;
+}
+
+bool relay_stream::consume_tokens(std::size_t bytes)
+{
+    if (rate <= 0.0)
+        return true;
+    auto now = std::chrono::steady_clock::now();
+    std::chrono::duration<double> elapsed = now - last_refill;
+    last_refill = now;
+    tokens = std::min(double(burst_size), tokens + elapsed.count() * rate);
+    if (tokens < bytes)
+        return false;
+    tokens -= bytes;
+    return true;
+}
+
+void relay_stream::send_current()
+{
+    if (!current)
+        return;
+    batch *b = current;
+    current = nullptr;
+    n_batches++;
+    output.async_send_packets(
+        b->packets,
+        [this, b] (const boost::system::error_code &ec, item_pointer_t bytes)
+        {
+            batch_sent(b, ec, bytes);
+        });
+}
+
+void relay_stream::batch_sent(batch *b, const boost::system::error_code &ec, item_pointer_t bytes)
+{
+    std::size_t n = b->packets.size();
+    n_forwarded_bytes += bytes;
+    if (!ec)
+        n_forwarded_packets += n;
+    else if (ec == boost::asio::error::would_block)
+        n_overflow += n;
+    else
+    {
+        n_send_errors += n;
+        log_warning("error forwarding packets: %1%", ec.message());
+    }
+    b->packets.clear();
+
+    std::lock_guard<std::mutex> lock(batch_mutex);
+    free_batches.push_back(b);
+    // The destructor may run as soon as the lock is released
+    batch_returned.notify_all();
+}
+
+bool relay_stream::packet_ready(const packet_header &packet)
+{
+    n_packets++;
+    pointer_decoder decoder(packet.heap_address_bits);
+    bool control = false;
+    bool end_of_stream = false;
+    for (int i = 0; i < packet.n_items; i++)
+    {
+        item_pointer_t pointer = load_be<item_pointer_t>(packet.pointers + i * sizeof(item_pointer_t));
+        if (decoder.get_id(pointer) == STREAM_CTRL_ID && decoder.is_immediate(pointer))
+        {
+            control = true;
+            if (decoder.get_immediate(pointer) == CTRL_STREAM_STOP)
+                end_of_stream = true;
+        }
+    }
+
+    if (!control && !is_wanted(packet))
+        n_filtered++;
+    else if (!control && !consume_tokens(packet.raw_size))
+        n_rate_limited++;
+    else if (packet.raw_size > max_packet_size)
+        n_overflow++;
+    else
+    {
+        if (!current)
+        {
+            std::lock_guard<std::mutex> lock(batch_mutex);
+            if (!free_batches.empty())
+            {
+                current = free_batches.back();
+                free_batches.pop_back();
+            }
+        }
+        if (!current)
+            n_overflow++;
+        else
+        {
+            std::uint8_t *slot = current->storage.get() + current->packets.size() * max_packet_size;
+            std::memcpy(slot, packet.raw, packet.raw_size);
+            current->packets.emplace_back(slot, packet.raw_size);
+            if (current->packets.size() == batch_size)
+                send_current();
+            else if (!flush_pending)
+            {
+                /* Send whatever has accumulated once the reader has finished
+                 * with its current burst of packets.
+                 */
+                flush_pending = true;
+                get_strand().post([this]
+                {
+                    flush_pending = false;
+                    send_current();
+                });
+            }
+        }
+    }
+
+    if (end_of_stream)
+        stop_received();
+    return true;
+}
+
+void relay_stream::stop_received()
+{
+    send_current();
+    stream::stop_received();
+}
+
+} // namespace recv
+} // namespace spead2
@@ -0,0 +1,163 @@
+/* Copyright 2016 SKA South Africa
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ */
+
+#include <spead2/common_features.h>
+#if SPEAD2_USE_SHM
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <spead2/common_shm.h>
+#include <spead2/common_logging.h>
+#include <spead2/recv_shm.h>
+#include <spead2/recv_packet.h>
+#include <spead2/recv_stream.h>
+
+namespace spead2
+{
+namespace recv
+{
+
+namespace
+{
+
+/**
+ * Pseudo-allocator whose pointers are slots of a ring. It never allocates;
+ * freeing a pointer releases the slot whose index is in the user handle.
+ */
+class shm_slot_allocator : public memory_allocator
+{
+private:
+    std::shared_ptr<shm_ring> ring;
+
+    virtual void free(std::uint8_t *, void *user) override
+    {
+        ring->release(reinterpret_cast<std::uintptr_t>(user));
+    }
+
+public:
+    explicit shm_slot_allocator(std::shared_ptr<shm_ring> ring) : ring(std::move(ring)) {}
+};
+
+} // anonymous namespace
+
+shm_reader::shm_reader(stream &owner, std::shared_ptr<shm_ring> ring)
+    : reader(owner), ring(std::move(ring)),
+    slot_allocator(std::make_shared<shm_slot_allocator>(this->ring))
+{
+    wait_thread = std::thread([this] { run_wait(); });
+}
+
+shm_reader::shm_reader(stream &owner, const std::string &name)
+    : shm_reader(owner, std::make_shared<shm_ring>(name))
+{
+}
+
+shm_reader::~shm_reader()
+{
+    // The thread has already posted finish(), so this does not block for long
+    if (wait_thread.joinable())
+        wait_thread.join();
+}
+
+void shm_reader::run_wait()
+{
+    try
+    {
+        while (!stopping)
+        {
+            if (!drain_pending.exchange(true))
+                get_stream().get_strand().post([this] { drain(); });
+            ring->wait();
+        }
+    }
+    catch (std::system_error &e)
+    {
+        log_warning("error waiting on shared memory ring: %1%", e.what());
+    }
+    // This is the last handler posted, so it runs after all the drains
+    get_stream().get_strand().post([this] { finish(); });
+}
+
+void shm_reader::drain()
+{
+    // Clear the flag first, so that a commit after the loop posts a new drain
+    drain_pending = false;
+    std::size_t index, length;
+    const std::uint8_t *data;
+    while (true)
+    {
+        data = ring->try_next(index, length);
+        if (!data)
+        {
+            /* The producer commits before closing, so check again after
+             * seeing the ring closed to be sure that it is empty.
+             */
+            if (!ring->is_closed() || !(data = ring->try_next(index, length)))
+                break;
+        }
+        if (is_stopping())
+        {
+            ring->release(index);
+            continue;
+        }
+        packet_header packet;
+        std::size_t size = decode_packet(packet, data, length);
+        if (size == length)
+        {
+            memory_allocator::pointer owner(
+                const_cast<std::uint8_t *>(packet.payload),
+                memory_allocator::deleter(slot_allocator, reinterpret_cast<void *>(index)));
+            packet.payload_owner = &owner;
+            get_stream_base().add_packet(packet);
+            // If the heap did not take the slot, owner releases it here
+        }
+        else
+        {
+            if (size != 0)
+                log_info("discarding packet due to size mismatch (%1% != %2%)", size, length);
+            ring->release(index);
+        }
+    }
+    if (ring->is_closed() && !is_stopping())
+    {
+        log_debug("shared memory reader: end of stream detected");
+        get_stream_base().stop_received();
+    }
+}
+
+void shm_reader::finish()
+{
+    drain();
+    stopped();
+}
+
+void shm_reader::stop()
+{
+    stopping = true;
+    ring->wake();
+}
+
+} // namespace recv
+} // namespace spead2
+
+#endif // SPEAD2_USE_SHM
@@ -22,8 +22,11 @@
 #include <utility>
 #include <cassert>
 #include <atomic>
+#include <algorithm>
+#include <stdexcept>
 #include <spead2/recv_stream.h>
 #include <spead2/recv_live_heap.h>
+#include <spead2/recv_heap.h>
 #include <spead2/common_memcpy.h>
 #include <spead2/common_thread_pool.h>
 
@@ -63,6 +66,64 @@ void stream_base::set_memory_allocator(std::shared_ptr<memory_allocator> allocat
     this->allocator = std::move(allocator);
 }
 
+void stream_base::set_item_filter(std::shared_ptr<const item_filter> filter)
+{
+    std::lock_guard<std::mutex> lock(allocator_mutex);
+    this->filter = std::move(filter);
+}
+
+void stream_base::set_descriptor_cache(std::shared_ptr<descriptor_cache> cache)
+{
+    std::lock_guard<std::mutex> lock(allocator_mutex);
+    descriptors_cache = std::move(cache);
+}
+
+std::shared_ptr<descriptor_cache> stream_base::get_descriptor_cache()
+{
+    std::lock_guard<std::mutex> lock(allocator_mutex);
+    return descriptors_cache;
+}
+
+void stream_base::set_checksum_id(s_item_pointer_t id)
+{
+    checksum_id.store(id, std::memory_order_relaxed);
+}
+
+s_item_pointer_t stream_base::get_checksum_id() const
+{
+    return checksum_id.load(std::memory_order_relaxed);
+}
+
+std::uint64_t stream_base::get_checksum_valid() const
+{
+    return checksum_valid.load(std::memory_order_relaxed);
+}
+
+std::uint64_t stream_base::get_checksum_invalid() const
+{
+    return checksum_invalid.load(std::memory_order_relaxed);
+}
+
+void stream_base::eject_heap(live_heap &h)
+{
+    s_item_pointer_t id = checksum_id.load(std::memory_order_relaxed);
+    if (id != 0)
+    {
+        switch (h.verify_checksum(id))
+        {
+        case CHECKSUM_VALID:
+            checksum_valid.fetch_add(1, std::memory_order_relaxed);
+            break;
+        case CHECKSUM_INVALID:
+            checksum_invalid.fetch_add(1, std::memory_order_relaxed);
+            break;
+        default:
+            break;
+        }
+    }
+    heap_ready(std::move(h));
+}
+
 void stream_base::set_memcpy(memcpy_function memcpy)
 {
     this->memcpy.store(memcpy, std::memory_order_relaxed);
@@ -86,6 +147,8 @@ void stream_base::set_memcpy(memcpy_function_id id)
 bool stream_base::add_packet(const packet_header &packet)
 {
     assert(!stopped);
+    if (packet_ready(packet))
+        return true;
     // Look for matching heap. For large heaps, this will in most
     // cases be in the head position.
     live_heap *h = NULL;
@@ -116,17 +179,25 @@ bool stream_base::add_packet(const packet_header &packet)
             h = reinterpret_cast<live_heap *>(&heap_storage[head]);
             if (heap_cnts[head] != -1)
             {
-                heap_ready(std::move(*h));
+                eject_heap(*h);
                 h->~live_heap();
             }
             heap_cnts[head] = heap_cnt;
             std::shared_ptr<memory_allocator> allocator;
+            std::shared_ptr<const item_filter> filter;
+            std::shared_ptr<descriptor_cache> descriptors_cache;
             {
                 std::lock_guard<std::mutex> lock(allocator_mutex);
                 allocator = this->allocator;
+                filter = this->filter;
+                descriptors_cache = this->descriptors_cache;
             }
             new (h) live_heap(heap_cnt, bug_compat, allocator);
             h->set_memcpy(memcpy.load(std::memory_order_relaxed));
+            if (filter)
+                h->set_item_filter(std::move(filter));
+            if (descriptors_cache)
+                h->set_descriptor_cache(std::move(descriptors_cache));
         }
     }
 
@@ -139,7 +210,7 @@ bool stream_base::add_packet(const packet_header &packet)
         if (h->is_complete())
         {
             if (!end_of_stream)
-                heap_ready(std::move(*h));
+                eject_heap(*h);
             heap_cnts[position] = -1;
             h->~live_heap();
         }
@@ -159,7 +230,7 @@ void stream_base::flush()
         if (heap_cnts[head] != -1)
         {
             live_heap *h = reinterpret_cast<live_heap *>(&heap_storage[head]);
-            heap_ready(std::move(*h));
+            eject_heap(*h);
             h->~live_heap();
             heap_cnts[head] = -1;
         }
@@ -176,6 +247,7 @@ void stream_base::stop_received()
 stream::stream(boost::asio::io_service &io_service, bug_compat_mask bug_compat, std::size_t max_heaps)
     : stream_base(bug_compat, max_heaps), strand(io_service)
 {
+    set_descriptor_cache(std::make_shared<descriptor_cache>());
 }
 
 stream::stream(thread_pool &thread_pool, bug_compat_mask bug_compat, std::size_t max_heaps)
@@ -212,6 +284,49 @@ void stream::stop_impl()
     run_in_strand([this] { readers.clear(); });
 }
 
+reader *stream::find_reader(std::uint64_t id) const
+{
+    for (const auto &ptr : readers)
+        if (ptr->id == id)
+            return ptr.get();
+    return nullptr;
+}
+
+void stream::remove_reader(reader *r)
+{
+    remove_reader_if([r](const reader &candidate) { return &candidate == r; });
+}
+
+void stream::remove_reader_by_id(std::uint64_t id)
+{
+    remove_reader_if([id](const reader &candidate) { return candidate.id == id; });
+}
+
+void stream::remove_reader_if(std::function<bool(const reader &)> pred)
+{
+    std::unique_ptr<reader> removed = run_in_strand([this, &pred] () -> std::unique_ptr<reader>
+    {
+        std::unique_ptr<reader> out;
+        if (is_stopped())
+            return out;
+        auto pos = std::find_if(readers.begin(), readers.end(),
+                                [&pred](const std::unique_ptr<reader> &ptr) { return pred(*ptr); });
+        if (pos == readers.end())
+            throw std::invalid_argument("reader does not belong to this stream");
+        out = std::move(*pos);
+        readers.erase(pos);
+        out->removed = true;
+        out->stop();
+        return out;
+    });
+    if (removed)
+    {
+        removed->join();
+        // Destroy the reader with the strand held, as in stop_impl
+        run_in_strand([&removed] { removed.reset(); });
+    }
+}
+
 void stream::stop()
 {
     std::call_once(stop_once, [this] { stop_impl(); });
@@ -28,6 +28,8 @@
 # include <unistd.h>
 #endif
 #include <system_error>
+#include <stdexcept>
+#include <memory>
 #include <cstdint>
 #include <cstring>
 #include <cstdlib>
@@ -40,6 +42,7 @@
 #include <spead2/recv_udp_base.h>
 #include <spead2/recv_udp_ibv.h>
 #include <spead2/common_logging.h>
+#include <spead2/common_memory_allocator.h>
 
 namespace spead2
 {
@@ -47,6 +50,23 @@ namespace recv
 {
 
 constexpr std::size_t udp_reader::default_buffer_size;
+constexpr std::size_t udp_reader::default_mmsg_count;
+
+/* Slots are rounded up to a multiple of this, so that each packet starts on
+ * a cache line.
+ */
+static constexpr std::size_t slot_alignment = 64;
+
+static std::size_t check_mmsg_count(std::size_t mmsg_count)
+{
+    if (mmsg_count == 0)
+        throw std::invalid_argument("mmsg_count must be positive");
+#if SPEAD2_USE_RECVMMSG
+    return mmsg_count;
+#else
+    return 1;
+#endif
+}
 
 #if SPEAD2_USE_RECVMMSG
 static boost::asio::ip::udp::socket duplicate_socket(
@@ -75,22 +95,27 @@ udp_reader::udp_reader(
     boost::asio::ip::udp::socket &&socket,
     const boost::asio::ip::udp::endpoint &endpoint,
     std::size_t max_size,
-    std::size_t buffer_size)
+    std::size_t buffer_size,
+    std::size_t mmsg_count,
+    std::shared_ptr<memory_allocator> allocator)
     : udp_reader_base(owner), socket(std::move(socket)), max_size(max_size),
 #if SPEAD2_USE_RECVMMSG
     socket2(socket.get_io_service()),
-    buffer(mmsg_count), iov(mmsg_count), msgvec(mmsg_count)
-#else
-    buffer(new std::uint8_t[max_size + 1])
 #endif
+    // Allocate one extra byte so that overflow can be detected
+    slot_stride((max_size + slot_alignment) / slot_alignment * slot_alignment)
 {
     assert(&this->socket.get_io_service() == &get_io_service());
+    mmsg_count = check_mmsg_count(mmsg_count);
+    if (!allocator)
+        allocator = std::make_shared<mmap_allocator>();
+    buffer = allocator->allocate(mmsg_count * slot_stride, nullptr);
 #if SPEAD2_USE_RECVMMSG
+    iov.resize(mmsg_count);
+    msgvec.resize(mmsg_count);
     for (std::size_t i = 0; i < mmsg_count; i++)
     {
-        // Allocate one extra byte so that overflow can be detected
-        buffer[i].reset(new std::uint8_t[max_size + 1]);
-        iov[i].iov_base = (void *) buffer[i].get();
+        iov[i].iov_base = (void *) slot(i);
         iov[i].iov_len = max_size + 1;
         std::memset(&msgvec[i], 0, sizeof(msgvec[i]));
         msgvec[i].msg_hdr.msg_iov = &iov[i];
@@ -98,28 +123,7 @@ udp_reader::udp_reader(
     }
 #endif
 
-    if (buffer_size != 0)
-    {
-        boost::asio::socket_base::receive_buffer_size option(buffer_size);
-        boost::system::error_code ec;
-        this->socket.set_option(option, ec);
-        if (ec)
-        {
-            log_warning("request for buffer size %s failed (%s): refer to documentation for details on increasing buffer size",
-                        buffer_size, ec.message());
-        }
-        else
-        {
-            // Linux silently clips to the maximum allowed size
-            boost::asio::socket_base::receive_buffer_size actual;
-            this->socket.get_option(actual);
-            if (std::size_t(actual.value()) < buffer_size)
-            {
-                log_warning("requested buffer size %d but only received %d: refer to documentation for details on increasing buffer size",
-                            buffer_size, actual.value());
-            }
-        }
-    }
+    set_socket_buffer_size(this->socket, buffer_size);
     this->socket.bind(endpoint);
 #if SPEAD2_USE_RECVMMSG
     socket2 = duplicate_socket(this->socket);
@@ -127,58 +131,53 @@ udp_reader::udp_reader(
     enqueue_receive();
 }
 
-static boost::asio::ip::udp::socket make_multicast_v4_socket(
-    boost::asio::io_service &io_service,
-    const boost::asio::ip::udp::endpoint &endpoint,
+/// Make a multicast join or leave option for an IPv4 group
+template<typename Option>
+static Option make_multicast_option(
+    const boost::asio::ip::address &group,
     const boost::asio::ip::address &interface_address)
 {
-    if (!endpoint.address().is_v4() || !endpoint.address().is_multicast())
-        throw std::invalid_argument("endpoint is not an IPv4 multicast address");
+    if (!group.is_v4() || !group.is_multicast())
+        throw std::invalid_argument("group is not an IPv4 multicast address");
     if (!interface_address.is_v4())
         throw std::invalid_argument("interface address is not an IPv4 address");
-    boost::asio::ip::udp::socket socket(io_service, endpoint.protocol());
-    socket.set_option(boost::asio::socket_base::reuse_address(true));
-    socket.set_option(boost::asio::ip::multicast::join_group(
-        endpoint.address().to_v4(), interface_address.to_v4()));
-    return socket;
+    return Option(group.to_v4(), interface_address.to_v4());
 }
 
-static boost::asio::ip::udp::socket make_multicast_v6_socket(
-    boost::asio::io_service &io_service,
-    const boost::asio::ip::udp::endpoint &endpoint,
+/// Make a multicast join or leave option for an IPv6 group
+template<typename Option>
+static Option make_multicast_option(
+    const boost::asio::ip::address &group,
     unsigned int interface_index)
 {
-    if (!endpoint.address().is_v6() || !endpoint.address().is_multicast())
-        throw std::invalid_argument("endpoint is not an IPv6 multicast address");
-    boost::asio::ip::udp::socket socket(io_service, endpoint.protocol());
-    socket.set_option(boost::asio::socket_base::reuse_address(true));
-    socket.set_option(boost::asio::ip::multicast::join_group(
-        endpoint.address().to_v6(), interface_index));
-    return socket;
+    if (!group.is_v6() || !group.is_multicast())
+        throw std::invalid_argument("group is not an IPv6 multicast address");
+    return Option(group.to_v6(), interface_index);
 }
 
-static boost::asio::ip::udp::socket make_socket(
-    boost::asio::io_service &io_service,
-    const boost::asio::ip::udp::endpoint &endpoint)
+udp_reader::udp_reader(
+    stream &owner,
+    const boost::asio::ip::udp::endpoint &endpoint,
+    std::size_t max_size,
+    std::size_t buffer_size)
+    : udp_reader(
+        owner,
+        make_socket(owner.get_strand().get_io_service(), endpoint),
+        endpoint, max_size, buffer_size)
 {
-    boost::asio::ip::udp::socket socket(io_service, endpoint.protocol());
-    if (endpoint.address().is_multicast())
-    {
-        socket.set_option(boost::asio::socket_base::reuse_address(true));
-        socket.set_option(boost::asio::ip::multicast::join_group(endpoint.address()));
-    }
-    return socket;
 }
 
 udp_reader::udp_reader(
     stream &owner,
     const boost::asio::ip::udp::endpoint &endpoint,
     std::size_t max_size,
-    std::size_t buffer_size)
+    std::size_t buffer_size,
+    std::size_t mmsg_count,
+    std::shared_ptr<memory_allocator> allocator)
     : udp_reader(
         owner,
         make_socket(owner.get_strand().get_io_service(), endpoint),
-        endpoint, max_size, buffer_size)
+        endpoint, max_size, buffer_size, mmsg_count, std::move(allocator))
 {
 }
 
@@ -187,11 +186,13 @@ udp_reader::udp_reader(
     const boost::asio::ip::udp::endpoint &endpoint,
     std::size_t max_size,
     std::size_t buffer_size,
-    const boost::asio::ip::address &interface_address)
+    const boost::asio::ip::address &interface_address,
+    std::size_t mmsg_count,
+    std::shared_ptr<memory_allocator> allocator)
     : udp_reader(
         owner,
         make_multicast_v4_socket(owner.get_strand().get_io_service(), endpoint, interface_address),
-        endpoint, max_size, buffer_size)
+        endpoint, max_size, buffer_size, mmsg_count, std::move(allocator))
 {
 }
 
@@ -200,11 +201,13 @@ udp_reader::udp_reader(
     const boost::asio::ip::udp::endpoint &endpoint,
     std::size_t max_size,
     std::size_t buffer_size,
-    unsigned int interface_index)
+    unsigned int interface_index,
+    std::size_t mmsg_count,
+    std::shared_ptr<memory_allocator> allocator)
     : udp_reader(
         owner,
         make_multicast_v6_socket(owner.get_strand().get_io_service(), endpoint, interface_index),
-        endpoint, max_size, buffer_size)
+        endpoint, max_size, buffer_size, mmsg_count, std::move(allocator))
 {
 }
 
@@ -231,19 +234,19 @@ void udp_reader::packet_handler(
             }
             for (int i = 0; i < received; i++)
             {
-                bool stopped = process_one_packet(buffer[i].get(), msgvec[i].msg_len, max_size);
+                bool stopped = process_one_packet(slot(i), msgvec[i].msg_len, max_size);
                 if (stopped)
                     break;
             }
 #else
-            process_one_packet(buffer.get(), bytes_transferred, max_size);
+            process_one_packet(slot(0), bytes_transferred, max_size);
 #endif
         }
     }
     else if (error != boost::asio::error::operation_aborted)
         log_warning("Error in UDP receiver: %1%", error.message());
 
-    if (!get_stream_base().is_stopped())
+    if (!is_stopping())
     {
         enqueue_receive();
     }
@@ -263,12 +266,52 @@ void udp_reader::enqueue_receive()
 #if SPEAD2_USE_RECVMMSG
         boost::asio::null_buffers(),
 #else
-        boost::asio::buffer(buffer.get(), max_size + 1),
+        boost::asio::buffer(slot(0), max_size + 1),
 #endif
         endpoint,
         get_stream().get_strand().wrap(std::bind(&udp_reader::packet_handler, this, _1, _2)));
 }
 
+template<typename Option>
+void udp_reader::set_multicast_option(const Option &option)
+{
+    // Once stopping, the socket may already have been closed
+    if (!is_stopping())
+        socket.set_option(option);
+}
+
+void udp_reader::join_multicast(
+    const boost::asio::ip::address &group,
+    const boost::asio::ip::address &interface_address)
+{
+    auto option = make_multicast_option<boost::asio::ip::multicast::join_group>(
+        group, interface_address);
+    run_in_strand([this, &option] { set_multicast_option(option); });
+}
+
+void udp_reader::join_multicast(const boost::asio::ip::address &group, unsigned int interface_index)
+{
+    auto option = make_multicast_option<boost::asio::ip::multicast::join_group>(
+        group, interface_index);
+    run_in_strand([this, &option] { set_multicast_option(option); });
+}
+
+void udp_reader::leave_multicast(
+    const boost::asio::ip::address &group,
+    const boost::asio::ip::address &interface_address)
+{
+    auto option = make_multicast_option<boost::asio::ip::multicast::leave_group>(
+        group, interface_address);
+    run_in_strand([this, &option] { set_multicast_option(option); });
+}
+
+void udp_reader::leave_multicast(const boost::asio::ip::address &group, unsigned int interface_index)
+{
+    auto option = make_multicast_option<boost::asio::ip::multicast::leave_group>(
+        group, interface_index);
+    run_in_strand([this, &option] { set_multicast_option(option); });
+}
+
 void udp_reader::stop()
 {
     /* asio guarantees that closing a socket will cancel any pending
@@ -323,9 +366,14 @@ static void init_ibv_override()
     }
 }
 
-std::unique_ptr<reader> reader_factory<udp_reader>::make_reader(
+/**
+ * If the ibverbs override is enabled and applicable to @a endpoint, construct
+ * an ibverbs reader; otherwise return null.
+ */
+static std::unique_ptr<reader> make_ibv_override(
     stream &owner,
     const boost::asio::ip::udp::endpoint &endpoint,
+    const boost::asio::ip::address &interface_address,
     std::size_t max_size,
     std::size_t buffer_size)
 {
@@ -338,11 +386,26 @@ std::unique_ptr<reader> reader_factory<udp_reader>::make_reader(
             log_info("Overriding reader for %1%:%2% to use ibverbs",
                      endpoint.address().to_string(), endpoint.port());
             return std::unique_ptr<reader>(new udp_ibv_reader(
-                    owner, endpoint, ibv_interface, max_size, buffer_size, ibv_comp_vector));
+                    owner, endpoint, interface_address, max_size, buffer_size, ibv_comp_vector));
         }
+#else
+        (void) owner;
+        (void) interface_address;
+        (void) max_size;
+        (void) buffer_size;
 #endif
     }
-    return std::unique_ptr<reader>(new udp_reader(owner, endpoint, max_size, buffer_size));
+    return nullptr;
+}
+
+std::unique_ptr<reader> reader_factory<udp_reader>::make_reader(
+    stream &owner,
+    const boost::asio::ip::udp::endpoint &endpoint,
+    std::size_t max_size,
+    std::size_t buffer_size)
+{
+    return make_reader(owner, endpoint, max_size, buffer_size,
+                       udp_reader::default_mmsg_count, nullptr);
 }
 
 std::unique_ptr<reader> reader_factory<udp_reader>::make_reader(
@@ -350,22 +413,16 @@ std::unique_ptr<reader> reader_factory<udp_reader>::make_reader(
     const boost::asio::ip::udp::endpoint &endpoint,
     std::size_t max_size,
     std::size_t buffer_size,
-    const boost::asio::ip::address &interface_address)
+    std::size_t mmsg_count,
+    std::shared_ptr<memory_allocator> allocator)
 {
-    if (endpoint.address().is_v4() && endpoint.address().is_multicast())
-    {
-        std::call_once(ibv_once, init_ibv_override);
-#if SPEAD2_USE_IBV
-        if (ibv_override)
-        {
-            log_info("Overriding reader for %1%:%2% to use ibverbs",
-                     endpoint.address().to_string(), endpoint.port());
-            return std::unique_ptr<reader>(new udp_ibv_reader(
-                    owner, endpoint, interface_address, max_size, buffer_size, ibv_comp_vector));
-        }
-#endif
-    }
-    return std::unique_ptr<reader>(new udp_reader(owner, endpoint, max_size, buffer_size, interface_address));
+    // ibv_interface is only read after make_ibv_override initialises it
+    std::unique_ptr<reader> ibv = make_ibv_override(
+        owner, endpoint, ibv_interface, max_size, buffer_size);
+    if (ibv)
+        return ibv;
+    return std::unique_ptr<reader>(new udp_reader(
+            owner, endpoint, max_size, buffer_size, mmsg_count, std::move(allocator)));
 }
 
 std::unique_ptr<reader> reader_factory<udp_reader>::make_reader(
@@ -373,10 +430,31 @@ std::unique_ptr<reader> reader_factory<udp_reader>::make_reader(
     const boost::asio::ip::udp::endpoint &endpoint,
     std::size_t max_size,
     std::size_t buffer_size,
-    unsigned int interface_index)
+    const boost::asio::ip::address &interface_address,
+    std::size_t mmsg_count,
+    std::shared_ptr<memory_allocator> allocator)
+{
+    std::unique_ptr<reader> ibv = make_ibv_override(
+        owner, endpoint, interface_address, max_size, buffer_size);
+    if (ibv)
+        return ibv;
+    return std::unique_ptr<reader>(new udp_reader(
+            owner, endpoint, max_size, buffer_size, interface_address,
+            mmsg_count, std::move(allocator)));
+}
+
+std::unique_ptr<reader> reader_factory<udp_reader>::make_reader(
+    stream &owner,
+    const boost::asio::ip::udp::endpoint &endpoint,
+    std::size_t max_size,
+    std::size_t buffer_size,
+    unsigned int interface_index,
+    std::size_t mmsg_count,
+    std::shared_ptr<memory_allocator> allocator)
 {
     return std::unique_ptr<reader>(new udp_reader(
-            owner, endpoint, max_size, buffer_size, interface_index));
+            owner, endpoint, max_size, buffer_size, interface_index,
+            mmsg_count, std::move(allocator)));
 }
 
 std::unique_ptr<reader> reader_factory<udp_reader>::make_reader(
@@ -384,10 +462,13 @@ std::unique_ptr<reader> reader_factory<udp_reader>::make_reader(
     boost::asio::ip::udp::socket &&socket,
     const boost::asio::ip::udp::endpoint &endpoint,
     std::size_t max_size,
-    std::size_t buffer_size)
+    std::size_t buffer_size,
+    std::size_t mmsg_count,
+    std::shared_ptr<memory_allocator> allocator)
 {
     return std::unique_ptr<reader>(new udp_reader(
-            owner, std::move(socket), endpoint, max_size, buffer_size));
+            owner, std::move(socket), endpoint, max_size, buffer_size,
+            mmsg_count, std::move(allocator)));
 }
 
 } // namespace recv
@@ -20,6 +20,8 @@
 
 #include <cstddef>
 #include <cstdint>
+#include <stdexcept>
+#include <boost/asio.hpp>
 #include <spead2/recv_reader.h>
 #include <spead2/recv_packet.h>
 #include <spead2/recv_stream.h>
@@ -61,5 +63,74 @@ bool udp_reader_base::process_one_packet(const std::uint8_t *data, std::size_t l
     return stopped;
 }
 
+boost::asio::ip::udp::socket udp_reader_base::make_socket(
+    boost::asio::io_service &io_service,
+    const boost::asio::ip::udp::endpoint &endpoint)
+{
+    boost::asio::ip::udp::socket socket(io_service, endpoint.protocol());
+    if (endpoint.address().is_multicast())
+    {
+        socket.set_option(boost::asio::socket_base::reuse_address(true));
+        socket.set_option(boost::asio::ip::multicast::join_group(endpoint.address()));
+    }
+    return socket;
+}
+
+boost::asio::ip::udp::socket udp_reader_base::make_multicast_v4_socket(
+    boost::asio::io_service &io_service,
+    const boost::asio::ip::udp::endpoint &endpoint,
+    const boost::asio::ip::address &interface_address)
+{
+    if (!endpoint.address().is_v4() || !endpoint.address().is_multicast())
+        throw std::invalid_argument("endpoint is not an IPv4 multicast address");
+    if (!interface_address.is_v4())
+        throw std::invalid_argument("interface address is not an IPv4 address");
+    boost::asio::ip::udp::socket socket(io_service, endpoint.protocol());
+    socket.set_option(boost::asio::socket_base::reuse_address(true));
+    socket.set_option(boost::asio::ip::multicast::join_group(
+        endpoint.address().to_v4(), interface_address.to_v4()));
+    return socket;
+}
+
+boost::asio::ip::udp::socket udp_reader_base::make_multicast_v6_socket(
+    boost::asio::io_service &io_service,
+    const boost::asio::ip::udp::endpoint &endpoint,
+    unsigned int interface_index)
+{
+    if (!endpoint.address().is_v6() || !endpoint.address().is_multicast())
+        throw std::invalid_argument("endpoint is not an IPv6 multicast address");
+    boost::asio::ip::udp::socket socket(io_service, endpoint.protocol());
+    socket.set_option(boost::asio::socket_base::reuse_address(true));
+    socket.set_option(boost::asio::ip::multicast::join_group(
+        endpoint.address().to_v6(), interface_index));
+    return socket;
+}
+
+void udp_reader_base::set_socket_buffer_size(
+    boost::asio::ip::udp::socket &socket, std::size_t buffer_size)
+{
+    if (buffer_size == 0)
+        return;
+    boost::asio::socket_base::receive_buffer_size option(buffer_size);
+    boost::system::error_code ec;
+    socket.set_option(option, ec);
+    if (ec)
+    {
+        log_warning("request for buffer size %s failed (%s): refer to documentation for details on increasing buffer size",
+                    buffer_size, ec.message());
+    }
+    else
+    {
+        // Linux silently clips to the maximum allowed size
+        boost::asio::socket_base::receive_buffer_size actual;
+        socket.get_option(actual);
+        if (std::size_t(actual.value()) < buffer_size)
+        {
+            log_warning("requested buffer size %d but only received %d: refer to documentation for details on increasing buffer size",
+                        buffer_size, actual.value());
+        }
+    }
+}
+
 } // namespace recv
 } // namespace spead2
@@ -204,7 +204,7 @@ void udp_ibv_reader::packet_handler(const boost::system::error_code &error)
     else if (error != boost::asio::error::operation_aborted)
         log_warning("Error in UDP receiver: %1%", error.message());
 
-    if (!get_stream_base().is_stopped())
+    if (!is_stopping())
     {
         enqueue_receive();
     }
@@ -230,6 +230,16 @@ void udp_ibv_reader::enqueue_receive()
     }
 }
 
+static void check_multicast_endpoint(const boost::asio::ip::udp::endpoint &endpoint)
+{
+    if (!endpoint.address().is_v4() || !endpoint.address().is_multicast())
+    {
+        std::ostringstream msg;
+        msg << "endpoint " << endpoint << " is not an IPv4 multicast address";
+        throw std::invalid_argument(msg.str());
+    }
+}
+
 udp_ibv_reader::udp_ibv_reader(
     stream &owner,
     const boost::asio::ip::udp::endpoint &endpoint,
@@ -256,16 +266,12 @@ udp_ibv_reader::udp_ibv_reader(
     n_slots(std::max(std::size_t(1), buffer_size / (max_size + header_length))),
     max_poll(max_poll),
     join_socket(owner.get_strand().get_io_service(), boost::asio::ip::udp::v4()),
+    interface_address(interface_address.is_v4() ? interface_address.to_v4() : boost::asio::ip::address_v4()),
     comp_channel_wrapper(owner.get_strand().get_io_service()),
     stop_poll(false)
 {
     for (const auto &endpoint : endpoints)
-        if (!endpoint.address().is_v4() || !endpoint.address().is_multicast())
-        {
-            std::ostringstream msg;
-            msg << "endpoint " << endpoint << " is not an IPv4 multicast address";
-            throw std::invalid_argument(msg.str());
-        }
+        check_multicast_endpoint(endpoint);
     if (!interface_address.is_v4())
         throw std::invalid_argument("interface address is not an IPv4 address");
     if (max_poll <= 0)
@@ -290,8 +296,6 @@ udp_ibv_reader::udp_ibv_reader(
     pd = ibv_pd_t(cm_id);
     qp = create_qp(pd, send_cq, recv_cq, n_slots);
     qp.modify(IBV_QPS_INIT, cm_id->port_num);
-    for (const auto &endpoint : endpoints)
-        flows.push_back(create_flow(qp, endpoint, cm_id->port_num));
 
     std::shared_ptr<mmap_allocator> allocator = std::make_shared<mmap_allocator>(0, true);
     buffer = allocator->allocate(buffer_size, nullptr);
@@ -312,8 +316,7 @@ udp_ibv_reader::udp_ibv_reader(
 
     join_socket.set_option(boost::asio::socket_base::reuse_address(true));
     for (const auto &endpoint : endpoints)
-        join_socket.set_option(boost::asio::ip::multicast::join_group(
-            endpoint.address().to_v4(), interface_address.to_v4()));
+        add_endpoint(endpoint);
 
     if (comp_channel)
         recv_cq.req_notify(false);
@@ -321,6 +324,62 @@ udp_ibv_reader::udp_ibv_reader(
     qp.modify(IBV_QPS_RTR);
 }
 
+void udp_ibv_reader::add_endpoint(const boost::asio::ip::udp::endpoint &endpoint)
+{
+    check_multicast_endpoint(endpoint);
+    if (flows.count(endpoint))
+    {
+        std::ostringstream msg;
+        msg << "endpoint " << endpoint << " is already subscribed";
+        throw std::invalid_argument(msg.str());
+    }
+    // Only join the group for the first endpoint that uses it
+    bool joined = false;
+    for (const auto &flow : flows)
+        if (flow.first.address() == endpoint.address())
+            joined = true;
+    ibv_flow_t flow = create_flow(qp, endpoint, cm_id->port_num);
+    if (!joined)
+        join_socket.set_option(boost::asio::ip::multicast::join_group(
+            endpoint.address().to_v4(), interface_address));
+    flows.emplace(endpoint, std::move(flow));
+}
+
+void udp_ibv_reader::remove_endpoint(const boost::asio::ip::udp::endpoint &endpoint)
+{
+    auto pos = flows.find(endpoint);
+    if (pos == flows.end())
+    {
+        std::ostringstream msg;
+        msg << "endpoint " << endpoint << " is not subscribed";
+        throw std::invalid_argument(msg.str());
+    }
+    flows.erase(pos);
+    for (const auto &flow : flows)
+        if (flow.first.address() == endpoint.address())
+            return;     // group is still in use
+    join_socket.set_option(boost::asio::ip::multicast::leave_group(
+        endpoint.address().to_v4(), interface_address));
+}
+
+void udp_ibv_reader::join_multicast(const boost::asio::ip::udp::endpoint &endpoint)
+{
+    run_in_strand([this, &endpoint]
+    {
+        if (!is_stopping())
+            add_endpoint(endpoint);
+    });
+}
+
+void udp_ibv_reader::leave_multicast(const boost::asio::ip::udp::endpoint &endpoint)
+{
+    run_in_strand([this, &endpoint]
+    {
+        if (!is_stopping())
+            remove_endpoint(endpoint);
+    });
+}
+
 void udp_ibv_reader::stop()
 {
     if (comp_channel)
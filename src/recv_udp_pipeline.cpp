@@ -0,0 +1,351 @@
+/* Copyright 2016 SKA South Africa
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/**
+ * @file
+ */
+
+#ifndef _GNU_SOURCE
+# define _GNU_SOURCE
+#endif
+#include <spead2/common_features.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <poll.h>
+#include <cassert>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <system_error>
+#include <chrono>
+#include <stdexcept>
+#include <utility>
+#include <boost/asio.hpp>
+#include <spead2/common_logging.h>
+#include <spead2/recv_udp_pipeline.h>
+
+namespace spead2
+{
+namespace recv
+{
+
+constexpr std::size_t udp_pipeline_reader::default_buffer_size;
+constexpr std::size_t udp_pipeline_reader::default_batches;
+constexpr std::size_t udp_pipeline_reader::default_batch_size;
+
+/**
+ * Validate the batch parameters, returning @a batches. This is called from
+ * the member initialiser list, before the ringbuffers (which require a
+ * positive capacity) are constructed.
+ */
+static std::size_t check_batches(std::size_t batches, std::size_t batch_size)
+{
+    if (batches == 0)
+        throw std::invalid_argument("batches must be positive");
+    if (batch_size == 0)
+        throw std::invalid_argument("batch_size must be positive");
+    return batches;
+}
+
+/// Ask the kernel to busy-poll the device queue when the socket is empty
+static void set_kernel_busy_poll(boost::asio::ip::udp::socket &socket, int busy_poll)
+{
+#ifdef SO_BUSY_POLL
+    int fd = socket.native_handle();
+    if (setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &busy_poll, sizeof(busy_poll)) != 0)
+    {
+        std::error_code code(errno, std::system_category());
+        log_warning("failed to set SO_BUSY_POLL: %1% (%2%)", code.value(), code.message());
+    }
+# ifdef SO_PREFER_BUSY_POLL
+    int prefer = 1;
+    if (setsockopt(fd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &prefer, sizeof(prefer)) != 0)
+    {
+        std::error_code code(errno, std::system_category());
+        log_warning("failed to set SO_PREFER_BUSY_POLL: %1% (%2%)", code.value(), code.message());
+    }
+# endif
+#else
+    (void) socket;
+    (void) busy_poll;
+    log_warning("SO_BUSY_POLL is not supported on this platform");
+#endif
+}
+
+udp_pipeline_reader::udp_pipeline_reader(
+    stream &owner,
+    boost::asio::ip::udp::socket &&socket,
+    const boost::asio::ip::udp::endpoint &endpoint,
+    std::size_t max_size,
+    std::size_t buffer_size,
+    std::size_t batches,
+    std::size_t batch_size,
+    int busy_poll,
+    bool kernel_busy_poll)
+    : udp_reader_base(owner), socket(std::move(socket)),
+    max_size(max_size), batch_size(batch_size), busy_poll(busy_poll),
+    batches(check_batches(batches, batch_size)), free_batches(batches), full_batches(batches)
+{
+    assert(&this->socket.get_io_service() == &get_io_service());
+    if (busy_poll < 0)
+        throw std::invalid_argument("busy_poll cannot be negative");
+    set_socket_buffer_size(this->socket, buffer_size);
+    this->socket.bind(endpoint);
+    if (busy_poll > 0 && kernel_busy_poll)
+        set_kernel_busy_poll(this->socket, busy_poll);
+    // One extra byte per packet so that truncation can be detected
+    const std::size_t stride = max_size + 1;
+    for (batch &b : this->batches)
+    {
+        b.storage.reset(new std::uint8_t[stride * batch_size]);
+        b.lengths.resize(batch_size);
+#if SPEAD2_USE_RECVMMSG
+        b.iov.resize(batch_size);
+        b.msgvec.resize(batch_size);
+        for (std::size_t i = 0; i < batch_size; i++)
+        {
+            b.iov[i].iov_base = (void *) (b.storage.get() + i * stride);
+            b.iov[i].iov_len = stride;
+            std::memset(&b.msgvec[i], 0, sizeof(b.msgvec[i]));
+            b.msgvec[i].msg_hdr.msg_iov = &b.iov[i];
+            b.msgvec[i].msg_hdr.msg_iovlen = 1;
+        }
+#endif
+        free_batches.push(&b);
+    }
+    network_thread = std::thread([this] { run_network(); });
+}
+
+udp_pipeline_reader::udp_pipeline_reader(
+    stream &owner,
+    const boost::asio::ip::udp::endpoint &endpoint,
+    std::size_t max_size,
+    std::size_t buffer_size,
+    std::size_t batches,
+    std::size_t batch_size,
+    int busy_poll,
+    bool kernel_busy_poll)
+    : udp_pipeline_reader(
+        owner,
+        make_socket(owner.get_strand().get_io_service(), endpoint),
+        endpoint, max_size, buffer_size, batches, batch_size,
+        busy_poll, kernel_busy_poll)
+{
+}
+
+udp_pipeline_reader::udp_pipeline_reader(
+    stream &owner,
+    const boost::asio::ip::udp::endpoint &endpoint,
+    std::size_t max_size,
+    std::size_t buffer_size,
+    const boost::asio::ip::address &interface_address,
+    std::size_t batches,
+    std::size_t batch_size,
+    int busy_poll,
+    bool kernel_busy_poll)
+    : udp_pipeline_reader(
+        owner,
+        make_multicast_v4_socket(owner.get_strand().get_io_service(), endpoint, interface_address),
+        endpoint, max_size, buffer_size, batches, batch_size,
+        busy_poll, kernel_busy_poll)
+{
+}
+
+udp_pipeline_reader::udp_pipeline_reader(
+    stream &owner,
+    const boost::asio::ip::udp::endpoint &endpoint,
+    std::size_t max_size,
+    std::size_t buffer_size,
+    unsigned int interface_index,
+    std::size_t batches,
+    std::size_t batch_size,
+    int busy_poll,
+    bool kernel_busy_poll)
+    : udp_pipeline_reader(
+        owner,
+        make_multicast_v6_socket(owner.get_strand().get_io_service(), endpoint, interface_index),
+        endpoint, max_size, buffer_size, batches, batch_size,
+        busy_poll, kernel_busy_poll)
+{
+}
+
+udp_pipeline_reader::~udp_pipeline_reader()
+{
+    // The thread has already posted finish(), so this does not block for long
+    if (network_thread.joinable())
+        network_thread.join();
+}
+
+bool udp_pipeline_reader::wait_readable()
+{
+    pollfd fds[2];
+    fds[0].fd = socket.native_handle();
+    fds[0].events = POLLIN;
+    fds[1].fd = stop_sem.get_fd();
+    fds[1].events = POLLIN;
+    while (!stopping)
+    {
+        int status = poll(fds, 2, -1);
+        if (status < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            std::error_code code(errno, std::system_category());
+            log_warning("poll failed: %1% (%2%)", code.value(), code.message());
+            return false;
+        }
+        if (fds[0].revents)
+            return !stopping;
+    }
+    return false;
+}
+
+void udp_pipeline_reader::receive(batch &b)
+{
+    int fd = socket.native_handle();
+    b.size = 0;
+#if SPEAD2_USE_RECVMMSG
+    int received = recvmmsg(fd, b.msgvec.data(), batch_size, MSG_DONTWAIT, nullptr);
+    if (received < 0)
+    {
+        if (errno != EAGAIN && errno != EWOULDBLOCK)
+        {
+            std::error_code code(errno, std::system_category());
+            log_warning("recvmmsg failed: %1% (%2%)", code.value(), code.message());
+        }
+        return;
+    }
+    for (int i = 0; i < received; i++)
+        b.lengths[i] = b.msgvec[i].msg_len;
+    b.size = received;
+#else
+    const std::size_t stride = max_size + 1;
+    while (b.size < batch_size)
+    {
+        ssize_t received = recv(fd, b.storage.get() + b.size * stride, stride, MSG_DONTWAIT);
+        if (received < 0)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                std::error_code code(errno, std::system_category());
+                log_warning("recv failed: %1% (%2%)", code.value(), code.message());
+            }
+            break;
+        }
+        b.lengths[b.size++] = received;
+    }
+#endif
+}
+
+bool udp_pipeline_reader::fill(batch &b)
+{
+    if (busy_poll.count() > 0)
+    {
+        auto deadline = std::chrono::steady_clock::now() + busy_poll;
+        do
+        {
+            receive(b);
+            if (b.size > 0)
+                return true;
+        } while (!stopping && std::chrono::steady_clock::now() < deadline);
+    }
+    while (wait_readable())
+    {
+        receive(b);
+        if (b.size > 0)
+            return true;
+    }
+    return false;
+}
+
+void udp_pipeline_reader::run_network()
+{
+    try
+    {
+        while (!stopping)
+        {
+            batch *b = free_batches.pop();
+            if (!fill(*b))
+                break;
+            full_batches.push(std::move(b));
+            if (!drain_pending.exchange(true))
+                get_stream().get_strand().post([this] { drain(); });
+        }
+    }
+    catch (ringbuffer_stopped &e)
+    {
+    }
+    // This is the last handler posted, so it runs after all the drains
+    get_stream().get_strand().post([this] { finish(); });
+}
+
+void udp_pipeline_reader::drain()
+{
+    // Clear the flag first, so that a batch pushed after the loop below
+    // finishes will post a new drain.
+    drain_pending = false;
+    const std::size_t stride = max_size + 1;
+    while (true)
+    {
+        batch *b;
+        try
+        {
+            b = full_batches.try_pop();
+        }
+        catch (ringbuffer_empty &e)
+        {
+            break;
+        }
+        if (!get_stream_base().is_stopped())
+        {
+            for (std::size_t i = 0; i < b->size; i++)
+            {
+                if (process_one_packet(b->storage.get() + i * stride, b->lengths[i], max_size))
+                    break;
+            }
+        }
+        try
+        {
+            free_batches.try_push(std::move(b));
+        }
+        catch (ringbuffer_stopped &e)
+        {
+            // Shutting down, so the batch is no longer needed
+        }
+    }
+}
+
+void udp_pipeline_reader::finish()
+{
+    drain();
+    socket.close();
+    stopped();
+}
+
+void udp_pipeline_reader::stop()
+{
+    /* Wake the network thread, whether it is waiting for the socket or for
+     * a free batch. It posts finish() when it exits.
+     */
+    stopping = true;
+    stop_sem.put();
+    free_batches.stop();
+}
+
+} // namespace recv
+} // namespace spead2
@@ -157,5 +157,12 @@ void heap::add_descriptor(const descriptor &descriptor)
     storage.emplace_back(std::move(blob.first));
 }
 
+void heap::set_checksum_id(s_item_pointer_t id)
+{
+    if (id != 0 && flavour_.get_heap_address_bits() < 32)
+        throw std::invalid_argument("heap address bits are too few to hold a checksum");
+    checksum_id = id;
+}
+
 } // namespace send
 } // namespace spead2
@@ -29,6 +29,7 @@
 #include <spead2/common_defines.h>
 #include <spead2/common_logging.h>
 #include <spead2/common_endian.h>
+#include <spead2/common_crc32c.h>
 
 namespace spead2
 {
@@ -65,6 +66,12 @@ packet_generator::packet_generator(
         if (!use_immediate(it, max_immediate_size))
             payload_size += it.data.buffer.length;
     }
+    n_items = h.items.size();
+    if (h.checksum_id != 0)
+    {
+        assert(max_immediate_size >= sizeof(checksum));
+        n_items++;
+    }
 
     /* Check if we need to add dummy payload to ensure that every packet
      * contains some payload.
@@ -75,7 +82,7 @@ packet_generator::packet_generator(
      * potentially one extra in case we need to inject a NULL item pointer
      * to mark the separation between the padding and the last item.
      */
-    std::size_t item_packets = h.items.size() / max_item_pointers_per_packet + 1;
+    std::size_t item_packets = n_items / max_item_pointers_per_packet + 1;
     /* We want every packet to have some payload, so that packets can be
      * unambiguously ordered and lost packets can be detected. For all
      * packets except the last, we want a multiple of sizeof(item_pointer_t)
@@ -88,6 +95,27 @@ packet_generator::packet_generator(
         payload_size = min_payload_size;
         need_null_item = true;
     }
+
+    if (h.checksum_id != 0)
+    {
+        // The checksum covers the whole payload, including the zero padding
+        s_item_pointer_t covered = 0;
+        for (const item &it : h.items)
+        {
+            if (!use_immediate(it, max_immediate_size))
+            {
+                checksum = crc32c(it.data.buffer.ptr, it.data.buffer.length, checksum);
+                covered += it.data.buffer.length;
+            }
+        }
+        static const std::uint8_t zeros[sizeof(item_pointer_t)] = {};
+        while (covered < payload_size)
+        {
+            std::size_t len = std::min(std::size_t(payload_size - covered), sizeof(zeros));
+            checksum = crc32c(zeros, len, checksum);
+            covered += len;
+        }
+    }
 }
 
 packet packet_generator::next_packet()
@@ -100,7 +128,7 @@ packet packet_generator::next_packet()
         const std::size_t max_immediate_size = h.get_flavour().get_heap_address_bits() / 8;
         const std::size_t n_item_pointers = std::min(
             max_item_pointers_per_packet,
-            h.items.size() + need_null_item - next_item_pointer);
+            n_items + need_null_item - next_item_pointer);
         std::size_t packet_payload_length = std::min(
             std::size_t(payload_size - payload_offset),
             max_packet_size - n_item_pointers * sizeof(item_pointer_t) - prefix_size);
@@ -124,11 +152,15 @@ packet packet_generator::next_packet()
         for (std::size_t i = 0; i < n_item_pointers; i++)
         {
             item_pointer_t ip;
-            if (next_item_pointer == h.items.size())
+            if (next_item_pointer == n_items)
             {
                 assert(need_null_item);
                 ip = htobe<item_pointer_t>(encoder.encode_address(NULL_ID, next_address));
             }
+            else if (next_item_pointer == h.items.size())
+            {
+                ip = htobe<item_pointer_t>(encoder.encode_immediate(h.checksum_id, checksum));
+            }
             else
             {
                 const item &it = h.items[next_item_pointer];
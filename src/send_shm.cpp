@@ -0,0 +1,102 @@
+/* Copyright 2016 SKA South Africa
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ */
+
+#include <spead2/common_features.h>
+#if SPEAD2_USE_SHM
+
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <boost/asio.hpp>
+#include <spead2/common_shm.h>
+#include <spead2/send_shm.h>
+
+namespace spead2
+{
+namespace send
+{
+
+constexpr std::chrono::microseconds shm_stream::retry_interval;
+
+shm_stream::shm_stream(
+    boost::asio::io_service &io_service,
+    std::shared_ptr<shm_ring> ring,
+    const stream_config &config)
+    : stream_impl<shm_stream>(io_service, config), ring(std::move(ring)), timer(io_service)
+{
+    if (this->ring->get_slot_size() < config.get_max_packet_size())
+        throw std::invalid_argument("slot size is less than the maximum packet size");
+}
+
+shm_stream::shm_stream(
+    boost::asio::io_service &io_service,
+    const std::string &name,
+    std::size_t n_slots,
+    const stream_config &config)
+    : shm_stream(io_service,
+                 std::make_shared<shm_ring>(name, n_slots, config.get_max_packet_size()),
+                 config)
+{
+}
+
+void shm_stream::try_send()
+{
+    std::size_t index;
+    std::uint8_t *slot = ring->try_acquire(index);
+    if (!slot)
+    {
+        timer.expires_from_now(retry_interval);
+        timer.async_wait([this] (const boost::system::error_code &error)
+        {
+            if (error)
+            {
+                handler_type handler = std::move(pending_handler);
+                handler(error, 0);
+            }
+            else
+                try_send();
+        });
+        return;
+    }
+
+    std::size_t size = 0;
+    for (const auto &buffer : pending_packet->buffers)
+    {
+        std::size_t buffer_size = boost::asio::buffer_size(buffer);
+        std::memcpy(slot + size, boost::asio::buffer_cast<const std::uint8_t *>(buffer), buffer_size);
+        size += buffer_size;
+    }
+    ring->commit(index, size);
+    pending_packet = nullptr;
+    get_io_service().dispatch(std::bind(std::move(pending_handler), boost::system::error_code(), size));
+}
+
+shm_stream::~shm_stream()
+{
+    flush();
+    ring->close();
+}
+
+} // namespace send
+} // namespace spead2
+
+#endif // SPEAD2_USE_SHM
@@ -26,18 +26,25 @@
 #include <memory>
 #include <chrono>
 #include <exception>
+#include <future>
+#include <algorithm>
+#include <cmath>
+#include <sys/resource.h>
 #include <boost/program_options.hpp>
 #include <boost/asio.hpp>
 #include <boost/format.hpp>
+#include <boost/lexical_cast.hpp>
 #include <spead2/common_thread_pool.h>
 #include <spead2/common_defines.h>
 #include <spead2/common_flavour.h>
 #include <spead2/common_memory_pool.h>
+#include <spead2/common_impair.h>
 #include <spead2/recv_udp.h>
 #include <spead2/recv_heap.h>
 #include <spead2/recv_live_heap.h>
 #include <spead2/recv_ring_stream.h>
 #include <spead2/recv_mem.h>
+#include <spead2/recv_packet.h>
 #include <spead2/send_heap.h>
 #include <spead2/send_udp.h>
 #include <spead2/send_stream.h>
@@ -86,13 +93,29 @@ struct options
     std::string multicast;
     std::string host;
     std::string port;
+
+    // Loopback mode
+    std::string transport = "udp";
+    double rate_gbps = 0.0;
+    std::size_t total_bytes = 256 * 1024 * 1024;
+    std::vector<std::size_t> sweep_packet_sizes;
+    std::vector<std::size_t> sweep_heap_sizes;
+    std::vector<std::size_t> sweep_heaps;
+    std::vector<int> sweep_threads;
+
+    // Impair mode
+    spead2::impairment_config impair;
+    std::size_t impair_heaps = 1024;
+    int passes = 10;
 };
 
 enum class command_mode
 {
     MASTER,
     SLAVE,
-    MEM
+    MEM,
+    LOOPBACK,
+    IMPAIR
 };
 
 template<typename T>
@@ -114,6 +137,12 @@ static void usage(std::ostream &o, const po::options_description &desc, command_
     case command_mode::MEM:
         o << "Usage spead2_bench mem [options]\n";
         break;
+    case command_mode::LOOPBACK:
+        o << "Usage spead2_bench loopback [options]\n";
+        break;
+    case command_mode::IMPAIR:
+        o << "Usage spead2_bench impair [options]\n";
+        break;
     }
     o << desc;
 }
@@ -136,6 +165,47 @@ static options parse_args(int argc, const char **argv, command_mode mode)
             ("mem-max-free", make_opt(opts.mem_max_free), "Maximum free memory buffers")
             ("mem-initial", make_opt(opts.mem_initial), "Initial free memory buffers");
     }
+    if (mode == command_mode::LOOPBACK)
+    {
+        /* Options that can be given several times (or with several values)
+         * to sweep over them. The scalar defaults are filled in below if they
+         * are not given.
+         */
+        desc.add_options()
+            ("quiet", po::bool_switch(&opts.quiet)->default_value(opts.quiet), "Print only the results")
+            ("memcpy-nt", po::bool_switch(&opts.memcpy_nt)->default_value(opts.memcpy_nt), "Use non-temporal memcpy")
+            ("transport", make_opt(opts.transport), "Transport to use (udp or mem)")
+            ("packet", po::value<std::vector<std::size_t>>(&opts.sweep_packet_sizes)->multitoken(), "Maximum packet size(s) to use")
+            ("heap-size", po::value<std::vector<std::size_t>>(&opts.sweep_heap_sizes)->multitoken(), "Payload size(s) for heaps")
+            ("heaps", po::value<std::vector<std::size_t>>(&opts.sweep_heaps)->multitoken(), "Maximum number(s) of in-flight heaps")
+            ("threads", po::value<std::vector<int>>(&opts.sweep_threads)->multitoken(), "Number(s) of threads for each of sender and receiver")
+            ("addr-bits", make_opt(opts.heap_address_bits), "Heap address bits")
+            ("rate", make_opt(opts.rate_gbps), "Send rate in Gb/s (0 for unlimited)")
+            ("bytes", make_opt(opts.total_bytes), "Amount of payload to send per configuration")
+            ("send-buffer", make_opt(opts.send_buffer), "Socket buffer size (sender)")
+            ("recv-buffer", make_opt(opts.recv_buffer), "Socket buffer size (receiver)")
+            ("burst", make_opt(opts.burst_size), "Send burst size")
+            ("mem-max-free", make_opt(opts.mem_max_free), "Maximum free memory buffers")
+            ("mem-initial", make_opt(opts.mem_initial), "Initial free memory buffers")
+            ("port", po::value<std::string>(&opts.port)->default_value("8888"), "UDP port on localhost");
+    }
+    if (mode == command_mode::IMPAIR)
+    {
+        opts.packet_size = 1472;
+        opts.heap_size = 65536;
+        desc.add_options()
+            ("quiet", po::bool_switch(&opts.quiet)->default_value(opts.quiet), "Print only the final result")
+            ("packet", make_opt(opts.packet_size), "Maximum packet size to use")
+            ("heap-size", make_opt(opts.heap_size), "Payload size for heap")
+            ("heaps", make_opt(opts.heaps), "Maximum number of in-flight heaps")
+            ("count", make_opt(opts.impair_heaps), "Number of heaps to send per pass")
+            ("passes", make_opt(opts.passes), "Number of passes over the packets")
+            ("drop", make_opt(opts.impair.drop), "Probability of dropping each packet")
+            ("duplicate", make_opt(opts.impair.duplicate), "Probability of duplicating each packet")
+            ("reorder", make_opt(opts.impair.reorder_window), "Maximum displacement of a packet, in packets")
+            ("interleave", make_opt(opts.impair.interleave), "Number of heaps whose packets are interleaved")
+            ("seed", make_opt(opts.impair.seed), "Seed for the random generator");
+    }
     if (mode == command_mode::MASTER)
     {
         desc.add_options()
@@ -176,6 +246,8 @@ static options parse_args(int argc, const char **argv, command_mode mode)
         positional.add("port", 1);
         break;
     case command_mode::MEM:
+    case command_mode::LOOPBACK:
+    case command_mode::IMPAIR:
         break;
     }
     try
@@ -197,6 +269,19 @@ static options parse_args(int argc, const char **argv, command_mode mode)
         {
             throw po::error("too few positional options have been specified on the command line");
         }
+        if (mode == command_mode::LOOPBACK)
+        {
+            if (opts.transport != "udp" && opts.transport != "mem")
+                throw po::error("--transport must be udp or mem");
+            if (opts.sweep_packet_sizes.empty())
+                opts.sweep_packet_sizes.push_back(opts.packet_size);
+            if (opts.sweep_heap_sizes.empty())
+                opts.sweep_heap_sizes.push_back(opts.heap_size);
+            if (opts.sweep_heaps.empty())
+                opts.sweep_heaps.push_back(opts.heaps);
+            if (opts.sweep_threads.empty())
+                opts.sweep_threads.push_back(1);
+        }
         return opts;
     }
     catch (po::error &e)
@@ -235,8 +320,13 @@ static std::string decode_string(const std::string &s)
     return out;
 }
 
+/**
+ * Send heaps, keeping two in flight. If @a send_times is given, it is filled
+ * with the time at which each heap was passed to the stream.
+ */
 static std::int64_t send_heaps(spead2::send::stream &stream,
-                               const std::vector<spead2::send::heap> &heaps)
+                               const std::vector<spead2::send::heap> &heaps,
+                               std::vector<std::chrono::high_resolution_clock::time_point> *send_times = nullptr)
 {
     std::size_t n_heaps = heaps.size();
     std::deque<std::future<std::int64_t>> futures;
@@ -262,6 +352,8 @@ static std::int64_t send_heaps(spead2::send::stream &stream,
             else
                 last_error = ec;
         };
+        if (send_times)
+            send_times->push_back(std::chrono::high_resolution_clock::now());
         stream.async_send_heap(heaps[i], callback);
     }
     stream.flush();
@@ -760,6 +852,253 @@ static void main_mem(int argc, const char **argv)
         std::cout << rate_gbps << '\n';
 }
 
+/// Receiver for loopback mode, which records when each heap completes
+class loopback_stream : public spead2::recv::stream
+{
+private:
+    virtual void heap_ready(spead2::recv::live_heap &&live) override
+    {
+        if (live.is_contiguous())
+        {
+            auto now = std::chrono::high_resolution_clock::now();
+            spead2::recv::heap heap(std::move(live));
+            // Heap cnts are assigned sequentially from 1 by the sender
+            std::size_t idx = heap.get_cnt() - 1;
+            if (idx < recv_times.size())
+                recv_times[idx] = now;
+            num_heaps++;
+        }
+    }
+
+    virtual void stop_received() override
+    {
+        if (!is_stopped())
+        {
+            spead2::recv::stream::stop_received();
+            stopped_promise.set_value();
+        }
+    }
+
+public:
+    loopback_stream(spead2::thread_pool &thread_pool, std::size_t max_heaps, std::size_t n_heaps)
+        : spead2::recv::stream(thread_pool, 0, max_heaps), recv_times(n_heaps)
+    {
+    }
+
+    std::int64_t num_heaps = 0;
+    /// Completion time per heap, or default-constructed if not received
+    std::vector<std::chrono::high_resolution_clock::time_point> recv_times;
+    std::promise<void> stopped_promise;
+};
+
+/// User plus system CPU time consumed by the process, in seconds
+static double cpu_time()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec
+        + 1e-6 * (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec);
+}
+
+struct loopback_result
+{
+    std::int64_t sent_heaps = 0;
+    std::int64_t received_heaps = 0;
+    double goodput = 0.0;              ///< Received payload bytes per second
+    double cpu_per_byte = 0.0;         ///< CPU seconds per payload byte sent
+    std::vector<double> latencies;     ///< Per-heap latency in seconds (sorted)
+};
+
+static loopback_result run_loopback(
+    const options &opts, std::size_t packet_size, std::size_t heap_size,
+    std::size_t max_heaps, int threads)
+{
+    typedef std::chrono::high_resolution_clock clock;
+    std::int64_t num_heaps = std::max(std::int64_t(opts.total_bytes / heap_size), std::int64_t(16));
+    spead2::thread_pool recv_pool(threads), send_pool(threads);
+    loopback_stream stream(recv_pool, max_heaps, num_heaps);
+    stream.set_memory_allocator(std::make_shared<spead2::memory_pool>(
+        heap_size, heap_size + 1024, opts.mem_max_free, opts.mem_initial));
+    if (opts.memcpy_nt)
+        stream.set_memcpy(spead2::MEMCPY_NONTEMPORAL);
+
+    spead2::flavour flavour(4, 64, opts.heap_address_bits);
+    std::vector<std::uint8_t> data(heap_size);
+    std::vector<spead2::send::heap> heaps;
+    for (std::int64_t i = 0; i < num_heaps; i++)
+    {
+        heaps.emplace_back(flavour);
+        heaps.back().add_item(0x1234, data, false);
+    }
+    heaps.emplace_back(flavour);
+    heaps.back().add_end();
+
+    loopback_result result;
+    result.sent_heaps = num_heaps;
+    std::vector<clock::time_point> send_times;
+    std::future<void> stopped = stream.stopped_promise.get_future();
+    clock::time_point start;
+    double cpu_start;
+    if (opts.transport == "mem")
+    {
+        std::stringstream encoded;
+        spead2::send::streambuf_stream sender(
+            send_pool.get_io_service(), *encoded.rdbuf(),
+            spead2::send::stream_config(packet_size, 0.0, opts.burst_size, 2));
+        send_heaps(sender, heaps);
+        std::string buffer = encoded.str();
+
+        start = clock::now();
+        cpu_start = cpu_time();
+        stream.emplace_reader<spead2::recv::mem_reader>(
+            (const std::uint8_t *) buffer.data(), buffer.size());
+        stopped.wait();
+    }
+    else
+    {
+        boost::asio::ip::udp::endpoint endpoint(
+            boost::asio::ip::address_v4::loopback(), boost::lexical_cast<std::uint16_t>(opts.port));
+        stream.emplace_reader<spead2::recv::udp_reader>(endpoint, packet_size, opts.recv_buffer);
+        spead2::send::stream_config config(
+            packet_size, opts.rate_gbps * 1e9 / 8, opts.burst_size, 3);
+        spead2::send::udp_stream sender(
+            send_pool.get_io_service(), endpoint, config, opts.send_buffer);
+
+        start = clock::now();
+        cpu_start = cpu_time();
+        send_heaps(sender, heaps, &send_times);
+        // The end-of-stream heap may be lost, so do not wait forever
+        if (stopped.wait_for(std::chrono::seconds(1)) != std::future_status::ready)
+            stream.stop();
+    }
+    double cpu = cpu_time() - cpu_start;
+    stream.stop();
+
+    clock::time_point last = start;
+    for (std::int64_t i = 0; i < num_heaps; i++)
+    {
+        const clock::time_point &t = stream.recv_times[i];
+        if (t == clock::time_point())
+            continue;
+        last = std::max(last, t);
+        if (!send_times.empty())
+            result.latencies.push_back(std::chrono::duration<double>(t - send_times[i]).count());
+    }
+    std::sort(result.latencies.begin(), result.latencies.end());
+    result.received_heaps = stream.num_heaps;
+    double elapsed = std::chrono::duration<double>(last - start).count();
+    if (elapsed > 0)
+        result.goodput = double(result.received_heaps) * heap_size / elapsed;
+    result.cpu_per_byte = cpu / (double(num_heaps) * heap_size);
+    return result;
+}
+
+/// Nearest-rank percentile of sorted values, in microseconds
+static std::string percentile(const std::vector<double> &sorted, double p)
+{
+    if (sorted.empty())
+        return "-";
+    std::size_t rank = std::size_t(std::ceil(p / 100.0 * sorted.size()));
+    rank = std::min(std::max(rank, std::size_t(1)), sorted.size());
+    return (boost::format("%.1f") % (sorted[rank - 1] * 1e6)).str();
+}
+
+static void main_loopback(int argc, const char **argv)
+{
+    options opts = parse_args(argc, argv, command_mode::LOOPBACK);
+    const char *row = "%-9s %7s %9s %6s %7s %10s %8s %9s %9s %9s %9s %9s\n";
+    if (!opts.quiet)
+        std::cout << boost::format(row)
+            % "transport" % "packet" % "heap-size" % "heaps" % "threads"
+            % "Gb/s" % "lost" % "ns/B(cpu)"
+            % "p50(us)" % "p90(us)" % "p99(us)" % "max(us)";
+    for (std::size_t packet_size : opts.sweep_packet_sizes)
+        for (std::size_t heap_size : opts.sweep_heap_sizes)
+            for (std::size_t max_heaps : opts.sweep_heaps)
+                for (int threads : opts.sweep_threads)
+                {
+                    loopback_result r = run_loopback(opts, packet_size, heap_size, max_heaps, threads);
+                    std::cout << boost::format(row)
+                        % opts.transport % packet_size % heap_size % max_heaps % threads
+                        % (boost::format("%.3f") % (r.goodput * 8e-9)).str()
+                        % (r.sent_heaps - r.received_heaps)
+                        % (boost::format("%.3f") % (r.cpu_per_byte * 1e9)).str()
+                        % percentile(r.latencies, 50) % percentile(r.latencies, 90)
+                        % percentile(r.latencies, 99) % percentile(r.latencies, 100);
+                }
+}
+
+/// Receiver for impair mode, which counts complete and incomplete heaps
+class impair_stream : public spead2::recv::stream_base
+{
+private:
+    virtual void heap_ready(spead2::recv::live_heap &&live) override
+    {
+        if (live.is_complete())
+        {
+            spead2::recv::heap heap(std::move(live));
+            complete++;
+        }
+        else
+            incomplete++;
+    }
+
+public:
+    using spead2::recv::stream_base::stream_base;
+    std::uint64_t complete = 0;
+    std::uint64_t incomplete = 0;
+};
+
+static void main_impair(int argc, const char **argv)
+{
+    options opts = parse_args(argc, argv, command_mode::IMPAIR);
+    spead2::packet_impairer impairer(opts.impair);
+    spead2::flavour flavour(4, 64, opts.heap_address_bits);
+    std::vector<std::uint8_t> data(opts.heap_size);
+    for (std::size_t i = 0; i < opts.impair_heaps; i++)
+    {
+        spead2::send::heap heap(flavour);
+        heap.add_item(0x1234, data, false);
+        impairer.add_heap(heap, i + 1, opts.packet_size);
+    }
+    std::vector<spead2::packet_impairer::packet_data> packets = impairer.get_packets();
+    std::size_t total_bytes = 0;
+    for (const auto &p : packets)
+        total_bytes += p.size();
+
+    std::uint64_t complete = 0, incomplete = 0;
+    double elapsed = 0.0;
+    for (int pass = 0; pass < opts.passes; pass++)
+    {
+        impair_stream stream(0, opts.heaps);
+        stream.set_memory_allocator(std::make_shared<spead2::memory_pool>(
+            opts.heap_size, opts.heap_size + 1024, opts.heaps + 1, opts.heaps + 1));
+        auto start = std::chrono::high_resolution_clock::now();
+        for (const auto &p : packets)
+        {
+            spead2::recv::packet_header header;
+            if (spead2::recv::decode_packet(header, p.data(), p.size()) > 0)
+                stream.add_packet(header);
+        }
+        stream.flush();
+        auto end = std::chrono::high_resolution_clock::now();
+        elapsed += std::chrono::duration<double>(end - start).count();
+        complete = stream.complete;
+        incomplete = stream.incomplete;
+    }
+    double rate_gbps = total_bytes * opts.passes / elapsed * 8e-9;
+    if (!opts.quiet)
+    {
+        std::cout << "Packets: " << impairer.get_num_packets() << " generated, "
+            << packets.size() << " after impairment\n";
+        std::cout << "Heaps: " << complete << " complete, " << incomplete << " incomplete\n";
+        std::cout << "Processed " << total_bytes * opts.passes << " bytes in " << elapsed << " seconds\n";
+        std::cout << rate_gbps << " Gbps\n";
+    }
+    else
+        std::cout << rate_gbps << ' ' << complete << ' ' << incomplete << '\n';
+}
+
 int main(int argc, const char **argv)
 {
     if (argc >= 2 && argv[1] == std::string("master"))
@@ -768,6 +1107,10 @@ int main(int argc, const char **argv)
         main_slave(argc - 1, argv + 1);
     else if (argc >= 2 && argv[1] == std::string("mem"))
         main_mem(argc - 1, argv + 1);
+    else if (argc >= 2 && argv[1] == std::string("loopback"))
+        main_loopback(argc - 1, argv + 1);
+    else if (argc >= 2 && argv[1] == std::string("impair"))
+        main_impair(argc - 1, argv + 1);
     else
     {
         std::cerr << "Usage:\n"
@@ -775,7 +1118,11 @@ int main(int argc, const char **argv)
             << "OR\n"
             << "    spead2_bench slave <port> [options]\n"
             << "OR\n"
-            << "    spead2_bench mem [options]\n";
+            << "    spead2_bench mem [options]\n"
+            << "OR\n"
+            << "    spead2_bench loopback [options]\n"
+            << "OR\n"
+            << "    spead2_bench impair [options]\n";
         return 2;
     }
 
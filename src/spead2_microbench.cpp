@@ -0,0 +1,552 @@
+/* Copyright 2016 SKA South Africa
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Microbenchmarks for the individual stages of the send and receive paths.
+ * Each benchmark is run for a growing number of operations until it takes at
+ * least a minimum time, and the results are written to stdout as JSON so
+ * that they can be compared between releases.
+ */
+
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <locale>
+#include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <chrono>
+#include <functional>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <cstdlib>
+#include <boost/program_options.hpp>
+#include <boost/asio.hpp>
+#include <spead2/common_defines.h>
+#include <spead2/common_flavour.h>
+#include <spead2/common_memcpy.h>
+#include <spead2/common_crc32c.h>
+#include <spead2/common_memory_allocator.h>
+#include <spead2/common_memory_pool.h>
+#include <spead2/common_ringbuffer.h>
+#include <spead2/recv_packet.h>
+#include <spead2/recv_live_heap.h>
+#include <spead2/recv_heap.h>
+#include <spead2/recv_stream.h>
+#include <spead2/send_heap.h>
+#include <spead2/send_packet.h>
+
+namespace po = boost::program_options;
+
+typedef std::chrono::high_resolution_clock clock_type;
+
+struct options
+{
+    std::string filter;
+    double min_time = 0.2;
+    bool list = false;
+};
+
+/**
+ * Runs a benchmark for the given number of operations, and returns the time
+ * taken in seconds. Setup that should not be timed is excluded by the
+ * function itself.
+ */
+typedef std::function<double(std::uint64_t)> bench_function;
+
+struct benchmark
+{
+    std::string name;
+    double bytes_per_op;       ///< Bytes processed per operation (0 if not meaningful)
+    bench_function run;
+};
+
+struct result
+{
+    std::string name;
+    std::uint64_t ops;
+    double seconds;
+    double bytes_per_op;
+};
+
+/// Sink for computed values, to prevent the compiler from eliding work
+static volatile std::uint64_t sink;
+
+static double elapsed(clock_type::time_point start)
+{
+    return std::chrono::duration<double>(clock_type::now() - start).count();
+}
+
+template<typename T>
+static po::typed_value<T> *make_opt(T &var)
+{
+    return po::value<T>(&var)->default_value(var);
+}
+
+static options parse_args(int argc, const char **argv)
+{
+    options opts;
+    po::options_description desc;
+    desc.add_options()
+        ("filter", make_opt(opts.filter), "Only run benchmarks whose names contain this string")
+        ("min-time", make_opt(opts.min_time), "Minimum time to run each benchmark (seconds)")
+        ("list", po::bool_switch(&opts.list)->default_value(opts.list), "List the benchmarks and exit")
+        ("help,h", "Show help text");
+    try
+    {
+        po::variables_map vm;
+        po::store(po::command_line_parser(argc, argv)
+            .style(po::command_line_style::default_style & ~po::command_line_style::allow_guessing)
+            .options(desc)
+            .run(), vm);
+        po::notify(vm);
+        if (vm.count("help"))
+        {
+            std::cout << "Usage: spead2_microbench [options]\n" << desc;
+            std::exit(0);
+        }
+        return opts;
+    }
+    catch (po::error &e)
+    {
+        std::cerr << e.what() << '\n';
+        std::cerr << "Usage: spead2_microbench [options]\n" << desc;
+        std::exit(2);
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+
+/// Encode heaps of a single item of @a heap_size bytes into packets
+static std::vector<std::vector<std::uint8_t>> make_packets(
+    std::size_t heap_size, std::size_t packet_size,
+    spead2::s_item_pointer_t first_cnt, std::size_t n_heaps)
+{
+    std::vector<std::uint8_t> payload(heap_size);
+    for (std::size_t i = 0; i < heap_size; i++)
+        payload[i] = std::uint8_t(i);
+    spead2::send::heap h;
+    h.add_item(0x1000, payload.data(), payload.size(), false);
+
+    std::vector<std::vector<std::uint8_t>> out;
+    for (std::size_t i = 0; i < n_heaps; i++)
+    {
+        spead2::send::packet_generator gen(h, first_cnt + i, packet_size);
+        while (true)
+        {
+            spead2::send::packet pkt = gen.next_packet();
+            if (pkt.buffers.empty())
+                break;
+            std::vector<std::uint8_t> raw(boost::asio::buffer_size(pkt.buffers));
+            boost::asio::buffer_copy(boost::asio::buffer(raw), pkt.buffers);
+            out.push_back(std::move(raw));
+        }
+    }
+    return out;
+}
+
+static spead2::recv::packet_header decode(const std::vector<std::uint8_t> &raw)
+{
+    spead2::recv::packet_header header;
+    std::size_t size = spead2::recv::decode_packet(header, raw.data(), raw.size());
+    if (size != raw.size())
+        throw std::runtime_error("failed to decode generated packet");
+    return header;
+}
+
+static double average_size(const std::vector<std::vector<std::uint8_t>> &packets)
+{
+    std::size_t total = 0;
+    for (const auto &p : packets)
+        total += p.size();
+    return double(total) / packets.size();
+}
+
+static benchmark bench_decode_packet(std::size_t packet_size)
+{
+    auto packets = std::make_shared<std::vector<std::vector<std::uint8_t>>>(
+        make_packets(1024 * 1024, packet_size, 1, 1));
+    return benchmark{
+        "decode_packet/" + std::to_string(packet_size),
+        average_size(*packets),
+        [packets] (std::uint64_t ops)
+        {
+            std::uint64_t total = 0;
+            std::size_t idx = 0;
+            spead2::recv::packet_header header;
+            auto start = clock_type::now();
+            for (std::uint64_t i = 0; i < ops; i++)
+            {
+                const auto &raw = (*packets)[idx];
+                total += spead2::recv::decode_packet(header, raw.data(), raw.size());
+                if (++idx == packets->size())
+                    idx = 0;
+            }
+            double t = elapsed(start);
+            sink = total;
+            return t;
+        }
+    };
+}
+
+/// Stream that discards heaps, counting them
+class counting_stream : public spead2::recv::stream_base
+{
+private:
+    virtual void heap_ready(spead2::recv::live_heap &&) override
+    {
+        heaps++;
+    }
+
+public:
+    using spead2::recv::stream_base::stream_base;
+    std::uint64_t heaps = 0;
+};
+
+enum class packet_order
+{
+    SEQUENTIAL,     ///< All packets of one heap, then the next
+    INTERLEAVED,    ///< Round-robin over 4 heaps
+    REVERSED        ///< Packets within each heap in reverse order
+};
+
+static benchmark bench_add_packet(packet_order order, std::size_t packet_size)
+{
+    const std::size_t heap_size = 65536;
+    const std::size_t n_heaps = 8;
+    const std::size_t interleave = 4;
+    auto raw = std::make_shared<std::vector<std::vector<std::uint8_t>>>(
+        make_packets(heap_size, packet_size, 1, n_heaps));
+    std::size_t per_heap = raw->size() / n_heaps;
+
+    // Headers point into *raw, which is kept alive by the closure
+    auto headers = std::make_shared<std::vector<spead2::recv::packet_header>>();
+    std::string order_name;
+    switch (order)
+    {
+    case packet_order::SEQUENTIAL:
+        order_name = "sequential";
+        for (const auto &p : *raw)
+            headers->push_back(decode(p));
+        break;
+    case packet_order::INTERLEAVED:
+        order_name = "interleaved";
+        for (std::size_t group = 0; group < n_heaps; group += interleave)
+            for (std::size_t j = 0; j < per_heap; j++)
+                for (std::size_t k = group; k < group + interleave; k++)
+                    headers->push_back(decode((*raw)[k * per_heap + j]));
+        break;
+    case packet_order::REVERSED:
+        order_name = "reversed";
+        for (std::size_t h = 0; h < n_heaps; h++)
+            for (std::size_t j = per_heap; j > 0; j--)
+                headers->push_back(decode((*raw)[h * per_heap + j - 1]));
+        break;
+    }
+
+    return benchmark{
+        "add_packet/" + order_name + "/" + std::to_string(packet_size),
+        average_size(*raw),
+        [raw, headers, heap_size] (std::uint64_t ops)
+        {
+            counting_stream stream(0, 8);
+            stream.set_memory_allocator(std::make_shared<spead2::memory_pool>(
+                0, heap_size, 16, 16));
+            std::size_t idx = 0;
+            auto start = clock_type::now();
+            for (std::uint64_t i = 0; i < ops; i++)
+            {
+                stream.add_packet((*headers)[idx]);
+                if (++idx == headers->size())
+                    idx = 0;
+            }
+            stream.flush();
+            double t = elapsed(start);
+            sink = stream.heaps;
+            return t;
+        }
+    };
+}
+
+static benchmark bench_heap_freeze(std::size_t n_items)
+{
+    // A heap with many small items, so that freezing has work to do
+    const std::size_t item_size = 64;
+    auto payload = std::make_shared<std::vector<std::uint8_t>>(n_items * item_size);
+    auto sh = std::make_shared<spead2::send::heap>();
+    for (std::size_t i = 0; i < n_items; i++)
+        sh->add_item(0x1000 + i, payload->data() + i * item_size, item_size, false);
+    auto raw = std::make_shared<std::vector<std::vector<std::uint8_t>>>();
+    spead2::send::packet_generator gen(*sh, 1, 65536);
+    for (spead2::send::packet pkt = gen.next_packet(); !pkt.buffers.empty(); pkt = gen.next_packet())
+    {
+        std::vector<std::uint8_t> data(boost::asio::buffer_size(pkt.buffers));
+        boost::asio::buffer_copy(boost::asio::buffer(data), pkt.buffers);
+        raw->push_back(std::move(data));
+    }
+
+    return benchmark{
+        "heap_freeze/" + std::to_string(n_items),
+        0.0,
+        [raw] (std::uint64_t ops)
+        {
+            const std::size_t batch = 64;
+            auto allocator = std::make_shared<spead2::memory_allocator>();
+            std::vector<spead2::recv::packet_header> headers;
+            for (const auto &p : *raw)
+                headers.push_back(decode(p));
+            double t = 0.0;
+            std::uint64_t total = 0;
+            for (std::uint64_t done = 0; done < ops; done += batch)
+            {
+                std::size_t n = std::min<std::uint64_t>(batch, ops - done);
+                std::vector<std::unique_ptr<spead2::recv::live_heap>> live;
+                std::vector<spead2::recv::heap> frozen;
+                frozen.reserve(n);
+                for (std::size_t i = 0; i < n; i++)
+                {
+                    live.emplace_back(new spead2::recv::live_heap(1, 0, allocator));
+                    for (const auto &header : headers)
+                        live.back()->add_packet(header);
+                }
+                // Items are decoded lazily, so include that in the timing
+                auto start = clock_type::now();
+                for (std::size_t i = 0; i < n; i++)
+                {
+                    frozen.emplace_back(std::move(*live[i]));
+                    total += frozen.back().get_items().size();
+                }
+                t += elapsed(start);
+            }
+            sink = total;
+            return t;
+        }
+    };
+}
+
+static benchmark bench_packet_generator(std::size_t packet_size)
+{
+    const std::size_t heap_size = 1024 * 1024;
+    auto payload = std::make_shared<std::vector<std::uint8_t>>(heap_size);
+    auto h = std::make_shared<spead2::send::heap>();
+    h->add_item(0x1000, payload->data(), payload->size(), false);
+    return benchmark{
+        "packet_generator/" + std::to_string(packet_size),
+        double(packet_size),
+        [payload, h, packet_size] (std::uint64_t ops)
+        {
+            std::uint64_t total = 0;
+            std::unique_ptr<spead2::send::packet_generator> gen(
+                new spead2::send::packet_generator(*h, 1, packet_size));
+            auto start = clock_type::now();
+            for (std::uint64_t i = 0; i < ops; i++)
+            {
+                spead2::send::packet pkt = gen->next_packet();
+                if (pkt.buffers.empty())
+                {
+                    gen.reset(new spead2::send::packet_generator(*h, 1, packet_size));
+                    pkt = gen->next_packet();
+                }
+                total += pkt.buffers.size();
+            }
+            double t = elapsed(start);
+            sink = total;
+            return t;
+        }
+    };
+}
+
+static benchmark bench_ringbuffer(std::size_t capacity)
+{
+    return benchmark{
+        "ringbuffer/" + std::to_string(capacity),
+        0.0,
+        [capacity] (std::uint64_t ops)
+        {
+            spead2::ringbuffer<std::uint64_t> ring(capacity);
+            auto start = clock_type::now();
+            std::thread producer([&ring, ops] {
+                for (std::uint64_t i = 0; i < ops; i++)
+                    ring.push(std::uint64_t(i));
+            });
+            std::uint64_t total = 0;
+            for (std::uint64_t i = 0; i < ops; i++)
+                total += ring.pop();
+            double t = elapsed(start);
+            producer.join();
+            sink = total;
+            return t;
+        }
+    };
+}
+
+static benchmark bench_memory_pool(int threads)
+{
+    const std::size_t size = 65536;
+    return benchmark{
+        "memory_pool/" + std::to_string(threads),
+        0.0,
+        [threads, size] (std::uint64_t ops)
+        {
+            auto pool = std::make_shared<spead2::memory_pool>(0, size, 4 * threads, 4 * threads);
+            std::vector<std::thread> workers;
+            auto start = clock_type::now();
+            for (int i = 0; i < threads; i++)
+            {
+                std::uint64_t my_ops = ops / threads + (std::uint64_t(i) < ops % threads ? 1 : 0);
+                workers.emplace_back([pool, my_ops, size] {
+                    for (std::uint64_t j = 0; j < my_ops; j++)
+                    {
+                        spead2::memory_allocator::pointer ptr = pool->allocate(size, nullptr);
+                        ptr.reset();
+                    }
+                });
+            }
+            for (auto &w : workers)
+                w.join();
+            return elapsed(start);
+        }
+    };
+}
+
+static benchmark bench_memcpy(spead2::memcpy_function_id id, std::size_t size)
+{
+    spead2::memcpy_function func = (id == spead2::MEMCPY_NONTEMPORAL)
+        ? spead2::memcpy_nontemporal : std::memcpy;
+    std::string name = (id == spead2::MEMCPY_NONTEMPORAL) ? "nontemporal" : "std";
+    return benchmark{
+        "memcpy/" + name + "/" + std::to_string(size),
+        double(size),
+        [func, size] (std::uint64_t ops)
+        {
+            std::vector<std::uint8_t> src(size, 1), dest(size);
+            auto start = clock_type::now();
+            for (std::uint64_t i = 0; i < ops; i++)
+                func(dest.data(), src.data(), size);
+            double t = elapsed(start);
+            sink = dest[size / 2];
+            return t;
+        }
+    };
+}
+
+static benchmark bench_crc32c(std::size_t size)
+{
+    return benchmark{
+        "crc32c/" + std::to_string(size),
+        double(size),
+        [size] (std::uint64_t ops)
+        {
+            std::vector<std::uint8_t> src(size, 1);
+            std::uint32_t crc = 0;
+            auto start = clock_type::now();
+            for (std::uint64_t i = 0; i < ops; i++)
+                crc = spead2::crc32c(src.data(), size, crc);
+            double t = elapsed(start);
+            sink = crc;
+            return t;
+        }
+    };
+}
+
+static std::vector<benchmark> make_benchmarks()
+{
+    std::vector<benchmark> out;
+    for (std::size_t packet_size : {1472, 9000})
+        out.push_back(bench_decode_packet(packet_size));
+    for (packet_order order : {packet_order::SEQUENTIAL, packet_order::INTERLEAVED, packet_order::REVERSED})
+        for (std::size_t packet_size : {1472, 9000})
+            out.push_back(bench_add_packet(order, packet_size));
+    for (std::size_t n_items : {4, 64})
+        out.push_back(bench_heap_freeze(n_items));
+    for (std::size_t packet_size : {1472, 9000})
+        out.push_back(bench_packet_generator(packet_size));
+    for (std::size_t capacity : {16, 1024})
+        out.push_back(bench_ringbuffer(capacity));
+    for (int threads : {1, 2, 4})
+        out.push_back(bench_memory_pool(threads));
+    for (spead2::memcpy_function_id id : {spead2::MEMCPY_STD, spead2::MEMCPY_NONTEMPORAL})
+        for (std::size_t size : {4096, 4 * 1024 * 1024})
+            out.push_back(bench_memcpy(id, size));
+    for (std::size_t size : {4096, 4 * 1024 * 1024})
+        out.push_back(bench_crc32c(size));
+    return out;
+}
+
+/**
+ * Run a benchmark with an increasing number of operations until it runs for
+ * at least @a min_time seconds.
+ */
+static result measure(const benchmark &b, double min_time)
+{
+    std::uint64_t ops = 1;
+    while (true)
+    {
+        double t = b.run(ops);
+        if (t >= min_time)
+            return result{b.name, ops, t, b.bytes_per_op};
+        // Aim slightly past the target, but grow by at most 100x per step
+        double scale = (t > 0.0) ? min_time * 1.2 / t : 100.0;
+        scale = std::min(scale, 100.0);
+        ops = std::max(ops + 1, std::uint64_t(ops * scale));
+    }
+}
+
+static void write_json(std::ostream &out, const std::vector<result> &results)
+{
+    out.imbue(std::locale::classic());
+    out << std::setprecision(6);
+    out << "{\n  \"benchmarks\": [";
+    for (std::size_t i = 0; i < results.size(); i++)
+    {
+        const result &r = results[i];
+        out << (i > 0 ? "," : "") << "\n    {\"name\": \"" << r.name << "\""
+            << ", \"iterations\": " << r.ops
+            << ", \"ns_per_op\": " << r.seconds * 1e9 / r.ops;
+        if (r.bytes_per_op > 0)
+            out << ", \"bytes_per_second\": " << r.bytes_per_op * r.ops / r.seconds;
+        out << "}";
+    }
+    out << "\n  ]\n}\n";
+}
+
+int main(int argc, const char **argv)
+{
+    options opts = parse_args(argc, argv);
+    std::vector<benchmark> benchmarks = make_benchmarks();
+    std::vector<result> results;
+    for (const benchmark &b : benchmarks)
+    {
+        if (b.name.find(opts.filter) == std::string::npos)
+            continue;
+        if (opts.list)
+        {
+            std::cout << b.name << '\n';
+            continue;
+        }
+        std::cerr << b.name << "... " << std::flush;
+        results.push_back(measure(b, opts.min_time));
+        const result &r = results.back();
+        std::cerr << r.seconds * 1e9 / r.ops << " ns/op\n";
+    }
+    if (!opts.list)
+        write_json(std::cout, results);
+    return 0;
+}
@@ -22,11 +22,18 @@
 #include <vector>
 #include <string>
 #include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <future>
+#include <algorithm>
+#include <sstream>
 #include <boost/program_options.hpp>
 #include <boost/asio.hpp>
 #include <boost/lexical_cast.hpp>
 #include <spead2/common_thread_pool.h>
 #include <spead2/recv_udp.h>
+#include <spead2/recv_udp_pipeline.h>
 #if SPEAD2_USE_NETMAP
 # include <spead2/recv_netmap.h>
 #endif
@@ -34,15 +41,18 @@
 # include <spead2/recv_udp_ibv.h>
 #endif
 #include <spead2/recv_heap.h>
+#include <spead2/recv_archive.h>
 #include <spead2/recv_live_heap.h>
 #include <spead2/recv_ring_stream.h>
+#include <spead2/common_endian.h>
+#include <spead2/common_logging.h>
 
 namespace po = boost::program_options;
 namespace asio = boost::asio;
 
 struct options
 {
-    bool quiet = false;
+    bool verbose = false;
     bool descriptors = false;
     bool pyspead = false;
     bool joint = false;
@@ -59,6 +69,18 @@ struct options
     std::size_t mem_initial = 8;
     bool ring = false;
     bool memcpy_nt = false;
+    std::size_t pipeline = 0;
+    int busy_poll = 0;
+    bool kernel_busy_poll = false;
+    std::size_t mmsg = spead2::recv::udp_reader::default_mmsg_count;
+    bool huge_pages = false;
+    double stats = 1.0;
+    spead2::s_item_pointer_t cnt_step = 1;
+    spead2::s_item_pointer_t timestamp_item = 0;
+    int pools = 1;
+    bool pinned = false;
+    std::vector<int> affinity;
+    std::string archive;
 #if SPEAD2_USE_NETMAP
     std::string netmap_if;
 #endif
@@ -96,7 +118,7 @@ static options parse_args(int argc, const char **argv)
     options opts;
     po::options_description desc, hidden, all;
     desc.add_options()
-        ("quiet", make_opt(opts.quiet), "Only show total of heaps received")
+        ("verbose", make_opt(opts.verbose), "Show each heap received")
         ("descriptors", make_opt(opts.descriptors), "Show descriptors")
         ("pyspead", make_opt(opts.pyspead), "Be bug-compatible with PySPEAD")
         ("joint", make_opt(opts.joint), "Treat all sources as a single stream")
@@ -113,6 +135,18 @@ static options parse_args(int argc, const char **argv)
         ("mem-initial", make_opt(opts.mem_initial), "Initial free memory buffers")
         ("ring", make_opt(opts.ring), "Use ringbuffer instead of callbacks")
         ("memcpy-nt", make_opt(opts.memcpy_nt), "Use non-temporal memcpy")
+        ("pipeline", make_opt(opts.pipeline), "Receive on a separate network thread with this many batches of packets (0 to disable)")
+        ("busy-poll", make_opt(opts.busy_poll), "Microseconds to busy-poll an empty socket before sleeping (implies --pipeline)")
+        ("kernel-busy-poll", make_opt(opts.kernel_busy_poll), "Also set SO_BUSY_POLL on the socket")
+        ("mmsg", make_opt(opts.mmsg), "Maximum number of packets to receive per system call")
+        ("huge-pages", make_opt(opts.huge_pages), "Use huge pages for the UDP receive buffers")
+        ("pools", make_opt(opts.pools), "Number of thread pools, to which streams are assigned round-robin")
+        ("pinned", make_opt(opts.pinned), "Give each worker thread its own I/O service, with streams assigned round-robin")
+        ("affinity", po::value<std::vector<int>>(&opts.affinity)->multitoken(), "Cores for the worker threads (pool by pool)")
+        ("stats", make_opt(opts.stats), "Print statistics as JSON lines at this interval in seconds (0 to only show the total)")
+        ("cnt-step", make_opt(opts.cnt_step), "Expected difference between consecutive heap IDs, for loss estimates")
+        ("archive", make_opt(opts.archive), "Append complete heaps to this heap archive file")
+        ("timestamp-item", make_opt(opts.timestamp_item), "Item ID holding the send time (64-bit big-endian ns since the epoch), for latency")
 #if SPEAD2_USE_NETMAP
         ("netmap", make_opt(opts.netmap_if), "Netmap interface")
 #endif
@@ -124,6 +158,8 @@ static options parse_args(int argc, const char **argv)
     ;
 
     hidden.add_options()
+        // Per-heap output is now opt-in, so this is accepted but has no effect
+        ("quiet", po::bool_switch(), "Only show total of heaps received")
         ("source", po::value<std::vector<std::string>>()->composing(), "sources");
     all.add(desc);
     all.add(hidden);
@@ -147,6 +183,20 @@ static options parse_args(int argc, const char **argv)
         if (!vm.count("source"))
             throw po::error("At least one port is required");
         opts.sources = vm["source"].as<std::vector<std::string>>();
+        if (opts.pools < 1)
+            throw po::error("--pools must be at least 1");
+        if (opts.pinned && opts.pools > 1)
+            throw po::error("--pinned cannot be combined with --pools");
+        if (opts.cnt_step < 1)
+            throw po::error("--cnt-step must be at least 1");
+        if (opts.busy_poll < 0)
+            throw po::error("--busy-poll cannot be negative");
+        if (opts.mmsg < 1)
+            throw po::error("--mmsg must be at least 1");
+        if (opts.busy_poll > 0 && opts.pipeline == 0)
+            opts.pipeline = spead2::recv::udp_pipeline_reader::default_batches;
+        if (opts.stats < 0)
+            throw po::error("--stats cannot be negative");
 #if SPEAD2_USE_NETMAP
         if (opts.sources.size() > 1 && opts.netmap_if != "")
         {
@@ -163,20 +213,25 @@ static options parse_args(int argc, const char **argv)
     }
 }
 
+/// Serialises output from the threads that receive heaps
+static std::mutex output_mutex;
+
 void show_heap(const spead2::recv::heap &fheap, const options &opts)
 {
-    if (opts.quiet)
+    if (!opts.verbose)
         return;
+    // Format the whole heap first, so that output from several threads does not interleave
+    std::ostringstream out;
     time_point now = std::chrono::high_resolution_clock::now();
     std::chrono::duration<double> elapsed = now - start;
-    std::cout << std::showbase;
-    std::cout << "Received heap " << fheap.get_cnt() << " at " << elapsed.count() << '\n';
+    out << std::showbase;
+    out << "Received heap " << fheap.get_cnt() << " at " << elapsed.count() << '\n';
     if (opts.descriptors)
     {
         std::vector<spead2::descriptor> descriptors = fheap.get_descriptors();
         for (const auto &descriptor : descriptors)
         {
-            std::cout
+            out
                 << "Descriptor for " << descriptor.name
                 << " (" << std::hex << descriptor.id << ")\n"
                 << "  description: " << descriptor.description << '\n'
@@ -185,35 +240,134 @@ void show_heap(const spead2::recv::heap &fheap, const options &opts)
             for (const auto &field : descriptor.format)
             {
                 if (!first)
-                    std::cout << ", ";
+                    out << ", ";
                 first = false;
-                std::cout << '(' << field.first << ", " << field.second << ')';
+                out << '(' << field.first << ", " << field.second << ')';
             }
-            std::cout << "]\n";
-            std::cout
+            out << "]\n";
+            out
                 << "  dtype:       " << descriptor.numpy_header << '\n'
                 << "  shape:       (";
             first = true;
             for (const auto &size : descriptor.shape)
             {
                 if (!first)
-                    std::cout << ", ";
+                    out << ", ";
                 first = false;
                 if (size == -1)
-                    std::cout << "?";
+                    out << "?";
                 else
-                    std::cout << size;
+                    out << size;
             }
-            std::cout << ")\n";
+            out << ")\n";
         }
     }
     const auto &items = fheap.get_items();
     for (const auto &item : items)
     {
-        std::cout << std::hex << item.id << std::dec
+        out << std::hex << item.id << std::dec
             << " = [" << item.length << " bytes]\n";
     }
-    std::cout << std::noshowbase;
+    std::lock_guard<std::mutex> lock(output_mutex);
+    std::cout << out.str();
+}
+
+/**
+ * Statistics for one stream. Heaps are recorded by the thread that receives
+ * them, and the counters are periodically collected (and reset) by the
+ * thread that prints them.
+ */
+class stream_stats
+{
+public:
+    /// Counters for one reporting interval
+    struct interval
+    {
+        std::uint64_t heaps = 0;
+        std::uint64_t incomplete = 0;
+        std::uint64_t lost = 0;
+        std::uint64_t bytes = 0;
+        std::vector<double> latencies;   ///< Latencies in seconds, if known
+    };
+
+private:
+    std::mutex mutex;
+    spead2::s_item_pointer_t cnt_step;
+    bool have_cnt = false;
+    spead2::s_item_pointer_t last_cnt = 0;
+    interval current;
+    std::uint64_t total_heaps = 0;
+
+public:
+    explicit stream_stats(spead2::s_item_pointer_t cnt_step) : cnt_step(cnt_step) {}
+
+    /**
+     * Record a heap. Heaps missing from the sequence of IDs are counted as
+     * lost, which over-counts if heaps arrive out of order. A jump that is
+     * not a multiple of the step is taken to be reordering rather than loss.
+     *
+     * @param latency  Time since the heap was sent, or negative if unknown
+     */
+    void add_heap(spead2::s_item_pointer_t cnt, std::size_t bytes, bool complete, double latency)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!have_cnt || cnt > last_cnt)
+        {
+            if (have_cnt)
+            {
+                spead2::s_item_pointer_t gap = cnt - last_cnt;
+                if (gap >= cnt_step && gap % cnt_step == 0)
+                    current.lost += gap / cnt_step - 1;
+            }
+            have_cnt = true;
+            last_cnt = cnt;
+        }
+        if (complete)
+        {
+            current.heaps++;
+            current.bytes += bytes;
+            total_heaps++;
+            if (latency >= 0)
+                current.latencies.push_back(latency);
+        }
+        else
+            current.incomplete++;
+    }
+
+    /// Return the counters for the interval since the previous call, and reset them
+    interval take()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        interval ans = std::move(current);
+        current = interval();
+        return ans;
+    }
+
+    std::uint64_t get_total_heaps()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return total_heaps;
+    }
+};
+
+/// Record a frozen heap in @a stats, extracting the send timestamp if requested
+static void record_heap(stream_stats &stats, const spead2::recv::heap &fheap, const options &opts)
+{
+    double latency = -1.0;
+    std::size_t bytes = 0;
+    for (const auto &item : fheap.get_items())
+    {
+        bytes += item.length;
+        if (opts.timestamp_item != 0 && item.id == opts.timestamp_item
+            && !item.is_immediate && item.length == 8)
+        {
+            std::int64_t sent = spead2::load_be<std::uint64_t>(item.ptr);
+            std::int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::system_clock::now().time_since_epoch()).count();
+            latency = (now - sent) * 1e-9;
+        }
+    }
+    stats.add_heap(fheap.get_cnt(), bytes, true, latency);
 }
 
 class callback_stream : public spead2::recv::stream
@@ -221,26 +375,39 @@ class callback_stream : public spead2::recv::stream
 private:
     std::int64_t n_complete = 0;
     const options opts;
+    stream_stats &stats;
+    spead2::recv::heap_archive_writer *archive;
 
     virtual void heap_ready(spead2::recv::live_heap &&heap) override
     {
         if (heap.is_contiguous())
         {
             spead2::recv::heap frozen(std::move(heap));
+            record_heap(stats, frozen, opts);
+            if (archive)
+                archive->write(frozen);
             show_heap(frozen, opts);
             n_complete++;
         }
         else
-            std::cout << "Discarding incomplete heap " << heap.get_cnt() << '\n';
+        {
+            stats.add_heap(heap.get_cnt(), 0, false, -1.0);
+            if (opts.verbose)
+            {
+                std::lock_guard<std::mutex> lock(output_mutex);
+                std::cout << "Discarding incomplete heap " << heap.get_cnt() << '\n';
+            }
+        }
     }
 
     std::promise<void> stop_promise;
 
 public:
     template<typename... Args>
-    callback_stream(const options &opts, Args&&... args)
+    callback_stream(const options &opts, stream_stats &stats,
+                    spead2::recv::heap_archive_writer *archive, Args&&... args)
         : spead2::recv::stream::stream(std::forward<Args>(args)...),
-        opts(opts) {}
+        opts(opts), stats(stats), archive(archive) {}
 
     virtual void stop_received() override
     {
@@ -258,8 +425,8 @@ public:
 
 template<typename It>
 static std::unique_ptr<spead2::recv::stream> make_stream(
-    spead2::thread_pool &thread_pool, const options &opts,
-    It first_source, It last_source)
+    spead2::thread_pool &thread_pool, const options &opts, stream_stats &stats,
+    spead2::recv::heap_archive_writer *archive, It first_source, It last_source)
 {
     using asio::ip::udp;
 
@@ -268,7 +435,7 @@ static std::unique_ptr<spead2::recv::stream> make_stream(
     if (opts.ring)
         stream.reset(new spead2::recv::ring_stream<>(thread_pool, bug_compat, opts.heaps, opts.ring_heaps));
     else
-        stream.reset(new callback_stream(opts, thread_pool, bug_compat, opts.heaps));
+        stream.reset(new callback_stream(opts, stats, archive, thread_pool, bug_compat, opts.heaps));
 
     if (opts.mem_pool)
     {
@@ -301,51 +468,193 @@ static std::unique_ptr<spead2::recv::stream> make_stream(
         }
         else
 #endif
+        if (opts.pipeline > 0)
         {
-            stream->emplace_reader<spead2::recv::udp_reader>(endpoint, opts.packet, opts.buffer);
+            stream->emplace_reader<spead2::recv::udp_pipeline_reader>(
+                endpoint, opts.packet, opts.buffer, opts.pipeline, opts.mmsg,
+                opts.busy_poll, opts.kernel_busy_poll);
+        }
+        else
+        {
+            std::shared_ptr<spead2::memory_allocator> allocator;
+            if (opts.huge_pages)
+                allocator = std::make_shared<spead2::mmap_allocator>(0, true);
+            stream->emplace_reader<spead2::recv::udp_reader>(
+                endpoint, opts.packet, opts.buffer, opts.mmsg, allocator);
         }
     }
     return stream;
 }
 
+/// Consume heaps from a ring stream until it stops, returning the number received
+static std::int64_t consume_ring(spead2::recv::ring_stream<> &stream, stream_stats &stats,
+                                 spead2::recv::heap_archive_writer *archive, const options &opts)
+{
+    std::int64_t n_complete = 0;
+    while (true)
+    {
+        try
+        {
+            spead2::recv::heap fh = stream.pop();
+            n_complete++;
+            record_heap(stats, fh, opts);
+            if (archive)
+                archive->write(fh);
+            show_heap(fh, opts);
+        }
+        catch (spead2::ringbuffer_stopped &e)
+        {
+            break;
+        }
+    }
+    return n_complete;
+}
+
+static std::string json_string(const std::string &s)
+{
+    std::string out = "\"";
+    for (char c : s)
+    {
+        if (c == '"' || c == '\\')
+            out += '\\';
+        out += c;
+    }
+    return out + '"';
+}
+
+/// Write one JSON line for each stream with the statistics since the last report
+static void report_stats(std::vector<std::unique_ptr<stream_stats>> &stats,
+                         const std::vector<std::string> &names,
+                         time_point &last, bool final)
+{
+    time_point now = std::chrono::high_resolution_clock::now();
+    double interval = std::chrono::duration<double>(now - last).count();
+    double elapsed = std::chrono::duration<double>(now - start).count();
+    last = now;
+    std::ostringstream out;
+    for (std::size_t i = 0; i < stats.size(); i++)
+    {
+        stream_stats::interval s = stats[i]->take();
+        out << "{\"time\": " << elapsed
+            << ", \"stream\": " << i
+            << ", \"sources\": " << json_string(names[i])
+            << ", \"interval\": " << interval
+            << ", \"heaps\": " << s.heaps
+            << ", \"incomplete\": " << s.incomplete
+            << ", \"lost\": " << s.lost
+            << ", \"bytes\": " << s.bytes
+            << ", \"heaps_per_s\": " << (interval > 0 ? s.heaps / interval : 0.0)
+            << ", \"gbps\": " << (interval > 0 ? s.bytes * 8e-9 / interval : 0.0)
+            << ", \"total_heaps\": " << stats[i]->get_total_heaps();
+        if (!s.latencies.empty())
+        {
+            std::sort(s.latencies.begin(), s.latencies.end());
+            auto pct = [&s](double p)
+            {
+                std::size_t idx = std::size_t(p / 100.0 * (s.latencies.size() - 1) + 0.5);
+                return s.latencies[idx] * 1e6;
+            };
+            out << ", \"latency_us\": {\"p50\": " << pct(50)
+                << ", \"p99\": " << pct(99)
+                << ", \"max\": " << s.latencies.back() * 1e6 << '}';
+        }
+        if (final)
+            out << ", \"final\": true";
+        out << "}\n";
+    }
+    std::cout << out.str() << std::flush;
+}
+
 int main(int argc, const char **argv)
 {
     options opts = parse_args(argc, argv);
+    // Keep writing log messages to stderr off the packet-handling threads
+    spead2::start_log_thread();
 
-    spead2::thread_pool thread_pool(opts.threads);
+    // Each pool takes the next opts.threads cores from the affinity list
+    std::vector<std::unique_ptr<spead2::thread_pool>> thread_pools;
+    std::unique_ptr<spead2::pinned_thread_pool> pinned_pool;
+    if (opts.pinned)
+        pinned_pool.reset(new spead2::pinned_thread_pool(opts.threads, opts.affinity));
+    else
+    {
+        for (int i = 0; i < opts.pools; i++)
+        {
+            std::vector<int> affinity;
+            for (int j = 0; j < opts.threads && !opts.affinity.empty(); j++)
+                affinity.push_back(opts.affinity[(i * opts.threads + j) % opts.affinity.size()]);
+            thread_pools.emplace_back(new spead2::thread_pool(opts.threads, affinity));
+        }
+    }
+
+    // Shared by all the streams (writing is thread-safe)
+    std::unique_ptr<spead2::recv::heap_archive_writer> archive;
+    if (!opts.archive.empty())
+        archive.reset(new spead2::recv::heap_archive_writer(opts.archive));
+
+    std::vector<std::unique_ptr<stream_stats>> stats;
+    std::vector<std::string> names;
     std::vector<std::unique_ptr<spead2::recv::stream> > streams;
+    auto add_stream = [&](std::vector<std::string>::const_iterator first,
+                          std::vector<std::string>::const_iterator last)
+    {
+        spead2::thread_pool &pool = pinned_pool
+            ? pinned_pool->next()
+            : *thread_pools[streams.size() % thread_pools.size()];
+        stats.emplace_back(new stream_stats(opts.cnt_step));
+        std::string name;
+        for (auto it = first; it != last; ++it)
+            name += (it == first ? "" : ",") + *it;
+        names.push_back(name);
+        streams.push_back(make_stream(pool, opts, *stats.back(), archive.get(), first, last));
+    };
     if (opts.joint)
+        add_stream(opts.sources.begin(), opts.sources.end());
+    else
     {
-        streams.push_back(make_stream(thread_pool, opts, opts.sources.begin(), opts.sources.end()));
+        for (auto it = opts.sources.cbegin(); it != opts.sources.cend(); ++it)
+            add_stream(it, it + 1);
     }
-    else
+
+    std::mutex done_mutex;
+    std::condition_variable done_cond;
+    bool done = false;
+    std::thread stats_thread;
+    if (opts.stats > 0)
     {
-        if (opts.sources.size() > 1 && opts.ring)
-        {
-            std::cerr << "Multiple streams cannot be used with --ring\n";
-            std::exit(2);
-        }
-        for (auto it = opts.sources.begin(); it != opts.sources.end(); ++it)
-            streams.push_back(make_stream(thread_pool, opts, it, it + 1));
+        stats_thread = std::thread([&] {
+            auto interval = std::chrono::duration_cast<std::chrono::high_resolution_clock::duration>(
+                std::chrono::duration<double>(opts.stats));
+            time_point last = start;
+            time_point next = start + interval;
+            std::unique_lock<std::mutex> lock(done_mutex);
+            while (!done_cond.wait_until(lock, next, [&done] { return done; }))
+            {
+                lock.unlock();
+                report_stats(stats, names, last, false);
+                lock.lock();
+                next += interval;
+            }
+            lock.unlock();
+            report_stats(stats, names, last, true);
+        });
     }
 
     std::int64_t n_complete = 0;
     if (opts.ring)
     {
-        auto &stream = dynamic_cast<spead2::recv::ring_stream<> &>(*streams[0]);
-        while (true)
+        // One consumer thread per stream
+        std::vector<std::future<std::int64_t>> consumers;
+        for (std::size_t i = 0; i < streams.size(); i++)
         {
-            try
-            {
-                spead2::recv::heap fh = stream.pop();
-                n_complete++;
-                show_heap(fh, opts);
-            }
-            catch (spead2::ringbuffer_stopped &e)
-            {
-                break;
-            }
+            auto &stream = dynamic_cast<spead2::recv::ring_stream<> &>(*streams[i]);
+            stream_stats &s = *stats[i];
+            spead2::recv::heap_archive_writer *a = archive.get();
+            consumers.push_back(std::async(std::launch::async, [&stream, &s, a, &opts] {
+                return consume_ring(stream, s, a, opts); }));
         }
+        for (auto &consumer : consumers)
+            n_complete += consumer.get();
     }
     else
     {
@@ -356,6 +665,19 @@ int main(int argc, const char **argv)
         }
     }
 
-    std::cout << "Received " << n_complete << " heaps\n";
+    if (stats_thread.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lock(done_mutex);
+            done = true;
+        }
+        done_cond.notify_all();
+        stats_thread.join();
+    }
+    else
+        std::cout << "Received " << n_complete << " heaps\n";
+    if (archive)
+        archive->close();
+    spead2::stop_log_thread();
     return 0;
 }
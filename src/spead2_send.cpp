@@ -23,12 +23,20 @@
 #include <exception>
 #include <cstdlib>
 #include <cstdint>
+#include <cstring>
 #include <memory>
+#include <future>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <algorithm>
 #include <boost/program_options.hpp>
 #include <boost/asio.hpp>
 #include <spead2/common_thread_pool.h>
 #include <spead2/send_stream.h>
 #include <spead2/send_udp.h>
+#include <spead2/common_endian.h>
 #if SPEAD2_USE_IBV
 # include <spead2/send_udp_ibv.h>
 #endif
@@ -49,6 +57,17 @@ struct options
     std::size_t burst = spead2::send::stream_config::default_burst_size;
     int threads = 1;
     double rate = 0.0;
+
+    // Traffic generator mode
+    bool generator = false;
+    std::vector<std::size_t> heap_sizes;
+    std::vector<std::size_t> item_counts;
+    double immediate = 0.0;
+    std::vector<std::string> destinations;
+    int interleave = 1;
+    double report = 1.0;
+    std::uint64_t seed = 0;
+    spead2::s_item_pointer_t timestamp_item = 0;
 #if SPEAD2_USE_IBV
     std::string ibv_if;
     int ibv_comp_vector = 0;
@@ -61,6 +80,7 @@ struct options
 static void usage(std::ostream &o, const po::options_description &desc)
 {
     o << "Usage: spead2_send [options] <host> <port>\n";
+    o << "       spead2_send --generator [options] [<host> <port>]\n";
     o << desc;
 }
 
@@ -84,7 +104,7 @@ static po::typed_value<T> *make_required_opt(T &var)
 static options parse_args(int argc, const char **argv)
 {
     options opts;
-    po::options_description desc, hidden, all;
+    po::options_description desc, generator("Traffic generator options"), hidden, all;
     desc.add_options()
         ("heap-size", make_opt(opts.heap_size), "Payload size for heap")
         ("items", make_opt(opts.items), "Number of items per heap")
@@ -102,6 +122,18 @@ static options parse_args(int argc, const char **argv)
         ("ibv-max-poll", make_opt(opts.ibv_max_poll), "Maximum number of times to poll in a row")
 #endif
     ;
+    generator.add_options()
+        ("generator", make_opt(opts.generator), "Generate a mixture of heaps, and report the rate achieved")
+        ("heap-sizes", po::value<std::vector<std::size_t>>(&opts.heap_sizes)->multitoken(), "Heap payload sizes to choose from")
+        ("item-counts", po::value<std::vector<std::size_t>>(&opts.item_counts)->multitoken(), "Numbers of items per heap to choose from")
+        ("immediate", make_opt(opts.immediate), "Fraction of items to send as immediates")
+        ("dest", po::value<std::vector<std::string>>(&opts.destinations)->multitoken(), "Destination as host:port (may be repeated)")
+        ("interleave", make_opt(opts.interleave), "Number of heaps in flight concurrently to each destination")
+        ("report", make_opt(opts.report), "Interval between rate reports in seconds (0 to disable)")
+        ("seed", make_opt(opts.seed), "Seed for choosing heap shapes")
+        ("timestamp-item", make_opt(opts.timestamp_item), "Item ID in which to send the send time, for spead2_recv latency")
+    ;
+    desc.add(generator);
     hidden.add_options()
         ("host", make_required_opt(opts.host), "Destination host")
         ("port", make_required_opt(opts.port), "Destination port")
@@ -126,8 +158,23 @@ static options parse_args(int argc, const char **argv)
             usage(std::cout, desc);
             std::exit(0);
         }
-        if (!vm.count("host") || !vm.count("port"))
+        if (vm.count("host") && vm.count("port"))
+            opts.destinations.insert(opts.destinations.begin(), opts.host + ':' + opts.port);
+        else if (!opts.generator || opts.destinations.empty())
             throw po::error("too few positional options have been specified on the command line");
+        if (opts.generator)
+        {
+            if (opts.heap_sizes.empty())
+                opts.heap_sizes.push_back(opts.heap_size);
+            if (opts.item_counts.empty())
+                opts.item_counts.push_back(opts.items);
+            if (std::find(opts.item_counts.begin(), opts.item_counts.end(), 0) != opts.item_counts.end())
+                throw po::error("--item-counts must be positive");
+            if (opts.immediate < 0.0 || opts.immediate > 1.0)
+                throw po::error("--immediate must be between 0 and 1");
+            if (opts.interleave < 1)
+                throw po::error("--interleave must be at least 1");
+        }
         return opts;
     }
     catch (po::error &e)
@@ -139,7 +186,8 @@ static options parse_args(int argc, const char **argv)
 }
 
 // Sends a heap, returning a future instead of using a completion handler
-std::future<std::size_t> async_send_heap(spead2::send::stream &stream, const spead2::send::heap &heap)
+std::future<std::size_t> async_send_heap(spead2::send::stream &stream, const spead2::send::heap &heap,
+                                         spead2::s_item_pointer_t cnt = -1)
 {
     auto promise = std::make_shared<std::promise<std::size_t>>();
     auto handler = [promise] (boost::system::error_code ec, std::size_t bytes_transferred)
@@ -149,7 +197,7 @@ std::future<std::size_t> async_send_heap(spead2::send::stream &stream, const spe
         else
             promise->set_value(bytes_transferred);
     };
-    stream.async_send_heap(heap, handler);
+    stream.async_send_heap(heap, handler, cnt);
     return promise->get_future();
 }
 
@@ -226,23 +274,17 @@ int run(spead2::send::stream &stream, const options &opts)
     return 0;
 }
 
-int main(int argc, const char **argv)
+static std::unique_ptr<spead2::send::stream> make_stream(
+    spead2::thread_pool &thread_pool, const udp::endpoint &endpoint,
+    const spead2::send::stream_config &config, const options &opts)
 {
-    options opts = parse_args(argc, argv);
-
-    spead2::thread_pool thread_pool(opts.threads);
-    udp::resolver resolver(thread_pool.get_io_service());
-    udp::resolver::query query(opts.host, opts.port);
-    auto it = resolver.resolve(query);
-    spead2::send::stream_config config(
-        opts.packet, opts.rate * 1024 * 1024 * 1024 / 8, opts.burst);
     std::unique_ptr<spead2::send::stream> stream;
 #if SPEAD2_USE_IBV
     if (opts.ibv_if != "")
     {
         boost::asio::ip::address interface_address = boost::asio::ip::address::from_string(opts.ibv_if);
         stream.reset(new spead2::send::udp_ibv_stream(
-                thread_pool.get_io_service(), *it, config,
+                thread_pool.get_io_service(), endpoint, config,
                 interface_address, opts.buffer, 1,
                 opts.ibv_comp_vector, opts.ibv_max_poll));
     }
@@ -250,7 +292,223 @@ int main(int argc, const char **argv)
 #endif
     {
         stream.reset(new spead2::send::udp_stream(
-                thread_pool.get_io_service(), *it, config, opts.buffer));
+                thread_pool.get_io_service(), endpoint, config, opts.buffer));
+    }
+    return stream;
+}
+
+static udp::endpoint resolve(spead2::thread_pool &thread_pool,
+                             const std::string &host, const std::string &port)
+{
+    udp::resolver resolver(thread_pool.get_io_service());
+    udp::resolver::query query(host, port);
+    return *resolver.resolve(query);
+}
+
+/**
+ * One stream of the traffic generator. Each destination has
+ * @ref options::interleave of these, which use disjoint heap IDs so that
+ * their heaps can be in flight concurrently.
+ */
+class generator_sender
+{
+private:
+    const options &opts;
+    spead2::flavour flavour;
+    std::unique_ptr<spead2::send::stream> stream;
+    std::mt19937_64 engine;
+    spead2::s_item_pointer_t next_cnt;
+    spead2::s_item_pointer_t cnt_step;
+    /// Payload shared by all addressed items
+    const std::vector<std::uint8_t> &payload;
+
+    std::unique_ptr<spead2::send::heap> make_heap(spead2::s_item_pointer_t cnt)
+    {
+        std::unique_ptr<spead2::send::heap> heap(new spead2::send::heap(flavour));
+        std::uniform_int_distribution<std::size_t> size_dist(0, opts.heap_sizes.size() - 1);
+        std::uniform_int_distribution<std::size_t> items_dist(0, opts.item_counts.size() - 1);
+        std::uniform_real_distribution<double> immediate_dist(0.0, 1.0);
+        std::size_t heap_size = opts.heap_sizes[size_dist(engine)];
+        std::size_t n_items = opts.item_counts[items_dist(engine)];
+
+        std::vector<bool> immediate(n_items);
+        std::size_t n_addressed = 0;
+        for (std::size_t i = 0; i < n_items; i++)
+        {
+            immediate[i] = opts.immediate > 0.0 && immediate_dist(engine) < opts.immediate;
+            if (!immediate[i])
+                n_addressed++;
+        }
+        std::size_t offset = 0;
+        std::size_t addressed = 0;
+        for (std::size_t i = 0; i < n_items; i++)
+        {
+            spead2::s_item_pointer_t id = 0x1000 + i;
+            if (immediate[i])
+                heap->add_item(id, spead2::item_pointer_t(cnt));
+            else
+            {
+                // Split the payload evenly, with the remainder in the last item
+                addressed++;
+                std::size_t length = (addressed == n_addressed)
+                    ? heap_size - offset : heap_size / n_addressed;
+                heap->add_item(id, payload.data() + offset, length, false);
+                offset += length;
+            }
+        }
+        if (opts.timestamp_item != 0)
+        {
+            std::uint64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::system_clock::now().time_since_epoch()).count();
+            std::unique_ptr<std::uint8_t[]> value(new std::uint8_t[8]);
+            now = spead2::htobe(now);
+            std::memcpy(value.get(), &now, sizeof(now));
+            heap->add_item(opts.timestamp_item, value.get(), 8, false);
+            heap->add_pointer(std::move(value));
+        }
+        return heap;
+    }
+
+public:
+    std::atomic<std::uint64_t> heaps{0};
+    std::atomic<std::uint64_t> bytes{0};
+
+    generator_sender(spead2::thread_pool &thread_pool, const udp::endpoint &endpoint,
+                     const options &opts, double rate,
+                     const std::vector<std::uint8_t> &payload,
+                     spead2::s_item_pointer_t first_cnt, spead2::s_item_pointer_t cnt_step,
+                     std::uint64_t seed)
+        : opts(opts),
+        flavour(spead2::maximum_version, 64, opts.addr_bits,
+                opts.pyspead ? spead2::BUG_COMPAT_PYSPEAD_0_5_2 : 0),
+        stream(make_stream(thread_pool, endpoint,
+                           spead2::send::stream_config(opts.packet, rate, opts.burst), opts)),
+        engine(seed), next_cnt(first_cnt), cnt_step(cnt_step), payload(payload)
+    {
+    }
+
+    /// Send @a n_heaps heaps (or forever if negative)
+    void run(std::int64_t n_heaps)
+    {
+        std::deque<std::future<std::size_t>> futures;
+        std::deque<std::unique_ptr<spead2::send::heap>> in_flight;
+        for (std::int64_t i = 0; n_heaps < 0 || i < n_heaps; i++)
+        {
+            if (futures.size() >= 2)
+            {
+                bytes += futures.front().get();
+                heaps++;
+                futures.pop_front();
+                in_flight.pop_front();
+            }
+            in_flight.push_back(make_heap(next_cnt));
+            futures.push_back(async_send_heap(*stream, *in_flight.back(), next_cnt));
+            next_cnt += cnt_step;
+        }
+        while (!futures.empty())
+        {
+            bytes += futures.front().get();
+            heaps++;
+            futures.pop_front();
+            in_flight.pop_front();
+        }
+    }
+
+    /// Send an end-of-stream heap
+    void stop()
+    {
+        spead2::send::heap heap(flavour);
+        heap.add_end();
+        async_send_heap(*stream, heap, next_cnt).get();
+    }
+};
+
+static int run_generator(spead2::thread_pool &thread_pool, const options &opts)
+{
+    std::vector<std::uint8_t> payload(*std::max_element(opts.heap_sizes.begin(), opts.heap_sizes.end()));
+    for (std::size_t i = 0; i < payload.size(); i++)
+        payload[i] = std::uint8_t(i);
+
+    std::size_t n_senders = opts.destinations.size() * opts.interleave;
+    double rate = opts.rate * 1024 * 1024 * 1024 / 8 / n_senders;
+    std::vector<std::unique_ptr<generator_sender>> senders;
+    for (const std::string &dest : opts.destinations)
+    {
+        auto colon = dest.rfind(':');
+        if (colon == std::string::npos)
+        {
+            std::cerr << "Destination " << dest << " must have the form host:port\n";
+            return 2;
+        }
+        udp::endpoint endpoint = resolve(thread_pool, dest.substr(0, colon), dest.substr(colon + 1));
+        for (int i = 0; i < opts.interleave; i++)
+            senders.emplace_back(new generator_sender(
+                thread_pool, endpoint, opts, rate, payload,
+                i + 1, opts.interleave, opts.seed + senders.size()));
+    }
+
+    std::vector<std::future<void>> drivers;
+    for (std::size_t i = 0; i < n_senders; i++)
+    {
+        std::int64_t n_heaps = -1;
+        if (opts.heaps >= 0)
+            n_heaps = opts.heaps / n_senders + (std::int64_t(i) < opts.heaps % std::int64_t(n_senders));
+        generator_sender *sender = senders[i].get();
+        drivers.push_back(std::async(std::launch::async, [sender, n_heaps] { sender->run(n_heaps); }));
+    }
+
+    typedef std::chrono::steady_clock clock;
+    auto start = clock::now();
+    auto last = start;
+    std::uint64_t last_bytes = 0;
+    auto report = [&] (clock::time_point now)
+    {
+        std::uint64_t heaps = 0, bytes = 0;
+        for (const auto &sender : senders)
+        {
+            heaps += sender->heaps;
+            bytes += sender->bytes;
+        }
+        double interval = std::chrono::duration<double>(now - last).count();
+        double elapsed = std::chrono::duration<double>(now - start).count();
+        std::cout << "Sent " << heaps << " heaps in " << elapsed << " s: "
+            << (interval > 0 ? (bytes - last_bytes) * 8e-9 / interval : 0.0) << " Gb/s\n"
+            << std::flush;
+        last = now;
+        last_bytes = bytes;
+    };
+    auto period = std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(opts.report));
+    for (auto &driver : drivers)
+    {
+        while (opts.report > 0
+               && driver.wait_until(last + period) == std::future_status::timeout)
+            report(clock::now());
+        driver.get();
+    }
+    if (opts.report > 0)
+    {
+        last = start;
+        last_bytes = 0;
+        report(clock::now());
     }
+
+    // One end-of-stream heap per destination, once all data has been sent
+    if (opts.heaps >= 0)
+        for (std::size_t i = 0; i < n_senders; i += opts.interleave)
+            senders[i]->stop();
+    return 0;
+}
+
+int main(int argc, const char **argv)
+{
+    options opts = parse_args(argc, argv);
+
+    spead2::thread_pool thread_pool(opts.threads);
+    if (opts.generator)
+        return run_generator(thread_pool, opts);
+    udp::endpoint endpoint = resolve(thread_pool, opts.host, opts.port);
+    spead2::send::stream_config config(
+        opts.packet, opts.rate * 1024 * 1024 * 1024 / 8, opts.burst);
+    std::unique_ptr<spead2::send::stream> stream = make_stream(thread_pool, endpoint, config, opts);
     return run(*stream, opts);
 }
@@ -0,0 +1,129 @@
+/* Copyright 2016 SKA South Africa
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Unit tests for bit-field packing and unpacking.
+ */
+
+#include <boost/test/unit_test.hpp>
+#include <vector>
+#include <cstdint>
+#include <stdexcept>
+#include <spead2/common_bits.h>
+
+namespace spead2
+{
+namespace unittest
+{
+
+BOOST_AUTO_TEST_SUITE(common)
+BOOST_AUTO_TEST_SUITE(bits)
+
+// Reference implementation, one bit at a time
+static std::vector<std::uint8_t> reference_pack(
+    const std::vector<std::vector<std::uint64_t>> &values,
+    const std::vector<int> &bits, std::size_t records)
+{
+    std::size_t total_bits = 0;
+    for (int b : bits)
+        total_bits += b;
+    std::vector<std::uint8_t> out((records * total_bits + 7) / 8);
+    std::size_t pos = 0;
+    for (std::size_t i = 0; i < records; i++)
+        for (std::size_t j = 0; j < bits.size(); j++)
+            for (int k = bits[j] - 1; k >= 0; k--, pos++)
+                if ((values[j][i] >> k) & 1)
+                    out[pos / 8] |= 0x80 >> (pos % 8);
+    return out;
+}
+
+// Pack and unpack pseudo-random values and compare to the reference
+static void check_roundtrip(const std::vector<int> &bits, std::size_t records)
+{
+    std::uint64_t state = 0x123456789abcdefULL;
+    std::vector<std::vector<std::uint64_t>> values(bits.size());
+    std::vector<const std::uint64_t *> in_ptrs;
+    for (std::size_t j = 0; j < bits.size(); j++)
+    {
+        for (std::size_t i = 0; i < records; i++)
+        {
+            state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+            std::uint64_t v = state;
+            if (bits[j] < 64)
+                v &= (std::uint64_t(1) << bits[j]) - 1;
+            values[j].push_back(v);
+        }
+        in_ptrs.push_back(values[j].data());
+    }
+
+    std::vector<std::uint8_t> expected = reference_pack(values, bits, records);
+    std::vector<std::uint8_t> packed(expected.size());
+    pack_bits(in_ptrs.data(), records, bits, packed.data());
+    BOOST_CHECK_EQUAL_COLLECTIONS(expected.begin(), expected.end(),
+                                  packed.begin(), packed.end());
+
+    std::vector<std::vector<std::uint64_t>> unpacked(bits.size(), std::vector<std::uint64_t>(records));
+    std::vector<std::uint64_t *> out_ptrs;
+    for (auto &u : unpacked)
+        out_ptrs.push_back(u.data());
+    unpack_bits(packed.data(), records, bits, out_ptrs.data());
+    for (std::size_t j = 0; j < bits.size(); j++)
+        BOOST_CHECK_EQUAL_COLLECTIONS(values[j].begin(), values[j].end(),
+                                      unpacked[j].begin(), unpacked[j].end());
+}
+
+BOOST_AUTO_TEST_CASE(single_field)
+{
+    // Covers the special cases as well as the generic code, and record
+    // counts that leave a tail for the generic code to handle
+    for (int b = 1; b <= 64; b++)
+        for (std::size_t records : {0, 1, 7, 64, 67})
+            check_roundtrip({b}, records);
+}
+
+BOOST_AUTO_TEST_CASE(multi_field)
+{
+    check_roundtrip({1, 7, 8, 32}, 10);
+    check_roundtrip({12, 4}, 9);
+    check_roundtrip({3, 64, 5}, 11);
+}
+
+BOOST_AUTO_TEST_CASE(known_12bit)
+{
+    const std::uint8_t packed[] = {0x12, 0x34, 0x56, 0x78, 0x90};
+    std::vector<std::uint64_t> values(3);
+    std::uint64_t *out = values.data();
+    unpack_bits(packed, 3, {12}, &out);
+    BOOST_CHECK_EQUAL(values[0], 0x123);
+    BOOST_CHECK_EQUAL(values[1], 0x456);
+    BOOST_CHECK_EQUAL(values[2], 0x789);
+}
+
+BOOST_AUTO_TEST_CASE(bad_width)
+{
+    std::uint8_t data[16] = {};
+    std::uint64_t values[1];
+    std::uint64_t *out = values;
+    BOOST_CHECK_THROW(unpack_bits(data, 1, {0}, &out), std::invalid_argument);
+    BOOST_CHECK_THROW(unpack_bits(data, 1, {65}, &out), std::invalid_argument);
+}
+
+BOOST_AUTO_TEST_SUITE_END()  // bits
+BOOST_AUTO_TEST_SUITE_END()  // common
+
+}} // namespace spead2::unittest
@@ -0,0 +1,98 @@
+/* Copyright 2016 SKA South Africa
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Unit tests for CRC-32C.
+ */
+
+#include <boost/test/unit_test.hpp>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <spead2/common_crc32c.h>
+
+namespace spead2
+{
+namespace unittest
+{
+
+BOOST_AUTO_TEST_SUITE(common)
+BOOST_AUTO_TEST_SUITE(crc32c)
+
+// Reference implementation, one bit at a time
+static std::uint32_t reference_crc32c(const std::uint8_t *data, std::size_t length)
+{
+    std::uint32_t crc = 0xffffffff;
+    for (std::size_t i = 0; i < length; i++)
+    {
+        crc ^= data[i];
+        for (int k = 0; k < 8; k++)
+            crc = (crc & 1) ? (crc >> 1) ^ 0x82f63b78 : crc >> 1;
+    }
+    return ~crc;
+}
+
+static std::vector<std::uint8_t> make_data(std::size_t length)
+{
+    std::vector<std::uint8_t> data(length);
+    std::uint32_t state = 1;
+    for (auto &d : data)
+    {
+        state = state * 1103515245 + 12345;
+        d = std::uint8_t(state >> 16);
+    }
+    return data;
+}
+
+BOOST_AUTO_TEST_CASE(known_value)
+{
+    const char *text = "123456789";
+    BOOST_CHECK_EQUAL(spead2::crc32c(text, std::strlen(text)), 0xe3069283);
+    BOOST_CHECK_EQUAL(spead2::crc32c(text, 0), 0);
+}
+
+BOOST_AUTO_TEST_CASE(lengths_and_alignments)
+{
+    // Covers the unaligned head, the interleaved blocks of both sizes and the tail
+    std::vector<std::uint8_t> data = make_data(3 * 8192 + 3 * 256 + 100);
+    for (std::size_t offset = 0; offset < 8; offset++)
+        for (std::size_t length : {0, 1, 7, 8, 9, 63, 767, 768, 1000, 24575, 24576, 24577, 25000})
+        {
+            if (offset + length > data.size())
+                continue;
+            BOOST_CHECK_EQUAL(spead2::crc32c(data.data() + offset, length),
+                              reference_crc32c(data.data() + offset, length));
+        }
+}
+
+BOOST_AUTO_TEST_CASE(chaining)
+{
+    std::vector<std::uint8_t> data = make_data(30000);
+    std::uint32_t expected = spead2::crc32c(data.data(), data.size());
+    for (std::size_t split : {0, 1, 100, 8192, 29999, 30000})
+    {
+        std::uint32_t crc = spead2::crc32c(data.data(), split);
+        crc = spead2::crc32c(data.data() + split, data.size() - split, crc);
+        BOOST_CHECK_EQUAL(crc, expected);
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()  // crc32c
+BOOST_AUTO_TEST_SUITE_END()  // common
+
+}} // namespace spead2::unittest
@@ -0,0 +1,208 @@
+/* Copyright 2016 SKA South Africa
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/**
+ * @file
+ *
+ * Unit tests for the packet impairment simulator, and for reassembly of
+ * impaired packet streams.
+ */
+
+#include <boost/test/unit_test.hpp>
+#include <vector>
+#include <map>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <spead2/common_impair.h>
+#include <spead2/common_memory_allocator.h>
+#include <spead2/send_heap.h>
+#include <spead2/recv_stream.h>
+#include <spead2/recv_live_heap.h>
+#include <spead2/recv_heap.h>
+#include <spead2/recv_packet.h>
+
+namespace spead2
+{
+namespace unittest
+{
+
+BOOST_AUTO_TEST_SUITE(common)
+BOOST_AUTO_TEST_SUITE(impair)
+
+static constexpr std::size_t heap_size = 20000;
+static constexpr std::size_t packet_size = 1024;
+static constexpr s_item_pointer_t item_id = 0x1000;
+
+// Stream that records completed heaps by cnt
+class collecting_stream : public spead2::recv::stream_base
+{
+private:
+    virtual void heap_ready(spead2::recv::live_heap &&h) override
+    {
+        if (h.is_complete())
+        {
+            spead2::recv::heap frozen(std::move(h));
+            std::vector<std::uint8_t> value;
+            for (const auto &item : frozen.get_items())
+                if (item.id == item_id)
+                    value.assign(item.ptr, item.ptr + item.length);
+            complete[frozen.get_cnt()] = std::move(value);
+        }
+        else
+            incomplete.push_back(h.get_cnt());
+    }
+
+public:
+    using spead2::recv::stream_base::stream_base;
+    std::map<s_item_pointer_t, std::vector<std::uint8_t>> complete;
+    std::vector<s_item_pointer_t> incomplete;
+};
+
+static std::vector<std::uint8_t> make_value(int cnt)
+{
+    std::vector<std::uint8_t> value(heap_size);
+    for (std::size_t i = 0; i < heap_size; i++)
+        value[i] = std::uint8_t(i * 7 + cnt);
+    return value;
+}
+
+static std::vector<packet_impairer::packet_data> make_packets(
+    const impairment_config &config, int n_heaps)
+{
+    packet_impairer impairer(config);
+    for (int i = 1; i <= n_heaps; i++)
+    {
+        std::vector<std::uint8_t> value = make_value(i);
+        spead2::send::heap h;
+        h.add_item(item_id, value.data(), value.size(), false);
+        impairer.add_heap(h, i, packet_size);
+    }
+    BOOST_CHECK_GT(impairer.get_num_packets(), std::size_t(n_heaps));
+    return impairer.get_packets();
+}
+
+static void feed(collecting_stream &stream, const std::vector<packet_impairer::packet_data> &packets)
+{
+    for (const auto &p : packets)
+    {
+        spead2::recv::packet_header header;
+        std::size_t size = spead2::recv::decode_packet(header, p.data(), p.size());
+        BOOST_REQUIRE_EQUAL(size, p.size());
+        stream.add_packet(header);
+    }
+    stream.flush();
+}
+
+BOOST_AUTO_TEST_CASE(identity)
+{
+    impairment_config config;
+    packet_impairer impairer(config);
+    std::vector<packet_impairer::packet_data> in{{1, 2}, {3}, {4, 5, 6}};
+    impairer.add_heap(std::vector<packet_impairer::packet_data>(in));
+    std::vector<packet_impairer::packet_data> out = impairer.get_packets();
+    BOOST_CHECK(in == out);
+}
+
+BOOST_AUTO_TEST_CASE(interleave)
+{
+    impairment_config config;
+    config.interleave = 2;
+    packet_impairer impairer(config);
+    impairer.add_heap({{1}, {2}, {3}});
+    impairer.add_heap({{4}});
+    impairer.add_heap({{5}, {6}});
+    std::vector<packet_impairer::packet_data> expected{{1}, {4}, {2}, {3}, {5}, {6}};
+    BOOST_CHECK(impairer.get_packets() == expected);
+}
+
+BOOST_AUTO_TEST_CASE(deterministic)
+{
+    impairment_config config;
+    config.drop = 0.1;
+    config.duplicate = 0.1;
+    config.reorder_window = 8;
+    config.seed = 42;
+    auto a = make_packets(config, 4);
+    auto b = make_packets(config, 4);
+    BOOST_CHECK(a == b);
+    config.seed = 43;
+    auto c = make_packets(config, 4);
+    BOOST_CHECK(a != c);
+}
+
+BOOST_AUTO_TEST_CASE(reassemble_lossless)
+{
+    /* Duplication, reordering and interleaving must not prevent reassembly,
+     * provided the stream can hold all the interleaved heaps. A duplicate
+     * that arrives after its heap has been completed starts a new heap that
+     * can never complete, so incomplete heaps are allowed only for heaps that
+     * were already delivered.
+     */
+    const int n_heaps = 12;
+    impairment_config config;
+    config.duplicate = 0.2;
+    config.reorder_window = 10;
+    config.interleave = 3;
+    config.seed = 1;
+    auto packets = make_packets(config, n_heaps);
+    collecting_stream stream(0, 8);
+    stream.set_memory_allocator(std::make_shared<memory_allocator>());
+    feed(stream, packets);
+    for (s_item_pointer_t cnt : stream.incomplete)
+        BOOST_CHECK(stream.complete.count(cnt));
+    BOOST_REQUIRE_EQUAL(stream.complete.size(), n_heaps);
+    for (int i = 1; i <= n_heaps; i++)
+    {
+        std::vector<std::uint8_t> expected = make_value(i);
+        const auto &actual = stream.complete[i];
+        BOOST_CHECK_EQUAL_COLLECTIONS(actual.begin(), actual.end(),
+                                      expected.begin(), expected.end());
+    }
+}
+
+BOOST_AUTO_TEST_CASE(reassemble_lossy)
+{
+    const int n_heaps = 20;
+    impairment_config config;
+    config.drop = 0.05;
+    config.seed = 2;
+    auto packets = make_packets(config, n_heaps);
+    collecting_stream stream(0, 4);
+    stream.set_memory_allocator(std::make_shared<memory_allocator>());
+    feed(stream, packets);
+    BOOST_CHECK(!stream.incomplete.empty());
+    BOOST_CHECK_EQUAL(stream.incomplete.size() + stream.complete.size(), n_heaps);
+}
+
+BOOST_AUTO_TEST_CASE(bad_config)
+{
+    impairment_config config;
+    config.drop = 1.5;
+    BOOST_CHECK_THROW(packet_impairer{config}, std::invalid_argument);
+    config.drop = 0.0;
+    config.duplicate = -0.1;
+    BOOST_CHECK_THROW(packet_impairer{config}, std::invalid_argument);
+    config.duplicate = 0.0;
+    config.interleave = 0;
+    BOOST_CHECK_THROW(packet_impairer{config}, std::invalid_argument);
+}
+
+BOOST_AUTO_TEST_SUITE_END()  // impair
+BOOST_AUTO_TEST_SUITE_END()  // common
+
+}} // namespace spead2::unittest
@@ -0,0 +1,191 @@
+/* Copyright 2016 SKA South Africa
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Unit tests for rate-limited and asynchronous logging.
+ */
+
+#include <boost/test/unit_test.hpp>
+#include <vector>
+#include <string>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <utility>
+#include <spead2/common_logging.h>
+
+namespace spead2
+{
+namespace unittest
+{
+
+/// Captures log messages, and restores the logging configuration afterwards
+struct capture_log
+{
+    std::mutex mutex;
+    std::vector<std::pair<log_level, std::string>> messages;
+    std::function<void(log_level, const std::string &)> old_function;
+
+    capture_log()
+    {
+        old_function = set_log_function([this](log_level level, const std::string &msg)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            messages.emplace_back(level, msg);
+        });
+    }
+
+    ~capture_log()
+    {
+        stop_log_thread();
+        set_log_rate_limit(default_log_rate_messages, default_log_rate_interval);
+        set_log_function(old_function);
+    }
+};
+
+BOOST_AUTO_TEST_SUITE(common)
+BOOST_AUTO_TEST_SUITE(logging)
+
+BOOST_AUTO_TEST_CASE(queue_fifo)
+{
+    log_queue queue(4);
+    log_level level;
+    std::string msg;
+    BOOST_CHECK(!queue.try_pop(level, msg));
+    for (int i = 0; i < 4; i++)
+        BOOST_CHECK(queue.try_push(log_level::info, std::to_string(i)));
+    BOOST_CHECK(!queue.try_push(log_level::info, "overflow"));
+    BOOST_CHECK_EQUAL(queue.get_dropped(), 1);
+    for (int i = 0; i < 4; i++)
+    {
+        BOOST_REQUIRE(queue.try_pop(level, msg));
+        BOOST_CHECK_EQUAL(msg, std::to_string(i));
+    }
+    BOOST_CHECK(!queue.pop(level, msg, std::chrono::milliseconds(1)));
+}
+
+BOOST_AUTO_TEST_CASE(queue_threads)
+{
+    // Several producers and one blocking consumer
+    const int producers = 4, per_producer = 10000;
+    log_queue queue(64);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < producers; i++)
+        threads.emplace_back([&queue, i]
+        {
+            for (int j = 0; j < per_producer; j++)
+                while (!queue.try_push(log_level::info, std::to_string(i)))
+                    std::this_thread::yield();
+        });
+    std::vector<int> counts(producers);
+    log_level level;
+    std::string msg;
+    for (int i = 0; i < producers * per_producer; i++)
+    {
+        BOOST_REQUIRE(queue.pop(level, msg, std::chrono::seconds(10)));
+        counts.at(std::stoi(msg))++;
+    }
+    for (auto &thread : threads)
+        thread.join();
+    for (int count : counts)
+        BOOST_CHECK_EQUAL(count, per_producer);
+}
+
+BOOST_AUTO_TEST_CASE(queue_stop)
+{
+    log_queue queue(4);
+    std::thread stopper([&queue]
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        queue.stop();
+    });
+    log_level level;
+    std::string msg;
+    BOOST_CHECK(!queue.pop(level, msg, std::chrono::seconds(10)));
+    stopper.join();
+}
+
+BOOST_AUTO_TEST_CASE(rate_limit)
+{
+    capture_log capture;
+    set_log_rate_limit(3, std::chrono::hours(1));
+    std::uint64_t suppressed = get_log_suppressed();
+    for (int i = 0; i < 10; i++)
+        log_warning("rate limit test %1%", i);
+    BOOST_CHECK_EQUAL(capture.messages.size(), 3);
+    BOOST_CHECK_EQUAL(get_log_suppressed() - suppressed, 7);
+
+    // Messages from a different site are counted separately
+    log_warning("another site");
+    BOOST_CHECK_EQUAL(capture.messages.size(), 4);
+
+    // Starting a new window reports the suppressed messages
+    set_log_rate_limit(3, std::chrono::nanoseconds(0));
+    log_warning("rate limit test %1%", 10);
+    BOOST_REQUIRE_EQUAL(capture.messages.size(), 6);
+    BOOST_CHECK_EQUAL(capture.messages[4].second,
+                      "suppressed 7 similar messages: rate limit test %1%");
+    BOOST_CHECK(capture.messages[4].first == log_level::warning);
+    BOOST_CHECK_EQUAL(capture.messages[5].second, "rate limit test 10");
+}
+
+BOOST_AUTO_TEST_CASE(rate_limit_plain)
+{
+    // Messages without arguments may be built at runtime, so are not limited
+    capture_log capture;
+    set_log_rate_limit(3, std::chrono::hours(1));
+    std::uint64_t suppressed = get_log_suppressed();
+    for (int i = 0; i < 10; i++)
+    {
+        std::string msg = "plain message " + std::to_string(i);
+        log_warning(msg.c_str());
+    }
+    BOOST_CHECK_EQUAL(capture.messages.size(), 10);
+    BOOST_CHECK_EQUAL(get_log_suppressed(), suppressed);
+}
+
+BOOST_AUTO_TEST_CASE(log_thread)
+{
+    capture_log capture;
+    set_log_rate_limit(0);
+    start_log_thread(16);
+    auto caller = std::this_thread::get_id();
+    std::thread::id receiver;
+    set_log_function([&](log_level level, const std::string &msg)
+    {
+        std::lock_guard<std::mutex> lock(capture.mutex);
+        receiver = std::this_thread::get_id();
+        capture.messages.emplace_back(level, msg);
+    });
+    for (int i = 0; i < 5; i++)
+        log_info("queued %1%", i);
+    stop_log_thread();
+    BOOST_REQUIRE_EQUAL(capture.messages.size(), 5);
+    for (int i = 0; i < 5; i++)
+        BOOST_CHECK_EQUAL(capture.messages[i].second, "queued " + std::to_string(i));
+    BOOST_CHECK(receiver != caller);
+
+    // After stopping, messages are delivered synchronously again
+    log_info("direct");
+    BOOST_CHECK(receiver == caller);
+}
+
+BOOST_AUTO_TEST_SUITE_END()  // logging
+BOOST_AUTO_TEST_SUITE_END()  // common
+
+}} // namespace spead2::unittest
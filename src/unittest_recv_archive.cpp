@@ -0,0 +1,235 @@
+/* Copyright 2016 SKA South Africa
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Unit tests for heap archives.
+ */
+
+#include <boost/test/unit_test.hpp>
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <spead2/common_defines.h>
+#include <spead2/common_thread_pool.h>
+#include <spead2/recv_archive.h>
+#include <spead2/recv_heap.h>
+#include <spead2/recv_mem.h>
+#include <spead2/send_heap.h>
+#include <spead2/send_streambuf.h>
+
+namespace spead2
+{
+namespace unittest
+{
+
+/// Encodes some heaps, then archives them through an @ref recv::archive_stream
+struct archive_fixture
+{
+    std::string filename;
+    std::vector<std::uint8_t> small, large;
+
+    archive_fixture()
+        : filename("/tmp/spead2-unittest-archive-" + std::to_string(getpid())),
+        small(100), large(100000)
+    {
+        for (std::size_t i = 0; i < small.size(); i++)
+            small[i] = i;
+        for (std::size_t i = 0; i < large.size(); i++)
+            large[i] = i * 7;
+
+        thread_pool tp;
+        std::stringbuf sb;
+        spead2::send::streambuf_stream sender(tp.get_io_service(), sb);
+        spead2::send::heap first, second, third;
+        descriptor d;
+        d.id = 0x1000;
+        d.name = "small";
+        d.description = "a small item";
+        d.numpy_header = "{'shape': (100,), 'fortran_order': False, 'descr': '|u1'}";
+        first.add_descriptor(d);
+        first.add_item(0x1000, small.data(), small.size(), false);
+        first.add_item(0x1001, 12345);
+        second.add_item(0x1002, large.data(), large.size(), false);
+        third.add_item(0x1000, small.data(), small.size(), false);
+        auto handler = [](const boost::system::error_code &, item_pointer_t) {};
+        sender.async_send_heap(first, handler, 10);
+        sender.async_send_heap(second, handler, 20);
+        sender.async_send_heap(third, handler, 15);
+        sender.flush();
+
+        std::string encoded = sb.str();
+        auto writer = std::make_shared<spead2::recv::heap_archive_writer>(filename, 4096);
+        {
+            spead2::recv::archive_stream stream(tp, writer);
+            stream.emplace_reader<spead2::recv::mem_reader>(
+                reinterpret_cast<const std::uint8_t *>(encoded.data()), encoded.size());
+        }
+        BOOST_REQUIRE_EQUAL(writer->size(), 3);
+        writer->close();
+    }
+
+    ~archive_fixture()
+    {
+        std::remove(filename.c_str());
+    }
+
+    /// Check that the reader sees the heaps that were written
+    void check(const spead2::recv::heap_archive_reader &reader)
+    {
+        BOOST_REQUIRE_EQUAL(reader.size(), 3);
+        BOOST_CHECK_EQUAL(reader.get_cnt(0), 10);
+        BOOST_CHECK_EQUAL(reader.get_cnt(2), 15);
+        BOOST_CHECK_EQUAL(reader.find(20), 1);
+        BOOST_CHECK(reader.contains(15));
+        BOOST_CHECK(!reader.contains(11));
+        BOOST_CHECK_THROW(reader.find(11), std::out_of_range);
+        BOOST_CHECK_THROW(reader.get(3), std::out_of_range);
+        const std::vector<std::size_t> expected_descriptors{0};
+        BOOST_CHECK_EQUAL_COLLECTIONS(
+            reader.get_descriptor_indices().begin(), reader.get_descriptor_indices().end(),
+            expected_descriptors.begin(), expected_descriptors.end());
+
+        spead2::recv::heap h = reader.get(reader.find(20));
+        BOOST_CHECK_EQUAL(h.get_cnt(), 20);
+        BOOST_CHECK_EQUAL(reinterpret_cast<std::uintptr_t>(h.get_payload()) % 64, 0);
+        const auto &items = h.get_items();
+        BOOST_REQUIRE_EQUAL(items.size(), 1);
+        BOOST_CHECK_EQUAL(items[0].id, 0x1002);
+        BOOST_CHECK_EQUAL_COLLECTIONS(items[0].ptr, items[0].ptr + items[0].length,
+                                      large.begin(), large.end());
+
+        spead2::recv::heap h0 = reader.get(0);
+        bool found_small = false, found_immediate = false;
+        for (const auto &item : h0.get_items())
+        {
+            if (item.id == 0x1000)
+            {
+                found_small = true;
+                BOOST_CHECK_EQUAL_COLLECTIONS(item.ptr, item.ptr + item.length,
+                                              small.begin(), small.end());
+            }
+            else if (item.id == 0x1001)
+            {
+                found_immediate = true;
+                BOOST_CHECK(item.is_immediate);
+                BOOST_CHECK_EQUAL(item.immediate_value, 12345);
+            }
+        }
+        BOOST_CHECK(found_small);
+        BOOST_CHECK(found_immediate);
+        std::vector<descriptor> descriptors = h0.get_descriptors();
+        BOOST_REQUIRE_EQUAL(descriptors.size(), 1);
+        BOOST_CHECK_EQUAL(descriptors[0].id, 0x1000);
+        BOOST_CHECK_EQUAL(descriptors[0].name, "small");
+    }
+};
+
+BOOST_AUTO_TEST_SUITE(recv)
+BOOST_FIXTURE_TEST_SUITE(archive, archive_fixture)
+
+BOOST_AUTO_TEST_CASE(indexed)
+{
+    spead2::recv::heap_archive_reader reader(filename);
+    check(reader);
+}
+
+BOOST_AUTO_TEST_CASE(unindexed)
+{
+    // Remove the trailer, as if the writer had not been closed
+    struct stat st;
+    BOOST_REQUIRE_EQUAL(stat(filename.c_str(), &st), 0);
+    BOOST_REQUIRE_EQUAL(truncate(filename.c_str(), st.st_size - 64), 0);
+    spead2::recv::heap_archive_reader reader(filename);
+    check(reader);
+}
+
+BOOST_AUTO_TEST_CASE(outlives_reader)
+{
+    std::unique_ptr<spead2::recv::heap_archive_reader> reader(
+        new spead2::recv::heap_archive_reader(filename));
+    spead2::recv::heap h = reader->get(2);
+    reader.reset();
+    const auto &items = h.get_items();
+    BOOST_REQUIRE_EQUAL(items.size(), 1);
+    BOOST_CHECK_EQUAL_COLLECTIONS(items[0].ptr, items[0].ptr + items[0].length,
+                                  small.begin(), small.end());
+}
+
+BOOST_AUTO_TEST_CASE(filtered)
+{
+    // Payload of items removed by a filter must not reach the file
+    const std::vector<std::uint8_t> secret(1000, 0xa5);
+    thread_pool tp;
+    std::stringbuf sb;
+    spead2::send::streambuf_stream sender(tp.get_io_service(), sb);
+    spead2::send::heap h;
+    h.add_item(0x1003, secret.data(), secret.size(), false);
+    h.add_item(0x1000, small.data(), small.size(), false);
+    sender.async_send_heap(h, [](const boost::system::error_code &, item_pointer_t) {}, 30);
+    sender.flush();
+
+    std::string encoded = sb.str();
+    auto writer = std::make_shared<spead2::recv::heap_archive_writer>(filename, 4096);
+    {
+        spead2::recv::archive_stream stream(tp, writer);
+        stream.set_item_filter(std::make_shared<spead2::recv::item_filter>(
+            spead2::recv::item_filter::mode::EXCLUDE, std::vector<s_item_pointer_t>{0x1003}));
+        stream.emplace_reader<spead2::recv::mem_reader>(
+            reinterpret_cast<const std::uint8_t *>(encoded.data()), encoded.size());
+    }
+    writer->close();
+
+    spead2::recv::heap_archive_reader reader(filename);
+    BOOST_REQUIRE_EQUAL(reader.size(), 1);
+    spead2::recv::heap stored = reader.get(0);
+    const auto &items = stored.get_items();
+    BOOST_REQUIRE_EQUAL(items.size(), 1);
+    BOOST_CHECK_EQUAL(items[0].id, 0x1000);
+    BOOST_CHECK(items[0].ptr == stored.get_payload());
+    BOOST_CHECK_EQUAL_COLLECTIONS(items[0].ptr, items[0].ptr + items[0].length,
+                                  small.begin(), small.end());
+
+    std::FILE *f = std::fopen(filename.c_str(), "rb");
+    BOOST_REQUIRE(f);
+    std::vector<std::uint8_t> contents;
+    int ch;
+    while ((ch = std::fgetc(f)) != EOF)
+        contents.push_back(ch);
+    std::fclose(f);
+    BOOST_CHECK(std::search(contents.begin(), contents.end(),
+                            secret.begin(), secret.begin() + 16) == contents.end());
+}
+
+BOOST_AUTO_TEST_CASE(not_archive)
+{
+    std::FILE *f = std::fopen(filename.c_str(), "wb");
+    std::fputs("this is not a heap archive, but it is long enough to have a header......", f);
+    std::fclose(f);
+    BOOST_CHECK_THROW(spead2::recv::heap_archive_reader reader(filename), std::invalid_argument);
+}
+
+BOOST_AUTO_TEST_SUITE_END()  // archive
+BOOST_AUTO_TEST_SUITE_END()  // recv
+
+}} // namespace spead2::unittest
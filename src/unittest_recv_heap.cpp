@@ -0,0 +1,58 @@
+#include <boost/test/unit_test.hpp>
+#include <vector>
+#include <thread>
+#include <memory>
+#include <cstdint>
+#include <spead2/common_defines.h>
+#include <spead2/common_flavour.h>
+#include <spead2/common_memory_allocator.h>
+#include <spead2/recv_heap.h>
+#include <spead2/send_utils.h>
+
+namespace spead2
+{
+namespace unittest
+{
+
+BOOST_AUTO_TEST_SUITE(recv)
+BOOST_AUTO_TEST_SUITE(heap)
+
+/* Items are decoded lazily, but const accessors must still be safe to call
+ * concurrently on a shared heap.
+ */
+BOOST_AUTO_TEST_CASE(concurrent_get_items)
+{
+    const int heap_address_bits = 48;
+    const int n_items = 64;
+    const int n_threads = 4;
+    send::pointer_encoder encoder(heap_address_bits);
+    std::vector<item_pointer_t> pointers;
+    for (int i = 0; i < n_items; i++)
+        pointers.push_back(encoder.encode_immediate(0x1000 + i, i));
+    const spead2::recv::heap h(
+        1, flavour(4, 64, heap_address_bits), std::move(pointers),
+        memory_allocator::pointer(), 0);
+
+    std::vector<const std::vector<spead2::recv::item> *> results(n_threads);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < n_threads; i++)
+        threads.emplace_back([&h, &results, i] { results[i] = &h.get_items(); });
+    for (auto &thread : threads)
+        thread.join();
+
+    for (int i = 0; i < n_threads; i++)
+        BOOST_CHECK_EQUAL(results[i], results[0]);
+    const std::vector<spead2::recv::item> &items = h.get_items();
+    BOOST_REQUIRE_EQUAL(items.size(), n_items);
+    for (int i = 0; i < n_items; i++)
+    {
+        BOOST_CHECK_EQUAL(items[i].id, 0x1000 + i);
+        BOOST_CHECK(items[i].is_immediate);
+        BOOST_CHECK_EQUAL(items[i].immediate_value, i);
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()  // heap
+BOOST_AUTO_TEST_SUITE_END()  // recv
+
+}} // namespace spead2::unittest
@@ -0,0 +1,209 @@
+/* Copyright 2016 SKA South Africa
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Unit tests for packet relays.
+ */
+
+#include <boost/test/unit_test.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <spead2/common_defines.h>
+#include <spead2/common_thread_pool.h>
+#include <spead2/recv_mem.h>
+#include <spead2/recv_packet.h>
+#include <spead2/recv_relay.h>
+#include <spead2/send_heap.h>
+#include <spead2/send_streambuf.h>
+
+namespace spead2
+{
+namespace unittest
+{
+
+/**
+ * Builds a packet stream to feed to a @ref recv::relay_stream. The relay
+ * only looks at packet headers, so the heaps are split into several small
+ * packets and the heap cnt of each packet is recorded.
+ */
+struct relay_fixture
+{
+    /// Packet size used for the input, so that each heap spans several packets
+    static constexpr std::size_t packet_size = 1024;
+
+    thread_pool tp;
+    std::string input;                          ///< Concatenated packets
+    std::vector<s_item_pointer_t> input_cnts;   ///< Heap cnt of each packet in @ref input
+    spead2::recv::relay_stats stats;            ///< Counters from the last @ref relay
+
+    /// Heap cnts of the packets in @a data
+    static std::vector<s_item_pointer_t> packet_cnts(const std::string &data)
+    {
+        std::vector<s_item_pointer_t> cnts;
+        auto ptr = reinterpret_cast<const std::uint8_t *>(data.data());
+        std::size_t remaining = data.size();
+        while (remaining > 0)
+        {
+            spead2::recv::packet_header packet;
+            std::size_t size = spead2::recv::decode_packet(packet, ptr, remaining);
+            BOOST_REQUIRE_GT(size, 0);
+            cnts.push_back(packet.heap_cnt);
+            ptr += size;
+            remaining -= size;
+        }
+        return cnts;
+    }
+
+    /// Append the packets of @a heap to @ref input
+    void add_heap(const spead2::send::heap &heap, s_item_pointer_t cnt)
+    {
+        std::stringbuf sb;
+        spead2::send::streambuf_stream sender(
+            tp.get_io_service(), sb, spead2::send::stream_config(packet_size));
+        sender.async_send_heap(heap, [](const boost::system::error_code &, item_pointer_t) {}, cnt);
+        sender.flush();
+        std::string packets = sb.str();
+        std::vector<s_item_pointer_t> cnts = packet_cnts(packets);
+        input += packets;
+        input_cnts.insert(input_cnts.end(), cnts.begin(), cnts.end());
+    }
+
+    /**
+     * The input is six heaps with cnts 1 to 6, each holding 3000 bytes of
+     * item 0x1000 (odd cnts) or 0x1001 (even cnts), then a stop heap with
+     * cnt 100.
+     */
+    relay_fixture()
+    {
+        std::vector<std::uint8_t> payload(3000);
+        for (std::size_t i = 0; i < payload.size(); i++)
+            payload[i] = i;
+        for (s_item_pointer_t cnt = 1; cnt <= 6; cnt++)
+        {
+            spead2::send::heap heap;
+            heap.add_item(cnt % 2 ? 0x1000 : 0x1001, payload.data(), payload.size(), false);
+            add_heap(heap, cnt);
+        }
+        spead2::send::heap stop;
+        stop.add_end();
+        add_heap(stop, 100);
+    }
+
+    /**
+     * Relay @ref input, after passing the relay to @a configure, and return
+     * the bytes that were forwarded. The counters are stored in @ref stats.
+     */
+    template<typename F>
+    std::string relay(F &&configure)
+    {
+        std::stringbuf sb;
+        spead2::send::streambuf_stream output(tp.get_io_service(), sb);
+        spead2::recv::relay_stream stream(tp, output, packet_size);
+        configure(stream);
+        stream.emplace_reader<spead2::recv::mem_reader>(
+            reinterpret_cast<const std::uint8_t *>(input.data()), input.size());
+        stream.stop();
+        stats = stream.get_stats();
+        output.flush();
+        return sb.str();
+    }
+};
+
+constexpr std::size_t relay_fixture::packet_size;
+
+BOOST_AUTO_TEST_SUITE(recv)
+BOOST_FIXTURE_TEST_SUITE(relay, relay_fixture)
+
+BOOST_AUTO_TEST_CASE(forward_all)
+{
+    std::string out = relay([](spead2::recv::relay_stream &) {});
+    BOOST_CHECK(out == input);
+    BOOST_CHECK_GT(input_cnts.size(), 7);
+    BOOST_CHECK_EQUAL(stats.packets, input_cnts.size());
+    BOOST_CHECK_EQUAL(stats.forwarded_packets, input_cnts.size());
+    BOOST_CHECK_EQUAL(stats.forwarded_bytes, input.size());
+    BOOST_CHECK_EQUAL(stats.filtered, 0);
+    BOOST_CHECK_EQUAL(stats.overflow, 0);
+}
+
+BOOST_AUTO_TEST_CASE(cnt_filter)
+{
+    std::string out = relay([](spead2::recv::relay_stream &stream)
+    {
+        stream.set_cnt_filter(3, 1);
+    });
+    std::vector<s_item_pointer_t> cnts = packet_cnts(out);
+    BOOST_REQUIRE(!cnts.empty());
+    // The stop heap is forwarded even though it does not match
+    BOOST_CHECK_EQUAL(cnts.back(), 100);
+    cnts.pop_back();
+    BOOST_CHECK(!cnts.empty());
+    for (s_item_pointer_t cnt : cnts)
+        BOOST_CHECK(cnt == 1 || cnt == 4);
+    BOOST_CHECK_EQUAL(stats.filtered + stats.forwarded_packets, stats.packets);
+}
+
+BOOST_AUTO_TEST_CASE(item_filter)
+{
+    std::string out = relay([](spead2::recv::relay_stream &stream)
+    {
+        stream.set_item_ids({0x1001, 0x2000});
+    });
+    std::vector<s_item_pointer_t> cnts = packet_cnts(out);
+    std::vector<s_item_pointer_t> expected;
+    for (s_item_pointer_t cnt : input_cnts)
+        if (cnt % 2 == 0 || cnt == 100)
+            expected.push_back(cnt);
+    // Heaps 2, 4 and 6 hold item 0x1001, including their later packets
+    BOOST_CHECK_EQUAL_COLLECTIONS(cnts.begin(), cnts.end(), expected.begin(), expected.end());
+}
+
+BOOST_AUTO_TEST_CASE(rate_limit)
+{
+    std::string out = relay([](spead2::recv::relay_stream &stream)
+    {
+        stream.set_rate(1.0, 4000);
+    });
+    // Only the burst fits, plus the stop heap which bypasses the limit
+    BOOST_CHECK_GT(stats.rate_limited, 0);
+    BOOST_CHECK_LT(out.size(), 4000 + 100);
+    BOOST_CHECK_EQUAL(packet_cnts(out).back(), 100);
+}
+
+BOOST_AUTO_TEST_CASE(bad_args)
+{
+    std::stringbuf sb;
+    spead2::send::streambuf_stream output(tp.get_io_service(), sb);
+    BOOST_CHECK_THROW(spead2::recv::relay_stream(tp, output, 0), std::invalid_argument);
+    spead2::recv::relay_stream stream(tp, output);
+    BOOST_CHECK_THROW(stream.set_cnt_filter(0, 0), std::invalid_argument);
+    BOOST_CHECK_THROW(stream.set_cnt_filter(2, 2), std::invalid_argument);
+    BOOST_CHECK_THROW(stream.set_rate(-1.0), std::invalid_argument);
+    // The burst must hold at least one packet
+    BOOST_CHECK_THROW(stream.set_rate(1e6, 0), std::invalid_argument);
+    BOOST_CHECK_THROW(stream.set_rate(1e6, spead2::recv::relay_stream::default_max_packet_size - 1), std::invalid_argument);
+    stream.set_rate(0.0, 0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()  // relay
+BOOST_AUTO_TEST_SUITE_END()  // recv
+
+}} // namespace spead2::unittest
@@ -0,0 +1,155 @@
+/* Copyright 2016 SKA South Africa
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file
+ *
+ * Unit tests for the shared memory transport.
+ */
+
+#include <spead2/common_features.h>
+#if SPEAD2_USE_SHM
+
+#include <boost/test/unit_test.hpp>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <unistd.h>
+#include <spead2/common_shm.h>
+#include <spead2/common_thread_pool.h>
+#include <spead2/common_ringbuffer.h>
+#include <spead2/recv_ring_stream.h>
+#include <spead2/recv_shm.h>
+#include <spead2/send_heap.h>
+#include <spead2/send_shm.h>
+
+namespace spead2
+{
+namespace unittest
+{
+
+static std::string shm_name(const char *suffix)
+{
+    return "/spead2-unittest-" + std::to_string(getpid()) + "-" + suffix;
+}
+
+BOOST_AUTO_TEST_SUITE(common)
+BOOST_AUTO_TEST_SUITE(shm)
+
+BOOST_AUTO_TEST_CASE(ring_slots)
+{
+    std::string name = shm_name("slots");
+    shm_ring producer(name, 2, 100);
+    shm_ring consumer(name);
+    BOOST_CHECK_EQUAL(consumer.get_n_slots(), 2);
+    BOOST_CHECK_EQUAL(consumer.get_slot_size(), 128);
+
+    std::size_t index0, index1, index;
+    std::uint8_t *slot0 = producer.try_acquire(index0);
+    std::uint8_t *slot1 = producer.try_acquire(index1);
+    BOOST_REQUIRE(slot0 != nullptr);
+    BOOST_REQUIRE(slot1 != nullptr);
+    BOOST_CHECK(producer.try_acquire(index) == nullptr);
+    slot0[0] = 10;
+    slot1[0] = 11;
+    producer.commit(index1, 5);
+    producer.commit(index0, 7);
+
+    // Slots come out in commit order, but can be released in any order
+    std::size_t length;
+    const std::uint8_t *data = consumer.try_next(index, length);
+    BOOST_REQUIRE(data != nullptr);
+    BOOST_CHECK_EQUAL(index, index1);
+    BOOST_CHECK_EQUAL(length, 5);
+    BOOST_CHECK_EQUAL(data[0], 11);
+    std::size_t second;
+    data = consumer.try_next(second, length);
+    BOOST_REQUIRE(data != nullptr);
+    BOOST_CHECK_EQUAL(second, index0);
+    BOOST_CHECK_EQUAL(length, 7);
+    BOOST_CHECK_EQUAL(data[0], 10);
+    BOOST_CHECK(consumer.try_next(index, length) == nullptr);
+
+    consumer.release(second);
+    BOOST_CHECK(producer.try_acquire(index) != nullptr);
+    BOOST_CHECK_EQUAL(index, index0);
+    BOOST_CHECK(producer.try_acquire(index) == nullptr);
+
+    BOOST_CHECK(!consumer.is_closed());
+    producer.close();
+    BOOST_CHECK(consumer.is_closed());
+}
+
+BOOST_AUTO_TEST_CASE(ring_bad_args)
+{
+    BOOST_CHECK_THROW(shm_ring(shm_name("bad"), 0, 100), std::invalid_argument);
+    BOOST_CHECK_THROW(shm_ring(shm_name("bad"), 2, 0), std::invalid_argument);
+    BOOST_CHECK_THROW(shm_ring(shm_name("missing")), std::system_error);
+}
+
+/**
+ * Sends a heap that fits in one packet and one that does not, and checks
+ * that only the former refers to the shared memory.
+ */
+BOOST_AUTO_TEST_CASE(stream_zero_copy)
+{
+    std::string name = shm_name("stream");
+    thread_pool tp(1);
+    std::unique_ptr<spead2::send::shm_stream> sender(new spead2::send::shm_stream(tp.get_io_service(), name, 8));
+    auto ring = std::make_shared<shm_ring>(name);
+    spead2::recv::ring_stream<> receiver(tp);
+    receiver.emplace_reader<spead2::recv::shm_reader>(ring);
+
+    std::vector<std::uint8_t> small(100, 1), large(10000, 2);
+    spead2::send::heap heap1, heap2;
+    heap1.add_item(0x1000, small.data(), small.size(), false);
+    heap2.add_item(0x1000, large.data(), large.size(), false);
+    auto handler = [](const boost::system::error_code &ec, item_pointer_t)
+    {
+        BOOST_CHECK(!ec);
+    };
+    sender->async_send_heap(heap1, handler);
+    sender->async_send_heap(heap2, handler);
+    sender->flush();
+    sender.reset();    // closes the ring
+
+    spead2::recv::heap received1(receiver.pop());
+    BOOST_CHECK(ring->contains(received1.get_payload()));
+    spead2::recv::heap received2(receiver.pop());
+    BOOST_CHECK(!ring->contains(received2.get_payload()));
+    for (const spead2::recv::heap *h : {&received1, &received2})
+    {
+        const std::vector<std::uint8_t> &expected = (h == &received1) ? small : large;
+        bool found = false;
+        for (const auto &item : h->get_items())
+            if (item.id == 0x1000)
+            {
+                found = true;
+                BOOST_CHECK_EQUAL_COLLECTIONS(item.ptr, item.ptr + item.length,
+                                              expected.begin(), expected.end());
+            }
+        BOOST_CHECK(found);
+    }
+    BOOST_CHECK_THROW(receiver.pop(), ringbuffer_stopped);
+}
+
+BOOST_AUTO_TEST_SUITE_END()  // shm
+BOOST_AUTO_TEST_SUITE_END()  // common
+
+}} // namespace spead2::unittest
+
+#endif // SPEAD2_USE_SHM
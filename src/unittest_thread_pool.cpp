@@ -0,0 +1,81 @@
+/* Copyright 2016 SKA South Africa
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/**
+ * @file
+ *
+ * Unit tests for thread pools.
+ */
+
+#include <boost/test/unit_test.hpp>
+#include <future>
+#include <thread>
+#include <vector>
+#include <stdexcept>
+#include <spead2/common_thread_pool.h>
+
+namespace spead2
+{
+namespace unittest
+{
+
+BOOST_AUTO_TEST_SUITE(common)
+BOOST_AUTO_TEST_SUITE(thread_pool)
+
+// Return the ID of the thread that runs a handler posted to io_service
+static std::thread::id handler_thread(boost::asio::io_service &io_service)
+{
+    std::promise<std::thread::id> promise;
+    io_service.post([&promise] { promise.set_value(std::this_thread::get_id()); });
+    return promise.get_future().get();
+}
+
+// Each io_service is run by exactly one thread, distinct from the others
+BOOST_AUTO_TEST_CASE(pinned_distinct_threads)
+{
+    spead2::pinned_thread_pool pool(3);
+    BOOST_REQUIRE_EQUAL(pool.size(), 3);
+    std::vector<std::thread::id> ids;
+    for (std::size_t i = 0; i < pool.size(); i++)
+    {
+        ids.push_back(handler_thread(pool.get_io_service(i)));
+        for (int j = 0; j < 10; j++)
+            BOOST_CHECK(handler_thread(pool.get_io_service(i)) == ids[i]);
+        for (std::size_t j = 0; j < i; j++)
+            BOOST_CHECK(ids[i] != ids[j]);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(pinned_next)
+{
+    spead2::pinned_thread_pool pool(2, {0});
+    BOOST_CHECK_EQUAL(&pool.next(), &pool.get_thread(0));
+    BOOST_CHECK_EQUAL(&pool.next(), &pool.get_thread(1));
+    BOOST_CHECK_EQUAL(&pool.next(), &pool.get_thread(0));
+}
+
+BOOST_AUTO_TEST_CASE(pinned_bad_args)
+{
+    BOOST_CHECK_THROW(spead2::pinned_thread_pool(0), std::invalid_argument);
+    spead2::pinned_thread_pool pool(1);
+    BOOST_CHECK_THROW(pool.get_thread(1), std::out_of_range);
+}
+
+BOOST_AUTO_TEST_SUITE_END()  // thread_pool
+BOOST_AUTO_TEST_SUITE_END()  // common
+
+}} // namespace spead2::unittest